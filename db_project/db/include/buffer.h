@@ -2,11 +2,14 @@
 #define DB_BUFFER_H_
 
 #include "page.h"
+#include "log.h"
+#include "numa.h"
 
 #include <iostream>
 #include <memory>
 #include <string>
 #include <stdexcept>
+#include <vector>
 
 template<typename ... Args>
 std::string string_format( const std::string& format, Args ... args )
@@ -25,50 +28,317 @@ std::string string_format( const std::string& format, Args ... args )
 
 #define MAX_USAGE_COUNT (5)
 
+/* A dirty victim is written with up to EVICT_BATCH - 1 others: its dirty
+ * neighbors on disk, up to EVICT_NEIGHBORS on each side, and the next
+ * victims, looked for among the EVICT_LOOKAHEAD buffers after the clock hand.
+ */
+#define EVICT_BATCH (16)
+#define EVICT_NEIGHBORS (4)
+#define EVICT_LOOKAHEAD (64)
+
+// Entries of the per-thread descriptor cache (see buffer_set_desc_cache())
+#define DESC_CACHE_SIZE (64)
+
 // For stat
 extern int64_t stat_get_buffer;
+extern int64_t stat_desc_cache_hits;
+extern int64_t stat_swizzled_hits;
 
 typedef struct buf_descriptor_t {
     int64_t table_id;
     pagenum_t page_num;
     page_t *buf_page;
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    uint32_t pin_count;
+    uint32_t usage_count;
+    bool is_dirty;
+    uint32_t tag;                   // Bumped as the frame takes or drops a page
+    uint32_t numa_node;             // Of its frame, whose free list it is on
+    page_t *shadow_page;            // The page as last logged (with WAL only)
+    struct buf_descriptor_t *next;  // Next in the hash chain or the free list
+
+    // For pointer swizzling (see buffer_set_swizzling())
+    struct buf_descriptor_t **swizzled;        // Children, by index + 1
+    struct buf_descriptor_t *swizzled_parent;  // Whose swizzled has it
+    int swizzled_index;                        // In swizzled of the parent
+
+    // For the replacement policy (see policy.h)
+    struct buf_descriptor_t *policy_prev;
+    struct buf_descriptor_t *policy_next;
+    uint32_t policy_list;           // The list of the policy it is in
+    uint64_t policy_history[2];     // The last uses
 } buf_descriptor_t;
 
 typedef struct ht_entry_t {
-    buf_descriptor_t *buf_desc;
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    buf_descriptor_t *buf_desc;     // Head of the hash chain
 } ht_entry_t;
 
+/* While the hashtable grows, the chains of the old entries are moved to the
+ * new ones a few at a time, and the pages not moved yet are looked up in
+ * the old entries.
+ */
+#define REHASH_STEP (8)
+
 typedef struct hashtable_t {
     uint32_t num_ht_entries;
     ht_entry_t *ht_entries;
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    uint32_t num_old_entries;
+    ht_entry_t *old_entries;        // NULL unless the hashtable grows
+    uint32_t num_moved;             // Old entries moved so far
 } hashtable_t;
 
+/* The frames of a pool come in chunks: the one of the pool, and one more
+ * each time it grows. The descriptors never move.
+ */
+typedef struct frame_chunk_t {
+    buf_descriptor_t *buf_descs;
+    page_t *buf_pages;
+    page_t *shadow_pages;           // NULL without WAL
+    uint32_t num_buf;
+    uint32_t first;                 // The index of its first frame in the pool
+    size_t map_size;                // Of buf_pages if mapped, 0 if allocated
+    int numa_node;                  // Where buf_pages are placed, -1 if not
+} frame_chunk_t;
+
+/* How the frames of a pool are allocated (see buffer_set_frame_flags()).
+ * FRAME_HUGE_PAGES maps them in 2 MiB huge pages if the system reserved
+ * enough, or else asks for transparent huge pages, so a pool of many frames
+ * takes few TLB entries. FRAME_NUMA splits them among the NUMA nodes, each
+ * node with its own free list, which the threads running there take from
+ * first.
+ */
+#define FRAME_HUGE_PAGES (1 << 0)
+#define FRAME_NUMA (1 << 1)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Descriptors of the mapped pages of a table come in chunks of this
+#define MAPPED_DESC_CHUNK (1024)
+
+/* A table opened with TABLE_OPEN_MMAP. Its pages are never read into
+ * frames: their descriptors point into the mapping of the file, and stay
+ * until the buffer pool is closed.
+ */
+typedef struct mapped_table_t {
+    int64_t table_id;
+    page_t *pages;                  // The mapping
+    uint64_t num_pages;
+    buf_descriptor_t **desc_chunks; // Allocated as the pages are used
+} mapped_table_t;
+
+/* Buffer pools.
+ * init_buffer_pool() sets up the default pool, and more are created by
+ * name with their own frames, hashtable and clock hand. A table is bound
+ * to a pool when it is opened, and its pages are cached there only, so the
+ * tables of one pool never evict those of another.
+ */
+#define MAX_BUFFER_POOLS (16)
+#define BUFFER_POOL_NAME_SIZE (32)
+#define DEFAULT_BUFFER_POOL "default"
+
+// Replacement policies of a pool (see policy.h)
+#define BUFFER_POLICY_CLOCK (0)
+#define BUFFER_POLICY_LRU_K (1)  // LRU-2
+#define BUFFER_POLICY_2Q (2)
+#define BUFFER_POLICY_ARC (3)
+
 typedef struct buffer_pool_t {
+    char name[BUFFER_POOL_NAME_SIZE];
     uint32_t num_buf;
     hashtable_t hashtable;
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    buf_descriptor_t **frames;      // The descriptors of the frames in use
+    frame_chunk_t *chunks;
+    int num_chunks;
+    uint32_t frame_flags;
+    int num_nodes;                  // The free lists in use
+    buf_descriptor_t *free_lists[MAX_NUMA_NODES];  // One for each node
+    uint32_t clock_hand;
+    const struct replacement_policy_t *policy;
+    void *policy_data;              // The state of the policy
 } buffer_pool_t;
 
+/* The pool of a table, and its quota of frames in the pool.
+ * A table at max_buf replaces its own pages only, and the pages of a table
+ * within min_buf are replaced by its own pages only.
+ */
+typedef struct table_binding_t {
+    buffer_pool_t *pool;  // NULL for the default pool
+    uint32_t min_buf;     // 0 for none
+    uint32_t max_buf;     // 0 for no limit
+    uint32_t num_buf;     // Frames holding pages of the table
+} table_binding_t;
+
 void mark_buffer_dirty(buf_descriptor_t *buf_desc);
 void unpin_buffer(buf_descriptor_t *buf_desc);
 
-int64_t buffer_open_table(const char *pathname);
-int init_buffer_pool(uint32_t num_ht_entries, uint32_t num_buf);
-buf_descriptor_t *get_buffer(int64_t table_id, pagenum_t page_num);
+/* Open a table, and bind it to the pool of the name (the default pool if
+ * NULL). A table opened again with another pool moves there, after its
+ * pages are written back and dropped from the pool it leaves.
+ * Returns -1 if there is no such pool, or a page of the table is pinned.
+ */
+int64_t buffer_open_table(const char *pathname, uint64_t flags = 0,
+                          const char *pool_name = NULL);
+uint64_t buffer_get_table_flags(int64_t table_id);
+int init_buffer_pool(uint32_t num_ht_entries, uint32_t num_buf,
+                     int policy = BUFFER_POLICY_CLOCK);
+
+/* Create a buffer pool with the name and the replacement policy, after
+ * init_buffer_pool().
+ * Returns 1 if the name is empty, has white space or is taken, there are
+ * MAX_BUFFER_POOLS already, there is no such policy, or the pool cannot be
+ * allocated.
+ */
+int buffer_create_pool(const char *name, uint32_t num_ht_entries,
+                       uint32_t num_buf, int policy = BUFFER_POLICY_CLOCK);
+
+/* Grow or shrink the pool of the name to num_buf frames, while it is used.
+ * Growing takes back the frames dropped from its last chunk, then adds a
+ * chunk of frames, and grows the hashtable with them, moving its chains
+ * over on the lookups that follow. Shrinking writes back and evicts the
+ * pages of the frames at the tail, and frees the chunks left empty.
+ * Returns 1 if there is no such pool, num_buf is below 4 or the minimums of
+ * the quotas of its tables, the frames cannot be allocated, or a frame at
+ * the tail is pinned (the pool is shrunk down to it then).
+ */
+int buffer_resize_pool(const char *name, uint32_t num_buf);
+
+/* Set the frame flags (FRAME_HUGE_PAGES, FRAME_NUMA) of the pools created
+ * from now on, including the default pool of the next init_buffer_pool().
+ * A pool that cannot be allocated so falls back to plain frames.
+ */
+void buffer_set_frame_flags(uint32_t flags);
+
+/* Turn the per-thread descriptor cache on or off (off by default).
+ * With it, get_buffer() remembers the last DESC_CACHE_SIZE pages of each
+ * thread, direct-mapped by their ids, and finds them again without the
+ * hashtable while their frames hold them: the root and the upper internal
+ * pages a descent goes through on every operation.
+ */
+void buffer_set_desc_cache(bool enable);
+
+/* Turn pointer swizzling on or off (off by default).
+ * With it, buffer_get_child() keeps a frame pointer to each child it got
+ * beside the frame of the internal page, and a descent of a tree held in
+ * the pool goes from frame to frame without the hashtable. The pointers
+ * are dropped as the child is evicted, and as the internal page is changed
+ * (marked dirty) or evicted. They never go into the page itself, so what
+ * is logged, written or compressed holds page numbers only.
+ */
+void buffer_set_swizzling(bool enable);
+
+// Get the pool of the name, NULL if there is none
+buffer_pool_t *find_pool(const char *name);
+
+// Get the number of frames of the pool of the name, 0 if there is none
+uint32_t buffer_get_pool_num_buf(const char *name);
+
+/* Set the quota of frames of a table in its pool (0 for none).
+ * Returns 1 if the table is not open, min_buf exceeds max_buf, max_buf is
+ * below the 4 frames an operation pins, or the minimums of the tables of
+ * the pool would leave it less than 4 frames.
+ */
+int buffer_set_table_quota(int64_t table_id, uint32_t min_buf,
+                           uint32_t max_buf);
+
+// Get the number of frames holding pages of the table
+uint32_t buffer_get_table_num_buf(int64_t table_id);
+
+/* Access hints of get_buffer(): how a use of a page counts toward keeping
+ * it in the pool.
+ * - BUFFER_ACCESS_POINT: a lookup. The usage count goes up by one.
+ * - BUFFER_ACCESS_INTERNAL: an internal page, which every lookup goes
+ *   through. The usage count goes up to MAX_USAGE_COUNT.
+ * - BUFFER_ACCESS_SCAN: a leaf a scan passes over, and
+ * - BUFFER_ACCESS_MAINTENANCE: a page bulk work (restructuring the tree)
+ *   touches in passing. Neither promotes the page, and a page read in for
+ *   them is placed to go first.
+ * The replacement policy counts the uses of the first two only.
+ */
+#define BUFFER_ACCESS_POINT (0)
+#define BUFFER_ACCESS_INTERNAL (1)
+#define BUFFER_ACCESS_SCAN (2)
+#define BUFFER_ACCESS_MAINTENANCE (3)
+
+buf_descriptor_t *get_buffer(int64_t table_id, pagenum_t page_num,
+                             int hint = BUFFER_ACCESS_POINT);
+
+/* Get the buffer of the child at the index of a pinned internal page (-1 for
+ * the most left one), whose page number is page_num: through the frame
+ * pointer of it if swizzled, and swizzling it if not.
+ */
+buf_descriptor_t *buffer_get_child(buf_descriptor_t *parent, int index,
+                                   pagenum_t page_num,
+                                   int hint = BUFFER_ACCESS_POINT);
+
+/* Count one more use of a pinned buffer as the access hint tells, for a
+ * page whose kind is known only once it is read.
+ */
+void buffer_count_access(buf_descriptor_t *buf_desc, int hint);
+
+/* Get the buffer of a page taken from the free page list of a table.
+ * Return NULL if the header page or the free page cannot be read in.
+ */
 buf_descriptor_t *get_buffer_of_new_page(int64_t table_id);
-void free_page(int64_t table_id, buf_descriptor_t *free_buf);
-int close_buffer_pool();
+
+/* Get the buffer of a page only if it is cached, without counting it as
+ * an access. Returns NULL if it is not.
+ */
+buf_descriptor_t *buffer_lookup(int64_t table_id, pagenum_t page_num);
+
+/* Read the pages not cached yet into the buffer pool with one submission,
+ * ahead of their use. Their get_buffer() is counted when it comes, and
+ * they are placed as the access hint of it tells.
+ * Returns the number of pages read.
+ */
+int buffer_prefetch(int64_t table_id, const pagenum_t *page_nums, int n,
+                    int hint = BUFFER_ACCESS_POINT);
+
+/* Put a pinned page to the free page list of a table.
+ * Returns 1 if the header page cannot be read in.
+ */
+int free_page(int64_t table_id, buf_descriptor_t *free_buf);
+
+/* Warm-up.
+ * close_buffer_pool() can dump the pages resident in the pools, and after
+ * a restart they are read back in, a few large reads at a time, so the
+ * pages hot before it are hot again without waiting for their misses.
+ */
+typedef struct warm_page_t {
+    int64_t table_id;
+    pagenum_t page_num;
+    uint32_t usage_count;
+} warm_page_t;
+
+/* Write the pages resident in the pools to a dump.
+ * Returns 1 if the dump cannot be written.
+ */
+int buffer_dump_pages(const char *dump_path);
+
+/* Read the pages of a dump, sorted by table and page number, and open
+ * their tables in the pools they were in. The tables gone, or whose pool
+ * is not created, are skipped.
+ * Returns 1 if the dump cannot be read.
+ */
+int buffer_load_dump(const char *dump_path, std::vector<warm_page_t> *pages);
+
+/* Read the next pages of a dump, of one table, into the free frames of its
+ * pool with one submission, and give them their usage counts back. A table
+ * takes no more frames than its max_buf leaves; the rest are skipped.
+ * Returns the number of pages of the dump gone through, or 0 once the pool
+ * has no free frame left.
+ */
+int buffer_warm_up(const warm_page_t *pages, int n);
+
+/* Close the buffer pool, dumping the pages resident to dump_path first
+ * unless it is NULL.
+ */
+int close_buffer_pool(const char *dump_path = NULL);
+
+// Log the files of the open tables again (after the log is truncated)
+void buffer_log_tables();
+
+/* Write back every dirty page and truncate the log.
+ * Recovery starts from here after a crash.
+ */
+int buffer_checkpoint();
 
 // For stat
 void init_buffer_stat();
@@ -0,0 +1,65 @@
+#ifndef DB_COMPRESS_H_
+#define DB_COMPRESS_H_
+
+#include "page.h"
+
+/* A small LZ77 codec in the style of LZ4.
+ *
+ * The compressed stream is a list of sequences:
+ *
+ *   | token | literal length+ | literals | offset (2) | match length+ |
+ *
+ * The high 4 bits of the token are the literal length and the low 4 bits
+ * are the match length minus 4. 15 means the length continues in the
+ * following bytes (255 means it continues again). The last sequence has
+ * literals only.
+ */
+
+// Compressed leaf page tag (never a valid parent page num)
+#define COMPRESSED_PAGE_MAGIC 0x4641454c52504d43ULL  // "CMPRLEAF"
+
+typedef struct compressed_page_header {
+    uint64_t magic;
+    uint16_t compressed_size;  // Size of the compressed stream
+    uint16_t slots_end;        // End of the slot array in the leaf page
+    uint16_t records_begin;    // Beginning of the records in the leaf page
+    uint16_t reserved;
+} compressed_page_header;
+
+/* Compress src_size bytes of src into dest.
+ * Returns the compressed size, or 0 if it exceeds dest_capacity.
+ */
+uint32_t compress_bytes(const byte *src, uint32_t src_size, byte *dest,
+                        uint32_t dest_capacity);
+
+/* Decompress src_size bytes of src into dest.
+ * Returns the decompressed size, or 0 if the stream is corrupted or
+ * exceeds dest_capacity.
+ */
+uint32_t decompress_bytes(const byte *src, uint32_t src_size, byte *dest,
+                          uint32_t dest_capacity);
+
+/* Compress the live part (header, slots and records) of a leaf page into
+ * dest, starting with a compressed_page_header.
+ * Returns the total size, or 0 if the page is not a well-formed leaf page or
+ * does not compress below dest_capacity.
+ */
+uint32_t compress_leaf_page(const page_t *page, byte *dest,
+                            uint32_t dest_capacity);
+
+/* Restore a leaf page compressed by compress_leaf_page().
+ * The free space between the slots and the records is zero-filled.
+ * Returns 0 on success, 1 if src is not a valid compressed page.
+ */
+int decompress_leaf_page(const byte *src, page_t *dest);
+
+/* Zero-fill the free space between the slots and the records of a leaf
+ * page, as decompress_leaf_page() restores it.
+ * Pages that are not well-formed leaf pages are left untouched.
+ */
+void clear_leaf_free_space(page_t *page);
+
+// Check if the on-disk page image is a compressed leaf page
+bool is_compressed_page(const byte *src);
+
+#endif  // DB_COMPRESS_H_
@@ -0,0 +1,13 @@
+#ifndef DB_CRC32C_H_
+#define DB_CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Extend a CRC32C (Castagnoli) over size bytes of data, starting from crc
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
+
+// Check whether crc32c() uses the CRC instruction of the CPU
+bool crc32c_is_hardware();
+
+#endif  // DB_CRC32C_H_
@@ -5,61 +5,114 @@
 #include <cstring>
 #include <cstdint>
 #include <vector>
+#include <string>
 
 #include "buffer.h"
+#include "key.h"
+#include "overflow.h"
+#include "txn.h"
 
 // Min, Max of value size
 #define MIN_VALUE_SIZE 50
 #define MAX_VALUE_SIZE 112
 
-// Threshold of deletion
-#define THRESHOLD 2500
+// Threshold of deletion (scaled from 2500 bytes of a 4 KiB page)
+#define THRESHOLD (2500 * PAGE_SIZE / (4 * 1024))
+
+// Leaves a scan reads ahead of itself in one batch
+#define READ_AHEAD_LEAVES 8
+
+/* Returned by the operations when a page of the table cannot be read in:
+ * the read fails, the page does not match its checksum (a torn write), or
+ * no frame of its pool can be taken (all pinned, or the victim is dirty and
+ * a write of the log or the table failed). A split or merge that meets one
+ * halfway is left half done.
+ */
+#define DB_BAD_PAGE 5
 
 
 // Insertion
 
 int insert_into_leaf(int64_t table_id, buf_descriptor_t *leaf_buf,
-                     db_key_t key, const char* value, uint16_t val_size);
+                     const tree_key_t *key, const char* value, uint16_t val_size);
 
 int insert_into_leaf_after_splitting(int64_t table_id, buf_descriptor_t* leaf_buf,
-                                     db_key_t key, const char* value, uint16_t val_size);
+                                     const tree_key_t *key, const char* value, uint16_t val_size);
 
 int insert_into_node(int64_t table_id, buf_descriptor_t* parent_buf,
-                     int right_index, uint64_t key, pagenum_t right_num);
+                     int right_index, const tree_key_t *key, pagenum_t right_num);
 
 int insert_into_node_after_splitting(int64_t table_id, buf_descriptor_t *parent_buf,
-                                     int right_index, uint64_t key, pagenum_t right_num);
+                                     int right_index, const tree_key_t *key, pagenum_t right_num);
 
-int insert_into_parent(int64_t table_id, buf_descriptor_t *left_buf, uint64_t key,
+int insert_into_parent(int64_t table_id, buf_descriptor_t *left_buf, const tree_key_t *key,
                        buf_descriptor_t *right_buf);
 
-int insert_into_new_root(int64_t table_id, buf_descriptor_t *left_buf, uint64_t key,
+int insert_into_new_root(int64_t table_id, buf_descriptor_t *left_buf, const tree_key_t *key,
                          buf_descriptor_t *right_buf);
 
-int start_new_tree(int64_t table_id, db_key_t key, const char *value, uint16_t val_size);
+int start_new_tree(int64_t table_id, const tree_key_t *key, const char *value, uint16_t val_size);
 
 
 // Deletion
 
-int remove_entry_from_page(int64_t table_id, buf_descriptor_t* buf, uint64_t key);
+int remove_entry_from_page(int64_t table_id, buf_descriptor_t* buf, const tree_key_t *key);
 
 int adjust_root(int64_t table_id, buf_descriptor_t* root_buf);
 
 int coalesce_nodes(int64_t table_id, buf_descriptor_t *buf,
                    buf_descriptor_t *neighbor_buf, buf_descriptor_t *parent_buf,
-                   int neighbor_index, int k_prime);
+                   int neighbor_index, const tree_key_t *k_prime);
 
 int redistribute_nodes(int64_t table_id, buf_descriptor_t *buf,
                        buf_descriptor_t *neighbor_buf, buf_descriptor_t *parent_buf,
-                       int neighbor_index, int k_prime_index, int k_prime);
+                       int neighbor_index, int k_prime_index, const tree_key_t *k_prime);
 
-int delete_entry(int64_t table_id, buf_descriptor_t* buf, uint64_t key);
+int delete_entry(int64_t table_id, buf_descriptor_t* buf, const tree_key_t *key);
 
 
 // Index manager APIs
 
-// Open an existing database file or create one if not exist.
-int64_t open_table(const char *pathname);
+/* Open an existing database file or create one with the flags if not exist.
+ * The pages of the table are cached in the buffer pool of pool_name, or the
+ * default one.
+ */
+int64_t open_table(const char *pathname, uint64_t flags = 0,
+                   const char *pool_name = NULL);
+
+/* Create a buffer pool of num_buf frames with the replacement policy
+ * (BUFFER_POLICY_*) to open tables with, after init_db(). The tables of a
+ * pool do not evict the pages of another. The name is one word.
+ */
+int create_buffer_pool(const char *name, uint32_t num_ht_entries,
+                       uint32_t num_buf, int policy = BUFFER_POLICY_CLOCK);
+
+/* Grow or shrink the buffer pool of the name (DEFAULT_BUFFER_POOL for the
+ * one of init_db()) to num_buf frames, without stopping the operations.
+ */
+int resize_buffer_pool(const char *name, uint32_t num_buf);
+
+/* Keep at least min_buf frames of its pool for the pages of a table, and
+ * let them take max_buf frames at most (0 for either to drop it).
+ */
+int set_table_quota(int64_t table_id, uint32_t min_buf, uint32_t max_buf);
+
+/* Keep the clean pages evicted from the buffer pools compressed in memory,
+ * up to budget bytes (0 to stop), so a miss of one is served without a
+ * read (see victim_cache.h).
+ */
+void set_victim_cache_budget(size_t budget);
+
+/* Let each thread find the pages it used lately without the hashtable of
+ * their pool (see buffer_set_desc_cache()).
+ */
+void enable_desc_cache(bool enable);
+
+/* Let the descents of the trees go from the frame of an internal page to
+ * the frames of its children without the hashtable, while they are in the
+ * pool (see buffer_set_swizzling()).
+ */
+void enable_swizzling(bool enable);
 
 // Insert a record to the given table.
 int db_insert(int64_t table_id, int64_t key, const char *value, uint16_t val_size);
@@ -70,15 +123,115 @@ int db_find(int64_t table_id, int64_t key, char *ret_val, uint16_t *val_size);
 // Delete a record with the matching key from the given table.
 int db_delete(int64_t table_id, int64_t key);
 
+// Replace the value of a record with the matching key.
+int db_update(int64_t table_id, int64_t key, const char *value, uint16_t val_size);
+
 // Find records with a key betwen the range: begin_key <= key <= end_key
 int db_scan(int64_t table_id, int64_t begin_key, int64_t end_key,
             std::vector<int64_t> *keys, std::vector<char*> *values,
             std::vector<uint16_t> *val_sizes);
 
-// Initialize the database system.
-int init_db(uint32_t num_ht_entries, uint32_t num_buf);
+/* Byte-string key APIs, for tables opened with TABLE_FLAG_VAR_KEYS.
+ * Keys are 1 to MAX_KEY_SIZE bytes compared with memcmp(); composite keys
+ * are built with key_builder_t (key.h).
+ * The int64 key APIs fail on these tables and vice versa.
+ */
+
+// Insert a record with a byte-string key to the given table.
+int db_insert(int64_t table_id, const char *key, uint16_t key_size,
+              const char *value, uint16_t val_size);
+
+// Find a record with the matching byte-string key from the given table.
+int db_find(int64_t table_id, const char *key, uint16_t key_size,
+            char *ret_val, uint16_t *val_size);
+
+// Delete a record with the matching byte-string key from the given table.
+int db_delete(int64_t table_id, const char *key, uint16_t key_size);
+
+// Replace the value of a record with the matching byte-string key.
+int db_update(int64_t table_id, const char *key, uint16_t key_size,
+              const char *value, uint16_t val_size);
+
+// Find records with a byte-string key betwen the range: begin_key <= key <= end_key
+int db_scan(int64_t table_id, const char *begin_key, uint16_t begin_size,
+            const char *end_key, uint16_t end_size,
+            std::vector<std::string> *keys, std::vector<char*> *values,
+            std::vector<uint16_t> *val_sizes);
 
-// Shutdown the databasee system.
-int shutdown_db();
+/* Large values.
+ * Values over MAX_VALUE_SIZE are stored in overflow pages and read in pieces
+ * with db_read_value(). db_find() returns 3 for them, and db_scan() returns
+ * them as NULL with size 0.
+ */
+
+// Insert a record with a value of up to MAX_LARGE_VALUE_SIZE bytes.
+int db_insert_large(int64_t table_id, int64_t key, const char *value,
+                    uint32_t val_size);
+
+// Insert a record with a byte-string key and a value of up to MAX_LARGE_VALUE_SIZE bytes.
+int db_insert_large(int64_t table_id, const char *key, uint16_t key_size,
+                    const char *value, uint32_t val_size);
+
+// Get the size of the value of a record.
+int db_get_value_size(int64_t table_id, int64_t key, uint32_t *val_size);
+
+// Get the size of the value of a record with a byte-string key.
+int db_get_value_size(int64_t table_id, const char *key, uint16_t key_size,
+                      uint32_t *val_size);
+
+// Read up to size bytes of the value of a record from offset.
+int db_read_value(int64_t table_id, int64_t key, uint32_t offset, char *buf,
+                  uint32_t size, uint32_t *read_size);
+
+// Read up to size bytes of the value of a record with a byte-string key from offset.
+int db_read_value(int64_t table_id, const char *key, uint16_t key_size,
+                  uint32_t offset, char *buf, uint32_t size,
+                  uint32_t *read_size);
+
+/* Initialize the database system.
+ * With log_path, changes are logged to the write-ahead log file there and
+ * every operation is durable when it returns. The tables are recovered from
+ * the log left by a crash.
+ * The default buffer pool replaces its pages with the policy (BUFFER_POLICY_*).
+ */
+int init_db(uint32_t num_ht_entries, uint32_t num_buf,
+            const char *log_path = NULL, int policy = BUFFER_POLICY_CLOCK);
+
+/* Transactions.
+ * The operations of a thread between db_begin() and db_commit() commit
+ * together; db_abort() undoes them. With the log, a transaction is durable
+ * when db_commit() returns, and one a crash interrupts is rolled back by
+ * init_db(). Each returns 0 on success, 1 if the thread has a transaction
+ * (db_begin) or has none (db_commit, db_abort), or the commit cannot be
+ * made durable as a write of the log failed (db_commit).
+ * The isolation is TXN_SNAPSHOT or TXN_SERIALIZABLE (txn.h). An operation
+ * returns TXN_ROLLED_BACK when its transaction is rolled back on a conflict.
+ */
+int db_begin(int isolation = TXN_SNAPSHOT);
+int db_commit();
+int db_abort();
+
+/* Write back every dirty page and truncate the log.
+ * Recovery after a crash starts from here.
+ */
+int checkpoint_db();
+
+/* Warm-up.
+ * shutdown_db() with a dump_path dumps the pages resident in the buffer
+ * pools there, and warm_up_db() after the next init_db() reads them back
+ * in the background: the tables are opened in their pools (create the
+ * pools first), and the pages read in page order with large reads until
+ * the pools have no free frame left. The operations go on meanwhile.
+ * warm_up_db() returns 1 if there is no dump, or a warm-up is going on.
+ */
+int warm_up_db(const char *dump_path);
+
+// Wait for the warm-up to finish, or stop it first
+void wait_warm_up_db(bool stop = false);
+
+/* Shutdown the databasee system.
+ * With dump_path, the pages resident in the buffer pools are dumped there.
+ */
+int shutdown_db(const char *dump_path = NULL);
 
 #endif  // DB_DB_H_
\ No newline at end of file
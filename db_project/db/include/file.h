@@ -10,23 +10,59 @@
 #include <cstring>
 #include "page.h"
 
-#define MAX_TABLES 20
-
 // For stats
 extern int64_t stat_read_page;
 extern int64_t stat_write_page;
+extern int64_t stat_checksum_failures;
 
 typedef struct table_node {
-    char pathname[128];
+    const char *pathname;
     int64_t table_id;
     int fd;
+    uint64_t flags;       // With the open flags in effect
+    uint32_t block_size;  // File system block size
+    page_t *map;          // The file mapped with TABLE_OPEN_MMAP, or NULL
+    uint64_t map_pages;   // Pages in the mapping
 } table_node;
 
-// Init table nodes
+// A page to read or write in a batch
+typedef struct page_io {
+    int64_t table_id;
+    pagenum_t pagenum;
+    struct page_t *page;
+    int result;  // 0 on success
+} page_io;
+
+// Init the table registry
 int init_tables();
 
-// Open existing table file or create one if it doesn't exist
-int64_t file_open_table_file(const char* pathname);
+/* Open existing table file or create one with the flags if it doesn't exist
+ * With TABLE_OPEN_DIRECT, the file is opened with O_DIRECT if its file
+ * system allows it, and the buffer pool is the only cache of its pages.
+ * With TABLE_OPEN_MMAP, an existing file is opened read-only and mapped
+ * into memory (unless its leaf pages are compressed).
+ */
+int64_t file_open_table_file(const char* pathname, uint64_t flags = 0);
+
+/* Get the mapping of a table opened with TABLE_OPEN_MMAP, and the number of
+ * pages in it. Returns NULL if the table is not mapped.
+ */
+page_t *file_get_mapping(int64_t table_id, uint64_t *num_pages);
+
+// Allocate a zero-filled page buffer aligned for O_DIRECT (free it with free())
+page_t *file_new_page_buffer();
+
+// Get the number of tables in the registry
+int file_get_num_tables();
+
+// Get the table node at index of the registry, NULL if there is none
+table_node *file_get_table(int index);
+
+// Get the index of the table in the registry, -1 if it is not open
+int file_get_table_index(int64_t table_id);
+
+// Get the table flags recorded in the header page
+uint64_t file_get_table_flags(int64_t table_id);
 
 // Allocate an on-disk page from the free page list
 pagenum_t file_alloc_page(int64_t table_id);
@@ -34,13 +70,46 @@ pagenum_t file_alloc_page(int64_t table_id);
 // Free an on-disk page to the free page list
 void file_free_page(int64_t table_id, pagenum_t pagenum);
 
-// Read an on-disk page into the in-memory page structure(dest)
-void file_read_page(int64_t table_id, pagenum_t pagenum, struct page_t* dest);
+/* Compute the checksum of a page, with its checksum field taken as zero.
+ * 0 is left for pages written without a checksum.
+ */
+uint32_t compute_page_checksum(const struct page_t* page);
+
+/* Read an on-disk page into the in-memory page structure(dest)
+ * Returns 1 if the page cannot be read whole, or does not match its
+ * checksum (a torn write).
+ */
+int file_read_page(int64_t table_id, pagenum_t pagenum, struct page_t* dest);
+
+/* Read the pages with one submission to the I/O backend.
+ * Returns the number of pages failed; the result of each is 0, or 1 if it
+ * could not be read or does not match its checksum.
+ */
+int file_read_pages(page_io *ios, int n);
+
+/* Set the checksum of a page about to be written.
+ * Leaf pages of compressed tables get their free space zero-filled first,
+ * as they are read back.
+ */
+void file_set_page_checksum(int64_t table_id, pagenum_t pagenum,
+                            struct page_t* page);
 
 // Write an in-memory page(src) to the on-disk page
 void file_write_page(int64_t table_id, pagenum_t pagenum, const struct page_t* src);
 
-// Close the table file
+/* Write the pages with one submission to the I/O backend.
+ * Returns the number of pages failed; the result of each is 0, or 1 if it
+ * could not be written.
+ */
+int file_write_pages(page_io *ios, int n);
+
+// Sync the table file to the disk
+int file_sync_table(int64_t table_id);
+
+// Sync all table files to the disk
+int file_sync_tables();
+
+// Close the table files, and empty the registry
 void file_close_table_files();
 
 #endif  // DB_FILE_H_
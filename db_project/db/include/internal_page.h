@@ -0,0 +1,84 @@
+#ifndef DB_INTERNAL_PAGE_H_
+#define DB_INTERNAL_PAGE_H_
+
+#include "page.h"
+#include "key.h"
+
+/* Internal pages come in three formats, chosen per table.
+ *
+ * Plain:  kp_pair pairs[INTERNAL_ORDER - 1]
+ * Packed: every key is stored as a narrow (1/2/4/8-byte) unsigned delta
+ *         from the page's base_key (the smallest key), followed by the page
+ *         numbers of the children:
+ *
+ *         packed = | delta[0 .. capacity) | page_num[0 .. capacity) |
+ *
+ *         The delta width is the narrowest one covering max_key - base_key,
+ *         so the capacity of a packed page depends on the keys it holds.
+ * Var:    byte-string keys. Fixed-size entries grow from the front and the
+ *         key bytes from the back, so the capacity depends on the key sizes:
+ *
+ *         packed = | var_entry[0 .. n) | free | key bytes |
+ */
+
+#define INTERNAL_PLAIN 0
+#define INTERNAL_PACKED 1
+#define INTERNAL_VAR 2
+
+// The number of keys a packed internal page holds with the given key width
+#define PACKED_CAPACITY(width) ((int)(DATA_SIZE / ((width) + sizeof(pagenum_t))))
+
+// The size of an entry of the var format, without its key bytes
+#define VAR_ENTRY_SIZE 20
+
+// The maximum number of keys of an internal page in any format
+#define MAX_INTERNAL_PAIRS PACKED_CAPACITY(1)
+
+// A key-page num pair taken out of an internal page
+typedef struct internal_entry {
+    tree_key_t key;
+    pagenum_t page_num;
+} internal_entry;
+
+// Get the internal page format of a table
+int internal_format(uint64_t table_flags);
+
+// Check whether the internal page can take one more pair with the key
+bool internal_has_room(const page_t *page, const tree_key_t *key, int format);
+
+// Check whether the internal page holds too few keys after a deletion
+bool internal_is_underfull(const page_t *page, int format);
+
+/* Check whether the pairs of left, k_prime and the pairs
+ * of right fit a page.
+ */
+bool internal_can_merge(const page_t *left, const tree_key_t *k_prime,
+                        const page_t *right, int format);
+
+// Check whether num_entries sorted entries fit a page
+bool internal_fits(const internal_entry *entries, int num_entries, int format);
+
+// Get the key of the index-th pair
+void internal_get_key(const page_t *page, int index, int format,
+                      tree_key_t *key);
+
+// Get the page num of the index-th pair (-1 for the most left page num)
+pagenum_t internal_get_child(const page_t *page, int index, int format);
+
+// Copy all key-page num pairs of the page into entries
+void internal_unpack(const page_t *page, internal_entry *entries, int format);
+
+/* Store the sorted entries into the page and set its number of keys.
+ * Returns 1 without touching the page if the entries do not fit.
+ */
+int internal_pack(page_t *page, const internal_entry *entries,
+                  int num_entries, int format);
+
+// Get the index of the last key <= key, or -1 (the most left page)
+int internal_search(const page_t *page, const tree_key_t *key, int format);
+
+// Get the number of keys < key
+int internal_lower_bound(const page_t *page, const tree_key_t *key,
+                         int format);
+
+#endif  // DB_INTERNAL_PAGE_H_
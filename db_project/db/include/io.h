@@ -0,0 +1,80 @@
+#ifndef DB_IO_H_
+#define DB_IO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* Page I/O backends.
+ *
+ * The file manager does its reads and writes through a backend, in
+ * batches of io_request that return when every request is done:
+ *
+ * - IO_BACKEND_SYNC: one pread()/pwrite() per request.
+ * - IO_BACKEND_URING: io_uring. A batch is queued and submitted with one
+ *   system call, and the thread sleeps until the completions arrive, so the
+ *   device sees the whole batch at once. Each thread has its own ring. The
+ *   table files are registered (IOSQE_FIXED_FILE), and the buffer pool
+ *   frames are registered as a fixed buffer for READ_FIXED/WRITE_FIXED,
+ *   sparing the kernel a page table walk per request.
+ *
+ * A request covers one buffer, or several (iov) for a run of the file, as
+ * with preadv()/pwritev().
+ *
+ * IO_BACKEND_AUTO picks io_uring if the kernel has it, the sync one if not.
+ */
+
+#define IO_BACKEND_AUTO 0
+#define IO_BACKEND_SYNC 1
+#define IO_BACKEND_URING 2
+
+#define IO_QUEUE_DEPTH 64  // Requests a ring holds at once
+#define IO_MAX_FILES 64    // Slots of registered files
+#define IO_MAX_VECTOR 64   // Buffers of a vectored request
+
+typedef struct io_request {
+    int fd;
+    int slot;        // The registered file slot of fd, -1 if none
+    void *buf;       // NULL for a vectored request
+    uint32_t size;   // In total
+    uint64_t offset;
+    bool write;
+    int64_t result;  // Bytes done, or -errno
+    const struct iovec *iov;  // The buffers of a vectored request
+    int iovcnt;
+} io_request;
+
+typedef struct io_backend_t {
+    const char *name;
+    int (*submit)(io_request *reqs, int n);
+} io_backend_t;
+
+// For stats
+extern int64_t stat_io_requests;
+extern int64_t stat_io_submits;  // System calls submitting requests
+
+/* Use the backend for the following I/O.
+ * Returns 1 (keeping the current one) if it is not available.
+ */
+int io_open(int backend);
+
+// Get the name of the backend in use
+const char *io_get_backend_name();
+
+// Register the file in the slot, or clear the slot with fd -1
+void io_set_file(int slot, int fd);
+
+// Register the memory of the buffer frames, or forget it with NULL
+void io_set_buffers(void *base, size_t size);
+
+/* Do the requests, in any order, and set their results.
+ * Returns the number of requests not done in full.
+ */
+int io_submit(io_request *reqs, int n);
+
+// Read or write size bytes at offset, returning the bytes done or -errno
+int64_t io_read(int fd, int slot, void *buf, uint32_t size, uint64_t offset);
+int64_t io_write(int fd, int slot, const void *buf, uint32_t size,
+                 uint64_t offset);
+
+#endif  // DB_IO_H_
@@ -0,0 +1,94 @@
+#ifndef DB_KEY_H_
+#define DB_KEY_H_
+
+#include "page.h"
+
+#include <cstring>
+
+/* Keys of the B+ tree.
+ *
+ * A table keys its records either by int64 (db_key_t) or by byte strings
+ * (TABLE_FLAG_VAR_KEYS) compared with memcmp(). Byte-string keys carry an
+ * abbreviated key: their first 8 bytes read as a big-endian number with the
+ * sign bit flipped, so comparing abbreviated keys as db_key_t orders them
+ * like memcmp() does. Only keys with equal abbreviated keys need to look at
+ * the bytes.
+ *
+ * Composite keys are built with the key_append_*() encoders, whose outputs
+ * compare with memcmp() in the order of their values.
+ */
+
+#define MAX_KEY_SIZE 64
+
+typedef struct tree_key_t {
+    db_key_t prefix;          // The int64 key, or the abbreviated key
+    uint16_t size;            // Size of the byte-string key, 0 for int64 keys
+    byte data[MAX_KEY_SIZE];  // The byte-string key
+} tree_key_t;
+
+// Get the abbreviated key of a byte-string key
+static inline db_key_t key_abbreviate(const byte *data, uint16_t size) {
+    uint64_t prefix = 0;
+
+    for (int i = 0; i < 8; i++)
+        prefix = (prefix << 8) | (i < size ? (uint8_t)data[i] : 0);
+
+    return (db_key_t)(prefix ^ ((uint64_t)1 << 63));
+}
+
+// Make a tree key of an int64 key
+static inline void key_set_int(tree_key_t *key, db_key_t value) {
+    key->prefix = value;
+    key->size = 0;
+}
+
+// Make a tree key of a byte-string key (size must not exceed MAX_KEY_SIZE)
+static inline void key_set_bytes(tree_key_t *key, const byte *data,
+                                 uint16_t size) {
+    key->prefix = key_abbreviate(data, size);
+    key->size = size;
+    memcpy(key->data, data, size);
+}
+
+// Compare a byte-string key with the bytes of another one
+static inline int key_compare_bytes(const byte *a, uint16_t a_size,
+                                    const byte *b, uint16_t b_size) {
+    int ret = memcmp(a, b, a_size < b_size ? a_size : b_size);
+
+    if (ret != 0)
+        return ret;
+
+    return (int)a_size - (int)b_size;
+}
+
+// Compare two tree keys of the same kind
+static inline int key_compare(const tree_key_t *a, const tree_key_t *b) {
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+
+    if (a->size == 0 && b->size == 0)
+        return 0;
+
+    return key_compare_bytes(a->data, a->size, b->data, b->size);
+}
+
+// Builder of composite keys
+typedef struct key_builder_t {
+    byte data[MAX_KEY_SIZE];
+    uint16_t size;
+    bool overflow;  // Set when a component did not fit
+} key_builder_t;
+
+// Start an empty composite key
+void key_builder_init(key_builder_t *builder);
+
+// Append an int64 component (8 bytes)
+void key_append_int64(key_builder_t *builder, int64_t value);
+
+/* Append a byte-string component.
+ * 0x00 bytes are escaped as 0x00 0xff and the component ends with 0x00 0x00,
+ * so a shorter string orders before the strings it prefixes.
+ */
+void key_append_bytes(key_builder_t *builder, const char *data, uint16_t size);
+
+#endif  // DB_KEY_H_
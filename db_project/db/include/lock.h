@@ -0,0 +1,55 @@
+#ifndef DB_LOCK_H_
+#define DB_LOCK_H_
+
+#include "txn.h"
+
+/* Record locks.
+ *
+ * A lock is taken on a (table id, key) by a transaction, shared (S) or
+ * exclusive (X), and held until the transaction ends. Requests that
+ * conflict with the ones granted wait in the queue of the lock, in order.
+ *
+ * The locks are spread over LOCK_PARTITIONS partitions by the hash of the
+ * record, each with its own mutex, so requests on different records rarely
+ * meet.
+ *
+ * Before a request waits, it looks for a cycle in the wait-for graph
+ * through the transactions it waits for. If one is found, the request
+ * fails with LOCK_DEADLOCK and its transaction is to be rolled back.
+ *
+ * A lock on the key NULL is on the end of the table (after the last key),
+ * for next-key locking: a scan locks the key after its range and a
+ * deletion the key after the deleted one, so insertions into those gaps
+ * (which check the key after them with an instant request) wait.
+ */
+
+#define LOCK_SHARED 1
+#define LOCK_EXCLUSIVE 2
+
+// Results of lock_acquire()
+#define LOCK_GRANTED 0
+#define LOCK_BUSY 1      // It would wait (without wait)
+#define LOCK_DEADLOCK 2  // Waiting would never end
+
+#define LOCK_PARTITIONS 16
+
+// For stats
+extern int64_t stat_lock_requests;
+extern int64_t stat_lock_waits;
+extern int64_t stat_lock_wait_ns;  // Total time of the waits
+extern int64_t stat_deadlocks;
+
+/* Lock the record with the key (the end of the table if NULL) for txn.
+ * With wait, waits until the lock is granted or a deadlock is found.
+ * An instant request is forgotten once granted, unless txn held the lock.
+ */
+int lock_acquire(txn_t *txn, int64_t table_id, const tree_key_t *key,
+                 int mode, bool instant, bool wait);
+
+// Release every lock of txn, waking up the waiting requests
+void lock_release_all(txn_t *txn);
+
+// Reset the stats
+void init_lock_stat();
+
+#endif  // DB_LOCK_H_
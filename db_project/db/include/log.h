@@ -0,0 +1,172 @@
+#ifndef DB_LOG_H_
+#define DB_LOG_H_
+
+#include "page.h"
+
+/* Write-ahead log.
+ *
+ * Every change of a page is logged as the bytes it changed, before and
+ * after, when the page is marked dirty. The records of one operation are
+ * put between LOG_BEGIN and LOG_COMMIT, and the operation is durable once
+ * its LOG_COMMIT is on disk.
+ *
+ * The log file starts with a log_file_header, followed by the records. The
+ * LSN of a record is base_lsn plus its offset after the file header, so LSNs
+ * keep growing when the log is truncated. LSN 0 means "never logged".
+ *
+ * The first change of a page after a checkpoint also logs the whole page
+ * as it was (LOG_PAGE_IMAGE), so recovery does not depend on the page on
+ * disk, which a crash may have left torn.
+ *
+ * Transactions (txn.h) log the inverse of their changes (LOG_UNDO) and their
+ * end (LOG_TXN_COMMIT, LOG_TXN_ABORT) in the operations of the changes.
+ *
+ * Recovery (recovery.h) replays the records after a crash. A checkpoint
+ * writes back every dirty page and truncates the log, so the log always
+ * starts at the last checkpoint.
+ *
+ * Committers wait in log_flush(). One of them writes and syncs everything
+ * appended so far while the others wait for it, so concurrent commits share
+ * one fdatasync() (group commit).
+ */
+
+typedef uint64_t lsn_t;
+
+// Log record types
+#define LOG_BEGIN 1   // An operation begins
+#define LOG_UPDATE 2  // Bytes of a page changed (log_update_t)
+#define LOG_COMMIT 3  // An operation is complete
+#define LOG_TABLE 4   // A table file is open (log_table_t)
+#define LOG_PAGE_IMAGE 5  // A whole page before its first change (log_update_t)
+#define LOG_UNDO 6        // How to undo a change of a transaction (log_undo_t)
+#define LOG_TXN_COMMIT 7  // A transaction is committed (log_txn_t)
+#define LOG_TXN_ABORT 8   // A transaction is rolled back (log_txn_t)
+
+#define LOG_FILE_MAGIC 0x474f4c4c41574244ULL  // "DBWALLOG"
+#define LOG_FILE_HEADER_SIZE 64
+#define LOG_BUFFER_SIZE (1024 * 1024)         // 1 MiB
+#define LOG_CHECKPOINT_SIZE (64 * 1024 * 1024)  // Log size to checkpoint at
+
+typedef struct log_file_header {
+    uint64_t magic;
+    lsn_t base_lsn;  // LSN of the first record
+    byte reserved[LOG_FILE_HEADER_SIZE - 16];
+} log_file_header;
+
+// Records are padded to 8 bytes
+typedef struct log_record_t {
+    uint32_t size;      // Size of the whole record
+    uint32_t checksum;  // CRC32C of the record with this field zeroed
+    lsn_t lsn;
+    lsn_t prev_lsn;     // Previous record of the same operation
+    uint64_t op_id;     // Operation the record belongs to
+    uint32_t type;
+    uint32_t reserved;
+} log_record_t;
+
+/* LOG_UPDATE: followed by the bytes before, then the bytes after
+ * LOG_PAGE_IMAGE: followed by the whole page (offset 0, length PAGE_SIZE)
+ */
+typedef struct log_update_t {
+    int64_t table_id;
+    pagenum_t page_num;
+    uint16_t offset;  // Offset of the bytes in the page
+    uint16_t length;  // Number of the bytes
+    uint32_t reserved;
+} log_update_t;
+
+// LOG_TABLE: tells which file a table id of the log stands for
+typedef struct log_table_t {
+    int64_t table_id;
+    uint64_t flags;
+    char pathname[128];
+} log_table_t;
+
+// LOG_UNDO: followed by the key bytes, then the value bytes
+typedef struct log_undo_t {
+    uint64_t txn_id;
+    int64_t table_id;
+    db_key_t key;       // The int64 key, or the abbreviated key
+    uint32_t type;      // UNDO_* of txn.h
+    uint16_t key_size;  // Size of the byte-string key, 0 for int64 keys
+    uint16_t val_size;
+} log_undo_t;
+
+// LOG_TXN_COMMIT, LOG_TXN_ABORT
+typedef struct log_txn_t {
+    uint64_t txn_id;
+} log_txn_t;
+
+// For stats
+extern int64_t stat_log_records;
+extern int64_t stat_log_commits;
+extern int64_t stat_log_syncs;
+
+// Open the log file, creating it if not exist
+int log_open(const char *pathname);
+
+// Flush and close the log file
+int log_close();
+
+// Check whether the log is open
+bool log_is_enabled();
+
+// Start an operation; its LOG_BEGIN is appended with its first change
+void log_begin_op();
+
+/* Finish the operation.
+ * Returns the LSN of its LOG_COMMIT to wait for, or 0 if it changed nothing.
+ */
+lsn_t log_end_op();
+
+/* Log a change of length bytes at offset of a page.
+ * Returns the LSN of the record.
+ */
+lsn_t log_page_update(int64_t table_id, pagenum_t page_num, uint16_t offset,
+                      uint16_t length, const byte *before, const byte *after);
+
+/* Log the whole page before its first change after a checkpoint.
+ * Returns the LSN of the record.
+ */
+lsn_t log_page_image(int64_t table_id, pagenum_t page_num, const byte *page);
+
+// Log how to undo a change of a transaction
+lsn_t log_undo(const log_undo_t *undo, const byte *key, const byte *value);
+
+/* Log the end of a transaction (LOG_TXN_COMMIT or LOG_TXN_ABORT).
+ * Returns the LSN of the record.
+ */
+lsn_t log_txn_end(uint32_t type, uint64_t txn_id);
+
+// Log the file of a table id
+void log_table(int64_t table_id, uint64_t flags, const char *pathname);
+
+/* Wait until the record at lsn is on disk.
+ * Returns 1 if it cannot be, as a write or sync of the log failed. The
+ * failure stays: no record is flushed after it, until the log is reopened.
+ */
+int log_flush(lsn_t lsn);
+
+// Get the LSN every record before which is on disk
+lsn_t log_get_flushed_lsn();
+
+// Get the LSN of the first record
+lsn_t log_get_base_lsn();
+
+// Get the LSN of the next record
+lsn_t log_get_end_lsn();
+
+/* Read size bytes of the records from lsn.
+ * Returns 1 if they are not all on disk.
+ */
+int log_read(lsn_t lsn, byte *dest, uint64_t size);
+
+/* Drop all records, once every page they changed is on disk.
+ * LSNs go on from the end of the dropped records.
+ */
+int log_truncate();
+
+// For stat
+void init_log_stat();
+
+#endif  // DB_LOG_H_
@@ -0,0 +1,94 @@
+#ifndef DB_MVCC_H_
+#define DB_MVCC_H_
+
+#include "txn.h"
+
+/* Multi-version concurrency control.
+ *
+ * The tree holds the latest version of each record, committed or not. When
+ * a record is changed while someone may still need the record as it was,
+ * the value before the change (as stored in the leaf, or its absence) is
+ * kept in the version store with the writer:
+ *
+ *   (table id, key) -> | writer, commit ts, value before | -> ... (older)
+ *
+ * Commits are numbered by a clock. A reader sees the database as of its
+ * snapshot: the writers committed at or before the snapshot timestamp, and
+ * its own transaction. Reading a record starts from the tree and steps back
+ * through the versions of the writers the snapshot does not see.
+ *
+ * A transaction reads from the snapshot taken at db_begin(), other reads
+ * from one taken when they start, so scans release the tree between leaves
+ * and let writers go on. Writers change the latest version; keeping two of
+ * them off the same record is left to record locks.
+ *
+ * A version is purged when every snapshot sees its writer. The overflow
+ * pages of the value it holds are freed then, as a reader may still follow
+ * the reference until that point.
+ */
+
+typedef struct snapshot_t {
+    uint64_t ts;      // Commits at or before ts are seen
+    uint64_t txn_id;  // The reader's transaction, 0 if none
+} snapshot_t;
+
+// For stats
+extern int64_t stat_versions_created;
+extern int64_t stat_versions_read;
+extern int64_t stat_versions_purged;
+
+/* Get the snapshot of the calling thread: the one of its transaction, or the
+ * latest one at TXN_SERIALIZABLE or without a transaction.
+ */
+void mvcc_get_snapshot(const txn_t *txn, snapshot_t *snapshot);
+
+// Take a snapshot to keep over several operations
+void mvcc_open_snapshot(snapshot_t *snapshot);
+
+// Release a snapshot taken by mvcc_open_snapshot()
+void mvcc_close_snapshot(const snapshot_t *snapshot);
+
+// Take the snapshot of a new transaction
+void mvcc_begin_txn(txn_t *txn);
+
+// Make the versions of a transaction visible to the later snapshots
+void mvcc_commit_txn(txn_t *txn);
+
+// Drop the versions of a transaction rolled back
+void mvcc_abort_txn(txn_t *txn);
+
+/* Keep the value before a change of the record with the key.
+ * txn is the writer, NULL for an operation committing by itself.
+ * Returns true if the version is kept; the overflow pages of the value are
+ * then freed when it is purged.
+ */
+bool mvcc_add_version(int64_t table_id, const tree_key_t *key, const txn_t *txn,
+                      bool exists, const byte *value, uint16_t val_size);
+
+/* Get the version of a record seen by the snapshot.
+ * exists, value and val_size hold the latest version on the call, and the
+ * one seen on return (value must have MAX_UNDO_VALUE_SIZE bytes).
+ */
+void mvcc_read(const snapshot_t *snapshot, int64_t table_id,
+               const tree_key_t *key, bool *exists, byte *value,
+               uint16_t *val_size);
+
+// Whether others committed a change of the record after the snapshot
+bool mvcc_is_changed_since(const snapshot_t *snapshot, int64_t table_id,
+                           const tree_key_t *key);
+
+/* Get the keys with versions in the range, in order:
+ * begin_key < key <= end_key, or begin_key <= key <= end_key with
+ * include_begin.
+ */
+void mvcc_get_keys(int64_t table_id, const tree_key_t *begin_key,
+                   bool include_begin, const tree_key_t *end_key,
+                   std::vector<tree_key_t> *keys);
+
+// Purge the versions every snapshot sees
+void mvcc_purge();
+
+// Drop every version and reset the stats (no snapshot must be open)
+void mvcc_clear();
+
+#endif  // DB_MVCC_H_
@@ -0,0 +1,29 @@
+#ifndef DB_NUMA_H_
+#define DB_NUMA_H_
+
+#include <stddef.h>
+
+/* NUMA placement, without libnuma: the nodes are read from sysfs, and
+ * memory and threads are bound to them with system calls. On a machine
+ * without NUMA there is one node, 0.
+ */
+
+#define MAX_NUMA_NODES 8  // Nodes from this on count as the last one
+
+// Get the number of NUMA nodes
+int numa_count_nodes();
+
+// Get the node of the CPU the calling thread runs on
+int numa_current_node();
+
+/* Place the pages of the memory on the node, before they are first touched.
+ * Returns 0 on success.
+ */
+int numa_place_memory(void *addr, size_t size, int node);
+
+/* Run the calling thread on the CPUs of the node only.
+ * Returns 0 on success.
+ */
+int numa_pin_thread(int node);
+
+#endif  // DB_NUMA_H_
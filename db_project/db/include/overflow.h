@@ -0,0 +1,42 @@
+#ifndef DB_OVERFLOW_H_
+#define DB_OVERFLOW_H_
+
+#include "buffer.h"
+
+/* Values too large for a leaf live in a chain of overflow pages. The record
+ * in the leaf holds an overflow_ref instead of the value. A reference is
+ * smaller than MIN_VALUE_SIZE, so its size tells it from an inline value.
+ *
+ * Every overflow page holds DATA_SIZE bytes of the value, but the last one.
+ */
+
+// Maximum size of a value in overflow pages
+#define MAX_LARGE_VALUE_SIZE (1U << 30)  // 1 GiB
+
+typedef struct overflow_ref {
+    uint32_t value_size;       // Size of the whole value
+    uint32_t reserved;
+    pagenum_t first_page_num;  // The first page of the chain
+} overflow_ref;
+
+#define OVERFLOW_REF_SIZE ((uint16_t)sizeof(overflow_ref))
+
+/* Write a value into a new chain of overflow pages.
+ * Returns 0 and sets the reference of the chain on success, or 1 (freeing
+ * the pages written) if no page can be allocated.
+ */
+int overflow_write(int64_t table_id, const char *value, uint32_t val_size,
+                   overflow_ref *ref);
+
+/* Read size bytes of the value from offset, following the chain.
+ * Returns the number of bytes read, short if a page cannot be read in.
+ */
+uint32_t overflow_read(int64_t table_id, const overflow_ref *ref,
+                       uint32_t offset, char *buf, uint32_t size);
+
+/* Free all pages of the chain.
+ * The rest of the chain is left allocated from a page that cannot be read in.
+ */
+void overflow_free(int64_t table_id, const overflow_ref *ref);
+
+#endif  // DB_OVERFLOW_H_
@@ -4,14 +4,36 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stddef.h>
+
+// Page size chosen at build time (-DDB_PAGE_SIZE=...)
+#ifndef DB_PAGE_SIZE
+#define DB_PAGE_SIZE (4 * 1024)                  // 4 KiB
+#endif
 
 #define INITIAL_DB_FILE_SIZE (10 * 1024 * 1024)  // 10 MiB
-#define PAGE_SIZE (4 * 1024)                     // 4 KiB
+#define PAGE_SIZE (db_page_layout::page_size)
 #define MAGIC_NUMBER 2024
-#define HEADER_SIZE 128
+#define HEADER_SIZE (db_page_layout::header_size)
 #define SLOT_SIZE 12
-#define DATA_SIZE (PAGE_SIZE - HEADER_SIZE)
-#define INTERNAL_ORDER 249
+#define DATA_SIZE (db_page_layout::data_size)
+#define INTERNAL_ORDER (db_page_layout::internal_order)
+
+// Table flags (stored in the header page at creation)
+#define TABLE_FLAG_PACKED_KEYS (1 << 0)      // Delta-packed internal page keys
+#define TABLE_FLAG_COMPRESSED_LEAF (1 << 1)  // Compressed on-disk leaf pages
+#define TABLE_FLAG_VAR_KEYS (1 << 2)         // Byte-string keys (see key.h)
+
+// Open flags (given to each open, not stored in the header page)
+#define TABLE_OPEN_DIRECT (1ULL << 32)  // O_DIRECT, past the kernel page cache
+#define TABLE_OPEN_MMAP (1ULL << 33)    // Read-only, pages read in place
+#define TABLE_OPEN_FLAGS (TABLE_OPEN_DIRECT | TABLE_OPEN_MMAP)
+
+// Alignment of the page buffers, as O_DIRECT needs
+#define PAGE_ALIGNMENT 4096
+
+// is_leaf of overflow pages, so they are never taken for nodes
+#define OVERFLOW_PAGE_TAG 2
 
 typedef uint64_t pagenum_t;
 typedef int64_t db_key_t;
@@ -28,17 +50,54 @@ typedef struct slot_t {
     uint16_t offset;
 } slot_t;
 
+/* Layout of the pages for a page size.
+ * Slot offsets are 16-bit, which bounds the page size by 32 KiB.
+ */
+template <int kPageSize>
+struct page_layout {
+    static_assert(kPageSize >= 4 * 1024 && kPageSize <= 32 * 1024,
+                  "page size must be between 4 KiB and 32 KiB");
+    static_assert((kPageSize & (kPageSize - 1)) == 0,
+                  "page size must be a power of two");
+
+    static constexpr int page_size = kPageSize;
+    static constexpr int header_size = 128;
+    static constexpr int data_size = page_size - header_size;
+    static constexpr int internal_order = data_size / (int)sizeof(kp_pair) + 1;
+};
+
+typedef page_layout<DB_PAGE_SIZE> db_page_layout;
+
+/* Bytes [96, 112) of every page hold the fields common to all page types
+ * below, which the page types leave in their reserved bytes.
+ */
+#define PAGE_COMMON_OFFSET 96
+
 struct page_t {
     union {
+        struct { // Common to all pages
+            byte reserved_common[PAGE_COMMON_OFFSET];
+            uint64_t page_lsn;       // LSN of the last logged change of the page
+            uint32_t page_checksum;  // CRC32C of the page on disk, 0 if none
+        };
         struct { // Header Page
             uint64_t magic_number;
             pagenum_t free_page_num;
             uint64_t num_of_pages;
             pagenum_t root_page_num;
+            uint64_t table_flags;
+            uint32_t page_size;
         };
         struct { // Free Page
             pagenum_t next_free_page_num;
         };
+        struct { // Overflow Page
+            pagenum_t next_overflow_page_num;  // -1 at the end of the chain
+            int32_t overflow_tag;              // OVERFLOW_PAGE_TAG (is_leaf)
+            uint32_t overflow_size;            // Bytes of the value in this page
+            byte reserved_overflow[112];
+            byte overflow_data[DATA_SIZE];
+        };
         struct { // Node Page
             // Node Header
             pagenum_t parent_page_num;
@@ -47,11 +106,16 @@ struct page_t {
             union {
                 struct { // Internal Page
                     // Internal Header
-                    byte reserved_internal[104];
+                    db_key_t base_key;   // Packed format only
+                    uint32_t key_width;  // Packed format only
+                    byte reserved_internal[92];
                     pagenum_t most_left_page_num;
 
                     // Internal Data
-                    kp_pair pairs[INTERNAL_ORDER - 1];
+                    union {
+                        kp_pair pairs[INTERNAL_ORDER - 1];
+                        byte packed[DATA_SIZE];
+                    };
                 };
                 struct { // Leaf Page
                     // Leaf Header
@@ -70,4 +134,13 @@ struct page_t {
 
 typedef struct page_t page_t;
 
+static_assert(sizeof(page_t) == PAGE_SIZE, "page_t must fill a page");
+static_assert(offsetof(page_t, page_lsn) == PAGE_COMMON_OFFSET &&
+              offsetof(page_t, page_checksum) == PAGE_COMMON_OFFSET + 8,
+              "common fields must be at PAGE_COMMON_OFFSET");
+static_assert(offsetof(page_t, page_size) + sizeof(uint32_t) <= PAGE_COMMON_OFFSET &&
+              offsetof(page_t, amount_of_free_space) >= PAGE_COMMON_OFFSET + 16 &&
+              offsetof(page_t, most_left_page_num) >= PAGE_COMMON_OFFSET + 16,
+              "page types must leave the common fields reserved");
+
 #endif // DB_PAGE_H
\ No newline at end of file
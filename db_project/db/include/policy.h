@@ -0,0 +1,64 @@
+#ifndef DB_POLICY_H_
+#define DB_POLICY_H_
+
+#include "buffer.h"
+
+/* Buffer replacement policies.
+ *
+ * A pool tells its policy when a page comes into a frame (insert), is used
+ * again (access) and leaves its frame (remove), and asks it for a victim
+ * when the free list is empty. A page leaves its frame evicted to make room
+ * for another, or dropped with its table or its frame; the policies
+ * remember the evicted ones only. A page inserted cold (read in for a scan
+ * or maintenance, see BUFFER_ACCESS_*) goes where the victims of its list
+ * are taken from, and does not count as coming back if the policy
+ * remembers it:
+ *
+ * - BUFFER_POLICY_CLOCK: clock sweep over the usage counts of the frames.
+ * - BUFFER_POLICY_LRU_K: LRU-2. The victim is the page used twice whose
+ *   second last use is the oldest, or before those, the least recently
+ *   used page used once. The last use of an evicted page is remembered for
+ *   a while, so a page read again soon keeps its history.
+ * - BUFFER_POLICY_2Q: a page comes into a FIFO (A1in) of a quarter of the
+ *   frames, and into the LRU list (Am) only if it is read again after
+ *   leaving the FIFO, which the ghost list of the pages evicted from it
+ *   (A1out) tells.
+ * - BUFFER_POLICY_ARC: LRU lists of the pages used once (T1) and more (T2),
+ *   with ghost lists of the pages evicted from each (B1, B2). A page read
+ *   again from B1 grows the target size of T1, and one from B2 shrinks it.
+ *
+ * A scan reads each page once, so it stays in A1in or T1 (or the pages
+ * used once in LRU-2) and leaves the pages used more alone.
+ */
+
+// The page a victim is looked for
+typedef struct victim_filter_t {
+    int64_t table_id;
+    pagenum_t page_num;
+    table_binding_t *binding;  // Of the table, NULL if it has none
+    bool at_max;               // Whether the table is at its max_buf
+} victim_filter_t;
+
+typedef struct replacement_policy_t {
+    const char *name;
+    int (*init)(buffer_pool_t *pool);
+    void (*destroy)(buffer_pool_t *pool);
+    void (*insert)(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                   bool cold);
+    void (*access)(buffer_pool_t *pool, buf_descriptor_t *buf_desc);
+    void (*remove)(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                   bool evicted);
+    buf_descriptor_t *(*get_victim)(buffer_pool_t *pool,
+                                    const victim_filter_t *filter);
+} replacement_policy_t;
+
+// Get the replacement policy, NULL if there is no such one
+const replacement_policy_t *get_replacement_policy(int policy);
+
+/* Whether the buffer may be taken for the page of the filter: it is not
+ * pinned, and the quotas of the tables let it go (in buffer.cc).
+ */
+bool buffer_is_replaceable(const buf_descriptor_t *buf_desc,
+                           const victim_filter_t *filter);
+
+#endif  // DB_POLICY_H_
@@ -0,0 +1,38 @@
+#ifndef DB_RECOVERY_H_
+#define DB_RECOVERY_H_
+
+#include "buffer.h"
+#include "txn.h"
+
+/* Crash recovery.
+ *
+ * The log holds the changes since the last checkpoint. Recovery opens the
+ * tables of its LOG_TABLE records and brings every page changed in the log
+ * up to date, starting from its LOG_PAGE_IMAGE if it has one (the page on
+ * disk may be torn): the changes newer than the page LSN are redone, then the
+ * changes of the operations without a LOG_COMMIT are undone, latest first.
+ * A tree modification (e.g. a split up to the root) is one operation, so
+ * it is either whole or gone after recovery.
+ *
+ * The transactions without a LOG_TXN_COMMIT or LOG_TXN_ABORT are losers.
+ * Their undo entries (LOG_UNDO) are handed back to be applied on the tree,
+ * as the pages they changed may have been changed by others since.
+ *
+ * Pages are recovered independently of each other, so they are split among
+ * RECOVERY_THREADS threads, each reading and writing a page once.
+ */
+
+#define RECOVERY_THREADS 4
+
+// For stats
+extern int64_t stat_redo_records;
+extern int64_t stat_undo_records;
+
+/* Recover the tables from the log, and get the undo entries of the loser
+ * transactions in log order.
+ * Called after the log and the buffer pool are initialized, before any
+ * page is buffered. Returns 0 on success.
+ */
+int recover_tables(std::vector<undo_entry> *losers);
+
+#endif  // DB_RECOVERY_H_
@@ -0,0 +1,84 @@
+#ifndef DB_TXN_H_
+#define DB_TXN_H_
+
+#include "key.h"
+
+#include <vector>
+
+/* Transactions.
+ *
+ * db_begin() starts a transaction on the calling thread, and the operations
+ * of the thread belong to it until db_commit() or db_abort(). Without one,
+ * every operation commits by itself.
+ *
+ * Every change of a transaction remembers its inverse on the key (an undo
+ * entry). The entries are kept for db_abort() and logged (LOG_UNDO) in the
+ * same operation as the change, so recovery undoes the transactions that
+ * did not end. The undo is logical, so it stays right when other
+ * transactions split or merge the same pages meanwhile.
+ *
+ * Overflow pages of deleted or replaced values are freed when the version
+ * holding them is purged (mvcc.h), so the undo can put the reference back.
+ *
+ * A transaction takes record locks (lock.h) on the records it writes. At
+ * TXN_SNAPSHOT it reads from its snapshot without locks, and fails to
+ * write a record committed by another after the snapshot. At
+ * TXN_SERIALIZABLE it reads the latest committed records, locking them and
+ * the key after a scanned range. Either way, an operation returns
+ * TXN_ROLLED_BACK after rolling back its transaction on a conflict.
+ */
+
+// Isolation levels
+#define TXN_SNAPSHOT 0
+#define TXN_SERIALIZABLE 1
+
+// Returned by an operation after rolling back its transaction
+#define TXN_ROLLED_BACK 4
+
+// Undo entry types
+#define UNDO_INSERT 1  // Delete the key
+#define UNDO_DELETE 2  // Insert the key with the value
+#define UNDO_UPDATE 3  // Replace the value of the key
+
+// Largest value an undo entry holds (a value in the leaf or a reference)
+#define MAX_UNDO_VALUE_SIZE 112
+
+typedef struct undo_entry {
+    uint64_t txn_id;
+    int64_t table_id;
+    int type;
+    tree_key_t key;
+    uint16_t val_size;                  // 0 for UNDO_INSERT
+    byte value[MAX_UNDO_VALUE_SIZE];    // The value as stored in the leaf
+} undo_entry;
+
+typedef struct txn_t {
+    uint64_t txn_id;
+    int isolation;
+    uint64_t snapshot_ts;  // The commits the transaction reads (mvcc.h)
+    std::vector<undo_entry> undo;
+    std::vector<struct lock_t*> locks;  // The locks granted (lock.h)
+} txn_t;
+
+// Get the transaction of the calling thread, NULL if none
+txn_t *txn_get_current();
+
+// Get a new transaction id
+uint64_t txn_new_id();
+
+// Start a transaction on the calling thread
+txn_t *txn_start(int isolation);
+
+// Forget the transaction of the calling thread
+void txn_finish();
+
+// Get the number of transactions not finished
+int txn_num_active();
+
+/* Remember how to undo a change of the current transaction, and log it.
+ * Called in the operation of the change.
+ */
+void txn_add_undo(txn_t *txn, int type, int64_t table_id,
+                  const tree_key_t *key, const byte *value, uint16_t val_size);
+
+#endif  // DB_TXN_H_
@@ -0,0 +1,50 @@
+#ifndef DB_VICTIM_CACHE_H_
+#define DB_VICTIM_CACHE_H_
+
+#include "page.h"
+
+#include <stddef.h>
+
+/* Compressed victim cache.
+ *
+ * A second tier behind the buffer pools: the clean pages evicted from the
+ * frames are kept compressed (compress.h) in memory, up to a budget of
+ * bytes, and a miss in a pool takes its page from here before reading it
+ * from the file. A page is either in a frame or here, never both, so the
+ * copy here is always the one on disk. The least recently evicted pages
+ * go first when the budget is full, and the pages that do not compress to
+ * VICTIM_CACHE_MAX_SIZE are not kept.
+ */
+
+#define VICTIM_CACHE_MAX_SIZE (PAGE_SIZE * 3 / 4)
+
+// For stat
+extern int64_t stat_victim_cache_hits;
+
+/* Set the budget of the cache in bytes (0 to turn it off), dropping the
+ * pages over it.
+ */
+void victim_cache_set_budget(size_t budget);
+
+// Whether the cache is on
+bool victim_cache_is_enabled();
+
+// Keep a clean page evicted from its frame
+void victim_cache_put(int64_t table_id, pagenum_t page_num,
+                      const page_t *page);
+
+/* Take a page out of the cache into dest.
+ * Returns 1 if it is not there.
+ */
+int victim_cache_take(int64_t table_id, pagenum_t page_num, page_t *dest);
+
+// Whether the page is in the cache
+bool victim_cache_contains(int64_t table_id, pagenum_t page_num);
+
+// Drop every page (the table ids are given out again)
+void victim_cache_clear();
+
+// Get the bytes the cache takes, and the number of pages in it
+size_t victim_cache_get_size(uint64_t *num_pages = NULL);
+
+#endif  // DB_VICTIM_CACHE_H_
@@ -1,52 +1,560 @@
 #include "buffer.h"
 #include "file.h"
+#include "internal_page.h"
+#include "io.h"
+#include "policy.h"
+#include "victim_cache.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
 
 // For stats
 int64_t stat_get_buffer;
 
-buffer_pool_t buffer_pool;
+// The default pool comes first
+buffer_pool_t buffer_pools[MAX_BUFFER_POOLS];
+int num_buffer_pools = 0;
+
+// The bindings of the tables, by their index in the table registry
+static std::vector<table_binding_t> table_bindings;
+
+static mapped_table_t *mapped_tables = NULL;
+static int num_mapped_tables = 0;
+
+/* The per-thread descriptor cache (see buffer_set_desc_cache()): the pages
+ * the thread got lately, direct-mapped by their ids. An entry holds while
+ * the frame has the same page (its descriptor has the same tag) and no
+ * frame was freed (the frame epoch is the same).
+ */
+typedef struct desc_cache_entry_t {
+    int64_t table_id;
+    pagenum_t page_num;
+    buf_descriptor_t *buf_desc;
+    uint32_t tag;
+    uint64_t epoch;
+} desc_cache_entry_t;
+
+static thread_local desc_cache_entry_t desc_cache[DESC_CACHE_SIZE];
+static bool desc_cache_enabled = false;
+static uint64_t frame_epoch = 1;
+int64_t stat_desc_cache_hits;
+
+static bool swizzling_enabled = false;
+int64_t stat_swizzled_hits;
+
+// Get the binding of a table, NULL if it was not opened through here
+static inline table_binding_t *get_binding(int64_t table_id) {
+    int index = file_get_table_index(table_id);
+
+    if (index < 0 || (size_t)index >= table_bindings.size())
+        return NULL;
+
+    return &table_bindings[index];
+}
+
+// Get the pool of a table with the binding
+#define get_pool(binding) \
+    ((binding) != NULL && (binding)->pool != NULL ? (binding)->pool : \
+                                                     &buffer_pools[0])
+
+// Get the pool caching the pages of a table
+static inline buffer_pool_t *get_table_pool(int64_t table_id) {
+    return get_pool(get_binding(table_id));
+}
+
+// Bytes of a page left unchanged between two changed ranges, up to which
+// the ranges are logged as one (a record header costs more than this)
+#define LOG_MERGE_GAP 32
+
+/* Write the pages to their files with one submission, with their checksums.
+ * The log records of the pages are written first (WAL-before-data).
+ * Returns 1, writing none and leaving them dirty, if the log cannot be
+ * flushed, or if a page cannot be written, which stays dirty. A dirty
+ * victim is not evicted then, so the files keep to what the log on disk
+ * has.
+ */
+int flush_buffers(buf_descriptor_t **buf_descs, int n) {
+    page_io ios[IO_QUEUE_DEPTH];
+    lsn_t max_lsn = 0;
+    int ret = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (buf_descs[i]->buf_page->page_lsn > max_lsn)
+            max_lsn = buf_descs[i]->buf_page->page_lsn;
+    }
+
+    if (n > 0 && buf_descs[0]->shadow_page != NULL && max_lsn != 0 &&
+        log_flush(max_lsn))
+        return 1;
+
+    for (int done = 0; done < n; done += IO_QUEUE_DEPTH) {
+        int count = n - done < IO_QUEUE_DEPTH ? n - done : IO_QUEUE_DEPTH;
+
+        for (int i = 0; i < count; i++) {
+            buf_descriptor_t *buf_desc = buf_descs[done + i];
+
+            file_set_page_checksum(buf_desc->table_id, buf_desc->page_num,
+                                   buf_desc->buf_page);
+
+            // The shadow is the same page, so it changes the same way.
+            if (buf_desc->shadow_page != NULL)
+                file_set_page_checksum(buf_desc->table_id, buf_desc->page_num,
+                                       buf_desc->shadow_page);
+
+            ios[i].table_id = buf_desc->table_id;
+            ios[i].pagenum = buf_desc->page_num;
+            ios[i].page = buf_desc->buf_page;
+        }
+
+        if (file_write_pages(ios, count))
+            ret = 1;
+
+        for (int i = 0; i < count; i++) {
+            if (ios[i].result == 0)
+                buf_descs[done + i]->is_dirty = false;
+        }
+    }
+
+    return ret;
+}
+
+// Get the mapped table of the id, NULL if it is not mapped
+mapped_table_t *find_mapped_table(int64_t table_id) {
+    for (int i = 0; i < num_mapped_tables; i++) {
+        if (mapped_tables[i].table_id == table_id)
+            return &mapped_tables[i];
+    }
+
+    return NULL;
+}
+
+// Serve the pages of a table opened with TABLE_OPEN_MMAP from its mapping
+void add_mapped_table(int64_t table_id) {
+    mapped_table_t *mapped;
+    uint64_t num_pages;
+    page_t *pages = file_get_mapping(table_id, &num_pages);
+
+    if (pages == NULL || find_mapped_table(table_id) != NULL)
+        return;
+
+    mapped = (mapped_table_t*)realloc(mapped_tables,
+        (num_mapped_tables + 1) * sizeof(mapped_table_t));
+    if (mapped == NULL)
+        return;
+
+    mapped_tables = mapped;
+    mapped = &mapped_tables[num_mapped_tables++];
+    mapped->table_id = table_id;
+    mapped->pages = pages;
+    mapped->num_pages = num_pages;
+    mapped->desc_chunks = (buf_descriptor_t**)calloc(
+        (num_pages + MAPPED_DESC_CHUNK - 1) / MAPPED_DESC_CHUNK,
+        sizeof(buf_descriptor_t*));
+}
+
+/* Get the buffer of a page of a mapped table, pointing into the mapping.
+ * The page is checked against its checksum on its first use.
+ * Return NULL if the page does not match its checksum.
+ */
+buf_descriptor_t *get_mapped_buffer(mapped_table_t *mapped,
+                                    pagenum_t page_num) {
+    buf_descriptor_t **chunk = &mapped->desc_chunks[page_num / MAPPED_DESC_CHUNK];
+    buf_descriptor_t *buf_desc;
+
+    if (*chunk == NULL) {
+        *chunk = (buf_descriptor_t*)calloc(MAPPED_DESC_CHUNK,
+                                           sizeof(buf_descriptor_t));
+        if (*chunk == NULL)
+            return NULL;
+    }
+
+    buf_desc = &(*chunk)[page_num % MAPPED_DESC_CHUNK];
+
+    if (buf_desc->buf_page == NULL) {
+        page_t *page = &mapped->pages[page_num];
+
+        if (page->page_checksum != 0 &&
+            page->page_checksum != compute_page_checksum(page)) {
+            stat_checksum_failures++;
+            return NULL;
+        }
+
+        buf_desc->table_id = mapped->table_id;
+        buf_desc->page_num = page_num;
+        buf_desc->buf_page = page;
+    }
+
+    buf_desc->pin_count++;
+
+    return buf_desc;
+}
+
+// Forget the mapped tables (the file manager unmaps them)
+void close_mapped_tables() {
+    for (int i = 0; i < num_mapped_tables; i++) {
+        mapped_table_t *mapped = &mapped_tables[i];
+        uint64_t num_chunks =
+            (mapped->num_pages + MAPPED_DESC_CHUNK - 1) / MAPPED_DESC_CHUNK;
+
+        for (uint64_t j = 0; j < num_chunks; j++)
+            free(mapped->desc_chunks[j]);
+        free(mapped->desc_chunks);
+    }
+
+    free(mapped_tables);
+    mapped_tables = NULL;
+    num_mapped_tables = 0;
+}
+
+uint64_t buffer_get_table_flags(int64_t table_id) {
+    return file_get_table_flags(table_id);
+}
+
+/* Log the bytes of the page changed since it was last logged.
+ *
+ * The page is compared with its shadow copy, and every changed range (with
+ * small unchanged gaps merged in) becomes one LOG_UPDATE with the bytes before
+ * and after. The page LSN is set to the last record.
+ *
+ * The first change after a checkpoint logs the whole page first, which
+ * recovery starts from instead of the page on disk that may be torn.
+ */
+void log_buffer_changes(buf_descriptor_t *buf_desc) {
+    byte *page = (byte*)buf_desc->buf_page;
+    byte *shadow = (byte*)buf_desc->shadow_page;
+    lsn_t lsn = 0;
+    uint32_t i = 0;
+    bool logged_image = buf_desc->shadow_page->page_lsn >= log_get_base_lsn();
+
+    while (i < PAGE_SIZE) {
+        // Skip the unchanged words.
+        while (i < PAGE_SIZE && !memcmp(page + i, shadow + i, sizeof(uint64_t)))
+            i += sizeof(uint64_t);
+
+        if (i == PAGE_SIZE)
+            break;
+
+        // Extend the range until a gap of LOG_MERGE_GAP unchanged bytes.
+        uint32_t begin = i;
+        uint32_t end = i + sizeof(uint64_t);
+
+        if (!logged_image) {
+            log_page_image(buf_desc->table_id, buf_desc->page_num, shadow);
+            logged_image = true;
+        }
 
-void inline flush_buffer(buf_descriptor_t *buf_desc) {
-    file_write_page(buf_desc->table_id, buf_desc->page_num, buf_desc->buf_page);
+        for (i = end; i < PAGE_SIZE && i < end + LOG_MERGE_GAP;
+             i += sizeof(uint64_t)) {
+            if (memcmp(page + i, shadow + i, sizeof(uint64_t)))
+                end = i + sizeof(uint64_t);
+        }
+
+        lsn = log_page_update(buf_desc->table_id, buf_desc->page_num, begin,
+                              end - begin, shadow + begin, page + begin);
+        memcpy(shadow + begin, page + begin, end - begin);
+        i = end;
+    }
+
+    if (lsn != 0) {
+        buf_desc->buf_page->page_lsn = lsn;
+        buf_desc->shadow_page->page_lsn = lsn;
+    }
 }
 
-int64_t buffer_open_table(const char *pathname) {
-    return file_open_table_file(pathname);
+// Drop the reference of its parent to a swizzled child
+static inline void unswizzle_child(buf_descriptor_t *child) {
+    if (child->swizzled_parent != NULL) {
+        child->swizzled_parent->swizzled[child->swizzled_index] = NULL;
+        child->swizzled_parent = NULL;
+    }
 }
 
-void inline mark_buffer_dirty(buf_descriptor_t *buf_desc) {
-//  TODO -----------------------------------------------------------------------
-    flush_buffer(buf_desc);
-//  ----------------------------------------------------------------------------
+// Drop the references of an internal page to its swizzled children
+static void unswizzle_children(buf_descriptor_t *buf_desc) {
+    if (buf_desc->swizzled == NULL)
+        return;
+
+    for (int i = 0; i <= MAX_INTERNAL_PAIRS; i++) {
+        if (buf_desc->swizzled[i] != NULL)
+            buf_desc->swizzled[i]->swizzled_parent = NULL;
+    }
+
+    free(buf_desc->swizzled);
+    buf_desc->swizzled = NULL;
+}
+
+void mark_buffer_dirty(buf_descriptor_t *buf_desc) {
+    if (buf_desc->shadow_page != NULL)
+        log_buffer_changes(buf_desc);
+
+    // The children may have moved.
+    unswizzle_children(buf_desc);
+
+    buf_desc->is_dirty = true;
 }
 
 void inline pin_buffer(buf_descriptor_t *buf_desc) {
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    buf_desc->pin_count++;
+}
+
+/* Count a use of a buffer as the access hint tells. The policy is told of
+ * the uses of the pages already there (is_hit) only: a page read in counts
+ * its first use when it is inserted.
+ */
+static inline void count_access(buffer_pool_t *pool,
+                                buf_descriptor_t *buf_desc, int hint,
+                                bool is_hit) {
+    if (hint == BUFFER_ACCESS_POINT) {
+        if (buf_desc->usage_count < MAX_USAGE_COUNT)
+            buf_desc->usage_count++;
+    } else if (hint == BUFFER_ACCESS_INTERNAL) {
+        buf_desc->usage_count = MAX_USAGE_COUNT;
+    } else {
+        return;
+    }
+
+    if (is_hit)
+        pool->policy->access(pool, buf_desc);
 }
 
-void inline unpin_buffer(buf_descriptor_t *buf_desc) {
-//  TODO -----------------------------------------------------------------------
-    free(buf_desc->buf_page);
-    free(buf_desc);
-//  ----------------------------------------------------------------------------
+void unpin_buffer(buf_descriptor_t *buf_desc) {
+    buf_desc->pin_count--;
 }
 
 /**
  * @brief Initialize the hashtable of the buffer pool.
  * 
+ * @param pool The buffer pool
  * @param num_ht_entries The number of hashtable entries
  * 
  * @details Initialize the hashtable using num_ht_entries. 
  */
-void init_hashtable(uint32_t num_ht_entries) {
+int init_hashtable(buffer_pool_t *pool, uint32_t num_ht_entries) {
+    if (num_ht_entries == 0)
+        num_ht_entries = 1;
+
+    memset(&pool->hashtable, 0, sizeof(hashtable_t));
+    pool->hashtable.ht_entries =
+        (ht_entry_t*)calloc(num_ht_entries, sizeof(ht_entry_t));
+    if (pool->hashtable.ht_entries == NULL)
+        return 1;
+
+    pool->hashtable.num_ht_entries = num_ht_entries;
+    return 0;
+}
+
+// The frame flags of the pools created next
+static uint32_t frame_flags = 0;
+
+// Put a free buffer on the free list of the node of its frame
+static inline void push_free_buffer(buffer_pool_t *pool,
+                                    buf_descriptor_t *buf_desc) {
+    buf_descriptor_t **free_list = &pool->free_lists[buf_desc->numa_node];
+
+    buf_desc->next = *free_list;
+    *free_list = buf_desc;
+}
+
+/* Take a free buffer, from the node of the calling thread if it has one.
+ * Returns NULL if every free list is empty.
+ */
+static inline buf_descriptor_t *pop_free_buffer(buffer_pool_t *pool) {
+    int node = pool->num_nodes > 1 ? numa_current_node() : 0;
 
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    for (int i = 0; i < pool->num_nodes; i++) {
+        buf_descriptor_t **free_list =
+            &pool->free_lists[(node + i) % pool->num_nodes];
 
-    buffer_pool.hashtable.num_ht_entries = num_ht_entries;
+        if (*free_list != NULL) {
+            buf_descriptor_t *buf_desc = *free_list;
+            *free_list = buf_desc->next;
+            return buf_desc;
+        }
+    }
+
+    return NULL;
+}
+
+/* Allocate the pages of num_buf frames, zero-filled and aligned for the
+ * tables opened with O_DIRECT. With frame flags they are mapped, in huge
+ * pages if there are enough reserved or else advised to become transparent
+ * huge pages, and placed on the node before they are touched. map_size is
+ * set to the size of the mapping, or 0 if the pages are allocated.
+ */
+static page_t *alloc_frame_pages(uint32_t num_buf, uint32_t flags, int node,
+                                 size_t *map_size) {
+    size_t size = (size_t)num_buf * PAGE_SIZE;
+    void *pages = MAP_FAILED;
+
+    *map_size = 0;
+
+    if (flags == 0) {
+        if (posix_memalign(&pages, PAGE_ALIGNMENT, size) != 0)
+            return NULL;
+        memset(pages, 0, size);
+        return (page_t*)pages;
+    }
+
+    if (flags & FRAME_HUGE_PAGES) {
+        size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        pages = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+
+    if (pages == MAP_FAILED) {
+        pages = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pages == MAP_FAILED)
+            return NULL;
+
+        // Without THP (or with it off), the pages stay small.
+        if (flags & FRAME_HUGE_PAGES)
+            madvise(pages, size, MADV_HUGEPAGE);
+    }
+
+    // A node the memory cannot be bound to gets it from wherever it comes.
+    if (node >= 0)
+        numa_place_memory(pages, size, node);
+
+    *map_size = size;
+    return (page_t*)pages;
+}
+
+// Free the frames of a chunk
+static void free_frame_chunk(frame_chunk_t *chunk) {
+    frame_epoch++;
+    for (uint32_t i = 0; chunk->buf_descs != NULL && i < chunk->num_buf; i++)
+        free(chunk->buf_descs[i].swizzled);
+    free(chunk->buf_descs);
+    if (chunk->map_size != 0)
+        munmap(chunk->buf_pages, chunk->map_size);
+    else
+        free(chunk->buf_pages);
+    free(chunk->shadow_pages);
+}
+
+// Free the frames and the hashtable of a pool
+void free_pool(buffer_pool_t *pool) {
+    if (pool->policy != NULL)
+        pool->policy->destroy(pool);
+
+    for (int i = 0; i < pool->num_chunks; i++)
+        free_frame_chunk(&pool->chunks[i]);
+
+    free(pool->chunks);
+    free(pool->frames);
+    free(pool->hashtable.ht_entries);
+    free(pool->hashtable.old_entries);
+    memset(pool, 0, sizeof(buffer_pool_t));
+}
+
+/* Add a chunk of num_buf frames to the pool, after the frames in use, and
+ * put them on the free list of the node (-1 for no placement).
+ */
+int add_frame_chunk(buffer_pool_t *pool, uint32_t num_buf, int node) {
+    frame_chunk_t chunk;
+    buf_descriptor_t *buf;
+
+    chunk.num_buf = num_buf;
+    chunk.first = pool->num_buf;
+    chunk.numa_node = node;
+    chunk.buf_descs =
+        (buf_descriptor_t*)calloc(num_buf, sizeof(buf_descriptor_t));
+    chunk.buf_pages =
+        alloc_frame_pages(num_buf, pool->frame_flags, node, &chunk.map_size);
+
+    // Huge pages or a node the system cannot give are done without.
+    if (chunk.buf_pages == NULL && pool->frame_flags != 0)
+        chunk.buf_pages = alloc_frame_pages(num_buf, 0, -1, &chunk.map_size);
+
+    // Changes are logged by comparing pages with their shadow copies.
+    chunk.shadow_pages =
+        log_is_enabled() ? (page_t*)calloc(num_buf, PAGE_SIZE) : NULL;
+
+    frame_chunk_t *chunks = (frame_chunk_t*)realloc(pool->chunks,
+        (pool->num_chunks + 1) * sizeof(frame_chunk_t));
+    if (chunks != NULL)
+        pool->chunks = chunks;
+
+    buf_descriptor_t **frames = (buf_descriptor_t**)realloc(pool->frames,
+        (size_t)(pool->num_buf + num_buf) * sizeof(buf_descriptor_t*));
+    if (frames != NULL)
+        pool->frames = frames;
+
+    if (chunk.buf_descs == NULL || chunk.buf_pages == NULL ||
+        (log_is_enabled() && chunk.shadow_pages == NULL) ||
+        chunks == NULL || frames == NULL) {
+        free_frame_chunk(&chunk);
+        return 1;
+    }
+
+    for (uint32_t i = num_buf; i-- > 0;) {
+        buf = &chunk.buf_descs[i];
+        buf->table_id = -1;
+        buf->page_num = -1;
+        buf->buf_page = &chunk.buf_pages[i];
+        buf->shadow_page = chunk.shadow_pages != NULL ?
+            &chunk.shadow_pages[i] : NULL;
+        buf->numa_node = node > 0 ? node : 0;
+        push_free_buffer(pool, buf);
+        pool->frames[pool->num_buf + i] = buf;
+    }
+
+    pool->chunks[pool->num_chunks++] = chunk;
+    pool->num_buf += num_buf;
+    return 0;
+}
+
+/* Add num_buf frames to the pool, split evenly among its nodes.
+ * Returns 1 if a chunk cannot be allocated, with the ones before it kept.
+ */
+int add_frames(buffer_pool_t *pool, uint32_t num_buf) {
+    if (pool->num_nodes == 1)
+        return add_frame_chunk(pool, num_buf, -1);
+
+    for (int node = 0; node < pool->num_nodes; node++) {
+        uint32_t n = num_buf / pool->num_nodes +
+            (node < (int)(num_buf % pool->num_nodes) ? 1 : 0);
+
+        if (n > 0 && add_frame_chunk(pool, n, node))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Allocate the frames and the hashtable of a pool, and put every buffer on
+ * the free list.
+ */
+int init_pool(buffer_pool_t *pool, const char *name, uint32_t num_ht_entries,
+              uint32_t num_buf, int policy) {
+    memset(pool, 0, sizeof(buffer_pool_t));
+    if (get_replacement_policy(policy) == NULL)
+        return 1;
+    strncpy(pool->name, name, BUFFER_POOL_NAME_SIZE - 1);
+    pool->frame_flags = frame_flags;
+    pool->num_nodes = (frame_flags & FRAME_NUMA) ? numa_count_nodes() : 1;
+
+    if (init_hashtable(pool, num_ht_entries))
+        return 1;
+
+    if (add_frames(pool, num_buf)) {
+        free_pool(pool);
+        return 1;
+    }
+
+    pool->clock_hand = 0;
+
+    if (get_replacement_policy(policy)->init(pool)) {
+        free_pool(pool);
+        return 1;
+    }
+    pool->policy = get_replacement_policy(policy);
+
+    return 0;
 }
 
 /**
@@ -59,63 +567,174 @@ void init_hashtable(uint32_t num_ht_entries) {
  * 
  * @details The num_buf must be greater or equal than 4 
  * (The splitting, deleting operation pins 3 page at once) + (header page)
+ * This sets up the default pool, which the tables are bound to unless they
+ * are opened with another, with the replacement policy.
  */
-int init_buffer_pool(uint32_t num_ht_entries, uint32_t num_buf) {
-    buf_descriptor_t *buf;
-
+int init_buffer_pool(uint32_t num_ht_entries, uint32_t num_buf, int policy) {
     if (num_buf < 4)
         return 1;
 
     if (init_tables())
         return 1;
 
-    init_hashtable(num_ht_entries);
+    table_bindings.clear();
+    num_buffer_pools = 0;
+    victim_cache_clear();
+
+    if (init_pool(&buffer_pools[0], DEFAULT_BUFFER_POOL, num_ht_entries,
+                  num_buf, policy))
+        return 1;
 
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    num_buffer_pools = 1;
+    mapped_tables = NULL;
+    num_mapped_tables = 0;
 
-    buffer_pool.num_buf = num_buf;
+    // The frames are where the pages are read into and written from.
+    io_set_buffers(buffer_pools[0].chunks[0].buf_pages,
+                   (size_t)buffer_pools[0].chunks[0].num_buf * PAGE_SIZE);
 
     init_buffer_stat();
 
     return 0;
 }
 
+/* Set the frame flags (FRAME_HUGE_PAGES, FRAME_NUMA) of the pools created
+ * from now on, including the default pool of the next init_buffer_pool().
+ */
+void buffer_set_frame_flags(uint32_t flags) {
+    frame_flags = flags;
+}
+
+// Get the pool of the name, NULL if there is none
+buffer_pool_t *find_pool(const char *name) {
+    for (int i = 0; i < num_buffer_pools; i++) {
+        if (!strcmp(buffer_pools[i].name, name))
+            return &buffer_pools[i];
+    }
+
+    return NULL;
+}
+
+/* Create a buffer pool with the name and the replacement policy, after
+ * init_buffer_pool().
+ * Returns 1 if the name is taken, there are MAX_BUFFER_POOLS already, there
+ * is no such policy, or the pool cannot be allocated.
+ */
+int buffer_create_pool(const char *name, uint32_t num_ht_entries,
+                       uint32_t num_buf, int policy) {
+    // A name is one word, to be read back from a dump.
+    if (num_buffer_pools == 0 || num_buffer_pools == MAX_BUFFER_POOLS ||
+        num_buf < 4 || name[0] == '\0' ||
+        name[strcspn(name, " \t\n\v\f\r")] != '\0' ||
+        strlen(name) >= BUFFER_POOL_NAME_SIZE || find_pool(name) != NULL)
+        return 1;
+
+    if (init_pool(&buffer_pools[num_buffer_pools], name, num_ht_entries,
+                  num_buf, policy))
+        return 1;
+
+    num_buffer_pools++;
+    return 0;
+}
+
 // macros for hashtable
-//  TODO -----------------------------------------------------------------------
+#define hash(table_id, page_num, num_entries) \
+    ((((uint64_t)table_id) * 100000 + page_num)%(num_entries))
+#define get_ht_entry(pool, table_id, page_num) \
+    (&((pool)->hashtable.ht_entries[ \
+        hash(table_id, page_num, (pool)->hashtable.num_ht_entries)]))
+
+// Get the old entry of the page if its chain is not moved yet, NULL if not
+static inline ht_entry_t *get_old_ht_entry(buffer_pool_t *pool,
+                                           int64_t table_id,
+                                           pagenum_t page_num) {
+    hashtable_t *hashtable = &pool->hashtable;
+
+    if (hashtable->old_entries == NULL)
+        return NULL;
+
+    uint32_t index = hash(table_id, page_num, hashtable->num_old_entries);
+
+    return index >= hashtable->num_moved ? &hashtable->old_entries[index] : NULL;
+}
 
 /**
- * @brief 
- * If necessary, modify these functions or implement an additional functions
- * of your own.
+ * @brief Move the chains of the next REHASH_STEP old entries to the new
+ * ones, while the hashtable grows.
  */
+void hashtable_rehash_step(buffer_pool_t *pool) {
+    hashtable_t *hashtable = &pool->hashtable;
+
+    for (int i = 0; i < REHASH_STEP &&
+                    hashtable->num_moved < hashtable->num_old_entries; i++) {
+        buf_descriptor_t *buf_desc =
+            hashtable->old_entries[hashtable->num_moved++].buf_desc;
 
-#define hash(table_id, page_num) \
-    ((((uint64_t)table_id) * 100000 + page_num)%(buffer_pool.hashtable.num_ht_entries))
-#define get_ht_entry(table_id, page_num) \
-    (&(buffer_pool.hashtable.ht_entries[hash(table_id, page_num)]))
+        while (buf_desc != NULL) {
+            buf_descriptor_t *next = buf_desc->next;
+            ht_entry_t *ht_entry = get_ht_entry(pool, buf_desc->table_id,
+                                                buf_desc->page_num);
 
-//  or
-//
-//  ht_entry_t *get_ht_entry(int64_t table_id, pagenum_t page_num) {
-//      ...
-//  }
+            buf_desc->next = ht_entry->buf_desc;
+            ht_entry->buf_desc = buf_desc;
+            buf_desc = next;
+        }
+    }
 
-//  ----------------------------------------------------------------------------
+    if (hashtable->num_moved == hashtable->num_old_entries) {
+        free(hashtable->old_entries);
+        hashtable->old_entries = NULL;
+        hashtable->num_old_entries = 0;
+        hashtable->num_moved = 0;
+    }
+}
+
+/**
+ * @brief Grow the hashtable to num_ht_entries. The chains are moved over
+ * by hashtable_rehash_step() later.
+ */
+int hashtable_grow(buffer_pool_t *pool, uint32_t num_ht_entries) {
+    hashtable_t *hashtable = &pool->hashtable;
+
+    // Finish the last growth first.
+    while (hashtable->old_entries != NULL)
+        hashtable_rehash_step(pool);
+
+    ht_entry_t *ht_entries =
+        (ht_entry_t*)calloc(num_ht_entries, sizeof(ht_entry_t));
+    if (ht_entries == NULL)
+        return 1;
+
+    hashtable->old_entries = hashtable->ht_entries;
+    hashtable->num_old_entries = hashtable->num_ht_entries;
+    hashtable->num_moved = 0;
+    hashtable->ht_entries = ht_entries;
+    hashtable->num_ht_entries = num_ht_entries;
+    return 0;
+}
 
 /**
  * @brief Look up the buffer(page) in hashtable.
  * 
  * @return The memory address of the found buffer descriptor.
  */
-inline buf_descriptor_t *hashtable_lookup(int64_t table_id, pagenum_t page_num) {
-    ht_entry_t *ht_entry;
-    buf_descriptor_t *buf_desc;
+inline buf_descriptor_t *hashtable_lookup(buffer_pool_t *pool, int64_t table_id,
+                                          pagenum_t page_num) {
+    ht_entry_t *ht_entry = get_ht_entry(pool, table_id, page_num);
+    buf_descriptor_t *buf_desc = ht_entry->buf_desc;
+
+    while (buf_desc != NULL &&
+           (buf_desc->table_id != table_id || buf_desc->page_num != page_num))
+        buf_desc = buf_desc->next;
 
-//  TODO -----------------------------------------------------------------------
-    buf_desc = NULL;
-//  ----------------------------------------------------------------------------
+    if (buf_desc == NULL &&
+        (ht_entry = get_old_ht_entry(pool, table_id, page_num)) != NULL) {
+        buf_desc = ht_entry->buf_desc;
+
+        while (buf_desc != NULL &&
+               (buf_desc->table_id != table_id || buf_desc->page_num != page_num))
+            buf_desc = buf_desc->next;
+    }
 
     return buf_desc;
 }
@@ -124,26 +743,136 @@ inline buf_descriptor_t *hashtable_lookup(int64_t table_id, pagenum_t page_num)
  * @brief Insert a new buffer(page) into the hashtable.
  * 
  * @details Assume this page is not in the hashtable.
+ * The buffer is counted in the frames of its table, and handed to the
+ * replacement policy, placed to go first if it is cold.
  */
-inline void hashtable_insert(buf_descriptor_t *buf_desc) {
-    ht_entry_t *ht_entry;
+inline void hashtable_insert(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                             bool cold = false) {
+    ht_entry_t *ht_entry = get_ht_entry(pool, buf_desc->table_id,
+                                        buf_desc->page_num);
+    table_binding_t *binding = get_binding(buf_desc->table_id);
+
+    buf_desc->next = ht_entry->buf_desc;
+    ht_entry->buf_desc = buf_desc;
+    buf_desc->tag++;
+
+    if (binding != NULL)
+        binding->num_buf++;
 
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    pool->policy->insert(pool, buf_desc, cold);
 }
 
 /**
  * @brief Delete the buffer(page) from the hashtable.
  * 
- * @details Assume this page is in the hashtable.
+ * @details Assume this page is in the hashtable. evicted tells the policy
+ * whether the page made room for another, or is dropped (with its table or
+ * its frame) and is not to be remembered.
  */
-inline void hashtable_delete(buf_descriptor_t *buf_desc) {
-    ht_entry_t *ht_entry;
+inline void hashtable_delete(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                             bool evicted) {
+    ht_entry_t *ht_entry = get_old_ht_entry(pool, buf_desc->table_id,
+                                            buf_desc->page_num);
+    buf_descriptor_t **link;
+    table_binding_t *binding = get_binding(buf_desc->table_id);
+
+    // A chain not moved yet may have it.
+    if (ht_entry != NULL) {
+        link = &ht_entry->buf_desc;
+        while (*link != NULL && *link != buf_desc)
+            link = &(*link)->next;
+    }
+
+    if (ht_entry == NULL || *link == NULL) {
+        link = &get_ht_entry(pool, buf_desc->table_id,
+                             buf_desc->page_num)->buf_desc;
+        while (*link != buf_desc)
+            link = &(*link)->next;
+    }
 
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    *link = buf_desc->next;
+    buf_desc->next = NULL;
+    buf_desc->tag++;
+    unswizzle_child(buf_desc);
+    unswizzle_children(buf_desc);
+
+    if (binding != NULL)
+        binding->num_buf--;
+
+    pool->policy->remove(pool, buf_desc, evicted);
+}
+
+// Whether a dirty buffer may be written back now (not in use)
+#define is_flushable(buf_desc) \
+    ((buf_desc) != NULL && (buf_desc)->is_dirty && (buf_desc)->pin_count == 0)
+
+/* Write back the dirty victim in one batch with
+ * - its neighbors on disk that are dirty too, which the file manager
+ *   writes with it in one vectored write, and
+ * - the dirty buffers the clock hand reaches next and would evict (unused
+ *   since the last sweep), so that the following evictions find them clean.
+ */
+void flush_victim(buffer_pool_t *pool, buf_descriptor_t *victim) {
+    buf_descriptor_t *batch[EVICT_BATCH];
+    buf_descriptor_t *buf_desc;
+    int n = 0;
+
+    batch[n++] = victim;
+
+    for (pagenum_t i = 1; i <= EVICT_NEIGHBORS && i <= victim->page_num &&
+                          n < EVICT_BATCH; i++) {
+        buf_desc = hashtable_lookup(pool, victim->table_id, victim->page_num - i);
+        if (!is_flushable(buf_desc))
+            break;
+        batch[n++] = buf_desc;
+    }
+
+    for (pagenum_t i = 1; i <= EVICT_NEIGHBORS && n < EVICT_BATCH; i++) {
+        buf_desc = hashtable_lookup(pool, victim->table_id, victim->page_num + i);
+        if (!is_flushable(buf_desc))
+            break;
+        batch[n++] = buf_desc;
+    }
+
+    int num_neighbors = n;
+
+    for (uint32_t i = 0; i < EVICT_LOOKAHEAD && i < pool->num_buf &&
+                         n < EVICT_BATCH; i++) {
+        buf_desc = pool->frames[(pool->clock_hand + i) % pool->num_buf];
+
+        if (!is_flushable(buf_desc) || buf_desc->usage_count != 0 ||
+            std::find(batch, batch + num_neighbors, buf_desc) !=
+                batch + num_neighbors)
+            continue;
+
+        batch[n++] = buf_desc;
+    }
+
+    flush_buffers(batch, n);
+}
+
+/* Whether the buffer may be taken for the page of the filter: it is not
+ * pinned, and
+ * - a table at its max_buf replaces its own pages only, and
+ * - the pages of a table within its min_buf are left to it.
+ */
+bool buffer_is_replaceable(const buf_descriptor_t *buf_desc,
+                           const victim_filter_t *filter) {
+    if (buf_desc->pin_count > 0)
+        return false;
+
+    if (buf_desc->table_id == filter->table_id)
+        return true;
+
+    if (filter->at_max)
+        return false;
+
+    if (buf_desc->table_id == -1)
+        return true;
+
+    const table_binding_t *owner = get_binding(buf_desc->table_id);
+
+    return owner == NULL || owner->num_buf > owner->min_buf;
 }
 
 /**
@@ -152,27 +881,104 @@ inline void hashtable_delete(buf_descriptor_t *buf_desc) {
  * @return The memory address of the victim buffer.
  * 
  * @details
- * This function selects a victim buffer for eviction, following the buffer
- * replacement policy. (clock sweep algorithm in this code)
+ * This function selects a victim buffer in the pool for a page of the table,
+ * following the replacement policy of the pool (see policy.h).
  * 
  * This first checks if there is an unused buffer in the buffer pool's freelist
- * and returns it if there is. Otherwise, selects and returns an appropriate
- * victim buffer according to the replacement policy.
+ * and returns it if there is. Otherwise, the policy selects a victim among
+ * the buffers buffer_is_replaceable() lets go.
  * 
  * Return NULL if all buffers in the buffer pool are pinned.
  */
-buf_descriptor_t *get_victim_buffer() {
+buf_descriptor_t *get_victim_buffer(buffer_pool_t *pool, int64_t table_id,
+                                    pagenum_t page_num) {
     buf_descriptor_t *buf_desc;
+    victim_filter_t filter;
+
+    filter.table_id = table_id;
+    filter.page_num = page_num;
+    filter.binding = get_binding(table_id);
+    filter.at_max = filter.binding != NULL && filter.binding->max_buf != 0 &&
+                    filter.binding->num_buf >= filter.binding->max_buf;
+
+    if (!filter.at_max && (buf_desc = pop_free_buffer(pool)) != NULL) {
+        buf_desc->next = NULL;
+        return buf_desc;
+    }
+
+    return pool->policy->get_victim(pool, &filter);
+}
+
+// Get the entry of a page in the descriptor cache of the thread
+static inline desc_cache_entry_t *get_desc_cache_entry(int64_t table_id,
+                                                       pagenum_t page_num) {
+    return &desc_cache[(page_num + (uint64_t)table_id * 31) %
+                       DESC_CACHE_SIZE];
+}
+
+// Remember the buffer of a page in the descriptor cache of the thread
+static inline void remember_buffer(buf_descriptor_t *buf_desc) {
+    desc_cache_entry_t *entry =
+        get_desc_cache_entry(buf_desc->table_id, buf_desc->page_num);
+
+    entry->table_id = buf_desc->table_id;
+    entry->page_num = buf_desc->page_num;
+    entry->buf_desc = buf_desc;
+    entry->tag = buf_desc->tag;
+    entry->epoch = frame_epoch;
+}
+
+// Turn the per-thread descriptor cache on or off
+void buffer_set_desc_cache(bool enable) {
+    desc_cache_enabled = enable;
+    frame_epoch++;
+}
+
+// Turn pointer swizzling on or off
+void buffer_set_swizzling(bool enable) {
+    swizzling_enabled = enable;
+}
+
+/* Get the buffer of the child at the index of a pinned internal page, whose
+ * page number is page_num.
+ */
+buf_descriptor_t *buffer_get_child(buf_descriptor_t *parent, int index,
+                                   pagenum_t page_num, int hint) {
+    buf_descriptor_t *child = parent->swizzled != NULL ?
+        parent->swizzled[index + 1] : NULL;
+
+    if (child != NULL) {
+        if (swizzling_enabled && child->page_num == page_num) {
+            stat_get_buffer++;
+            stat_swizzled_hits++;
+            pin_buffer(child);
+            count_access(get_table_pool(child->table_id), child, hint, true);
+            return child;
+        }
+
+        unswizzle_child(child);
+    }
+
+    child = get_buffer(parent->table_id, page_num, hint);
 
-//  TODO -----------------------------------------------------------------------
-    buf_desc = (buf_descriptor_t*)malloc(sizeof(buf_descriptor_t));
-    buf_desc->buf_page = (page_t*)malloc(PAGE_SIZE);
+    // The pages of a mapped table are not in frames.
+    if (!swizzling_enabled || child == NULL ||
+        (num_mapped_tables > 0 && find_mapped_table(parent->table_id) != NULL))
+        return child;
 
-    if (buf_desc != NULL)
-        return buf_desc;
-//  ----------------------------------------------------------------------------
+    if (parent->swizzled == NULL) {
+        parent->swizzled = (buf_descriptor_t**)calloc(MAX_INTERNAL_PAIRS + 1,
+            sizeof(buf_descriptor_t*));
+        if (parent->swizzled == NULL)
+            return child;
+    }
 
-    return NULL;
+    unswizzle_child(child);
+    parent->swizzled[index + 1] = child;
+    child->swizzled_parent = parent;
+    child->swizzled_index = index + 1;
+
+    return child;
 }
 
 /**
@@ -189,7 +995,7 @@ buf_descriptor_t *get_victim_buffer() {
  * 
  * 1. Get a new buffer by calling get_victim_buffer().
  * 
- * 2. Flush the buffer by calling flush_buffer() if the buffer is dirty.
+ * 2. Flush the buffer by calling flush_victim() if the buffer is dirty.
  * 
  * 3. Delete the buffer from the hashtable if necessary.
  * 
@@ -201,26 +1007,255 @@ buf_descriptor_t *get_victim_buffer() {
  * During this process, the usage count must not exceed MAX_USAGE_COUNT, and
  * buf_desc must increment the reference count by calling pin_buffer() before
  * being returned.
+ *
+ * The use is counted as the access hint (BUFFER_ACCESS_*) tells: a scan or
+ * maintenance does not promote the page, and a page read in for them is
+ * placed to go first.
+ *
+ * Return NULL if all buffers are pinned, the dirty victim cannot be written
+ * back (it stays), or the page cannot be read whole or does not match its
+ * checksum.
  */
-buf_descriptor_t *get_buffer(int64_t table_id, pagenum_t page_num) {
+buf_descriptor_t *get_buffer(int64_t table_id, pagenum_t page_num, int hint) {
     buf_descriptor_t *buf_desc;
+    buffer_pool_t *pool;
 
     stat_get_buffer++;
 
-//  TODO -----------------------------------------------------------------------
-    buf_desc = get_victim_buffer();
-    pin_buffer(buf_desc);
+    // The pages of a mapped table are read in place.
+    if (num_mapped_tables > 0) {
+        mapped_table_t *mapped = find_mapped_table(table_id);
+
+        if (mapped != NULL && page_num < mapped->num_pages)
+            return get_mapped_buffer(mapped, page_num);
+    }
+
+    pool = get_table_pool(table_id);
+
+    if (desc_cache_enabled) {
+        desc_cache_entry_t *entry = get_desc_cache_entry(table_id, page_num);
+
+        if (entry->epoch == frame_epoch && entry->table_id == table_id &&
+            entry->page_num == page_num &&
+            entry->buf_desc->tag == entry->tag) {
+            stat_desc_cache_hits++;
+            pin_buffer(entry->buf_desc);
+            count_access(pool, entry->buf_desc, hint, true);
+            return entry->buf_desc;
+        }
+    }
+
+    if (pool->hashtable.old_entries != NULL)
+        hashtable_rehash_step(pool);
+
+    buf_desc = hashtable_lookup(pool, table_id, page_num);
+
+    if (buf_desc != NULL) {
+        pin_buffer(buf_desc);
+        count_access(pool, buf_desc, hint, true);
+        if (desc_cache_enabled)
+            remember_buffer(buf_desc);
+        return buf_desc;
+    }
+
+    buf_desc = get_victim_buffer(pool, table_id, page_num);
+    if (buf_desc == NULL)
+        return NULL;
+
+    if (buf_desc->is_dirty)
+        flush_victim(pool, buf_desc);
+
+    if (buf_desc->is_dirty)
+        return NULL;
+
+    // The page evicted is clean now, and goes to the victim cache.
+    if (buf_desc->table_id != -1) {
+        victim_cache_put(buf_desc->table_id, buf_desc->page_num,
+                         buf_desc->buf_page);
+        hashtable_delete(pool, buf_desc, true);
+    }
 
     buf_desc->table_id = table_id;
     buf_desc->page_num = page_num;
-    file_read_page(table_id, page_num, buf_desc->buf_page);
-//  ----------------------------------------------------------------------------
+    buf_desc->usage_count = 0;
+    // Give the buffer back if the page is torn.
+    if (victim_cache_take(table_id, page_num, buf_desc->buf_page) &&
+        file_read_page(table_id, page_num, buf_desc->buf_page)) {
+        buf_desc->table_id = -1;
+        buf_desc->page_num = -1;
+        push_free_buffer(pool, buf_desc);
+        return NULL;
+    }
+
+    if (buf_desc->shadow_page != NULL)
+        memcpy(buf_desc->shadow_page, buf_desc->buf_page, PAGE_SIZE);
+
+    hashtable_insert(pool, buf_desc, hint == BUFFER_ACCESS_SCAN ||
+                                     hint == BUFFER_ACCESS_MAINTENANCE);
+    pin_buffer(buf_desc);
+    count_access(pool, buf_desc, hint, false);
+    if (desc_cache_enabled)
+        remember_buffer(buf_desc);
+
+    return buf_desc;
+}
+
+/* Count one more use of a pinned buffer as the access hint tells, for a
+ * page whose kind is known only once it is read.
+ */
+void buffer_count_access(buf_descriptor_t *buf_desc, int hint) {
+    // The pages of mapped tables are not in a pool.
+    if (num_mapped_tables > 0 && find_mapped_table(buf_desc->table_id))
+        return;
+
+    count_access(get_table_pool(buf_desc->table_id), buf_desc, hint, true);
+}
+
+/* Get the buffer of a page only if it is cached, without counting it as
+ * an access. Returns NULL if it is not.
+ */
+buf_descriptor_t *buffer_lookup(int64_t table_id, pagenum_t page_num) {
+    if (num_mapped_tables > 0) {
+        mapped_table_t *mapped = find_mapped_table(table_id);
+
+        if (mapped != NULL && page_num < mapped->num_pages)
+            return get_mapped_buffer(mapped, page_num);
+    }
+
+    buf_descriptor_t *buf_desc =
+        hashtable_lookup(get_table_pool(table_id), table_id, page_num);
+
+    if (buf_desc != NULL)
+        buf_desc->pin_count++;
 
     return buf_desc;
 }
 
+/* Read the pages not cached yet into the buffer pool with one submission,
+ * ahead of their use. Their get_buffer() is counted when it comes, and
+ * they are placed as the access hint of it tells.
+ * Returns the number of pages read.
+ */
+int buffer_prefetch(int64_t table_id, const pagenum_t *page_nums, int n,
+                    int hint) {
+    buf_descriptor_t *bufs[IO_QUEUE_DEPTH];
+    buf_descriptor_t *dirty[IO_QUEUE_DEPTH];
+    page_io ios[IO_QUEUE_DEPTH];
+    buffer_pool_t *pool;
+    int num_bufs = 0;
+    int num_dirty = 0;
+    int num_read = 0;
+    bool cold = hint == BUFFER_ACCESS_SCAN || hint == BUFFER_ACCESS_MAINTENANCE;
+
+    // Have the kernel read the pages of a mapped table ahead.
+    if (num_mapped_tables > 0) {
+        mapped_table_t *mapped = find_mapped_table(table_id);
+
+        if (mapped != NULL) {
+            for (int i = 0; i < n; i++) {
+                if (page_nums[i] < mapped->num_pages)
+                    madvise(&mapped->pages[page_nums[i]], PAGE_SIZE,
+                            MADV_WILLNEED);
+            }
+
+            return 0;
+        }
+    }
+
+    pool = get_table_pool(table_id);
+
+    for (int i = 0; i < n && num_bufs < IO_QUEUE_DEPTH; i++) {
+        bool is_duplicate = false;
+
+        // The pages in the victim cache come back without a read.
+        if (hashtable_lookup(pool, table_id, page_nums[i]) != NULL ||
+            victim_cache_contains(table_id, page_nums[i]))
+            continue;
+
+        for (int j = 0; j < num_bufs; j++)
+            is_duplicate |= ios[j].pagenum == page_nums[i];
+
+        if (is_duplicate)
+            continue;
+
+        // Keep the victims pinned until they are read into.
+        buf_descriptor_t *buf_desc = get_victim_buffer(pool, table_id,
+                                                       page_nums[i]);
+        if (buf_desc == NULL)
+            break;
+
+        buf_desc->pin_count++;
+        if (buf_desc->is_dirty)
+            dirty[num_dirty++] = buf_desc;
+
+        ios[num_bufs].table_id = table_id;
+        ios[num_bufs].pagenum = page_nums[i];
+        ios[num_bufs].page = buf_desc->buf_page;
+        bufs[num_bufs++] = buf_desc;
+    }
+
+    flush_buffers(dirty, num_dirty);
+
+    // The victims that cannot be written back stay, and fewer pages are read.
+    int num_taken = 0;
+
+    for (int i = 0; i < num_bufs; i++) {
+        if (bufs[i]->is_dirty) {
+            bufs[i]->pin_count--;
+            continue;
+        }
+
+        if (bufs[i]->table_id != -1) {
+            victim_cache_put(bufs[i]->table_id, bufs[i]->page_num,
+                             bufs[i]->buf_page);
+            hashtable_delete(pool, bufs[i], true);
+        }
+
+        bufs[i]->table_id = -1;
+        bufs[i]->page_num = -1;
+        bufs[num_taken] = bufs[i];
+        ios[num_taken++] = ios[i];
+    }
+
+    num_bufs = num_taken;
+
+    file_read_pages(ios, num_bufs);
+
+    for (int i = 0; i < num_bufs; i++) {
+        buf_descriptor_t *buf_desc = bufs[i];
+
+        buf_desc->pin_count--;
+
+        // Give the buffer back if the page is torn.
+        if (ios[i].result != 0) {
+            push_free_buffer(pool, buf_desc);
+            continue;
+        }
+
+        buf_desc->table_id = table_id;
+        buf_desc->page_num = ios[i].pagenum;
+        // Survive one sweep of the clock hand until it is used, unless it
+        // is cold.
+        buf_desc->usage_count = cold ? 0 : 1;
+
+        if (buf_desc->shadow_page != NULL)
+            memcpy(buf_desc->shadow_page, buf_desc->buf_page, PAGE_SIZE);
+
+        hashtable_insert(pool, buf_desc, cold);
+        num_read++;
+    }
+
+    return num_read;
+}
+
+/* Get the buffer of a page taken from the free page list of a table.
+ * Return NULL if the header page or the free page cannot be read in.
+ */
 buf_descriptor_t *get_buffer_of_new_page(int64_t table_id) {
     buf_descriptor_t *header_buf = get_buffer(table_id, 0);
+    if (header_buf == NULL)
+        return NULL;
+
     page_t *header_page = header_buf->buf_page;
     pagenum_t new_page_num = header_page->free_page_num;
     buf_descriptor_t *buf_desc;
@@ -230,13 +1265,17 @@ buf_descriptor_t *get_buffer_of_new_page(int64_t table_id) {
     // If there is any free page, get the page.
     if (new_page_num != -1) {
         buf_desc = get_buffer(table_id, new_page_num);
+        if (buf_desc == NULL) {
+            unpin_buffer(header_buf);
+            return NULL;
+        }
         header_page->free_page_num = buf_desc->buf_page->next_free_page_num;
     }
     // Or not, double the database.
     else {
         // Double the database.
         uint64_t num_of_pages = 2 * header_page->num_of_pages;
-        page_t *tmp_page = (page_t*)malloc(PAGE_SIZE);
+        page_t *tmp_page = file_new_page_buffer();
 
         // Write new free page number.
         tmp_page->next_free_page_num = -1;
@@ -254,6 +1293,10 @@ buf_descriptor_t *get_buffer_of_new_page(int64_t table_id) {
 
         free(tmp_page);
 
+        // The free pages bypass the log, so make them durable before
+        // the header page refers to them.
+        file_sync_table(table_id);
+
         // Get new buffer.
         new_page_num = num_of_pages - 1;
         buf_desc = get_buffer(table_id, new_page_num);
@@ -265,8 +1308,14 @@ buf_descriptor_t *get_buffer_of_new_page(int64_t table_id) {
     return buf_desc;
 }
 
-void free_page(int64_t table_id, buf_descriptor_t *buf) {
+/* Put a pinned page to the free page list of a table.
+ * Returns 1 if the header page cannot be read in.
+ */
+int free_page(int64_t table_id, buf_descriptor_t *buf) {
     buf_descriptor_t *header_buf = get_buffer(table_id, 0);
+    if (header_buf == NULL)
+        return 1;
+
     page_t *header_page = header_buf->buf_page;
     page_t *buf_page = buf->buf_page;
 
@@ -277,18 +1326,501 @@ void free_page(int64_t table_id, buf_descriptor_t *buf) {
     mark_buffer_dirty(header_buf);
     mark_buffer_dirty(buf);
     unpin_buffer(header_buf);
+
+    return 0;
+}
+
+/* Write back the dirty pages of the pool (of the table only, unless -1).
+ * Returns 1 if the log cannot be flushed for them, or one cannot be written.
+ */
+int flush_pool_buffers(buffer_pool_t *pool, int64_t table_id) {
+    buf_descriptor_t *batch[IO_QUEUE_DEPTH];
+    buf_descriptor_t *buf_desc;
+    int ret = 0;
+    int n = 0;
+
+    for (uint32_t i = 0; i < pool->num_buf; i++) {
+        buf_desc = pool->frames[i];
+
+        if (buf_desc->table_id == -1 || !buf_desc->is_dirty ||
+            (table_id != -1 && buf_desc->table_id != table_id))
+            continue;
+
+        batch[n++] = buf_desc;
+        if (n == IO_QUEUE_DEPTH) {
+            ret |= flush_buffers(batch, n);
+            n = 0;
+        }
+    }
+
+    return ret | flush_buffers(batch, n);
+}
+
+/* Write back every dirty page, IO_QUEUE_DEPTH pages at a time.
+ * Returns 1 if the log cannot be flushed for them, or one cannot be written.
+ */
+int flush_all_buffers() {
+    int ret = 0;
+
+    for (int i = 0; i < num_buffer_pools; i++)
+        ret |= flush_pool_buffers(&buffer_pools[i], -1);
+
+    return ret;
+}
+
+/* Write back the pages of the table in the pool, and give their buffers
+ * back to the free list.
+ * Returns 1 (dropping none) if a page is pinned, the log cannot be
+ * flushed for them, or one cannot be written.
+ */
+int drop_table_buffers(buffer_pool_t *pool, int64_t table_id) {
+    buf_descriptor_t *buf_desc;
+
+    for (uint32_t i = 0; i < pool->num_buf; i++) {
+        if (pool->frames[i]->table_id == table_id &&
+            pool->frames[i]->pin_count > 0)
+            return 1;
+    }
+
+    if (flush_pool_buffers(pool, table_id))
+        return 1;
+
+    for (uint32_t i = 0; i < pool->num_buf; i++) {
+        buf_desc = pool->frames[i];
+        if (buf_desc->table_id != table_id)
+            continue;
+
+        hashtable_delete(pool, buf_desc, false);
+        buf_desc->table_id = -1;
+        buf_desc->page_num = -1;
+        buf_desc->usage_count = 0;
+        push_free_buffer(pool, buf_desc);
+    }
+
+    return 0;
+}
+
+// The sum of the minimums of the quotas of the tables of the pool
+uint64_t get_pool_min_buf(buffer_pool_t *pool) {
+    uint64_t total_min = 0;
+
+    for (size_t i = 0; i < table_bindings.size(); i++) {
+        if (get_pool(&table_bindings[i]) == pool)
+            total_min += table_bindings[i].min_buf;
+    }
+
+    return total_min;
 }
 
-int close_buffer_pool() {
+/* Drop the frames of the pool from the tail down to num_buf, or to the last
+ * one pinned. Their pages are written back and evicted, and the chunks all
+ * of whose frames are dropped are freed. The frames dropped from the last
+ * chunk kept stay with it, and are taken back first when the pool grows.
+ * Returns 1 if a pinned frame is left above num_buf, or (dropping none)
+ * if the log cannot be flushed for their pages or one cannot be written.
+ */
+int shrink_pool(buffer_pool_t *pool, uint32_t num_buf) {
+    buf_descriptor_t *batch[IO_QUEUE_DEPTH];
     buf_descriptor_t *buf_desc;
+    uint32_t new_num_buf = num_buf;
+    int ret = 0;
+    int n = 0;
+
+    for (uint32_t i = pool->num_buf; i-- > num_buf;) {
+        if (pool->frames[i]->pin_count > 0) {
+            new_num_buf = i + 1;
+            break;
+        }
+    }
+
+    // Write back the dirty pages first, then evict them.
+    for (uint32_t i = new_num_buf; i < pool->num_buf; i++) {
+        buf_desc = pool->frames[i];
+        if (buf_desc->table_id == -1 || !buf_desc->is_dirty)
+            continue;
+
+        batch[n++] = buf_desc;
+        if (n == IO_QUEUE_DEPTH) {
+            ret |= flush_buffers(batch, n);
+            n = 0;
+        }
+    }
+
+    if (ret | flush_buffers(batch, n))
+        return 1;
+
+    for (uint32_t i = new_num_buf; i < pool->num_buf; i++) {
+        buf_desc = pool->frames[i];
+        if (buf_desc->table_id != -1)
+            hashtable_delete(pool, buf_desc, false);
+
+        buf_desc->table_id = -1;
+        buf_desc->page_num = -1;
+        buf_desc->usage_count = 0;
+    }
+
+    // Make the free lists again of the unused frames left.
+    memset(pool->free_lists, 0, sizeof(pool->free_lists));
+    for (uint32_t i = new_num_buf; i-- > 0;) {
+        buf_desc = pool->frames[i];
+        if (buf_desc->table_id != -1 || buf_desc->pin_count > 0)
+            continue;
+
+        push_free_buffer(pool, buf_desc);
+    }
+
+    pool->num_buf = new_num_buf;
+    if (pool->clock_hand >= new_num_buf)
+        pool->clock_hand = 0;
+
+    while (pool->num_chunks > 1 &&
+           pool->chunks[pool->num_chunks - 1].first >= new_num_buf) {
+        free_frame_chunk(&pool->chunks[--pool->num_chunks]);
+    }
+
+    return new_num_buf != num_buf;
+}
+
+/* Take back up to num_buf of the frames shrink_pool() dropped from the last
+ * chunk, onto the free lists.
+ * Returns the number of frames taken back.
+ */
+static uint32_t take_back_frames(buffer_pool_t *pool, uint32_t num_buf) {
+    frame_chunk_t *chunk = &pool->chunks[pool->num_chunks - 1];
+    uint32_t n =
+        std::min(num_buf, chunk->first + chunk->num_buf - pool->num_buf);
+
+    for (uint32_t i = n; i-- > 0;)
+        push_free_buffer(pool, pool->frames[pool->num_buf + i]);
+
+    pool->num_buf += n;
+    return n;
+}
+
+/* Grow or shrink the pool of the name to num_buf frames, while it is used.
+ * Growing takes back the frames dropped from its last chunk, then adds a
+ * chunk of frames, and grows the hashtable with them, moving its chains
+ * over on the lookups that follow. Shrinking writes back and evicts the
+ * pages of the frames at the tail, and frees the chunks left empty.
+ * Returns 1 if there is no such pool, num_buf is below 4 or the minimums of
+ * the quotas of its tables, the frames cannot be allocated, or a frame at
+ * the tail is pinned (the pool is shrunk down to it then).
+ */
+int buffer_resize_pool(const char *name, uint32_t num_buf) {
+    buffer_pool_t *pool = find_pool(name);
+
+    if (pool == NULL || num_buf < 4 || get_pool_min_buf(pool) + 4 > num_buf)
+        return 1;
+
+    if (num_buf < pool->num_buf)
+        return shrink_pool(pool, num_buf);
+
+    if (num_buf == pool->num_buf)
+        return 0;
+
+    uint32_t old_num_buf = pool->num_buf;
+    int result = 0;
+
+    if (take_back_frames(pool, num_buf - old_num_buf) < num_buf - old_num_buf)
+        result = add_frames(pool, num_buf - pool->num_buf);
+
+    // Keep the length of the chains as it was, with the frames added.
+    uint64_t num_ht_entries =
+        (uint64_t)pool->hashtable.num_ht_entries * pool->num_buf / old_num_buf;
+
+    if (num_ht_entries > pool->hashtable.num_ht_entries &&
+        num_ht_entries <= UINT32_MAX)
+        hashtable_grow(pool, num_ht_entries);
+
+    return result;
+}
+
+// Get the number of frames of the pool of the name, 0 if there is none
+uint32_t buffer_get_pool_num_buf(const char *name) {
+    buffer_pool_t *pool = find_pool(name);
+
+    return pool != NULL ? pool->num_buf : 0;
+}
+
+/* Open a table, and bind it to the pool of the name (the default pool if
+ * NULL). A table opened again with another pool moves there, after its
+ * pages are written back and dropped from the pool it leaves.
+ * Returns -1 if there is no such pool, or a page of the table is pinned.
+ */
+int64_t buffer_open_table(const char *pathname, uint64_t flags,
+                          const char *pool_name) {
+    buffer_pool_t *pool = NULL;
+
+    if (pool_name != NULL && (pool = find_pool(pool_name)) == NULL)
+        return -1;
+
+    int64_t table_id = file_open_table_file(pathname, flags);
+    if (table_id < 0)
+        return table_id;
+
+    if (flags & TABLE_OPEN_MMAP)
+        add_mapped_table(table_id);
+
+    int index = file_get_table_index(table_id);
+    if ((size_t)index >= table_bindings.size())
+        table_bindings.resize(index + 1);
+
+    table_binding_t *binding = &table_bindings[index];
+
+    if (pool != NULL && get_pool(binding) != pool) {
+        if (drop_table_buffers(get_pool(binding), table_id))
+            return -1;
+
+        binding->pool = pool;
+        binding->min_buf = 0;
+        binding->max_buf = 0;
+    }
+
+    // Tell the log which file the table id stands for.
+    if (log_is_enabled())
+        log_table(table_id, file_get_table_flags(table_id), pathname);
+
+    return table_id;
+}
+
+/* Set the quota of frames of a table in its pool (0 for none).
+ * Returns 1 if the table is not open, min_buf exceeds max_buf, max_buf is
+ * below the 4 frames an operation pins, or the minimums of the tables of
+ * the pool would leave it less than 4 frames.
+ */
+int buffer_set_table_quota(int64_t table_id, uint32_t min_buf,
+                           uint32_t max_buf) {
+    table_binding_t *binding = get_binding(table_id);
+    uint64_t total_min = min_buf;
+
+    if (binding == NULL || (max_buf != 0 && (max_buf < 4 || min_buf > max_buf)))
+        return 1;
+
+    for (size_t i = 0; i < table_bindings.size(); i++) {
+        if (&table_bindings[i] != binding &&
+            get_pool(&table_bindings[i]) == get_pool(binding))
+            total_min += table_bindings[i].min_buf;
+    }
+
+    if (total_min + 4 > get_pool(binding)->num_buf)
+        return 1;
+
+    binding->min_buf = min_buf;
+    binding->max_buf = max_buf;
+    return 0;
+}
+
+// Get the number of frames holding pages of the table
+uint32_t buffer_get_table_num_buf(int64_t table_id) {
+    table_binding_t *binding = get_binding(table_id);
+
+    return binding != NULL ? binding->num_buf : 0;
+}
+
+// Log the files of the open tables again (after the log is truncated)
+void buffer_log_tables() {
+    table_node *table;
+
+    for (int i = 0; i < file_get_num_tables(); i++) {
+        table = file_get_table(i);
+        log_table(table->table_id, table->flags, table->pathname);
+    }
+}
+
+/* Write back every dirty page and truncate the log.
+ * Recovery starts from here after a crash.
+ */
+int buffer_checkpoint() {
+    if (flush_all_buffers() || file_sync_tables() || log_truncate())
+        return 1;
+
+    buffer_log_tables();
+    return 0;
+}
+
+/* Write the pages resident in the frames of the pools to a dump, table by
+ * table in page order. A table line gives the pool, the open flags and the
+ * path of the table, and a line for each of its pages the page number and
+ * the usage count. The dump replaces the old one only once it is whole.
+ * Returns 1 if the dump cannot be written.
+ */
+int buffer_dump_pages(const char *dump_path) {
+    std::vector<warm_page_t> pages;
+    std::string tmp_path = std::string(dump_path) + ".tmp";
+    FILE *file;
+    int64_t table_id = -1;
+
+    for (int i = 0; i < num_buffer_pools; i++) {
+        buffer_pool_t *pool = &buffer_pools[i];
+
+        for (uint32_t j = 0; j < pool->num_buf; j++) {
+            buf_descriptor_t *buf_desc = pool->frames[j];
+
+            if (buf_desc->table_id != -1)
+                pages.push_back({ buf_desc->table_id, buf_desc->page_num,
+                                  buf_desc->usage_count });
+        }
+    }
+
+    std::sort(pages.begin(), pages.end(),
+              [](const warm_page_t &a, const warm_page_t &b) {
+                  return a.table_id != b.table_id ? a.table_id < b.table_id :
+                                                    a.page_num < b.page_num;
+              });
+
+    file = fopen(tmp_path.c_str(), "w");
+    if (file == NULL)
+        return 1;
+
+    for (const warm_page_t &page : pages) {
+        if (page.table_id != table_id) {
+            table_id = page.table_id;
+            fprintf(file, "table %s %" PRIu64 " %s\n",
+                    get_table_pool(table_id)->name,
+                    (uint64_t)(buffer_get_table_flags(table_id) &
+                               TABLE_OPEN_FLAGS),
+                    file_get_table(file_get_table_index(table_id))->pathname);
+        }
+
+        fprintf(file, "%" PRIu64 " %u\n", page.page_num, page.usage_count);
+    }
+
+    if (fclose(file) != 0 || rename(tmp_path.c_str(), dump_path) != 0) {
+        remove(tmp_path.c_str());
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Read the pages of a dump, and open their tables in the pools they were
+ * in, as they were opened. The tables gone, or whose pool is not created
+ * (yet), are skipped.
+ * Returns 1 if the dump cannot be read.
+ */
+int buffer_load_dump(const char *dump_path, std::vector<warm_page_t> *pages) {
+    FILE *file = fopen(dump_path, "r");
+    char line[4096];
+    char pool_name[BUFFER_POOL_NAME_SIZE];
+    int64_t table_id = -1;
+    uint64_t flags;
+    int path_offset;
+    warm_page_t page;
+
+    if (file == NULL)
+        return 1;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+
+        if (sscanf(line, "table %31s %" SCNu64 " %n", pool_name, &flags,
+                   &path_offset) == 2) {
+            const char *pathname = line + path_offset;
+
+            // Do not create the tables gone since.
+            table_id = -1;
+            if (access(pathname, F_OK) == 0 && find_pool(pool_name) != NULL &&
+                !(flags & TABLE_OPEN_MMAP))
+                table_id = buffer_open_table(pathname, flags, pool_name);
+        } else if (sscanf(line, "%" SCNu64 " %u", &page.page_num,
+                          &page.usage_count) == 2 && table_id >= 0) {
+            page.table_id = table_id;
+            pages->push_back(page);
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// Count the free frames of the pool, up to max
+static int count_free_buffers(buffer_pool_t *pool, int max) {
+    int count = 0;
+
+    for (int i = 0; i < pool->num_nodes; i++) {
+        for (buf_descriptor_t *buf_desc = pool->free_lists[i];
+             buf_desc != NULL && count < max; buf_desc = buf_desc->next)
+            count++;
+    }
+
+    return count;
+}
+
+/* Read the next pages of a dump, of one table, into the free frames of its
+ * pool with one submission, and give them their usage counts back. Pages
+ * next to each other on disk are read together.
+ * A table takes no more frames than its max_buf leaves, so the warm-up
+ * evicts nothing; the pages of a table at its max_buf are skipped.
+ * Returns the number of pages of the dump gone through, or 0 once the pool
+ * has no free frame left.
+ */
+int buffer_warm_up(const warm_page_t *pages, int n) {
+    pagenum_t page_nums[IO_QUEUE_DEPTH];
+    int64_t table_id = pages[0].table_id;
+    buffer_pool_t *pool = get_table_pool(table_id);
+    const table_binding_t *binding = get_binding(table_id);
+    int num_pages = 0;
+    int num_read;
+
+    while (num_pages < n && num_pages < IO_QUEUE_DEPTH &&
+           pages[num_pages].table_id == table_id) {
+        page_nums[num_pages] = pages[num_pages].page_num;
+        num_pages++;
+    }
+
+    num_read = count_free_buffers(pool, num_pages);
+    if (num_read == 0)
+        return 0;
+
+    if (binding != NULL && binding->max_buf != 0)
+        num_read = std::min((uint32_t)num_read,
+                            binding->max_buf > binding->num_buf
+                                ? binding->max_buf - binding->num_buf
+                                : 0);
+    if (num_read == 0)
+        return num_pages;
+
+    buffer_prefetch(table_id, page_nums, num_read);
+
+    for (int i = 0; i < num_read; i++) {
+        buf_descriptor_t *buf_desc =
+            hashtable_lookup(pool, table_id, page_nums[i]);
+
+        if (buf_desc != NULL && buf_desc->usage_count < pages[i].usage_count)
+            buf_desc->usage_count =
+                std::min(pages[i].usage_count, (uint32_t)MAX_USAGE_COUNT);
+    }
+
+    return num_read;
+}
+
+/* Close the buffer pool, writing back the dirty pages.
+ * With dump_path, the pages resident are dumped there first, to be read
+ * back in by buffer_warm_up() after the next start.
+ */
+int close_buffer_pool(const char *dump_path) {
     int ret = 0;
 
-//  TODO -----------------------------------------------------------------------
-//  ...
-//  ----------------------------------------------------------------------------
+    if (num_buffer_pools == 0)
+        return 1;
+
+    if (dump_path != NULL)
+        ret = buffer_dump_pages(dump_path);
 
+    // Write back the dirty pages.
+    ret |= flush_all_buffers();
+
+    close_mapped_tables();
+    file_sync_tables();
     file_close_table_files();
 
+    io_set_buffers(NULL, 0);
+    for (int i = 0; i < num_buffer_pools; i++)
+        free_pool(&buffer_pools[i]);
+    num_buffer_pools = 0;
+    table_bindings.clear();
+    victim_cache_clear();
+
     return ret;
 }
 
@@ -296,6 +1828,10 @@ void init_buffer_stat() {
     stat_get_buffer = 0;
     stat_read_page = 0;
     stat_write_page = 0;
+    stat_checksum_failures = 0;
+    stat_victim_cache_hits = 0;
+    stat_desc_cache_hits = 0;
+    stat_swizzled_hits = 0;
 }
 
 int64_t get_buffer_hit_ratio() {
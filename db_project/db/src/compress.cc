@@ -0,0 +1,309 @@
+#include "compress.h"
+
+#include <cstring>
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+
+static inline uint32_t read32(const byte *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash4(const byte *p) {
+    return (read32(p) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Write an extended length (after the 15 stored in the token)
+static inline byte *write_length(byte *op, byte *op_end, uint32_t length) {
+    for (; length >= 255; length -= 255) {
+        if (op >= op_end)
+            return NULL;
+        *op++ = (byte)255;
+    }
+
+    if (op >= op_end)
+        return NULL;
+    *op++ = (byte)length;
+    return op;
+}
+
+// Read an extended length (after the 15 stored in the token)
+static inline const byte *read_length(const byte *ip, const byte *ip_end,
+                                      uint32_t *length) {
+    uint8_t b;
+
+    do {
+        if (ip >= ip_end)
+            return NULL;
+        b = (uint8_t)*ip++;
+        *length += b;
+    } while (b == 255);
+
+    return ip;
+}
+
+// Emit one sequence, returns the new output position or NULL if overflowed
+static byte *write_sequence(byte *op, byte *op_end, const byte *literals,
+                            uint32_t literal_length, uint32_t offset,
+                            uint32_t match_length) {
+    byte *token = op++;
+
+    if (token >= op_end)
+        return NULL;
+
+    uint8_t lit_nibble = literal_length < 15 ? literal_length : 15;
+    uint8_t match_nibble = 0;
+
+    if (literal_length >= 15 &&
+        (op = write_length(op, op_end, literal_length - 15)) == NULL)
+        return NULL;
+
+    if (op + literal_length > op_end)
+        return NULL;
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (match_length > 0) {
+        uint32_t code = match_length - MIN_MATCH;
+        match_nibble = code < 15 ? code : 15;
+
+        if (op + 2 > op_end)
+            return NULL;
+        *op++ = (byte)(offset & 0xff);
+        *op++ = (byte)(offset >> 8);
+
+        if (code >= 15 && (op = write_length(op, op_end, code - 15)) == NULL)
+            return NULL;
+    }
+
+    *token = (byte)((lit_nibble << 4) | match_nibble);
+    return op;
+}
+
+/* Compress src_size bytes of src into dest.
+ * Returns the compressed size, or 0 if it exceeds dest_capacity.
+ */
+uint32_t compress_bytes(const byte *src, uint32_t src_size, byte *dest,
+                        uint32_t dest_capacity) {
+    uint16_t table[1 << HASH_BITS];
+    const byte *ip = src;
+    const byte *anchor = src;
+    const byte *ip_end = src + src_size;
+    byte *op = dest;
+    byte *op_end = dest + dest_capacity;
+
+    // Positions are stored as 16-bit values.
+    if (src_size > 65535)
+        return 0;
+
+    memset(table, 0xff, sizeof(table));
+
+    while (ip + MIN_MATCH <= ip_end) {
+        uint32_t h = hash4(ip);
+        uint16_t candidate = table[h];
+        table[h] = (uint16_t)(ip - src);
+
+        if (candidate == 0xffff || ip - (src + candidate) > MAX_OFFSET ||
+            read32(src + candidate) != read32(ip)) {
+            ip++;
+            continue;
+        }
+
+        // Extend the match.
+        const byte *match = src + candidate;
+        uint32_t match_length = MIN_MATCH;
+        while (ip + match_length < ip_end && match[match_length] == ip[match_length])
+            match_length++;
+
+        op = write_sequence(op, op_end, anchor, ip - anchor, ip - match,
+                            match_length);
+        if (op == NULL)
+            return 0;
+
+        ip += match_length;
+        anchor = ip;
+    }
+
+    // The last literals.
+    op = write_sequence(op, op_end, anchor, ip_end - anchor, 0, 0);
+    if (op == NULL)
+        return 0;
+
+    return op - dest;
+}
+
+/* Decompress src_size bytes of src into dest.
+ * Returns the decompressed size, or 0 if the stream is corrupted or
+ * exceeds dest_capacity.
+ */
+uint32_t decompress_bytes(const byte *src, uint32_t src_size, byte *dest,
+                          uint32_t dest_capacity) {
+    const byte *ip = src;
+    const byte *ip_end = src + src_size;
+    byte *op = dest;
+    byte *op_end = dest + dest_capacity;
+
+    while (ip < ip_end) {
+        uint8_t token = (uint8_t)*ip++;
+        uint32_t literal_length = token >> 4;
+
+        if (literal_length == 15 &&
+            (ip = read_length(ip, ip_end, &literal_length)) == NULL)
+            return 0;
+
+        if (ip + literal_length > ip_end || op + literal_length > op_end)
+            return 0;
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        // The last sequence has literals only.
+        if (ip == ip_end)
+            break;
+
+        if (ip + 2 > ip_end)
+            return 0;
+        uint32_t offset = (uint8_t)ip[0] | ((uint8_t)ip[1] << 8);
+        ip += 2;
+
+        uint32_t match_length = token & 0x0f;
+        if (match_length == 15 &&
+            (ip = read_length(ip, ip_end, &match_length)) == NULL)
+            return 0;
+        match_length += MIN_MATCH;
+
+        if (offset == 0 || offset > (uint32_t)(op - dest) ||
+            op + match_length > op_end)
+            return 0;
+
+        // Matches may overlap the output, so copy byte by byte.
+        const byte *match = op - offset;
+        for (uint32_t i = 0; i < match_length; i++)
+            op[i] = match[i];
+        op += match_length;
+    }
+
+    return op - dest;
+}
+
+/* Compress the live part (header, slots and records) of a leaf page into
+ * dest, starting with a compressed_page_header.
+ * Returns the total size, or 0 if the page is not a well-formed leaf page or
+ * does not compress below dest_capacity.
+ */
+uint32_t compress_leaf_page(const page_t *page, byte *dest,
+                            uint32_t dest_capacity) {
+    compressed_page_header header;
+    byte live[PAGE_SIZE];
+    uint32_t records_begin = PAGE_SIZE;
+
+    if (page->is_leaf != 1 || page->num_of_keys < 0 ||
+        page->num_of_keys > DATA_SIZE / SLOT_SIZE)
+        return 0;
+
+    uint32_t slots_end = HEADER_SIZE + page->num_of_keys * SLOT_SIZE;
+
+    // Find the beginning of the records, checking every slot.
+    for (int i = 0; i < page->num_of_keys; i++) {
+        slot_t slot;
+        memcpy(&slot, page->data + i * SLOT_SIZE, SLOT_SIZE);
+
+        if (slot.offset < slots_end || slot.offset + slot.size > PAGE_SIZE)
+            return 0;
+
+        if (slot.offset < records_begin)
+            records_begin = slot.offset;
+    }
+
+    if (dest_capacity <= sizeof(header))
+        return 0;
+
+    // Gather the live bytes, then compress them.
+    memcpy(live, page, slots_end);
+    memcpy(live + slots_end, page->space + records_begin,
+           PAGE_SIZE - records_begin);
+
+    uint32_t compressed_size =
+        compress_bytes(live, slots_end + PAGE_SIZE - records_begin,
+                       dest + sizeof(header), dest_capacity - sizeof(header));
+    if (compressed_size == 0)
+        return 0;
+
+    header.magic = COMPRESSED_PAGE_MAGIC;
+    header.compressed_size = compressed_size;
+    header.slots_end = slots_end;
+    header.records_begin = records_begin;
+    header.reserved = 0;
+    memcpy(dest, &header, sizeof(header));
+
+    return sizeof(header) + compressed_size;
+}
+
+/* Restore a leaf page compressed by compress_leaf_page().
+ * The free space between the slots and the records is zero-filled.
+ * Returns 0 on success, 1 if src is not a valid compressed page.
+ */
+int decompress_leaf_page(const byte *src, page_t *dest) {
+    compressed_page_header header;
+    byte live[PAGE_SIZE];
+
+    memcpy(&header, src, sizeof(header));
+
+    if (header.magic != COMPRESSED_PAGE_MAGIC ||
+        header.compressed_size > PAGE_SIZE - sizeof(header) ||
+        header.slots_end > header.records_begin ||
+        header.records_begin > PAGE_SIZE)
+        return 1;
+
+    uint32_t live_size = header.slots_end + PAGE_SIZE - header.records_begin;
+
+    if (decompress_bytes(src + sizeof(header), header.compressed_size, live,
+                         PAGE_SIZE) != live_size)
+        return 1;
+
+    memcpy(dest, live, header.slots_end);
+    memset(dest->space + header.slots_end, 0,
+           header.records_begin - header.slots_end);
+    memcpy(dest->space + header.records_begin, live + header.slots_end,
+           PAGE_SIZE - header.records_begin);
+
+    return 0;
+}
+
+/* Zero-fill the free space between the slots and the records of a leaf
+ * page, as decompress_leaf_page() restores it.
+ * Pages that are not well-formed leaf pages are left untouched.
+ */
+void clear_leaf_free_space(page_t *page) {
+    uint32_t records_begin = PAGE_SIZE;
+
+    if (page->is_leaf != 1 || page->num_of_keys < 0 ||
+        page->num_of_keys > DATA_SIZE / SLOT_SIZE)
+        return;
+
+    uint32_t slots_end = HEADER_SIZE + page->num_of_keys * SLOT_SIZE;
+
+    for (int i = 0; i < page->num_of_keys; i++) {
+        slot_t slot;
+        memcpy(&slot, page->data + i * SLOT_SIZE, SLOT_SIZE);
+
+        if (slot.offset < slots_end || slot.offset + slot.size > PAGE_SIZE)
+            return;
+
+        if (slot.offset < records_begin)
+            records_begin = slot.offset;
+    }
+
+    memset(page->space + slots_end, 0, records_begin - slots_end);
+}
+
+// Check if the on-disk page image is a compressed leaf page
+bool is_compressed_page(const byte *src) {
+    uint64_t magic;
+
+    memcpy(&magic, src, sizeof(magic));
+    return magic == COMPRESSED_PAGE_MAGIC;
+}
@@ -0,0 +1,77 @@
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE
+#endif
+
+#include <cstring>
+
+#define CRC32C_POLY 0x82f63b78  // Reflected Castagnoli polynomial
+
+// Lookup table of the byte-at-a-time software CRC, built at load time
+static struct crc32c_table_t {
+    uint32_t entries[256];
+    bool hardware;  // The CPU has the CRC32 instruction (SSE4.2)
+
+    crc32c_table_t() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+
+            for (int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+
+            entries[i] = crc;
+        }
+
+#ifdef CRC32C_HARDWARE
+        hardware = __builtin_cpu_supports("sse4.2");
+#else
+        hardware = false;
+#endif
+    }
+} crc32c_table;
+
+static uint32_t crc32c_software(uint32_t crc, const uint8_t *p, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        crc = crc32c_table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+#ifdef CRC32C_HARDWARE
+// 8 bytes per instruction, the tail byte by byte
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t *p, size_t size) {
+    uint64_t crc64 = crc;
+    uint64_t word;
+
+    for (; size >= sizeof(word); size -= sizeof(word), p += sizeof(word)) {
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    crc = (uint32_t)crc64;
+    for (; size > 0; size--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+#endif
+
+// Extend a CRC32C (Castagnoli) over size bytes of data, starting from crc
+uint32_t crc32c(uint32_t crc, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t*)data;
+
+#ifdef CRC32C_HARDWARE
+    if (crc32c_table.hardware)
+        return ~crc32c_hardware(~crc, p, size);
+#endif
+
+    return ~crc32c_software(~crc, p, size);
+}
+
+// Check whether crc32c() uses the CRC instruction of the CPU
+bool crc32c_is_hardware() {
+    return crc32c_table.hardware;
+}
@@ -1,55 +1,251 @@
 #include "db.h"
+#include "internal_page.h"
+#include "lock.h"
+#include "mvcc.h"
+#include "recovery.h"
+#include "txn.h"
+#include "victim_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 // macro for getting slot
 #define get_slot(data, idx) \
     ((slot_t*)((data) + (idx) * SLOT_SIZE))
 
+// macro for getting the internal page format of the table
+#define get_format(table_id) \
+    internal_format(buffer_get_table_flags(table_id))
+
+// macro for checking whether the table is read-only (mapped)
+#define is_read_only(table_id) \
+    ((buffer_get_table_flags(table_id) & TABLE_OPEN_MMAP) != 0)
+
+// macro for checking whether the table has byte-string keys
+#define has_var_keys(table_id) \
+    ((buffer_get_table_flags(table_id) & TABLE_FLAG_VAR_KEYS) != 0)
+
+/* The record of a byte-string key starts with the key:
+ *
+ *   | key size (2) | key | value |
+ */
+#define RECORD_KEY_HEADER_SIZE 2
+
+// macro for checking whether a value is a reference to overflow pages
+#define is_overflow_value(val_size) ((val_size) == OVERFLOW_REF_SIZE)
+
+static_assert(OVERFLOW_REF_SIZE < MIN_VALUE_SIZE,
+              "overflow references must be smaller than inline values");
+
+// Serializes the operations on the trees and the buffer pool
+pthread_mutex_t db_latch = PTHREAD_MUTEX_INITIALIZER;
+
+// Number of operations waiting for the latch, for long ones to give way
+std::atomic<int> num_waiting_ops(0);
+
+// Starts an operation: takes the latch and begins it in the log.
+void begin_operation() {
+    num_waiting_ops++;
+    pthread_mutex_lock(&db_latch);
+    num_waiting_ops--;
+
+    if (log_is_enabled())
+        log_begin_op();
+}
+
+/* Ends an operation. Its commit is waited for after releasing the latch,
+ * so the next operations go on and commit in the same log write.
+ * The operations of a transaction are durable with the transaction.
+ * Returns 1 if the commit cannot be made durable (the log failed).
+ */
+int end_operation() {
+    mvcc_purge();
+
+    lsn_t commit_lsn = log_is_enabled() ? log_end_op() : 0;
+
+    // Keep the log (and the recovery time) bounded, but keep the undo
+    // entries of the transactions going on.
+    if (commit_lsn != 0 && txn_num_active() == 0 &&
+        log_get_end_lsn() - log_get_base_lsn() > LOG_CHECKPOINT_SIZE)
+        buffer_checkpoint();
+
+    pthread_mutex_unlock(&db_latch);
+
+    if (commit_lsn != 0 && txn_get_current() == NULL)
+        return log_flush(commit_lsn);
+
+    return 0;
+}
+
+/* Compares the key of a slot with the given key.
+ * record is the record of the slot.
+ */
+int compare_slot_key(const slot_t *slot, const byte *record,
+                     const tree_key_t *key) {
+    uint16_t key_size;
+
+    if (slot->key != key->prefix)
+        return slot->key < key->prefix ? -1 : 1;
+
+    // int64 keys are whole in the slot.
+    if (key->size == 0)
+        return 0;
+
+    memcpy(&key_size, record, RECORD_KEY_HEADER_SIZE);
+    return key_compare_bytes(record + RECORD_KEY_HEADER_SIZE, key_size,
+                             key->data, key->size);
+}
+
+/* Gets the key of a slot.
+ * record is the record of the slot.
+ */
+void get_slot_key(const slot_t *slot, const byte *record, bool var_keys,
+                  tree_key_t *key) {
+    key->prefix = slot->key;
+    key->size = 0;
+
+    if (var_keys) {
+        memcpy(&key->size, record, RECORD_KEY_HEADER_SIZE);
+        memcpy(key->data, record + RECORD_KEY_HEADER_SIZE, key->size);
+    }
+}
+
+/* Gets the value of a record.
+ * Returns the value and its size through val_size.
+ */
+const byte *get_record_value(const slot_t *slot, const byte *record,
+                             bool var_keys, uint16_t *val_size) {
+    uint16_t key_size;
+
+    if (!var_keys) {
+        *val_size = slot->size;
+        return record;
+    }
+
+    memcpy(&key_size, record, RECORD_KEY_HEADER_SIZE);
+    *val_size = slot->size - RECORD_KEY_HEADER_SIZE - key_size;
+    return record + RECORD_KEY_HEADER_SIZE + key_size;
+}
+
+// The leaves a scan reads ahead of itself: children of the parent of a leaf
+typedef struct read_ahead_t {
+    pagenum_t parent_num;  // -1 if there is none, or nothing left to read
+    int next_index;        // Of the child to read next
+    pagenum_t last_num;    // The last leaf read ahead
+} read_ahead_t;
+
 /* Traces the path from the root to a leaf, searching
  * by key.
- * Returns the leaf page containing the given key.
+ * Returns 0 with the leaf page containing the given key in leaf_buf, 1 if
+ * there is no root page, or DB_BAD_PAGE if a page on the path cannot be
+ * read in. leaf_buf is NULL but on 0.
+ * With ra, sets it up to read ahead the leaves after it.
  */
-buf_descriptor_t *find_leaf(int64_t table_id, db_key_t key,
-                            pagenum_t* p_num_ref = NULL) {
-    buf_descriptor_t *header_buf = get_buffer(table_id, 0);
+int find_leaf(int64_t table_id, const tree_key_t *key,
+              buf_descriptor_t **leaf_buf, pagenum_t* p_num_ref = NULL,
+              read_ahead_t *ra = NULL) {
+    *leaf_buf = NULL;
+
+    buf_descriptor_t *header_buf = get_buffer(table_id, 0,
+                                              BUFFER_ACCESS_INTERNAL);
+    if (header_buf == NULL)
+        return DB_BAD_PAGE;
+
     pagenum_t p_num = header_buf->buf_page->root_page_num;
     unpin_buffer(header_buf);
 
     if (p_num == -1)
-        return NULL;
+        return 1;
 
     // Start from root page.
     buf_descriptor_t *tmp_buf = get_buffer(table_id, p_num);
+    if (tmp_buf == NULL)
+        return DB_BAD_PAGE;
+
     page_t *tmp_page = tmp_buf->buf_page;
-    int p_index;
+    int format = get_format(table_id);
+    int p_index = -1;
+    pagenum_t parent_num = -1;
     
     // Iterate until the leaf page is reached.
     while (!tmp_page->is_leaf) {
-        p_index = -1;
+        // Every lookup goes through the internal pages.
+        buffer_count_access(tmp_buf, BUFFER_ACCESS_INTERNAL);
 
         // Find offset.
-        while (p_index < (tmp_page->num_of_keys - 1)) {
-            if (tmp_page->pairs[p_index + 1].key <= key)
-                p_index++;
-            else
-                break;
-        }
+        p_index = internal_search(tmp_page, key, format);
+        parent_num = p_num;
 
         // Most left page or not.
-        if (p_index >= 0)
-            p_num = tmp_page->pairs[p_index].page_num;
-        else
-            p_num = tmp_page->most_left_page_num;
+        p_num = internal_get_child(tmp_page, p_index, format);
 
-        // Release current internal page and get its child page.
+        // Get its child page and release current internal page.
+        buf_descriptor_t *child_buf = buffer_get_child(tmp_buf, p_index,
+                                                       p_num);
         unpin_buffer(tmp_buf);
-        tmp_buf = get_buffer(table_id, p_num);
-        tmp_page =tmp_buf->buf_page;
+        if (child_buf == NULL)
+            return DB_BAD_PAGE;
+        tmp_buf = child_buf;
+        tmp_page = tmp_buf->buf_page;
     }
 
     if (p_num_ref != NULL)
         *p_num_ref = p_num;
 
-    return tmp_buf;
+    if (ra != NULL) {
+        ra->parent_num = parent_num;
+        ra->next_index = p_index + 1;
+        ra->last_num = p_num;
+    }
+
+    *leaf_buf = tmp_buf;
+    return 0;
+}
+
+/* Reads ahead, in one batch, the leaves after the last one read ahead that
+ * hold keys up to end_key, among the children of the same parent.
+ * The parent is looked at only if it is still cached.
+ */
+void read_ahead_leaves(int64_t table_id, read_ahead_t *ra,
+                       const tree_key_t *end_key) {
+    pagenum_t leaves[READ_AHEAD_LEAVES];
+    tree_key_t key;
+    int n = 0;
+
+    if (ra->parent_num == -1)
+        return;
+
+    buf_descriptor_t *parent_buf = buffer_lookup(table_id, ra->parent_num);
+    if (parent_buf == NULL) {
+        ra->parent_num = -1;
+        return;
+    }
+
+    page_t *parent = parent_buf->buf_page;
+    int format = get_format(table_id);
+
+    // The keys of the child at an index are >= the key at the index.
+    for (; n < READ_AHEAD_LEAVES && ra->next_index < parent->num_of_keys;
+         ra->next_index++) {
+        internal_get_key(parent, ra->next_index, format, &key);
+        if (key_compare(&key, end_key) > 0)
+            break;
+
+        leaves[n++] = internal_get_child(parent, ra->next_index, format);
+    }
+
+    unpin_buffer(parent_buf);
+
+    if (n == 0) {
+        ra->parent_num = -1;
+        return;
+    }
+
+    ra->last_num = leaves[n - 1];
+    buffer_prefetch(table_id, leaves, n, BUFFER_ACCESS_SCAN);
 }
 
 /* Finds the appropriate place to
@@ -62,22 +258,34 @@ int cut( int length ) {
         return length/2 + 1;
 }
 
-/* Creates a new internal page. */
+/* Creates a new internal page.
+ * Returns NULL if no page can be allocated.
+ */
 buf_descriptor_t *make_node(int64_t table_id) {
     buf_descriptor_t *new_buf = get_buffer_of_new_page(table_id);
+    if (new_buf == NULL)
+        return NULL;
+
     page_t *new_page = new_buf->buf_page;
 
     new_page->parent_page_num = -1;
     new_page->is_leaf = 0;
     new_page->num_of_keys = 0;
     new_page->most_left_page_num = -1;
+    new_page->base_key = 0;
+    new_page->key_width = 1;
 
     return new_buf;
 }
 
-/* Creates a new leaf page. */
+/* Creates a new leaf page.
+ * Returns NULL if no page can be allocated.
+ */
 buf_descriptor_t *make_leaf(int64_t table_id) {
     buf_descriptor_t *new_buf = make_node(table_id);
+    if (new_buf == NULL)
+        return NULL;
+
     page_t *new_page = new_buf->buf_page;
 
     new_page->is_leaf = 1;
@@ -91,20 +299,33 @@ buf_descriptor_t *make_leaf(int64_t table_id) {
  * to find the index of the parent's page num position 
  * to the right of the key to be inserted.
  */
-int get_right_index(page_t* parent, db_key_t key) {
+int get_right_index(page_t* parent, const tree_key_t *key, int format) {
+    return internal_lower_bound(parent, key, format);
+}
+
+/* Replaces the key of the index-th pair of an internal page.
+ * Returns 1 without touching the page if a packed or var page
+ * cannot hold the new key.
+ */
+int set_internal_key(page_t *page, int index, const tree_key_t *key, int format) {
+    internal_entry temp_nodes[MAX_INTERNAL_PAIRS];
 
-    int right_index = 0;
-    while (right_index < parent->num_of_keys && parent->pairs[right_index].key < key)
-        right_index++;
+    if (format == INTERNAL_PLAIN) {
+        page->pairs[index].key = key->prefix;
+        return 0;
+    }
 
-    return right_index;
+    internal_unpack(page, temp_nodes, format);
+    temp_nodes[index].key = *key;
+
+    return internal_pack(page, temp_nodes, page->num_of_keys, format);
 }
 
 /* Inserts a new key and value into a leaf.
  * Returns the altered leaf.
  */
 int insert_into_leaf(int64_t table_id, buf_descriptor_t *leaf_buf,
-                     db_key_t key, const char* value, uint16_t val_size) {
+                     const tree_key_t *key, const char* value, uint16_t val_size) {
     int i, j;
     page_t *leaf_page = leaf_buf->buf_page;
     slot_t *slot;
@@ -115,7 +336,7 @@ int insert_into_leaf(int64_t table_id, buf_descriptor_t *leaf_buf,
     for (i = 0; i < leaf_page->num_of_keys; i++) {
         slot = get_slot(leaf_page->data, i);
 
-        if (slot->key >= key)
+        if (compare_slot_key(slot, (byte*)leaf_page + slot->offset, key) >= 0)
             break;
     }
 
@@ -148,7 +369,7 @@ int insert_into_leaf(int64_t table_id, buf_descriptor_t *leaf_buf,
     slot = get_slot(leaf_page->data, i);
 
     // Set metadata.
-    slot->key = key;
+    slot->key = key->prefix;
     slot->size = val_size;
     slot->offset = temp_offset;
 
@@ -169,12 +390,12 @@ int insert_into_leaf(int64_t table_id, buf_descriptor_t *leaf_buf,
  * in half.
  */
 int insert_into_leaf_after_splitting(int64_t table_id, buf_descriptor_t* leaf_buf,
-                                     db_key_t key, const char* value, uint16_t val_size) {
+                                     const tree_key_t *key, const char* value, uint16_t val_size) {
     
     slot_t *slot;
     page_t *leaf_page = leaf_buf->buf_page;
     int insertion_index = -1, split = -1, i, j;
-    db_key_t new_key;
+    tree_key_t new_key;
     char data_buffer[DATA_SIZE];
     uint16_t size;
 
@@ -185,7 +406,8 @@ int insert_into_leaf_after_splitting(int64_t table_id, buf_descriptor_t* leaf_bu
     for (insertion_index = 0; insertion_index < leaf_page->num_of_keys; insertion_index++) {
         slot = get_slot(data_buffer, insertion_index);
 
-        if (slot->key > key)
+        if (compare_slot_key(slot, data_buffer + slot->offset - HEADER_SIZE,
+                             key) > 0)
             break;
     }
 
@@ -210,6 +432,11 @@ int insert_into_leaf_after_splitting(int64_t table_id, buf_descriptor_t* leaf_bu
 
     // making new leaf
     buf_descriptor_t* new_leaf_buf = make_leaf(table_id);
+    if (new_leaf_buf == NULL) {
+        unpin_buffer(leaf_buf);
+        return DB_BAD_PAGE;
+    }
+
     page_t *new_leaf_page = new_leaf_buf->buf_page;
     uint64_t temp_offset = PAGE_SIZE;
     slot_t *temp_slot;
@@ -238,7 +465,7 @@ int insert_into_leaf_after_splitting(int64_t table_id, buf_descriptor_t* leaf_bu
 
         temp_offset -= val_size;
         
-        temp_slot->key = key;
+        temp_slot->key = key->prefix;
         temp_slot->size = val_size;
         temp_slot->offset = temp_offset;
 
@@ -287,7 +514,7 @@ int insert_into_leaf_after_splitting(int64_t table_id, buf_descriptor_t* leaf_bu
         else
             temp_offset = PAGE_SIZE - val_size;
         
-        temp_slot->key = key;
+        temp_slot->key = key->prefix;
         temp_slot->size = val_size;
         temp_slot->offset = temp_offset;
 
@@ -317,9 +544,11 @@ int insert_into_leaf_after_splitting(int64_t table_id, buf_descriptor_t* leaf_bu
     leaf_page->right_sibling_page_num = new_leaf_buf->page_num;
     
     new_leaf_page->parent_page_num = leaf_page->parent_page_num;
-    new_key = get_slot(new_leaf_page->data, 0)->key;
+    slot = get_slot(new_leaf_page->data, 0);
+    get_slot_key(slot, (byte*)new_leaf_page + slot->offset,
+                 has_var_keys(table_id), &new_key);
 
-    return insert_into_parent(table_id, leaf_buf, new_key, new_leaf_buf);
+    return insert_into_parent(table_id, leaf_buf, &new_key, new_leaf_buf);
 }
 
 /* Inserts a new key and page num
@@ -327,15 +556,21 @@ int insert_into_leaf_after_splitting(int64_t table_id, buf_descriptor_t* leaf_bu
  * without violating the B+ tree properties.
  */
 int insert_into_node(int64_t table_id, buf_descriptor_t *internal_buf,
-                     int right_index, uint64_t key, pagenum_t right_num) {
+                     int right_index, const tree_key_t *key, pagenum_t right_num) {
     page_t *parent_page = internal_buf->buf_page;
+    int format = get_format(table_id);
+    internal_entry temp_nodes[MAX_INTERNAL_PAIRS];
+    int num_keys = parent_page->num_of_keys;
+
+    internal_unpack(parent_page, temp_nodes, format);
+
+    for (int i = num_keys; i > right_index; i--)
+        temp_nodes[i] = temp_nodes[i - 1];
 
-    for (int i = parent_page->num_of_keys; i > right_index; i--)
-        parent_page->pairs[i] = parent_page->pairs[i - 1];
+    temp_nodes[right_index].key = *key;
+    temp_nodes[right_index].page_num = right_num;
 
-    parent_page->pairs[right_index].key = key;
-    parent_page->pairs[right_index].page_num = right_num;
-    parent_page->num_of_keys++;
+    internal_pack(parent_page, temp_nodes, num_keys + 1, format);
 
     mark_buffer_dirty(internal_buf);
     unpin_buffer(internal_buf);
@@ -343,17 +578,30 @@ int insert_into_node(int64_t table_id, buf_descriptor_t *internal_buf,
     return 0;
 }
 
+/* Releases the two pages of a split that
+ * meets a page it cannot read in.
+ */
+int give_up_split(buf_descriptor_t *left_buf, buf_descriptor_t *right_buf) {
+    mark_buffer_dirty(left_buf);
+    mark_buffer_dirty(right_buf);
+    unpin_buffer(left_buf);
+    unpin_buffer(right_buf);
+
+    return DB_BAD_PAGE;
+}
+
 /* Inserts a new key and page num
  * into an internal page, causing the page's size to exceed
  * the order, and causing the page to split into two.
  */
 int insert_into_node_after_splitting(int64_t table_id, buf_descriptor_t *internal_buf,
-                                     int right_index, uint64_t key, pagenum_t right_num) {
+                                     int right_index, const tree_key_t *key, pagenum_t right_num) {
     page_t* internal_page = internal_buf->buf_page;
+    int format = get_format(table_id);
 
-    int i, j, split;
-    uint64_t k_prime;
-    kp_pair temp_nodes[INTERNAL_ORDER+5];
+    int i, split, num_pairs;
+    tree_key_t k_prime;
+    internal_entry temp_nodes[MAX_INTERNAL_PAIRS + 1];
 
     /* First create a temporary set of key - page num pairs
      * to hold everything in order, including
@@ -364,46 +612,46 @@ int insert_into_node_after_splitting(int64_t table_id, buf_descriptor_t *interna
      * the other half to the new.
      */
 
-    for (i = 0, j = 0; i < INTERNAL_ORDER - 1; i++, j++) {
-        if (j == right_index)
-            j++;
+    num_pairs = internal_page->num_of_keys + 1;
+    internal_unpack(internal_page, temp_nodes, format);
 
-        temp_nodes[j] = internal_page->pairs[i];
-    }
+    for (i = num_pairs - 1; i > right_index; i--)
+        temp_nodes[i] = temp_nodes[i - 1];
 
-    temp_nodes[right_index].key = key;
+    temp_nodes[right_index].key = *key;
     temp_nodes[right_index].page_num = right_num;
 
     /* Create the new page and copy
      * half the keys and pointers to the
      * old and half to the new.
      */  
-    split = cut(INTERNAL_ORDER) - 1;
+    split = cut(num_pairs) - 1;
     
     buf_descriptor_t *new_internal_buf = make_node(table_id);
+    if (new_internal_buf == NULL) {
+        unpin_buffer(internal_buf);
+        return DB_BAD_PAGE;
+    }
+
     pagenum_t new_internal_page_num = new_internal_buf->page_num;
     page_t *new_internal_page = new_internal_buf->buf_page;
 
-    internal_page->num_of_keys = 0;
-
     // Left, original internal page.
-    for (i = 0; i < split; i++) {
-        internal_page->pairs[i] = temp_nodes[i];
-        internal_page->num_of_keys++;
-    }
+    internal_pack(internal_page, temp_nodes, split, format);
     
     k_prime = temp_nodes[split].key;
     new_internal_page->most_left_page_num = temp_nodes[split].page_num;
     new_internal_page->parent_page_num = internal_page->parent_page_num;
 
     // Right, new internal page.
-    for (++i, j = 0; i < INTERNAL_ORDER; i++, j++) {
-        new_internal_page->pairs[j] = temp_nodes[i];
-        new_internal_page->num_of_keys++;
-    }
+    internal_pack(new_internal_page, temp_nodes + split + 1,
+                  num_pairs - split - 1, format);
 
     pagenum_t child_num = new_internal_page->most_left_page_num;
-    buf_descriptor_t *child_buf = get_buffer(table_id, child_num);
+    buf_descriptor_t *child_buf = get_buffer(table_id, child_num,
+                                             BUFFER_ACCESS_MAINTENANCE);
+    if (child_buf == NULL)
+        return give_up_split(internal_buf, new_internal_buf);
 
     child_buf->buf_page->parent_page_num = new_internal_page_num;
 
@@ -411,9 +659,11 @@ int insert_into_node_after_splitting(int64_t table_id, buf_descriptor_t *interna
     unpin_buffer(child_buf);
 
     // Set the parent number of child pages.
-    for (i = 0; i < new_internal_page->num_of_keys; i++) {
-        child_num = new_internal_page->pairs[i].page_num;
-        child_buf = get_buffer(table_id, child_num);
+    for (i = split + 1; i < num_pairs; i++) {
+        child_num = temp_nodes[i].page_num;
+        child_buf = get_buffer(table_id, child_num, BUFFER_ACCESS_MAINTENANCE);
+        if (child_buf == NULL)
+            return give_up_split(internal_buf, new_internal_buf);
         child_buf->buf_page->parent_page_num = new_internal_page_num;
         mark_buffer_dirty(child_buf);
         unpin_buffer(child_buf);
@@ -424,17 +674,18 @@ int insert_into_node_after_splitting(int64_t table_id, buf_descriptor_t *interna
      * the old page to the left and the new to the right.
      */
 
-    return insert_into_parent(table_id, internal_buf, k_prime, new_internal_buf);
+    return insert_into_parent(table_id, internal_buf, &k_prime, new_internal_buf);
 }
 
 /* Inserts a new page (leaf or internal) into the B+ tree.
  * Returns the root of the tree after insertion.
  */
-int insert_into_parent(int64_t table_id, buf_descriptor_t *left_buf, uint64_t key,
+int insert_into_parent(int64_t table_id, buf_descriptor_t *left_buf, const tree_key_t *key,
                        buf_descriptor_t *right_buf) {
     page_t *left_page = left_buf->buf_page;
 
     int right_index;
+    int format = get_format(table_id);
     pagenum_t parent_num = left_page->parent_page_num;
     pagenum_t right_num = right_buf->page_num;
 
@@ -449,15 +700,18 @@ int insert_into_parent(int64_t table_id, buf_descriptor_t *left_buf, uint64_t ke
     unpin_buffer(right_buf);
 
     buf_descriptor_t *parent_buf = get_buffer(table_id, parent_num);
+    if (parent_buf == NULL)
+        return DB_BAD_PAGE;
+
     page_t *parent = parent_buf->buf_page;
 
-    right_index = get_right_index(parent, key);
+    right_index = get_right_index(parent, key, format);
 
 
     /* Simple case: the new key fits into the node. 
      */
 
-    if (parent->num_of_keys < INTERNAL_ORDER - 1)
+    if (internal_has_room(parent, key, format))
         return insert_into_node(table_id, parent_buf, right_index, key, right_num);
 
     /* Harder case:  split a node in order 
@@ -471,20 +725,30 @@ int insert_into_parent(int64_t table_id, buf_descriptor_t *left_buf, uint64_t ke
  * and inserts the appropriate key into
  * the new root.
  */
-int insert_into_new_root(int64_t table_id, buf_descriptor_t *left_buf, uint64_t key,
+int insert_into_new_root(int64_t table_id, buf_descriptor_t *left_buf, const tree_key_t *key,
                          buf_descriptor_t *right_buf) {
+    buf_descriptor_t *header_buf = get_buffer(table_id, 0);
+    if (header_buf == NULL)
+        return give_up_split(left_buf, right_buf);
+
     buf_descriptor_t *root_buf = make_node(table_id);
+    if (root_buf == NULL) {
+        unpin_buffer(header_buf);
+        return give_up_split(left_buf, right_buf);
+    }
+
     page_t* root_page = root_buf->buf_page;
+    internal_entry root_pair;
+
+    root_pair.key = *key;
+    root_pair.page_num = right_buf->page_num;
 
     root_page->most_left_page_num = left_buf->page_num;
-    root_page->pairs[0].key = key;
-    root_page->pairs[0].page_num = right_buf->page_num;
-    root_page->num_of_keys++;
+    internal_pack(root_page, &root_pair, 1, get_format(table_id));
     root_page->parent_page_num = -1;
     left_buf->buf_page->parent_page_num = root_buf->page_num;
     right_buf->buf_page->parent_page_num = root_buf->page_num;
 
-    buf_descriptor_t *header_buf = get_buffer(table_id, 0);
     header_buf->buf_page->root_page_num = root_buf->page_num;
 
     mark_buffer_dirty(left_buf);
@@ -499,18 +763,25 @@ int insert_into_new_root(int64_t table_id, buf_descriptor_t *left_buf, uint64_t
     return 0;
 }
 
-int start_new_tree(int64_t table_id, db_key_t key, const char *value, uint16_t val_size) {
+int start_new_tree(int64_t table_id, const tree_key_t *key, const char *value, uint16_t val_size) {
+    buf_descriptor_t *header_buf = get_buffer(table_id, 0);
+    if (header_buf == NULL)
+        return DB_BAD_PAGE;
+
     buf_descriptor_t *root_buf = make_leaf(table_id);
-    page_t *root_page = root_buf->buf_page;
+    if (root_buf == NULL) {
+        unpin_buffer(header_buf);
+        return DB_BAD_PAGE;
+    }
 
-    buf_descriptor_t *header_buf = get_buffer(table_id, 0);
+    page_t *root_page = root_buf->buf_page;
     page_t *header_page = header_buf->buf_page;
     header_page->root_page_num = root_buf->page_num;
     
     slot_t *slot = get_slot(root_page->data, 0);
     uint16_t new_offset = PAGE_SIZE - val_size;
 
-    slot->key = key;
+    slot->key = key->prefix;
     slot->size = val_size;
     slot->offset = new_offset;
 
@@ -535,13 +806,13 @@ int start_new_tree(int64_t table_id, db_key_t key, const char *value, uint16_t v
  * is the leftmost child), returns -1 to signify
  * this special case.
  */
-int get_neighbor_index(page_t* parent, pagenum_t p_num)
+int get_neighbor_index(page_t* parent, pagenum_t p_num, int format)
 {
     if (parent->most_left_page_num == p_num)
         return -1;
 
     for (int i = 0; i < parent->num_of_keys; i++) {
-        if (parent->pairs[i].page_num == p_num)
+        if (internal_get_child(parent, i, format) == p_num)
             return i;
     }
 
@@ -550,7 +821,7 @@ int get_neighbor_index(page_t* parent, pagenum_t p_num)
     exit(EXIT_FAILURE);
 }
 
-int remove_entry_from_page(int64_t table_id, buf_descriptor_t* buf, uint64_t key) {
+int remove_entry_from_page(int64_t table_id, buf_descriptor_t* buf, const tree_key_t *key) {
     page_t *page = buf->buf_page;
 
     int i;
@@ -559,13 +830,21 @@ int remove_entry_from_page(int64_t table_id, buf_descriptor_t* buf, uint64_t key
     i = 0;
 
     if (!page->is_leaf) {
+        int format = get_format(table_id);
+        internal_entry temp_nodes[MAX_INTERNAL_PAIRS];
+
+        internal_unpack(page, temp_nodes, format);
+
         // Find the deletion point.
-        while (page->pairs[i].key != key)
+        while (key_compare(&temp_nodes[i].key, key) != 0)
             i++;
 
         // Shift the remaining key-pointer pairs. 
         for (i++; i < page->num_of_keys; i++)
-            page->pairs[i - 1] = page->pairs[i];
+            temp_nodes[i - 1] = temp_nodes[i];
+
+        // One key fewer.
+        internal_pack(page, temp_nodes, page->num_of_keys - 1, format);
     } else {
         uint16_t val_size;
         uint64_t temp_offset;
@@ -575,7 +854,7 @@ int remove_entry_from_page(int64_t table_id, buf_descriptor_t* buf, uint64_t key
         for (; i < page->num_of_keys; i++) {
             slot = get_slot(page->data, i);
 
-            if (slot->key == key) {
+            if (compare_slot_key(slot, (byte*)page + slot->offset, key) == 0) {
                 val_size = slot->size;
                 break;
             }
@@ -598,10 +877,10 @@ int remove_entry_from_page(int64_t table_id, buf_descriptor_t* buf, uint64_t key
         }
 
         page->amount_of_free_space += (SLOT_SIZE + val_size);
-    }
 
-    // One key fewer.
-    (page->num_of_keys)--;
+        // One key fewer.
+        (page->num_of_keys)--;
+    }
 
     mark_buffer_dirty(buf);
 
@@ -622,21 +901,36 @@ int adjust_root(int64_t table_id, buf_descriptor_t* root_buf) {
     }
 
     /* Case: empty root. 
+     * An empty root is left as it is if a page
+     * cannot be read in.
      */
 
-    free_page(table_id, root_buf);
+    buf_descriptor_t *header_buf = get_buffer(table_id, 0);
+    buf_descriptor_t *child_buf = NULL;
+
+    if (header_buf != NULL && !root_page->is_leaf)
+        child_buf = get_buffer(table_id, root_page->most_left_page_num);
+
+    if (header_buf == NULL || (!root_page->is_leaf && child_buf == NULL) ||
+        free_page(table_id, root_buf)) {
+        if (child_buf != NULL)
+            unpin_buffer(child_buf);
+        if (header_buf != NULL)
+            unpin_buffer(header_buf);
+        unpin_buffer(root_buf);
+        return DB_BAD_PAGE;
+    }
+
+    page_t *header_page = header_buf->buf_page;
 
     // If it has a child, promote 
     // the first (only) child
     // as the new root.
 
-    buf_descriptor_t *header_buf = get_buffer(table_id, 0);
-    page_t *header_page = header_buf->buf_page;
-
     if (!root_page->is_leaf) {
         header_page->root_page_num = root_page->most_left_page_num;
         unpin_buffer(root_buf);
-        root_buf = get_buffer(table_id, header_page->root_page_num);
+        root_buf = child_buf;
         root_buf->buf_page->parent_page_num = -1;
         mark_buffer_dirty(root_buf);
     }
@@ -662,7 +956,7 @@ int adjust_root(int64_t table_id, buf_descriptor_t* root_buf) {
  */
 int coalesce_nodes(int64_t table_id, buf_descriptor_t *buf,
                    buf_descriptor_t *neighbor_buf, buf_descriptor_t *parent_buf,
-                   int neighbor_index, int k_prime) {
+                   int neighbor_index, const tree_key_t *k_prime) {
 
     int i, j, n_end, insertion_index;
 
@@ -694,16 +988,19 @@ int coalesce_nodes(int64_t table_id, buf_descriptor_t *buf,
     insertion_index = neighbor_page->num_of_keys;
     n_end = page->num_of_keys;
     if (!page->is_leaf) {
+        int format = get_format(table_id);
+        internal_entry temp_nodes[MAX_INTERNAL_PAIRS];
+
+        internal_unpack(neighbor_page, temp_nodes, format);
+
         // Append k_prime.
-        neighbor_page->pairs[insertion_index].key = k_prime;
-        neighbor_page->pairs[insertion_index].page_num = page->most_left_page_num;
-        neighbor_page->num_of_keys++;
+        temp_nodes[insertion_index].key = *k_prime;
+        temp_nodes[insertion_index].page_num = page->most_left_page_num;
         
         // Pull key-pointer pairs.
-        for (i = insertion_index + 1, j = 0; j < n_end; i++, j++)
-            neighbor_page->pairs[i] = page->pairs[j];
-
-        neighbor_page->num_of_keys += n_end;
+        internal_unpack(page, temp_nodes + insertion_index + 1, format);
+        internal_pack(neighbor_page, temp_nodes, insertion_index + 1 + n_end,
+                      format);
         
         pagenum_t child_num;
         buf_descriptor_t *child_buf;
@@ -711,8 +1008,13 @@ int coalesce_nodes(int64_t table_id, buf_descriptor_t *buf,
         // Set the parent number of the child nodes.
         for (i = insertion_index; i < neighbor_page->num_of_keys; i++)
         {
-            child_num = neighbor_page->pairs[i].page_num;
-            child_buf = get_buffer(table_id, child_num);
+            child_num = temp_nodes[i].page_num;
+            child_buf = get_buffer(table_id, child_num,
+                                   BUFFER_ACCESS_MAINTENANCE);
+            if (child_buf == NULL) {
+                unpin_buffer(parent_buf);
+                return give_up_split(buf, neighbor_buf);
+            }
             child_buf->buf_page->parent_page_num = neighbor_buf->page_num;
 
             mark_buffer_dirty(child_buf);
@@ -755,7 +1057,11 @@ int coalesce_nodes(int64_t table_id, buf_descriptor_t *buf,
         neighbor_page->right_sibling_page_num = page->right_sibling_page_num;
     }
 
-    free_page(table_id, buf);
+    if (free_page(table_id, buf)) {
+        unpin_buffer(parent_buf);
+        return give_up_split(buf, neighbor_buf);
+    }
+
     mark_buffer_dirty(neighbor_buf);
     unpin_buffer(buf);
     unpin_buffer(neighbor_buf);
@@ -763,6 +1069,18 @@ int coalesce_nodes(int64_t table_id, buf_descriptor_t *buf,
     return delete_entry(table_id, parent_buf, k_prime);
 }
 
+/* Releases the pages of a redistribution
+ * that has been given up.
+ */
+int skip_redistribution(buf_descriptor_t *buf, buf_descriptor_t *neighbor_buf,
+                        buf_descriptor_t *parent_buf) {
+    unpin_buffer(parent_buf);
+    unpin_buffer(buf);
+    unpin_buffer(neighbor_buf);
+
+    return 0;
+}
+
 /* Redistributes entries between two nodes when
  * one has become too small after deletion
  * but its neighbor is too big to append the
@@ -771,14 +1089,25 @@ int coalesce_nodes(int64_t table_id, buf_descriptor_t *buf,
  */
 int redistribute_nodes(int64_t table_id, buf_descriptor_t *buf,
                        buf_descriptor_t *neighbor_buf, buf_descriptor_t *parent_buf,
-                       int neighbor_index, int k_prime_index, int k_prime) {
+                       int neighbor_index, int k_prime_index, const tree_key_t *k_prime) {
     page_t *page = buf->buf_page;
     page_t *neighbor_page = neighbor_buf->buf_page;
     page_t *parent_page = parent_buf->buf_page;
+    int format = get_format(table_id);
+    bool var_keys = has_var_keys(table_id);
 
     int i;
     buf_descriptor_t *temp_buf;
     pagenum_t temp_num;
+    tree_key_t new_k_prime;
+    internal_entry temp_nodes[MAX_INTERNAL_PAIRS];
+
+    /* The key of the parent is set before moving anything.
+     * A packed parent cannot always take a key widening
+     * its key range, nor a var parent a longer key, and
+     * then this node is left below the minimum, which
+     * is harmless.
+     */
 
     /* Case: this node has a neighbor to the left. 
      * Pull the neighbor's last key-pointer pair over
@@ -786,29 +1115,38 @@ int redistribute_nodes(int64_t table_id, buf_descriptor_t *buf,
      */
     if (neighbor_index != -1) {
         if (!page->is_leaf) {
-            // Push key-pointer pairs to the right.
-            for (i = page->num_of_keys; i > 0; i--)
-                page->pairs[i] = page->pairs[i - 1];
+            int last = neighbor_page->num_of_keys - 1;
 
             // Set the key of the parent node.
-            parent_page->pairs[k_prime_index].key =
-                neighbor_page->pairs[neighbor_page->num_of_keys - 1].key;
-            temp_num = neighbor_page->pairs[neighbor_page->num_of_keys - 1].page_num;
+            internal_get_key(neighbor_page, last, format, &new_k_prime);
+            if (set_internal_key(parent_page, k_prime_index, &new_k_prime, format))
+                return skip_redistribution(buf, neighbor_buf, parent_buf);
+            temp_num = internal_get_child(neighbor_page, last, format);
 
             // Pull the neighbor's last key-pointer pair.
-            page->pairs[0].key = k_prime;
-            page->pairs[0].page_num = page->most_left_page_num;
+            temp_nodes[0].key = *k_prime;
+            temp_nodes[0].page_num = page->most_left_page_num;
             page->most_left_page_num = temp_num;
 
+            // Push key-pointer pairs to the right.
+            internal_unpack(page, temp_nodes + 1, format);
+            internal_pack(page, temp_nodes, page->num_of_keys + 1, format);
+
+            internal_unpack(neighbor_page, temp_nodes, format);
+            internal_pack(neighbor_page, temp_nodes, last, format);
+
             // Set the parent number of the child node.
-            temp_buf = get_buffer(table_id, temp_num);
+            temp_buf = get_buffer(table_id, temp_num,
+                                  BUFFER_ACCESS_MAINTENANCE);
+            if (temp_buf == NULL) {
+                mark_buffer_dirty(parent_buf);
+                unpin_buffer(parent_buf);
+                return give_up_split(buf, neighbor_buf);
+            }
             temp_buf->buf_page->parent_page_num = buf->page_num;
 
             mark_buffer_dirty(temp_buf);
             unpin_buffer(temp_buf);
-
-            (page->num_of_keys)++;
-            (neighbor_page->num_of_keys)--;
         } else {
             int j, count;
             uint64_t amount_of_free_space = page->amount_of_free_space;
@@ -829,6 +1167,13 @@ int redistribute_nodes(int64_t table_id, buf_descriptor_t *buf,
                     break;
             }
 
+            // Set the key of the parent node.
+            slot = get_slot(neighbor_page->data, neighbor_page->num_of_keys - count);
+            get_slot_key(slot, (byte*)neighbor_page + slot->offset, var_keys,
+                         &new_k_prime);
+            if (set_internal_key(parent_page, k_prime_index, &new_k_prime, format))
+                return skip_redistribution(buf, neighbor_buf, parent_buf);
+
             // Push records to the right.
             for (i = page->num_of_keys - 1; i >= 0; i--) {
                 slot = get_slot(page->data, i);
@@ -867,8 +1212,6 @@ int redistribute_nodes(int64_t table_id, buf_descriptor_t *buf,
 
             page->num_of_keys += count;
             neighbor_page->num_of_keys -= count;
-
-            parent_page->pairs[k_prime_index].key = get_slot(page->data, 0)->key;
         }
     }
 
@@ -880,27 +1223,35 @@ int redistribute_nodes(int64_t table_id, buf_descriptor_t *buf,
     else {
         if (!page->is_leaf) {
             // Set the key of the parent node.
-            parent_page->pairs[k_prime_index].key = neighbor_page->pairs[0].key;
+            internal_get_key(neighbor_page, 0, format, &new_k_prime);
+            if (set_internal_key(parent_page, k_prime_index, &new_k_prime, format))
+                return skip_redistribution(buf, neighbor_buf, parent_buf);
             temp_num = neighbor_page->most_left_page_num;
 
             // Pull the neighbor's leftmost key-pointer pair.
-            page->pairs[page->num_of_keys].key = k_prime;
-            page->pairs[page->num_of_keys].page_num = temp_num;
-            neighbor_page->most_left_page_num = neighbor_page->pairs[0].page_num;
+            internal_unpack(page, temp_nodes, format);
+            temp_nodes[page->num_of_keys].key = *k_prime;
+            temp_nodes[page->num_of_keys].page_num = temp_num;
+            internal_pack(page, temp_nodes, page->num_of_keys + 1, format);
 
             // Push key-pointer pairs to the left.
-            for (i = 0; i < neighbor_page->num_of_keys - 1; i++)
-                neighbor_page->pairs[i] = neighbor_page->pairs[i + 1];
+            internal_unpack(neighbor_page, temp_nodes, format);
+            neighbor_page->most_left_page_num = temp_nodes[0].page_num;
+            internal_pack(neighbor_page, temp_nodes + 1,
+                          neighbor_page->num_of_keys - 1, format);
 
             // Set the parent number of the child node.
-            temp_buf = get_buffer(table_id, temp_num);
+            temp_buf = get_buffer(table_id, temp_num,
+                                  BUFFER_ACCESS_MAINTENANCE);
+            if (temp_buf == NULL) {
+                mark_buffer_dirty(parent_buf);
+                unpin_buffer(parent_buf);
+                return give_up_split(buf, neighbor_buf);
+            }
             temp_buf->buf_page->parent_page_num = buf->page_num;
 
             mark_buffer_dirty(temp_buf);
             unpin_buffer(temp_buf);
-
-            (page->num_of_keys)++;
-            (neighbor_page->num_of_keys)--;
         } else {
             int j, count;
             uint64_t amount_of_free_space = page->amount_of_free_space;
@@ -921,6 +1272,13 @@ int redistribute_nodes(int64_t table_id, buf_descriptor_t *buf,
                     break;
             }
 
+            // Set the key of the parent node.
+            slot = get_slot(neighbor_page->data, count);
+            get_slot_key(slot, (byte*)neighbor_page + slot->offset, var_keys,
+                         &new_k_prime);
+            if (set_internal_key(parent_page, k_prime_index, &new_k_prime, format))
+                return skip_redistribution(buf, neighbor_buf, parent_buf);
+
             // Pull neighbor's records.
             temp_offset = get_slot(page->data, page->num_of_keys - 1)->offset;
             for(i = 0, j = page->num_of_keys; i < count; i++, j++) {
@@ -959,9 +1317,6 @@ int redistribute_nodes(int64_t table_id, buf_descriptor_t *buf,
 
             page->num_of_keys += count;
             neighbor_page->num_of_keys -= count;
-
-            parent_page->pairs[k_prime_index].key =
-                get_slot(neighbor_page->data, 0)->key;
         }
     }
 
@@ -984,10 +1339,20 @@ int redistribute_nodes(int64_t table_id, buf_descriptor_t *buf,
  * from the leaf, and then makes all appropriate
  * changes to preserve the B+ tree properties.
  */
-int delete_entry(int64_t table_id, buf_descriptor_t* buf, uint64_t key) {
+int delete_entry(int64_t table_id, buf_descriptor_t* buf, const tree_key_t *key) {
     
     int k_prime_index, neighbor_index;
 
+    buf_descriptor_t *header_buf = get_buffer(table_id, 0);
+    if (header_buf == NULL) {
+        unpin_buffer(buf);
+        return DB_BAD_PAGE;
+    }
+
+    page_t *header_page = header_buf->buf_page;
+    pagenum_t root_num = header_page->root_page_num;
+    unpin_buffer(header_buf);
+
     // Remove key and pointer from node.
 
     remove_entry_from_page(table_id, buf, key);
@@ -995,11 +1360,6 @@ int delete_entry(int64_t table_id, buf_descriptor_t* buf, uint64_t key) {
     /* Case:  deletion from the root. 
      */
 
-    buf_descriptor_t *header_buf = get_buffer(table_id, 0);
-    page_t *header_page = header_buf->buf_page;
-    pagenum_t root_num = header_page->root_page_num;
-    unpin_buffer(header_buf);
-
     if (buf->page_num == root_num) 
         return adjust_root(table_id, buf);
 
@@ -1012,8 +1372,10 @@ int delete_entry(int64_t table_id, buf_descriptor_t* buf, uint64_t key) {
     /* Case:  node stays at or above minimum.
      * (The simple case.)
      */
+    int format = get_format(table_id);
+
     if (!page->is_leaf) {
-        if (page->num_of_keys >= cut(INTERNAL_ORDER) - 1) {
+        if (!internal_is_underfull(page, format)) {
             unpin_buffer(buf);
             return 0;
         }
@@ -1034,40 +1396,49 @@ int delete_entry(int64_t table_id, buf_descriptor_t* buf, uint64_t key) {
      * Also find the key (k_prime) in the parent
      * between the pointer to this node and the pointer
      * to the neighbor.
+     * If either cannot be read in, the node is left
+     * below the minimum, which is harmless.
      */
 
     pagenum_t neighbor_num;
-    uint64_t k_prime;
+    tree_key_t k_prime;
 
     pagenum_t parent_num = page->parent_page_num;
     buf_descriptor_t *parent_buf = get_buffer(table_id, parent_num);
+    if (parent_buf == NULL) {
+        unpin_buffer(buf);
+        return DB_BAD_PAGE;
+    }
+
     page_t *parent_page = parent_buf->buf_page;
 
     // Find neighbor and k_prime.
-    neighbor_index = get_neighbor_index(parent_page, buf->page_num);
+    neighbor_index = get_neighbor_index(parent_page, buf->page_num, format);
     k_prime_index = neighbor_index == -1 ? 0 : neighbor_index;
+    internal_get_key(parent_page, k_prime_index, format, &k_prime);
 
-    if (neighbor_index > 0)
-    {
-        k_prime = parent_page->pairs[neighbor_index].key;
-        neighbor_num = parent_page->pairs[neighbor_index - 1].page_num;
-    } else {
-        k_prime = parent_page->pairs[0].key;
+    if (neighbor_index == -1)
+        neighbor_num = internal_get_child(parent_page, 0, format);
+    else
+        neighbor_num = internal_get_child(parent_page, neighbor_index - 1, format);
 
-        if (neighbor_index == -1)
-            neighbor_num = parent_page->pairs[0].page_num;
-        else
-            neighbor_num = parent_page->most_left_page_num;
+    buf_descriptor_t *neighbor_buf = get_buffer(table_id, neighbor_num);
+    if (neighbor_buf == NULL) {
+        unpin_buffer(parent_buf);
+        unpin_buffer(buf);
+        return DB_BAD_PAGE;
     }
 
-    buf_descriptor_t *neighbor_buf = get_buffer(table_id, neighbor_num);
     page_t* neighbor_page = neighbor_buf->buf_page;
     bool is_coalescence;
 
     // Coalescence or Redistribution
     if (!page->is_leaf) {
+        page_t *left_page = neighbor_index == -1 ? page : neighbor_page;
+        page_t *right_page = neighbor_index == -1 ? neighbor_page : page;
+
         is_coalescence =
-            (neighbor_page->num_of_keys + page->num_of_keys < INTERNAL_ORDER - 1);
+            internal_can_merge(left_page, &k_prime, right_page, format);
     } else {
         is_coalescence =
             (neighbor_page->amount_of_free_space + page->amount_of_free_space >= DATA_SIZE);
@@ -1077,43 +1448,48 @@ int delete_entry(int64_t table_id, buf_descriptor_t* buf, uint64_t key) {
 
     if (is_coalescence)
         return coalesce_nodes(table_id, buf, neighbor_buf, parent_buf, 
-                              neighbor_index, k_prime);
+                              neighbor_index, &k_prime);
 
     /* Redistribution. */
 
     else
         return redistribute_nodes(table_id, buf, neighbor_buf, parent_buf,
-                                  neighbor_index, k_prime_index, k_prime);
+                                  neighbor_index, k_prime_index, &k_prime);
 
-    printf("never reach state, key: %lu\n", key);
+    printf("never reach state, key: %ld\n", key->prefix);
     return -1;
 }
 
-int db_find_internal(int64_t table_id, int64_t key, char *ret_val,
+/* Finds the record of the key.
+ * If found, the leaf stays pinned and the value points into it.
+ * Returns 1 if there is no tree, 2 if the record does not exist, or
+ * DB_BAD_PAGE.
+ */
+int db_find_internal(int64_t table_id, const tree_key_t *key, const byte **value,
                      uint16_t *val_size, buf_descriptor_t **leaf_buf) {
-    *leaf_buf = find_leaf(table_id, key);
+    int ret = find_leaf(table_id, key, leaf_buf);
 
-    if (*leaf_buf == NULL)
-        return 1;
+    if (ret != 0)
+        return ret;
 
     page_t *leaf_page = (*leaf_buf)->buf_page;
     int i;
     slot_t *slot;
+    const byte *record;
 
     // Find the key.
     for (i = 0; i < leaf_page->num_of_keys; i++) {
         slot = get_slot(leaf_page->data, i);
+        record = (byte*)leaf_page + slot->offset;
 
-        if (slot->key == key)
+        if (compare_slot_key(slot, record, key) == 0)
             break;
     }
 
     // The key exists.
     if (i < leaf_page->num_of_keys) {
-        if (ret_val != NULL) {
-            memcpy(ret_val, (char*)leaf_page + slot->offset, slot->size);
-            *val_size = slot->size;
-        }
+        if (value != NULL)
+            *value = get_record_value(slot, record, key->size > 0, val_size);
 
         return 0;
     }
@@ -1121,16 +1497,11 @@ int db_find_internal(int64_t table_id, int64_t key, char *ret_val,
     return 2;
 }
 
-// Open an existing database file or create one if not exist.
-int64_t open_table(const char *pathname) {
-    return buffer_open_table(pathname);
-}
-
-// Insert a record to the given table.
-int db_insert(int64_t table_id, int64_t key, const char *value, uint16_t val_size) {
-    if (val_size < MIN_VALUE_SIZE || val_size > MAX_VALUE_SIZE)
-        return 1;
-    
+/* Inserts a record into the leaf the key
+ * belongs to, starting a new tree if empty.
+ */
+int insert_record(int64_t table_id, const tree_key_t *key,
+                  const char *record, uint16_t size) {
     buf_descriptor_t *leaf_buf;
     int ret = db_find_internal(table_id, key, NULL, NULL, &leaf_buf);
 
@@ -1140,132 +1511,1293 @@ int db_insert(int64_t table_id, int64_t key, const char *value, uint16_t val_siz
         return 1;
     }
 
+    // A page on the path cannot be read in.
+    if (ret == DB_BAD_PAGE)
+        return ret;
+
     // The first insertion
     if (ret == 1)
-        return start_new_tree(table_id, key, value, val_size);
+        return start_new_tree(table_id, key, record, size);
 
     // Insert the record directly into the leaf page.
-    if (leaf_buf->buf_page->amount_of_free_space >= (SLOT_SIZE + val_size))
-        return insert_into_leaf(table_id, leaf_buf, key, value, val_size);
+    if (leaf_buf->buf_page->amount_of_free_space >= (SLOT_SIZE + size))
+        return insert_into_leaf(table_id, leaf_buf, key, record, size);
 
     // Insert the record with splitting.
-    return insert_into_leaf_after_splitting(table_id, leaf_buf, key, value, val_size);
+    return insert_into_leaf_after_splitting(table_id, leaf_buf, key, record, size);
 }
 
-// Find a record with the matching key from the given table.
-int db_find(int64_t table_id, int64_t key, char *ret_val, uint16_t *val_size) {
-    buf_descriptor_t *leaf_buf;
-    int ret = db_find_internal(table_id, key, ret_val, val_size, &leaf_buf);
+/* Inserts a value with the key, building the record
+ * for byte-string keys.
+ */
+int insert_value(int64_t table_id, const tree_key_t *key,
+                 const char *value, uint16_t val_size) {
+    char record[RECORD_KEY_HEADER_SIZE + MAX_KEY_SIZE + MAX_VALUE_SIZE];
 
-    if (leaf_buf)
-        unpin_buffer(leaf_buf);
+    if (key->size == 0)
+        return insert_record(table_id, key, value, val_size);
 
-    return ret;
+    // Build the record: the key, then the value.
+    memcpy(record, &key->size, RECORD_KEY_HEADER_SIZE);
+    memcpy(record + RECORD_KEY_HEADER_SIZE, key->data, key->size);
+    memcpy(record + RECORD_KEY_HEADER_SIZE + key->size, value, val_size);
+
+    return insert_record(table_id, key, record,
+                         RECORD_KEY_HEADER_SIZE + key->size + val_size);
 }
 
-// Delete a record with the matching key from the given table.
-int db_delete(int64_t table_id, int64_t key) {
+/* Inserts a value of any size, moving it to
+ * overflow pages if it does not fit a leaf.
+ */
+int insert_large_value(int64_t table_id, const tree_key_t *key,
+                       const char *value, uint32_t val_size) {
     buf_descriptor_t *leaf_buf;
-    int ret = db_find_internal(table_id, key, NULL, NULL, &leaf_buf);
+    overflow_ref ref;
+    int ret;
 
-    // The key does not exist.
-    if (ret != 0)
+    if (val_size < MIN_VALUE_SIZE || val_size > MAX_LARGE_VALUE_SIZE)
         return 1;
 
-    return delete_entry(table_id, leaf_buf, key);
-}
+    if (val_size <= MAX_VALUE_SIZE)
+        return insert_value(table_id, key, value, val_size);
 
-// Find records with a key betwen the range: begin_key <= key <= end_key
-int db_scan(int64_t table_id, int64_t begin_key, int64_t end_key,
-            std::vector<int64_t> *keys, std::vector<char*> *values,
-            std::vector<uint16_t> *val_sizes) {
+    // Check the key first not to write the value in vain.
+    ret = db_find_internal(table_id, key, NULL, NULL, &leaf_buf);
 
-    buf_descriptor_t *leaf_buf = find_leaf(table_id, begin_key);
+    if (leaf_buf)
+        unpin_buffer(leaf_buf);
 
-    // There is no root page.
-    if (leaf_buf == NULL)
+    if (ret == 0)
         return 1;
 
-    page_t *leaf_page = leaf_buf->buf_page;
-    int i = 0;
-    slot_t *slot;
-    db_key_t temp_key = begin_key;
-    char *temp_value;
-    uint16_t val_size;
-    pagenum_t sibling_num;
-    bool reached_end = false;
-
-    // Find the leaf page that contains begin_key.
-    while (temp_key <= end_key) {
-        slot = get_slot(leaf_page->data, i);
-        temp_key = slot->key;
+    if (ret == DB_BAD_PAGE)
+        return ret;
 
-        if (temp_key >= begin_key)
-            break;
+    if (overflow_write(table_id, value, val_size, &ref))
+        return 1;
 
-        if (i < leaf_page->num_of_keys - 1) {
-            i++;
-        } else {
-            sibling_num = leaf_page->right_sibling_page_num;
+    return insert_value(table_id, key, (const char*)&ref, OVERFLOW_REF_SIZE);
+}
 
-            if (sibling_num == -1) {
-                reached_end = true;
-                break;
-            }
+/* Delete the record with the key, with its overflow pages.
+ * With old_value, the value as stored in the leaf is copied there, and its
+ * overflow pages are left to the caller.
+ */
+int delete_record(int64_t table_id, const tree_key_t *key,
+                  char *old_value = NULL, uint16_t *old_size = NULL) {
+    buf_descriptor_t *leaf_buf;
+    const byte *value;
+    uint16_t val_size;
+    overflow_ref ref;
+    int ret = db_find_internal(table_id, key, &value, &val_size, &leaf_buf);
 
+    // The key does not exist.
+    if (ret != 0) {
+        if (leaf_buf)
             unpin_buffer(leaf_buf);
-
-            leaf_buf = get_buffer(table_id, sibling_num);
-            leaf_page = leaf_buf->buf_page;
-            i = 0;
-        }
+        return ret == DB_BAD_PAGE ? ret : 1;
     }
 
-    // There is no key for this range.
-    if (temp_key > end_key || reached_end) {
-        unpin_buffer(leaf_buf);
-        return 1;
+    if (old_value != NULL) {
+        memcpy(old_value, value, val_size);
+        *old_size = val_size;
+        return delete_entry(table_id, leaf_buf, key);
     }
 
-    // Scan leaf pages.
-    while (temp_key <= end_key) {
-        val_size = slot->size;
-        keys->push_back(temp_key);
-        temp_value = (char*)calloc(1, val_size);
+    if (!is_overflow_value(val_size))
+        return delete_entry(table_id, leaf_buf, key);
 
-        memcpy(temp_value, (char*)leaf_page + slot->offset, val_size);
-        values->push_back(temp_value);
-        val_sizes->push_back(val_size);
-        
-        if (i < leaf_page->num_of_keys - 1) {
-            i++;
-        } else {
-            sibling_num = leaf_page->right_sibling_page_num;
+    memcpy(&ref, value, OVERFLOW_REF_SIZE);
+    ret = delete_entry(table_id, leaf_buf, key);
+    overflow_free(table_id, &ref);
 
-            if (sibling_num == -1)
-                break;
+    return ret;
+}
+
+/* Replace the value of the record with the key.
+ * The old value as stored in the leaf is copied to old_value, and its
+ * overflow pages are left to the caller.
+ */
+int update_record(int64_t table_id, const tree_key_t *key, const char *value,
+                  uint16_t val_size, char *old_value, uint16_t *old_size) {
+    buf_descriptor_t *leaf_buf;
+    const byte *cur_value;
+    uint16_t cur_size;
+    char temp[MAX_UNDO_VALUE_SIZE];
+    uint16_t temp_size;
+    int ret = db_find_internal(table_id, key, &cur_value, &cur_size, &leaf_buf);
 
+    // The key does not exist.
+    if (ret != 0) {
+        if (leaf_buf)
             unpin_buffer(leaf_buf);
+        return ret == DB_BAD_PAGE ? ret : 1;
+    }
+
+    memcpy(old_value, cur_value, cur_size);
+    *old_size = cur_size;
+
+    // A value of the same size is overwritten in place.
+    if (cur_size == val_size) {
+        memcpy((byte*)cur_value, value, val_size);
+        mark_buffer_dirty(leaf_buf);
+        unpin_buffer(leaf_buf);
+        return 0;
+    }
+
+    unpin_buffer(leaf_buf);
+
+    ret = delete_record(table_id, key, temp, &temp_size);
+    if (ret != 0)
+        return ret;
+
+    return insert_value(table_id, key, value, val_size);
+}
+
+// Apply an undo entry of a transaction
+int apply_undo(const undo_entry *entry) {
+    const tree_key_t *key = &entry->key;
+
+    switch (entry->type) {
+    case UNDO_INSERT:
+        return delete_record(entry->table_id, key);
+    case UNDO_DELETE:
+        return insert_value(entry->table_id, key, entry->value,
+                            entry->val_size);
+    case UNDO_UPDATE:
+        if (delete_record(entry->table_id, key))
+            return 1;
+        return insert_value(entry->table_id, key, entry->value,
+                            entry->val_size);
+    }
+
+    return 1;
+}
+
+/* Keep the value replaced or deleted for the snapshots that still see it,
+ * or drop its overflow pages.
+ */
+void release_old_value(int64_t table_id, const tree_key_t *key,
+                       const txn_t *txn, const char *value, uint16_t val_size) {
+    overflow_ref ref;
+
+    if (mvcc_add_version(table_id, key, txn, true, value, val_size) ||
+        !is_overflow_value(val_size))
+        return;
+
+    memcpy(&ref, value, OVERFLOW_REF_SIZE);
+    overflow_free(table_id, &ref);
+}
+
+/* Finds the first key after the given one.
+ * Returns 1 if there is none, or DB_BAD_PAGE.
+ */
+int find_next_key(int64_t table_id, const tree_key_t *key,
+                  tree_key_t *next_key) {
+    bool var_keys = key->size > 0;
+    buf_descriptor_t *leaf_buf;
+    pagenum_t sibling_num;
+    slot_t *slot;
+    const byte *record;
+    int i = 0;
+    int ret = find_leaf(table_id, key, &leaf_buf);
+
+    // There is no root page.
+    if (ret != 0)
+        return ret;
+
+    while (true) {
+        page_t *leaf_page = leaf_buf->buf_page;
+
+        for (; i < leaf_page->num_of_keys; i++) {
+            slot = get_slot(leaf_page->data, i);
+            record = (byte*)leaf_page + slot->offset;
+
+            if (compare_slot_key(slot, record, key) > 0) {
+                get_slot_key(slot, record, var_keys, next_key);
+                unpin_buffer(leaf_buf);
+                return 0;
+            }
+        }
+
+        sibling_num = leaf_page->right_sibling_page_num;
+        unpin_buffer(leaf_buf);
+
+        if (sibling_num == -1)
+            return 1;
+
+        leaf_buf = get_buffer(table_id, sibling_num, BUFFER_ACCESS_SCAN);
+        if (leaf_buf == NULL)
+            return DB_BAD_PAGE;
+        i = 0;
+    }
+}
+
+/* Gets who locks the records of an operation: the transaction of the
+ * thread, or self for an operation by itself while transactions may hold
+ * locks. Returns NULL if no lock is needed.
+ * Called in the operation.
+ */
+txn_t *get_lock_owner(txn_t *self) {
+    txn_t *txn = txn_get_current();
+
+    if (txn != NULL)
+        return txn;
+
+    if (txn_num_active() == 0)
+        return NULL;
+
+    self->txn_id = txn_new_id();
+    self->isolation = TXN_SERIALIZABLE;
+    return self;
+}
+
+/* Locks a record (the end of the table if key is NULL) in an operation.
+ * A busy lock is waited for with the latch released.
+ * Returns 0 if locked at once, 1 if locked after a wait (the tree may have
+ * changed meanwhile), or TXN_ROLLED_BACK on a deadlock.
+ */
+int lock_record(txn_t *owner, int64_t table_id, const tree_key_t *key,
+                int mode, bool instant) {
+    if (lock_acquire(owner, table_id, key, mode, instant, false) ==
+        LOCK_GRANTED)
+        return 0;
+
+    end_operation();
+    int ret = lock_acquire(owner, table_id, key, mode, instant, true);
+    begin_operation();
+
+    return ret == LOCK_GRANTED ? 1 : TXN_ROLLED_BACK;
+}
+
+/* Locks the key after the given one, or the end of the table (also if
+ * the leaves cannot be read in, which the operation then fails on).
+ */
+int lock_next_record(txn_t *owner, int64_t table_id, const tree_key_t *key,
+                     int mode, bool instant) {
+    tree_key_t next_key;
+    bool has_next = find_next_key(table_id, key, &next_key) == 0;
+
+    return lock_record(owner, table_id, has_next ? &next_key : NULL, mode,
+                       instant);
+}
+
+/* Locks a record to write, and the key after it with next_mode (an
+ * instant request for an insertion).
+ * Returns 0 when locked, or TXN_ROLLED_BACK on a deadlock or, at
+ * TXN_SNAPSHOT, if another committed a change of the record after the
+ * snapshot.
+ */
+int lock_for_write(txn_t *owner, int64_t table_id, const tree_key_t *key,
+                   int next_mode, bool next_instant) {
+    snapshot_t snapshot;
+    int ret;
+
+    do {
+        ret = lock_record(owner, table_id, key, LOCK_EXCLUSIVE, false);
+
+        if (ret == 0 && next_mode != 0)
+            ret = lock_next_record(owner, table_id, key, next_mode,
+                                   next_instant);
+    } while (ret == 1);
+
+    if (ret != 0 || owner->isolation != TXN_SNAPSHOT)
+        return ret;
+
+    // The first committer wins.
+    mvcc_get_snapshot(owner, &snapshot);
+    if (mvcc_is_changed_since(&snapshot, table_id, key))
+        return TXN_ROLLED_BACK;
+
+    return 0;
+}
+
+/* Ends an operation. Releases the locks of an operation by itself, or
+ * rolls back the transaction of the thread after a conflict.
+ */
+int finish_operation(int ret, txn_t *owner) {
+    if (end_operation() != 0 && ret == 0)
+        ret = 1;
+
+    if (owner != NULL && owner != txn_get_current())
+        lock_release_all(owner);
+
+    if (ret == TXN_ROLLED_BACK)
+        db_abort();
+
+    return ret;
+}
+
+// Insert a record of any value size as one operation.
+int db_insert_internal(int64_t table_id, const tree_key_t *key,
+                       const char *value, uint32_t val_size) {
+    txn_t *txn = txn_get_current();
+    txn_t self;
+    int ret = 0;
+
+    if (is_read_only(table_id))
+        return 1;
+
+    begin_operation();
+    txn_t *owner = get_lock_owner(&self);
+
+    if (owner != NULL)
+        ret = lock_for_write(owner, table_id, key, LOCK_EXCLUSIVE, true);
+
+    if (ret == 0)
+        ret = insert_large_value(table_id, key, value, val_size);
+
+    if (ret == 0) {
+        if (txn != NULL)
+            txn_add_undo(txn, UNDO_INSERT, table_id, key, NULL, 0);
+
+        mvcc_add_version(table_id, key, txn, false, NULL, 0);
+    }
+
+    return finish_operation(ret, owner);
+}
+
+// Delete a record as one operation.
+int db_delete_internal(int64_t table_id, const tree_key_t *key) {
+    txn_t *txn = txn_get_current();
+    txn_t self;
+    char old_value[MAX_UNDO_VALUE_SIZE];
+    uint16_t old_size;
+    int ret = 0;
+
+    if (is_read_only(table_id))
+        return 1;
+
+    begin_operation();
+    txn_t *owner = get_lock_owner(&self);
+
+    // Lock the gap the key leaves, too.
+    if (owner != NULL)
+        ret = lock_for_write(owner, table_id, key, LOCK_EXCLUSIVE, false);
+
+    if (ret == 0)
+        ret = delete_record(table_id, key, old_value, &old_size);
+
+    if (ret == 0) {
+        if (txn != NULL)
+            txn_add_undo(txn, UNDO_DELETE, table_id, key, old_value, old_size);
+
+        release_old_value(table_id, key, txn, old_value, old_size);
+    }
+
+    return finish_operation(ret, owner);
+}
+
+// Update a record as one operation.
+int db_update_internal(int64_t table_id, const tree_key_t *key,
+                       const char *value, uint16_t val_size) {
+    txn_t *txn = txn_get_current();
+    txn_t self;
+    char old_value[MAX_UNDO_VALUE_SIZE];
+    uint16_t old_size;
+    int ret = 0;
+
+    if (is_read_only(table_id))
+        return 1;
+
+    begin_operation();
+    txn_t *owner = get_lock_owner(&self);
+
+    if (owner != NULL)
+        ret = lock_for_write(owner, table_id, key, 0, false);
+
+    if (ret == 0)
+        ret = update_record(table_id, key, value, val_size, old_value,
+                            &old_size);
+
+    if (ret == 0) {
+        if (txn != NULL)
+            txn_add_undo(txn, UNDO_UPDATE, table_id, key, old_value, old_size);
+
+        release_old_value(table_id, key, txn, old_value, old_size);
+    }
+
+    return finish_operation(ret, owner);
+}
+
+/* Roll back the transactions a crash interrupted.
+ * The undo entries are in the order of the changes.
+ */
+int undo_transactions(const std::vector<undo_entry> *entries) {
+    std::vector<uint64_t> txn_ids;
+    int ret = 0;
+
+    if (entries->empty())
+        return 0;
+
+    begin_operation();
+
+    for (size_t i = entries->size(); i-- > 0;) {
+        ret |= apply_undo(&(*entries)[i]);
+        txn_ids.push_back((*entries)[i].txn_id);
+    }
+
+    std::sort(txn_ids.begin(), txn_ids.end());
+    txn_ids.erase(std::unique(txn_ids.begin(), txn_ids.end()), txn_ids.end());
+
+    for (size_t i = 0; i < txn_ids.size(); i++)
+        log_txn_end(LOG_TXN_ABORT, txn_ids[i]);
+
+    ret |= end_operation();
+
+    return ret;
+}
+
+/* Finds the version of the record with the key seen by the thread, and
+ * copies the value as stored in the leaf. At TXN_SERIALIZABLE, the record
+ * (or the key after it if none) is locked first.
+ * Returns 1 if there is no tree, 2 if the record does not exist in the
+ * snapshot, TXN_ROLLED_BACK, or DB_BAD_PAGE.
+ */
+int find_visible_value(int64_t table_id, const tree_key_t *key, byte *value,
+                       uint16_t *val_size) {
+    txn_t *txn = txn_get_current();
+    snapshot_t snapshot;
+    buf_descriptor_t *leaf_buf;
+    const byte *leaf_value;
+    int ret;
+    bool exists;
+
+    while (true) {
+        ret = db_find_internal(table_id, key, &leaf_value, val_size, &leaf_buf);
+        exists = ret == 0;
+
+        if (exists)
+            memcpy(value, leaf_value, *val_size);
+
+        if (leaf_buf)
+            unpin_buffer(leaf_buf);
+
+        if (ret == DB_BAD_PAGE)
+            return ret;
+
+        if (txn == NULL || txn->isolation != TXN_SERIALIZABLE)
+            break;
+
+        int lock_ret = exists ?
+            lock_record(txn, table_id, key, LOCK_SHARED, false) :
+            lock_next_record(txn, table_id, key, LOCK_SHARED, false);
+
+        if (lock_ret == 0)
+            break;
+        if (lock_ret == TXN_ROLLED_BACK)
+            return lock_ret;
+    }
+
+    mvcc_get_snapshot(txn, &snapshot);
+    mvcc_read(&snapshot, table_id, key, &exists, value, val_size);
+
+    if (exists)
+        return 0;
+
+    return ret != 0 ? ret : 2;
+}
+
+/* Finds the value with the key and copies it.
+ * Returns 3 without copying if the value is in overflow pages.
+ */
+int find_value(int64_t table_id, const tree_key_t *key, char *ret_val,
+               uint16_t *val_size) {
+    byte value[MAX_UNDO_VALUE_SIZE];
+    uint16_t size;
+    int ret = find_visible_value(table_id, key, value, &size);
+
+    if (ret != 0)
+        return ret;
+
+    if (is_overflow_value(size))
+        return 3;
+
+    if (ret_val != NULL) {
+        memcpy(ret_val, value, size);
+        *val_size = size;
+    }
+
+    return 0;
+}
+
+/* Reads size bytes of the value with the key from offset.
+ * Either of buf and read_size may be NULL to get the
+ * size of the value only.
+ */
+int read_value(int64_t table_id, const tree_key_t *key, uint32_t offset,
+               char *buf, uint32_t size, uint32_t *read_size,
+               uint32_t *val_size) {
+    byte value[MAX_UNDO_VALUE_SIZE];
+    uint16_t size_in_leaf;
+    overflow_ref ref;
+    int ret = find_visible_value(table_id, key, value, &size_in_leaf);
+
+    if (ret != 0)
+        return ret;
+
+    // A value in the leaf.
+    if (!is_overflow_value(size_in_leaf)) {
+        uint32_t n = 0;
+
+        if (offset < size_in_leaf)
+            n = std::min(size, (uint32_t)size_in_leaf - offset);
+
+        if (buf != NULL)
+            memcpy(buf, value + offset, n);
+        if (read_size != NULL)
+            *read_size = n;
+        if (val_size != NULL)
+            *val_size = size_in_leaf;
+
+        return 0;
+    }
+
+    memcpy(&ref, value, OVERFLOW_REF_SIZE);
+
+    if (val_size != NULL)
+        *val_size = ref.value_size;
+
+    if (buf != NULL && read_size != NULL)
+        *read_size = overflow_read(table_id, &ref, offset, buf, size);
+
+    return 0;
+}
+
+// A record of a leaf read by a scan
+typedef struct scan_entry {
+    tree_key_t key;
+    uint16_t val_size;
+    byte value[MAX_UNDO_VALUE_SIZE];  // As stored in the leaf
+} scan_entry;
+
+/* Copies the records from the leaf of the key from on, up to end_key:
+ * from <= key, or from < key without include_from.
+ * Once a record is found, stops at the end of a leaf if other operations
+ * are waiting. Sets done if there is no record left after those.
+ * Returns DB_BAD_PAGE if a leaf cannot be read in.
+ */
+int scan_leaf(int64_t table_id, const tree_key_t *from, bool include_from,
+              const tree_key_t *end_key, std::vector<scan_entry> *entries,
+              bool *done) {
+    bool var_keys = end_key->size > 0;
+    read_ahead_t ra;
+    buf_descriptor_t *leaf_buf;
+    int ret = find_leaf(table_id, from, &leaf_buf, NULL, &ra);
+
+    *done = true;
+
+    // There is no root page.
+    if (ret == 1)
+        return 0;
+
+    if (ret != 0)
+        return ret;
+
+    page_t *leaf_page = leaf_buf->buf_page;
+    int i = 0;
+    slot_t *slot;
+    const byte *record;
+    const byte *value;
+    pagenum_t sibling_num;
+    scan_entry entry;
+
+    *done = false;
+
+    while (true) {
+        // Move to the right sibling at the end of the leaf page.
+        if (i == leaf_page->num_of_keys) {
+            sibling_num = leaf_page->right_sibling_page_num;
+
+            if (sibling_num == -1) {
+                *done = true;
+                break;
+            }
+
+            // Leave the rest to the next call.
+            if (!entries->empty() && num_waiting_ops > 0)
+                break;
+
+            // The leaves read ahead run out here.
+            if (leaf_buf->page_num == ra.last_num)
+                read_ahead_leaves(table_id, &ra, end_key);
+
+            unpin_buffer(leaf_buf);
+
+            leaf_buf = get_buffer(table_id, sibling_num, BUFFER_ACCESS_SCAN);
+            if (leaf_buf == NULL)
+                return DB_BAD_PAGE;
 
-            leaf_buf = get_buffer(table_id, sibling_num);
             leaf_page = leaf_buf->buf_page;
             i = 0;
+            continue;
         }
 
-        slot = get_slot(leaf_page->data, i);
-        temp_key = slot->key;
+        slot = get_slot(leaf_page->data, i++);
+        record = (byte*)leaf_page + slot->offset;
+
+        // Skip the keys before from.
+        int cmp = compare_slot_key(slot, record, from);
+        if (cmp < 0 || (cmp == 0 && !include_from))
+            continue;
+
+        if (compare_slot_key(slot, record, end_key) > 0) {
+            *done = true;
+            break;
+        }
+
+        get_slot_key(slot, record, var_keys, &entry.key);
+        value = get_record_value(slot, record, var_keys, &entry.val_size);
+        memcpy(entry.value, value, entry.val_size);
+        entries->push_back(entry);
     }
 
     unpin_buffer(leaf_buf);
+
     return 0;
 }
 
+/* Locks the records of a scan at TXN_SERIALIZABLE, and with end_key the
+ * key after the range, against the insertions into the range.
+ * Returns 0 if locked at once, 1 if locked after a wait, or TXN_ROLLED_BACK.
+ */
+int lock_scanned(txn_t *txn, int64_t table_id,
+                 const std::vector<scan_entry> *entries,
+                 const std::vector<tree_key_t> *version_keys,
+                 const tree_key_t *end_key) {
+    int ret = 0;
+    int lock_ret;
+
+    for (size_t i = 0; i < entries->size(); i++) {
+        lock_ret = lock_record(txn, table_id, &(*entries)[i].key,
+                               LOCK_SHARED, false);
+        if (lock_ret == TXN_ROLLED_BACK)
+            return lock_ret;
+        ret |= lock_ret;
+    }
+
+    // The records deleted by others are locked by them until they end.
+    for (size_t i = 0; i < version_keys->size(); i++) {
+        lock_ret = lock_record(txn, table_id, &(*version_keys)[i],
+                               LOCK_SHARED, false);
+        if (lock_ret == TXN_ROLLED_BACK)
+            return lock_ret;
+        ret |= lock_ret;
+    }
+
+    if (end_key != NULL) {
+        lock_ret = lock_next_record(txn, table_id, end_key, LOCK_SHARED, false);
+        if (lock_ret == TXN_ROLLED_BACK)
+            return lock_ret;
+        ret |= lock_ret;
+    }
+
+    return ret;
+}
+
+/* Find records with a key betwen the range: begin_key <= key <= end_key
+ * The keys are appended to int_keys or str_keys by the key type.
+ * The records are read from a snapshot a leaf at a time, and the tree is
+ * released in between so that long scans do not hold up writers.
+ * At TXN_SERIALIZABLE, the latest records are read, locked a leaf at a time.
+ */
+int scan_records(int64_t table_id, const tree_key_t *begin_key,
+                 const tree_key_t *end_key, std::vector<int64_t> *int_keys,
+                 std::vector<std::string> *str_keys,
+                 std::vector<char*> *values, std::vector<uint16_t> *val_sizes) {
+    bool var_keys = begin_key->size > 0;
+    txn_t *txn = txn_get_current();
+    bool locking = txn != NULL && txn->isolation == TXN_SERIALIZABLE;
+    snapshot_t snapshot;
+    std::vector<scan_entry> entries;
+    std::vector<tree_key_t> version_keys;
+    tree_key_t from = *begin_key;
+    tree_key_t upper;
+    bool include_from = true;
+    bool done = false;
+    bool found = false;
+    char *temp_value;
+    int ret = 0;
+
+    begin_operation();
+
+    if (txn != NULL)
+        mvcc_get_snapshot(txn, &snapshot);
+    else
+        mvcc_open_snapshot(&snapshot);
+
+    while (!done) {
+        entries.clear();
+        version_keys.clear();
+
+        ret = scan_leaf(table_id, &from, include_from, end_key, &entries,
+                        &done);
+        if (ret != 0)
+            break;
+
+        upper = done ? *end_key : entries.back().key;
+
+        // Records deleted after the snapshot are not in the leaves.
+        mvcc_get_keys(table_id, &from, include_from, &upper, &version_keys);
+
+        // Look at the leaf again after waiting for a lock.
+        if (locking) {
+            ret = lock_scanned(txn, table_id, &entries, &version_keys,
+                               done ? end_key : NULL);
+
+            if (ret == 1) {
+                ret = 0;
+                done = false;
+                continue;
+            }
+
+            if (ret != 0)
+                break;
+
+            mvcc_get_snapshot(txn, &snapshot);
+        }
+
+        size_t i = 0;
+        size_t j = 0;
+
+        while (i < entries.size() || j < version_keys.size()) {
+            scan_entry entry;
+            bool exists = true;
+            int cmp = i == entries.size() ? 1 :
+                      j == version_keys.size() ? -1 :
+                      key_compare(&entries[i].key, &version_keys[j]);
+
+            if (cmp <= 0) {
+                entry = entries[i++];
+                if (cmp == 0)
+                    j++;
+            } else {
+                entry.key = version_keys[j++];
+                exists = false;
+            }
+
+            mvcc_read(&snapshot, table_id, &entry.key, &exists, entry.value,
+                      &entry.val_size);
+
+            if (!exists)
+                continue;
+
+            found = true;
+
+            if (var_keys)
+                str_keys->push_back(std::string(entry.key.data,
+                                                entry.key.size));
+            else
+                int_keys->push_back(entry.key.prefix);
+
+            // Values in overflow pages are left to read_value().
+            if (is_overflow_value(entry.val_size)) {
+                values->push_back(NULL);
+                val_sizes->push_back(0);
+                continue;
+            }
+
+            temp_value = (char*)calloc(1, entry.val_size);
+
+            memcpy(temp_value, entry.value, entry.val_size);
+            values->push_back(temp_value);
+            val_sizes->push_back(entry.val_size);
+        }
+
+        from = upper;
+        include_from = false;
+
+        // Let the waiting operations in between the leaves.
+        if (!done) {
+            end_operation();
+            begin_operation();
+        }
+    }
+
+    if (txn == NULL)
+        mvcc_close_snapshot(&snapshot);
+
+    // There is no key for this range.
+    if (ret == 0 && !found)
+        ret = 1;
+
+    return finish_operation(ret, NULL);
+}
+
+/* Makes a tree key of a byte-string key.
+ * Returns 1 if the table does not have byte-string keys
+ * or the key size is out of range.
+ */
+int make_var_key(int64_t table_id, const char *key, uint16_t key_size,
+                 tree_key_t *tree_key) {
+    if (!has_var_keys(table_id) || key_size == 0 || key_size > MAX_KEY_SIZE)
+        return 1;
+
+    key_set_bytes(tree_key, key, key_size);
+    return 0;
+}
+
+// Open an existing database file or create one with the flags if not exist.
+int64_t open_table(const char *pathname, uint64_t flags,
+                   const char *pool_name) {
+    pthread_mutex_lock(&db_latch);
+    int64_t table_id = buffer_open_table(pathname, flags, pool_name);
+    pthread_mutex_unlock(&db_latch);
+
+    return table_id;
+}
+
+// Create a buffer pool of num_buf frames to open tables with.
+int create_buffer_pool(const char *name, uint32_t num_ht_entries,
+                       uint32_t num_buf, int policy) {
+    pthread_mutex_lock(&db_latch);
+    int ret = buffer_create_pool(name, num_ht_entries, num_buf, policy);
+    pthread_mutex_unlock(&db_latch);
+
+    return ret;
+}
+
+// Grow or shrink the buffer pool of the name to num_buf frames.
+int resize_buffer_pool(const char *name, uint32_t num_buf) {
+    pthread_mutex_lock(&db_latch);
+    int ret = buffer_resize_pool(name, num_buf);
+    pthread_mutex_unlock(&db_latch);
+
+    return ret;
+}
+
+// Set the quota of frames of a table in its buffer pool.
+int set_table_quota(int64_t table_id, uint32_t min_buf, uint32_t max_buf) {
+    pthread_mutex_lock(&db_latch);
+    int ret = buffer_set_table_quota(table_id, min_buf, max_buf);
+    pthread_mutex_unlock(&db_latch);
+
+    return ret;
+}
+
+/* Keep the clean pages evicted from the buffer pools compressed in memory,
+ * up to budget bytes (0 to stop).
+ */
+void set_victim_cache_budget(size_t budget) {
+    pthread_mutex_lock(&db_latch);
+    victim_cache_set_budget(budget);
+    pthread_mutex_unlock(&db_latch);
+}
+
+// Turn the per-thread descriptor cache on or off.
+void enable_desc_cache(bool enable) {
+    pthread_mutex_lock(&db_latch);
+    buffer_set_desc_cache(enable);
+    pthread_mutex_unlock(&db_latch);
+}
+
+// Turn pointer swizzling on or off.
+void enable_swizzling(bool enable) {
+    pthread_mutex_lock(&db_latch);
+    buffer_set_swizzling(enable);
+    pthread_mutex_unlock(&db_latch);
+}
+
+// Insert a record to the given table.
+int db_insert(int64_t table_id, int64_t key, const char *value, uint16_t val_size) {
+    tree_key_t tree_key;
+
+    if (val_size < MIN_VALUE_SIZE || val_size > MAX_VALUE_SIZE)
+        return 1;
+
+    if (has_var_keys(table_id))
+        return 1;
+
+    key_set_int(&tree_key, key);
+    return db_insert_internal(table_id, &tree_key, value, val_size);
+}
+
+// Insert a record with a byte-string key to the given table.
+int db_insert(int64_t table_id, const char *key, uint16_t key_size,
+              const char *value, uint16_t val_size) {
+    tree_key_t tree_key;
+
+    if (val_size < MIN_VALUE_SIZE || val_size > MAX_VALUE_SIZE)
+        return 1;
+
+    if (make_var_key(table_id, key, key_size, &tree_key))
+        return 1;
+
+    return db_insert_internal(table_id, &tree_key, value, val_size);
+}
+
+// Find a record with the matching key from the given table.
+int db_find(int64_t table_id, int64_t key, char *ret_val, uint16_t *val_size) {
+    tree_key_t tree_key;
+
+    if (has_var_keys(table_id))
+        return 1;
+
+    key_set_int(&tree_key, key);
+    begin_operation();
+    int ret = find_value(table_id, &tree_key, ret_val, val_size);
+
+    return finish_operation(ret, NULL);
+}
+
+// Find a record with the matching byte-string key from the given table.
+int db_find(int64_t table_id, const char *key, uint16_t key_size,
+            char *ret_val, uint16_t *val_size) {
+    tree_key_t tree_key;
+
+    if (make_var_key(table_id, key, key_size, &tree_key))
+        return 1;
+
+    begin_operation();
+    int ret = find_value(table_id, &tree_key, ret_val, val_size);
+
+    return finish_operation(ret, NULL);
+}
+
+// Delete a record with the matching key from the given table.
+int db_delete(int64_t table_id, int64_t key) {
+    tree_key_t tree_key;
+
+    if (has_var_keys(table_id))
+        return 1;
+
+    key_set_int(&tree_key, key);
+    return db_delete_internal(table_id, &tree_key);
+}
+
+// Delete a record with the matching byte-string key from the given table.
+int db_delete(int64_t table_id, const char *key, uint16_t key_size) {
+    tree_key_t tree_key;
+
+    if (make_var_key(table_id, key, key_size, &tree_key))
+        return 1;
+
+    return db_delete_internal(table_id, &tree_key);
+}
+
+// Replace the value of a record with the matching key.
+int db_update(int64_t table_id, int64_t key, const char *value,
+              uint16_t val_size) {
+    tree_key_t tree_key;
+
+    if (val_size < MIN_VALUE_SIZE || val_size > MAX_VALUE_SIZE)
+        return 1;
+
+    if (has_var_keys(table_id))
+        return 1;
+
+    key_set_int(&tree_key, key);
+    return db_update_internal(table_id, &tree_key, value, val_size);
+}
+
+// Replace the value of a record with the matching byte-string key.
+int db_update(int64_t table_id, const char *key, uint16_t key_size,
+              const char *value, uint16_t val_size) {
+    tree_key_t tree_key;
+
+    if (val_size < MIN_VALUE_SIZE || val_size > MAX_VALUE_SIZE)
+        return 1;
+
+    if (make_var_key(table_id, key, key_size, &tree_key))
+        return 1;
+
+    return db_update_internal(table_id, &tree_key, value, val_size);
+}
+
+// Find records with a key betwen the range: begin_key <= key <= end_key
+int db_scan(int64_t table_id, int64_t begin_key, int64_t end_key,
+            std::vector<int64_t> *keys, std::vector<char*> *values,
+            std::vector<uint16_t> *val_sizes) {
+    tree_key_t begin, end;
+
+    if (has_var_keys(table_id))
+        return 1;
+
+    key_set_int(&begin, begin_key);
+    key_set_int(&end, end_key);
+
+    return scan_records(table_id, &begin, &end, keys, NULL, values, val_sizes);
+}
+
+// Find records with a byte-string key betwen the range: begin_key <= key <= end_key
+int db_scan(int64_t table_id, const char *begin_key, uint16_t begin_size,
+            const char *end_key, uint16_t end_size,
+            std::vector<std::string> *keys, std::vector<char*> *values,
+            std::vector<uint16_t> *val_sizes) {
+    tree_key_t begin, end;
+
+    if (make_var_key(table_id, begin_key, begin_size, &begin) ||
+        make_var_key(table_id, end_key, end_size, &end))
+        return 1;
+
+    return scan_records(table_id, &begin, &end, NULL, keys, values, val_sizes);
+}
+
+// Insert a record with a value of up to MAX_LARGE_VALUE_SIZE bytes.
+int db_insert_large(int64_t table_id, int64_t key, const char *value,
+                    uint32_t val_size) {
+    tree_key_t tree_key;
+
+    if (has_var_keys(table_id))
+        return 1;
+
+    key_set_int(&tree_key, key);
+    return db_insert_internal(table_id, &tree_key, value, val_size);
+}
+
+// Insert a record with a byte-string key and a value of up to MAX_LARGE_VALUE_SIZE bytes.
+int db_insert_large(int64_t table_id, const char *key, uint16_t key_size,
+                    const char *value, uint32_t val_size) {
+    tree_key_t tree_key;
+
+    if (make_var_key(table_id, key, key_size, &tree_key))
+        return 1;
+
+    return db_insert_internal(table_id, &tree_key, value, val_size);
+}
+
+// Get the size of the value of a record.
+int db_get_value_size(int64_t table_id, int64_t key, uint32_t *val_size) {
+    tree_key_t tree_key;
+
+    if (has_var_keys(table_id))
+        return 1;
+
+    key_set_int(&tree_key, key);
+    begin_operation();
+    int ret = read_value(table_id, &tree_key, 0, NULL, 0, NULL, val_size);
+
+    return finish_operation(ret, NULL);
+}
+
+// Get the size of the value of a record with a byte-string key.
+int db_get_value_size(int64_t table_id, const char *key, uint16_t key_size,
+                      uint32_t *val_size) {
+    tree_key_t tree_key;
+
+    if (make_var_key(table_id, key, key_size, &tree_key))
+        return 1;
+
+    begin_operation();
+    int ret = read_value(table_id, &tree_key, 0, NULL, 0, NULL, val_size);
+
+    return finish_operation(ret, NULL);
+}
+
+// Read up to size bytes of the value of a record from offset.
+int db_read_value(int64_t table_id, int64_t key, uint32_t offset, char *buf,
+                  uint32_t size, uint32_t *read_size) {
+    tree_key_t tree_key;
+
+    if (has_var_keys(table_id))
+        return 1;
+
+    key_set_int(&tree_key, key);
+    begin_operation();
+    int ret = read_value(table_id, &tree_key, offset, buf, size, read_size, NULL);
+
+    return finish_operation(ret, NULL);
+}
+
+// Read up to size bytes of the value of a record with a byte-string key from offset.
+int db_read_value(int64_t table_id, const char *key, uint16_t key_size,
+                  uint32_t offset, char *buf, uint32_t size,
+                  uint32_t *read_size) {
+    tree_key_t tree_key;
+
+    if (make_var_key(table_id, key, key_size, &tree_key))
+        return 1;
+
+    begin_operation();
+    int ret = read_value(table_id, &tree_key, offset, buf, size, read_size, NULL);
+
+    return finish_operation(ret, NULL);
+}
+
+// The warm-up of the buffer pool going on (see warm_up_db())
+static pthread_t warm_up_thread;
+static bool warm_up_started = false;
+static std::atomic<bool> warm_up_stopping(false);
+static std::string warm_up_path;
+
+/* Read the pages of the dump back in, a batch at a time, letting the
+ * operations go between the batches.
+ */
+static void *warm_up(void *) {
+    std::vector<warm_page_t> pages;
+    size_t done = 0;
+
+    pthread_mutex_lock(&db_latch);
+    buffer_load_dump(warm_up_path.c_str(), &pages);
+    pthread_mutex_unlock(&db_latch);
+
+    while (done < pages.size() && !warm_up_stopping) {
+        if (num_waiting_ops > 0)
+            sched_yield();
+
+        pthread_mutex_lock(&db_latch);
+        int n = buffer_warm_up(&pages[done], pages.size() - done);
+        pthread_mutex_unlock(&db_latch);
+
+        if (n == 0)
+            break;
+        done += n;
+    }
+
+    return NULL;
+}
+
+/* Start reading the pages dumped by shutdown_db() back into the buffer
+ * pools in the background.
+ */
+int warm_up_db(const char *dump_path) {
+    if (warm_up_started || access(dump_path, R_OK) != 0)
+        return 1;
+
+    warm_up_path = dump_path;
+    warm_up_stopping = false;
+    if (pthread_create(&warm_up_thread, NULL, warm_up, NULL) != 0)
+        return 1;
+
+    warm_up_started = true;
+    return 0;
+}
+
+// Wait for the warm-up to finish, or stop it first
+void wait_warm_up_db(bool stop) {
+    if (!warm_up_started)
+        return;
+
+    warm_up_stopping = stop;
+    pthread_join(warm_up_thread, NULL);
+    warm_up_started = false;
+}
+
 // Initialize the database system.
-int init_db(uint32_t num_ht_entries, uint32_t num_buf) {
-    return init_buffer_pool(num_ht_entries, num_buf);
+int init_db(uint32_t num_ht_entries, uint32_t num_buf, const char *log_path,
+            int policy) {
+    init_log_stat();
+    init_lock_stat();
+    mvcc_clear();
+
+    if (log_path != NULL && log_open(log_path))
+        return 1;
+
+    if (init_buffer_pool(num_ht_entries, num_buf, policy))
+        return 1;
+
+    // Replay the log left by a crash, then roll back the transactions.
+    if (log_is_enabled()) {
+        std::vector<undo_entry> losers;
+
+        if (recover_tables(&losers) || undo_transactions(&losers) ||
+            buffer_checkpoint())
+            return 1;
+    }
+
+    // Recovery reads pages around the buffer pool.
+    init_buffer_stat();
+
+    return 0;
+}
+
+// Start a transaction on the calling thread.
+int db_begin(int isolation) {
+    if (txn_get_current() != NULL ||
+        (isolation != TXN_SNAPSHOT && isolation != TXN_SERIALIZABLE))
+        return 1;
+
+    pthread_mutex_lock(&db_latch);
+    mvcc_begin_txn(txn_start(isolation));
+    pthread_mutex_unlock(&db_latch);
+
+    return 0;
 }
 
-// Shutdown the databasee system.
-int shutdown_db() {
-    return close_buffer_pool();
-}
\ No newline at end of file
+/* Commit the transaction of the calling thread.
+ * Its changes are durable (with the log) when this returns.
+ */
+int db_commit() {
+    txn_t *txn = txn_get_current();
+
+    if (txn == NULL)
+        return 1;
+
+    begin_operation();
+    mvcc_commit_txn(txn);
+
+    // Nothing to log for a transaction without changes.
+    if (log_is_enabled() && !txn->undo.empty())
+        log_txn_end(LOG_TXN_COMMIT, txn->txn_id);
+
+    // The locks go before the commit is durable, as the commits are
+    // durable in order.
+    lock_release_all(txn);
+    txn_finish();
+
+    return end_operation();
+}
+
+// Roll back the transaction of the calling thread.
+int db_abort() {
+    txn_t *txn = txn_get_current();
+    int ret = 0;
+
+    if (txn == NULL)
+        return 1;
+
+    begin_operation();
+
+    for (size_t i = txn->undo.size(); i-- > 0;)
+        ret |= apply_undo(&txn->undo[i]);
+
+    mvcc_abort_txn(txn);
+
+    if (log_is_enabled() && !txn->undo.empty())
+        log_txn_end(LOG_TXN_ABORT, txn->txn_id);
+
+    lock_release_all(txn);
+    txn_finish();
+    ret |= end_operation();
+
+    return ret;
+}
+
+/* Write back every dirty page and truncate the log.
+ * Recovery after a crash starts from here.
+ */
+int checkpoint_db() {
+    if (!log_is_enabled() || txn_num_active() > 0)
+        return 1;
+
+    pthread_mutex_lock(&db_latch);
+    int ret = buffer_checkpoint();
+    pthread_mutex_unlock(&db_latch);
+
+    return ret;
+}
+
+/* Shutdown the databasee system.
+ * With dump_path, the pages resident in the buffer pools are dumped there
+ * for warm_up_db().
+ */
+int shutdown_db(const char *dump_path) {
+    wait_warm_up_db(true);
+
+    int ret = close_buffer_pool(dump_path);
+
+    // The versions are purged as the snapshots close, so only those of the
+    // transactions going on are left.
+    mvcc_clear();
+
+    // Every logged change is in the table files now, but the transactions
+    // going on are left to recovery.
+    if (log_is_enabled()) {
+        if (ret == 0 && txn_num_active() == 0)
+            ret = log_truncate();
+        if (log_close() != 0)
+            ret = 1;
+    }
+
+    return ret;
+}
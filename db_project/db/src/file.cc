@@ -1,67 +1,224 @@
 #include "file.h"
+#include "compress.h"
+#include "crc32c.h"
+#include "io.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string>
+#include <sys/mman.h>
+#include <unordered_map>
+#include <vector>
 
 // For stats
 int64_t stat_read_page;
 int64_t stat_write_page;
-
-// table id counter
-int tid_counter = 0;
-table_node tables[MAX_TABLES];
+int64_t stat_checksum_failures;
+
+/* The table registry.
+ * Table ids are MAGIC_NUMBER + the index of the table node, so a lookup by
+ * id goes straight to its node. The nodes are allocated in chunks as tables
+ * are opened; a chunk never moves, and neither does the directory of them,
+ * so the nodes can be looked up while another table is being inserted.
+ * The pathnames are hashed to the table ids, and the node of a table points
+ * to the pathname kept as the key.
+ */
+#define TABLE_CHUNK 256        // Table nodes in a chunk
+#define MAX_TABLE_CHUNKS 1024  // Up to 262144 tables
+
+static table_node *table_chunks[MAX_TABLE_CHUNKS];
+static int num_tables = 0;
+static std::unordered_map<std::string, int64_t> table_ids;
+
+#define file_table_node(index) \
+    (&table_chunks[(index) / TABLE_CHUNK][(index) % TABLE_CHUNK])
 
 // Init table nodes
 int init_tables() {
-    for (int i = 0; i < MAX_TABLES; i++) {
-        tables[i].fd = -1;
-        tables[i].table_id = -1;
-    }
-
-    tid_counter = 0;
+    file_close_table_files();
     return 0;
 }
 
 // Search table by pathname
 int64_t file_search_table_pathname(const char *pathname) {
-    for (int i = 0; i < MAX_TABLES; i++) {
-        if (!strcmp(pathname, tables[i].pathname))
-            return tables[i].table_id;
-    }
+    std::unordered_map<std::string, int64_t>::iterator it =
+        table_ids.find(pathname);
 
-    return -1;
+    return it == table_ids.end() ? -1 : it->second;
+}
+
+// Search table node by table_id
+table_node *file_search_table_node(int64_t table_id) {
+    int64_t index = table_id - MAGIC_NUMBER;
+
+    if (index < 0 || index >= num_tables)
+        return NULL;
+
+    return file_table_node(index);
 }
 
 // Search fd by table_id
 int file_search_table_id(int64_t table_id) {
-    for (int i = 0; i < MAX_TABLES; i++) {
-        if (tables[i].table_id == table_id)
-            return tables[i].fd;
-    }
+    table_node *table = file_search_table_node(table_id);
 
-    return -1;
+    return table == NULL ? -1 : table->fd;
 }
 
+// The slot of the table in the files registered with the I/O backend
+#define file_table_slot(table) ((int)((table)->table_id - MAGIC_NUMBER))
+
 #define file_read_page_internal(table_id, pagenum, dest) \
-    (pread(file_search_table_id(table_id), dest, PAGE_SIZE, PAGE_SIZE * pagenum))
+    (file_page_io(file_search_table_node(table_id), pagenum, dest, false))
 
 #define file_write_page_internal(table_id, pagenum, src) \
-    (pwrite(file_search_table_id(table_id), src, PAGE_SIZE, PAGE_SIZE * pagenum))
+    (file_page_io(file_search_table_node(table_id), pagenum, src, true))
 
-// Insert table node into array with fd
-int64_t file_insert_table(const char *pathname, int fd) {
+// Whether a buffer may be read into or written from directly by the table
+#define file_is_aligned(table, buf) \
+    (!((table)->flags & TABLE_OPEN_DIRECT) || \
+     (uintptr_t)(buf) % PAGE_ALIGNMENT == 0)
 
-    // Set table id with magic number
-    int64_t new_id = MAGIC_NUMBER + tid_counter++;
+// Read or write a whole page through the I/O backend
+static int64_t file_page_io(table_node *table, pagenum_t pagenum,
+                            const void *buf, bool write) {
+    if (table == NULL)
+        return -1;
+
+    // O_DIRECT takes aligned buffers only, so go through one.
+    if (!file_is_aligned(table, buf)) {
+        alignas(PAGE_ALIGNMENT) byte bounce[PAGE_SIZE];
+        int64_t ret;
+
+        if (write) {
+            memcpy(bounce, buf, PAGE_SIZE);
+            return io_write(table->fd, file_table_slot(table), bounce,
+                            PAGE_SIZE, PAGE_SIZE * pagenum);
+        }
+
+        // A failed or short read leaves the page untouched.
+        ret = io_read(table->fd, file_table_slot(table), bounce, PAGE_SIZE,
+                      PAGE_SIZE * pagenum);
+        if (ret == PAGE_SIZE)
+            memcpy((void*)buf, bounce, PAGE_SIZE);
+        return ret;
+    }
+
+    if (write)
+        return io_write(table->fd, file_table_slot(table), buf, PAGE_SIZE,
+                        PAGE_SIZE * pagenum);
+
+    return io_read(table->fd, file_table_slot(table), (void*)buf, PAGE_SIZE,
+                   PAGE_SIZE * pagenum);
+}
+
+// Allocate a zero-filled page buffer aligned for O_DIRECT (free it with free())
+page_t *file_new_page_buffer() {
+    void *page;
+
+    if (posix_memalign(&page, PAGE_ALIGNMENT, PAGE_SIZE) != 0)
+        return NULL;
+
+    memset(page, 0, PAGE_SIZE);
+    return (page_t*)page;
+}
+
+/* Open the table file, with O_DIRECT if asked for.
+ * The file is opened without it where the file system refuses it, and
+ * TABLE_OPEN_DIRECT is taken out of flags then.
+ * A file to map is opened read-only, and never created.
+ */
+static int file_open_fd(const char *pathname, int open_flags,
+                        uint64_t *flags) {
+    int fd;
+
+    if (*flags & TABLE_OPEN_MMAP) {
+        if (open_flags & O_CREAT)
+            return -1;
+
+        open_flags = (open_flags & ~O_RDWR) | O_RDONLY;
+    }
+
+    if (*flags & TABLE_OPEN_DIRECT) {
+        fd = open(pathname, open_flags | O_DIRECT, 0644);
+        if (fd >= 0 || errno != EINVAL)
+            return fd;
+
+        *flags &= ~TABLE_OPEN_DIRECT;
+    }
+
+    return open(pathname, open_flags, 0644);
+}
+
+/* Map the file of a table opened with TABLE_OPEN_MMAP.
+ * Compressed leaf pages must be decompressed into a frame, so such tables
+ * are left unmapped (and read-only).
+ */
+static void file_map_table(table_node *table) {
+    struct stat st;
+
+    if ((table->flags & TABLE_FLAG_COMPRESSED_LEAF) ||
+        fstat(table->fd, &st) != 0 || st.st_size < (off_t)PAGE_SIZE)
+        return;
+
+    uint64_t num_pages = st.st_size / PAGE_SIZE;
+    void *map = mmap(NULL, num_pages * PAGE_SIZE, PROT_READ, MAP_SHARED,
+                     table->fd, 0);
+
+    if (map == MAP_FAILED)
+        return;
+
+    // Lookups touch a page here and there; scans ask for theirs ahead.
+    madvise(map, num_pages * PAGE_SIZE, MADV_RANDOM);
 
-    // Set table data into array
-    strcpy(tables[tid_counter].pathname, pathname);
-    tables[tid_counter].table_id = new_id;
-    tables[tid_counter].fd = fd;
+    table->map = (page_t*)map;
+    table->map_pages = num_pages;
+}
+
+// Insert table node into the registry with fd, -1 if it is full
+int64_t file_insert_table(const char *pathname, int fd) {
+    int index = num_tables;
+
+    // Allocate the next chunk of nodes if the last one is used up
+    if (index % TABLE_CHUNK == 0) {
+        if (index / TABLE_CHUNK == MAX_TABLE_CHUNKS)
+            return -1;
+
+        if (table_chunks[index / TABLE_CHUNK] == NULL) {
+            table_chunks[index / TABLE_CHUNK] =
+                (table_node*)calloc(TABLE_CHUNK, sizeof(table_node));
+            if (table_chunks[index / TABLE_CHUNK] == NULL)
+                return -1;
+        }
+    }
 
-    // And return it
+    // Set table id with magic number
+    int64_t new_id = MAGIC_NUMBER + index;
+    table_node *table = file_table_node(index);
+
+    // Set table data into the node
+    table->pathname =
+        table_ids.insert(std::make_pair(std::string(pathname), new_id))
+            .first->first.c_str();
+    table->table_id = new_id;
+    table->fd = fd;
+    table->flags = 0;
+    table->map = NULL;
+    table->map_pages = 0;
+
+    // Compressed pages are written in file system blocks
+    struct stat st;
+    table->block_size =
+        (fstat(fd, &st) == 0 && st.st_blksize > 0) ? st.st_blksize : PAGE_SIZE;
+
+    io_set_file(index, fd);
+
+    // Publish the node, and return its id
+    num_tables = index + 1;
     return new_id;
 }
 
-// Open existing table file or create one if it doesn't exist
-int64_t file_open_table_file(const char* pathname) {
+// Open existing table file or create one with the flags if it doesn't exist
+int64_t file_open_table_file(const char* pathname, uint64_t flags) {
 
     // First, search the table node with pathname if the table exist
     int64_t table_id = file_search_table_pathname(pathname);
@@ -70,46 +227,73 @@ int64_t file_open_table_file(const char* pathname) {
     if (table_id > -1)
         return table_id;
 
-    // If the table node array is filled, return -2
-    if (tid_counter == MAX_TABLES)
-        return -2;
-
-    page_t *header_page = (page_t*)malloc(PAGE_SIZE);
+    page_t *header_page = file_new_page_buffer();
+    uint64_t open_flags = flags & TABLE_OPEN_FLAGS;
 
     // Open table file
-    int fd = open(pathname, O_RDWR|O_SYNC, 0644);
+    int fd = file_open_fd(pathname, O_RDWR, &open_flags);
 
     // If the file exist, check the magic number
     if (fd > 0) {
-        
-        // Set table, get id
-        table_id = file_insert_table(pathname, fd);
-        file_read_page_internal(table_id, 0, header_page);
 
-        // If match, set table fd and return it
-        if (header_page->magic_number == MAGIC_NUMBER) {
+        // Check the header before the table is registered, so a refused
+        // file leaves nothing open (files without a recorded page size
+        // have 4 KiB pages)
+        ssize_t size = pread(fd, header_page, PAGE_SIZE, 0);
+        uint32_t page_size = header_page->page_size == 0 ?
+            4 * 1024 : header_page->page_size;
+
+        // If not match (including other page sizes), return -2
+        // (-1 is for malloc failed)
+        if (size <= 0 || header_page->magic_number != MAGIC_NUMBER ||
+            page_size != PAGE_SIZE) {
+            close(fd);
             free(header_page);
-            return table_id;
+            return -2;
         }
-        // Or not, return -2 (-1 is for malloc failed)
-        else {
+
+        // Set table, get id (if the registry is full, return -2)
+        table_id = file_insert_table(pathname, fd);
+        if (table_id < 0) {
+            close(fd);
             free(header_page);
             return -2;
         }
+
+        // Set table flags, and return it
+        table_node *table = file_search_table_node(table_id);
+
+        table->flags = header_page->table_flags | open_flags;
+        free(header_page);
+
+        if (open_flags & TABLE_OPEN_MMAP)
+            file_map_table(table);
+
+        return table_id;
     }
 
     // Or not, create new table file
-    fd = open(pathname, O_RDWR|O_CREAT|O_SYNC, 0644);
+    open_flags = flags & TABLE_OPEN_FLAGS;
+    fd = file_open_fd(pathname, O_RDWR|O_CREAT, &open_flags);
     if (fd < 0)
         return -1;
 
     // Set table, get id
+    flags = (flags & ~TABLE_OPEN_FLAGS) | open_flags;
     table_id = file_insert_table(pathname, fd);
+    if (table_id < 0) {
+        close(fd);
+        remove(pathname);
+        free(header_page);
+        return -2;
+    }
+
+    file_search_table_node(table_id)->flags = flags;
 
     // Init table size (default: 10 MiB)
     uint64_t init_pages_num = INITIAL_DB_FILE_SIZE / PAGE_SIZE;
     uint64_t init_free_pages_num = init_pages_num - 1;
-    page_t *tmp_free_page = (page_t*)malloc(PAGE_SIZE);
+    page_t *tmp_free_page = file_new_page_buffer();
 
     if (tmp_free_page == NULL) {
         free(header_page);
@@ -117,10 +301,13 @@ int64_t file_open_table_file(const char* pathname) {
     }
 
     // Set and write the header page
+    memset(header_page, 0, PAGE_SIZE);
     header_page->magic_number = MAGIC_NUMBER;
     header_page->free_page_num = init_free_pages_num;
     header_page->num_of_pages = init_pages_num;
     header_page->root_page_num = -1;
+    header_page->table_flags = flags & ~TABLE_OPEN_FLAGS;
+    header_page->page_size = PAGE_SIZE;
     file_write_page_internal(table_id, 0, header_page);
 
     // Set and write all free pages with for-loop
@@ -135,24 +322,68 @@ int64_t file_open_table_file(const char* pathname) {
     free(tmp_free_page);
     free(header_page);
 
+    // Pages are written without O_SYNC, so make the new file durable
+    fsync(fd);
+
     // Set table fd and return it
     return table_id;
 }
 
+// Get the number of tables in the registry
+int file_get_num_tables() {
+    return num_tables;
+}
+
+// Get the table node at index of the registry, NULL if there is none
+table_node *file_get_table(int index) {
+    if (index < 0 || index >= num_tables)
+        return NULL;
+
+    return file_table_node(index);
+}
+
+// Get the index of the table in the registry, -1 if it is not open
+int file_get_table_index(int64_t table_id) {
+    int64_t index = table_id - MAGIC_NUMBER;
+
+    return index < 0 || index >= num_tables ? -1 : (int)index;
+}
+
+/* Get the mapping of a table opened with TABLE_OPEN_MMAP, and the number of
+ * pages in it. Returns NULL if the table is not mapped.
+ */
+page_t *file_get_mapping(int64_t table_id, uint64_t *num_pages) {
+    table_node *table = file_search_table_node(table_id);
+
+    if (table == NULL || table->map == NULL)
+        return NULL;
+
+    *num_pages = table->map_pages;
+    return table->map;
+}
+
+// Get the table flags recorded in the header page
+uint64_t file_get_table_flags(int64_t table_id) {
+    table_node *table = file_search_table_node(table_id);
+
+    return table != NULL ? table->flags : 0;
+}
+
 // Allocate an on-disk page from the free page list
 pagenum_t file_alloc_page(int64_t table_id) {
-    page_t *header_page = (page_t*)malloc(PAGE_SIZE);
+    page_t *header_page = file_new_page_buffer();
 
     file_read_page(table_id, 0, header_page);
 
     // Read header page's free page num
     pagenum_t new_free_page_num = header_page->free_page_num;
-    page_t *tmp_page = (page_t*)malloc(PAGE_SIZE);
+    page_t *tmp_page = file_new_page_buffer();
 
     // If there is a free page, get it and fix the list order
     if (new_free_page_num != -1) {
         file_read_page(table_id, header_page->free_page_num, tmp_page);
         header_page->free_page_num = tmp_page->next_free_page_num;
+        file_set_page_checksum(table_id, 0, header_page);
         file_write_page(table_id, 0, header_page);
     }
     // Or not, double the entire database and return new one;
@@ -171,6 +402,7 @@ pagenum_t file_alloc_page(int64_t table_id) {
 
         header_page->free_page_num = num_of_pages - 2;
         header_page->num_of_pages = num_of_pages;
+        file_set_page_checksum(table_id, 0, header_page);
         file_write_page(table_id, 0, header_page);
     }
 
@@ -182,8 +414,8 @@ pagenum_t file_alloc_page(int64_t table_id) {
 
 // Free an on-disk page to the free page list
 void file_free_page(int64_t table_id, pagenum_t pagenum) {
-    page_t *header_page = (page_t*)malloc(PAGE_SIZE);
-    page_t *tmp_page = (page_t*)malloc(PAGE_SIZE);
+    page_t *header_page = file_new_page_buffer();
+    page_t *tmp_page = file_new_page_buffer();
 
     file_read_page(table_id, 0, header_page);
 
@@ -194,37 +426,362 @@ void file_free_page(int64_t table_id, pagenum_t pagenum) {
 
     // And adjust that to header page
     header_page->free_page_num = pagenum;
+    file_set_page_checksum(table_id, 0, header_page);
     file_write_page(table_id, 0, header_page);
     free(header_page);
 }
 
-// Read an on-disk page into the in-memory page structure(dest)
-void file_read_page(int64_t table_id, pagenum_t pagenum, struct page_t* dest) {
-    file_read_page_internal(table_id, pagenum, dest);
+/* Compress a leaf page into image (PAGE_SIZE bytes), zero-filled up to a
+ * file system block boundary.
+ * Returns the size to write, or 0 if the page is not a leaf page or does
+ * not save any block.
+ */
+static uint32_t file_compress_page(const table_node *table,
+                                   const struct page_t* src, byte *image) {
+    uint32_t size = compress_leaf_page(src, image, PAGE_SIZE);
+
+    if (size == 0)
+        return 0;
+
+    uint32_t aligned_size =
+        (size + table->block_size - 1) / table->block_size * table->block_size;
+
+    if (aligned_size >= PAGE_SIZE)
+        return 0;
+
+    memset(image + size, 0, aligned_size - size);
+    return aligned_size;
+}
+
+// Punch a hole in the rest of a page written compressed in size bytes
+static void file_punch_page(const table_node *table, pagenum_t pagenum,
+                            uint32_t size) {
+    // Failing to punch the hole is harmless, the tail is never read.
+    fallocate(table->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              PAGE_SIZE * pagenum + size, PAGE_SIZE - size);
+}
+
+/* Compute the checksum of a page, with its checksum field taken as zero.
+ * 0 is left for pages written without a checksum.
+ */
+uint32_t compute_page_checksum(const struct page_t* page) {
+    static const uint32_t zero = 0;
+    const size_t offset = offsetof(page_t, page_checksum);
+
+    uint32_t crc = crc32c(0, page, offset);
+    crc = crc32c(crc, &zero, sizeof(zero));
+    crc = crc32c(crc, page->space + offset + sizeof(zero),
+                 PAGE_SIZE - offset - sizeof(zero));
+
+    return crc != 0 ? crc : 1;
+}
+
+/* Check a page just read, decompressing it if it was written compressed.
+ * Returns 1 if the page does not match its checksum (a torn write).
+ */
+static int file_check_page(int64_t table_id, pagenum_t pagenum,
+                           struct page_t* dest) {
+    // Decompress the leaf page if it was written compressed
+    if (pagenum != 0 && is_compressed_page(dest->space) &&
+        (file_get_table_flags(table_id) & TABLE_FLAG_COMPRESSED_LEAF)) {
+        byte image[PAGE_SIZE];
+
+        memcpy(image, dest, PAGE_SIZE);
+        if (decompress_leaf_page(image, dest)) {
+            stat_checksum_failures++;
+            return 1;
+        }
+    }
+
+    if (dest->page_checksum != 0 &&
+        dest->page_checksum != compute_page_checksum(dest)) {
+        stat_checksum_failures++;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Read an on-disk page into the in-memory page structure(dest)
+ * Returns 1 if the page cannot be read whole, or does not match its
+ * checksum (a torn write).
+ */
+int file_read_page(int64_t table_id, pagenum_t pagenum, struct page_t* dest) {
+    int64_t ret = file_read_page_internal(table_id, pagenum, dest);
     stat_read_page++;
+
+    // What is left in dest may be another page, with a valid checksum.
+    if (ret != PAGE_SIZE)
+        return 1;
+
+    return file_check_page(table_id, pagenum, dest);
+}
+
+/* Get the i-th of the scratch pages of a batch of n (aligned for
+ * O_DIRECT), allocated on the first call.
+ */
+static byte *file_scratch_page(byte **scratch, int i, int n) {
+    if (*scratch == NULL &&
+        posix_memalign((void**)scratch, PAGE_ALIGNMENT,
+                       (size_t)n * PAGE_SIZE) != 0)
+        abort();
+
+    return *scratch + (size_t)i * PAGE_SIZE;
+}
+
+/* Read or write the pages of a batch with one submission to the I/O
+ * backend. The i-th page goes from or to bufs[i], sizes[i] bytes of it.
+ * The runs of adjacent whole pages of a file become one vectored request.
+ * Sets done[i] to whether the page was read or written in full.
+ */
+static void file_submit_pages(const page_io *ios, byte *const *bufs,
+                              const uint32_t *sizes, int n, bool write,
+                              bool *done) {
+    std::vector<table_node*> table_of(n);
+    std::vector<int> order(n);
+    std::vector<struct iovec> iovs(n);
+    std::vector<io_request> reqs;
+
+    for (int i = 0; i < n; i++) {
+        table_of[i] = file_search_table_node(ios[i].table_id);
+        order[i] = i;
+    }
+
+    // Put the pages of a file in order, so that the runs are adjacent.
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        if (table_of[a] != table_of[b])
+            return table_of[a] < table_of[b];
+        return ios[a].pagenum < ios[b].pagenum;
+    });
+
+    for (int k = 0; k < n;) {
+        int first = order[k];
+        table_node *table = table_of[first];
+        int len = 1;
+
+        iovs[k].iov_base = bufs[first];
+        iovs[k].iov_len = sizes[first];
+
+        // Extend the run while the pages are whole and follow each other.
+        while (table != NULL && k + len < n && len < IO_MAX_VECTOR) {
+            int prev = order[k + len - 1];
+            int next = order[k + len];
+
+            if (table_of[next] != table || sizes[prev] != PAGE_SIZE ||
+                sizes[next] != PAGE_SIZE ||
+                ios[next].pagenum != ios[prev].pagenum + 1)
+                break;
+
+            iovs[k + len].iov_base = bufs[next];
+            iovs[k + len].iov_len = PAGE_SIZE;
+            len++;
+        }
+
+        io_request req;
+        req.fd = table != NULL ? table->fd : -1;
+        req.slot = table != NULL ? file_table_slot(table) : -1;
+        req.offset = PAGE_SIZE * ios[first].pagenum;
+        req.write = write;
+        req.result = 0;
+
+        if (len == 1) {
+            req.buf = bufs[first];
+            req.size = sizes[first];
+            req.iov = NULL;
+            req.iovcnt = 0;
+        } else {
+            req.buf = NULL;
+            req.size = len * PAGE_SIZE;
+            req.iov = &iovs[k];
+            req.iovcnt = len;
+        }
+
+        reqs.push_back(req);
+        k += len;
+    }
+
+    io_submit(reqs.data(), reqs.size());
+
+    for (int k = 0, r = 0; k < n; r++) {
+        int len = reqs[r].iov != NULL ? reqs[r].iovcnt : 1;
+        bool ok = reqs[r].result == reqs[r].size;
+
+        for (int j = 0; j < len; j++)
+            done[order[k + j]] = ok;
+        k += len;
+    }
+}
+
+/* Read the pages with one submission to the I/O backend.
+ * Returns the number of pages failed; the result of each is 0, or 1 if it
+ * could not be read or does not match its checksum.
+ */
+int file_read_pages(page_io *ios, int n) {
+    std::vector<byte*> bufs(n);
+    std::vector<uint32_t> sizes(n, PAGE_SIZE);
+    bool *done = new bool[n];
+    byte *scratch = NULL;  // For the pages O_DIRECT cannot read into
+    int failed = 0;
+
+    for (int i = 0; i < n; i++) {
+        table_node *table = file_search_table_node(ios[i].table_id);
+
+        bufs[i] = (byte*)ios[i].page;
+        if (table != NULL && !file_is_aligned(table, bufs[i]))
+            bufs[i] = file_scratch_page(&scratch, i, n);
+    }
+
+    file_submit_pages(ios, bufs.data(), sizes.data(), n, false, done);
+    stat_read_page += n;
+
+    for (int i = 0; i < n; i++) {
+        page_io *io = &ios[i];
+
+        if (bufs[i] != (byte*)io->page)
+            memcpy(io->page, bufs[i], PAGE_SIZE);
+
+        io->result = !done[i] ||
+                     file_check_page(io->table_id, io->pagenum, io->page);
+        failed += io->result;
+    }
+
+    delete[] done;
+    free(scratch);
+
+    return failed;
+}
+
+/* Set the checksum of a page about to be written.
+ * Leaf pages of compressed tables get their free space zero-filled first,
+ * as they are read back.
+ */
+void file_set_page_checksum(int64_t table_id, pagenum_t pagenum,
+                            struct page_t* page) {
+    if (pagenum != 0 &&
+        (file_get_table_flags(table_id) & TABLE_FLAG_COMPRESSED_LEAF))
+        clear_leaf_free_space(page);
+
+    page->page_checksum = compute_page_checksum(page);
 }
 
 // Write an in-memory page(src) to the on-disk page
 void file_write_page(int64_t table_id, pagenum_t pagenum, const struct page_t* src) {
-    file_write_page_internal(table_id, pagenum, src);
+    table_node *table = file_search_table_node(table_id);
+
     stat_write_page++;
+
+    // Compress the leaf page if the table asks for it
+    if (pagenum != 0 && (table->flags & TABLE_FLAG_COMPRESSED_LEAF)) {
+        alignas(PAGE_ALIGNMENT) byte image[PAGE_SIZE];
+        uint32_t size = file_compress_page(table, src, image);
+
+        if (size != 0) {
+            io_write(table->fd, file_table_slot(table), image, size,
+                     PAGE_SIZE * pagenum);
+            file_punch_page(table, pagenum, size);
+            return;
+        }
+    }
+
+    file_write_page_internal(table_id, pagenum, src);
 }
 
-// Close the table file
-void file_close_table_files() {
-    for (int i = 0; i < MAX_TABLES; i++) {
-        if (tables[i].fd != 0) {
-            close(tables[i].fd);
-            tables[i].fd = -1;
-            tables[i].table_id = -1;
+/* Write the pages with one submission to the I/O backend.
+ * Returns the number of pages failed; the result of each is 0, or 1 if it
+ * could not be written.
+ */
+int file_write_pages(page_io *ios, int n) {
+    std::vector<byte*> bufs(n);
+    std::vector<uint32_t> sizes(n, PAGE_SIZE);
+    bool *done = new bool[n];
+    byte *scratch = NULL;  // For compressed leaf pages, and the pages
+                           // O_DIRECT cannot write from
+    int failed = 0;
+
+    for (int i = 0; i < n; i++) {
+        page_io *io = &ios[i];
+        table_node *table = file_search_table_node(io->table_id);
+
+        bufs[i] = (byte*)io->page;
+
+        // Compress the leaf page if the table asks for it
+        if (table != NULL && io->pagenum != 0 &&
+            (table->flags & TABLE_FLAG_COMPRESSED_LEAF)) {
+            byte *image = file_scratch_page(&scratch, i, n);
+            uint32_t size = file_compress_page(table, io->page, image);
+
+            if (size != 0) {
+                bufs[i] = image;
+                sizes[i] = size;
+            }
         }
+
+        if (table != NULL && !file_is_aligned(table, bufs[i])) {
+            bufs[i] = file_scratch_page(&scratch, i, n);
+            memcpy(bufs[i], io->page, PAGE_SIZE);
+        }
+    }
+
+    file_submit_pages(ios, bufs.data(), sizes.data(), n, true, done);
+    stat_write_page += n;
+
+    for (int i = 0; i < n; i++) {
+        ios[i].result = !done[i];
+        failed += ios[i].result;
+
+        if (sizes[i] != PAGE_SIZE)
+            file_punch_page(file_search_table_node(ios[i].table_id),
+                            ios[i].pagenum, sizes[i]);
+    }
+
+    delete[] done;
+    free(scratch);
+
+    return failed;
+}
+
+// Sync the table file to the disk
+int file_sync_table(int64_t table_id) {
+    int fd = file_search_table_id(table_id);
+
+    return fd < 0 || fdatasync(fd) != 0;
+}
+
+// Sync all table files to the disk
+int file_sync_tables() {
+    int ret = 0;
+
+    for (int i = 0; i < num_tables; i++) {
+        if (fdatasync(file_table_node(i)->fd) != 0)
+            ret = 1;
+    }
+
+    return ret;
+}
+
+// Close the table files, and empty the registry
+void file_close_table_files() {
+    for (int i = 0; i < num_tables; i++) {
+        table_node *table = file_table_node(i);
+
+        if (table->map != NULL)
+            munmap(table->map, table->map_pages * PAGE_SIZE);
+
+        io_set_file(i, -1);
+        close(table->fd);
     }
 
-    tid_counter = 0;
+    // The chunks are kept for the tables opened next.
+    for (int i = 0; i < MAX_TABLE_CHUNKS && table_chunks[i] != NULL; i++)
+        memset(table_chunks[i], 0, TABLE_CHUNK * sizeof(table_node));
+
+    num_tables = 0;
+    table_ids.clear();
 }
 
 // For stat
 void init_stat_file() {
     stat_read_page = 0;
     stat_write_page = 0;
+    stat_checksum_failures = 0;
 }
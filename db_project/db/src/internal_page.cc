@@ -0,0 +1,467 @@
+#include "internal_page.h"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Get the narrowest delta width covering the key range
+static uint32_t packed_width(db_key_t min_key, db_key_t max_key) {
+    uint64_t range = (uint64_t)max_key - (uint64_t)min_key;
+
+    if (range <= UINT8_MAX)
+        return 1;
+    if (range <= UINT16_MAX)
+        return 2;
+    if (range <= UINT32_MAX)
+        return 4;
+    return 8;
+}
+
+// Get the largest delta the width can hold
+static inline uint64_t packed_max_delta(uint32_t width) {
+    return width == 8 ? UINT64_MAX : ((uint64_t)1 << (8 * width)) - 1;
+}
+
+static inline byte *packed_children(page_t *page) {
+    return page->packed + PACKED_CAPACITY(page->key_width) * page->key_width;
+}
+
+static inline const byte *packed_children(const page_t *page) {
+    return page->packed + PACKED_CAPACITY(page->key_width) * page->key_width;
+}
+
+static inline uint64_t packed_get_delta(const page_t *page, int index) {
+    const byte *p = page->packed + index * page->key_width;
+
+    switch (page->key_width) {
+    case 1: return *(const uint8_t*)p;
+    case 2: { uint16_t d; memcpy(&d, p, 2); return d; }
+    case 4: { uint32_t d; memcpy(&d, p, 4); return d; }
+    default: { uint64_t d; memcpy(&d, p, 8); return d; }
+    }
+}
+
+static inline void packed_set_delta(page_t *page, int index, uint64_t delta) {
+    byte *p = page->packed + index * page->key_width;
+
+    switch (page->key_width) {
+    case 1: *(uint8_t*)p = (uint8_t)delta; break;
+    case 2: { uint16_t d = delta; memcpy(p, &d, 2); break; }
+    case 4: { uint32_t d = delta; memcpy(p, &d, 4); break; }
+    default: memcpy(p, &delta, 8); break;
+    }
+}
+
+/* Count the deltas <= target among the first num_keys deltas.
+ * The deltas are sorted, so whole vectors are compared until the first one
+ * holding a greater delta, and the rest is finished one by one.
+ */
+static int packed_count_le(const page_t *page, int num_keys, uint64_t target) {
+    int i = 0;
+
+#if defined(__SSE2__)
+    const byte *p = page->packed;
+
+    switch (page->key_width) {
+    case 1: {
+        const __m128i bias = _mm_set1_epi8((char)0x80);
+        const __m128i t = _mm_xor_si128(_mm_set1_epi8((char)target), bias);
+
+        for (; i + 16 <= num_keys; i += 16) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(p + i));
+            int mask = _mm_movemask_epi8(
+                _mm_cmpgt_epi8(_mm_xor_si128(d, bias), t));
+
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        break;
+    }
+    case 2: {
+        const __m128i bias = _mm_set1_epi16((short)0x8000);
+        const __m128i t = _mm_xor_si128(_mm_set1_epi16((short)target), bias);
+
+        for (; i + 8 <= num_keys; i += 8) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(p + 2 * i));
+            int mask = _mm_movemask_epi8(
+                _mm_cmpgt_epi16(_mm_xor_si128(d, bias), t));
+
+            if (mask)
+                return i + __builtin_ctz(mask) / 2;
+        }
+        break;
+    }
+    case 4: {
+        const __m128i bias = _mm_set1_epi32((int)0x80000000);
+        const __m128i t = _mm_xor_si128(_mm_set1_epi32((int)target), bias);
+
+        for (; i + 4 <= num_keys; i += 4) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(p + 4 * i));
+            int mask = _mm_movemask_epi8(
+                _mm_cmpgt_epi32(_mm_xor_si128(d, bias), t));
+
+            if (mask)
+                return i + __builtin_ctz(mask) / 4;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+#endif
+
+    for (; i < num_keys; i++) {
+        if (packed_get_delta(page, i) > target)
+            break;
+    }
+
+    return i;
+}
+
+typedef struct var_entry {
+    db_key_t prefix;     // The abbreviated key
+    pagenum_t page_num;
+    uint16_t size;       // Size of the key bytes
+    uint16_t offset;     // Offset of the key bytes in packed
+} var_entry;
+
+static inline void var_get_entry(const page_t *page, int index,
+                                 var_entry *entry) {
+    const byte *p = page->packed + index * VAR_ENTRY_SIZE;
+
+    memcpy(&entry->prefix, p, 8);
+    memcpy(&entry->page_num, p + 8, 8);
+    memcpy(&entry->size, p + 16, 2);
+    memcpy(&entry->offset, p + 18, 2);
+}
+
+static inline void var_set_entry(page_t *page, int index,
+                                 const var_entry *entry) {
+    byte *p = page->packed + index * VAR_ENTRY_SIZE;
+
+    memcpy(p, &entry->prefix, 8);
+    memcpy(p + 8, &entry->page_num, 8);
+    memcpy(p + 16, &entry->size, 2);
+    memcpy(p + 18, &entry->offset, 2);
+}
+
+// Get the bytes used by the entries and keys of a var page
+static int var_used_space(const page_t *page) {
+    int used = 0;
+
+    for (int i = 0; i < page->num_of_keys; i++) {
+        uint16_t size;
+        memcpy(&size, page->packed + i * VAR_ENTRY_SIZE + 16, 2);
+        used += VAR_ENTRY_SIZE + size;
+    }
+
+    return used;
+}
+
+// Compare the key of the index-th entry of a var page with key
+static inline int var_compare(const page_t *page, int index,
+                              const tree_key_t *key) {
+    var_entry entry;
+
+    var_get_entry(page, index, &entry);
+
+    if (entry.prefix != key->prefix)
+        return entry.prefix < key->prefix ? -1 : 1;
+
+    return key_compare_bytes(page->packed + entry.offset, entry.size,
+                             key->data, key->size);
+}
+
+// Get the number of keys of a var page comparing <= key (or < key)
+static int var_count(const page_t *page, const tree_key_t *key,
+                     bool inclusive) {
+    int low = 0, high = page->num_of_keys;
+
+    while (low < high) {
+        int mid = (low + high) / 2;
+        int cmp = var_compare(page, mid, key);
+
+        if (cmp < 0 || (inclusive && cmp == 0))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+// Get the internal page format of a table
+int internal_format(uint64_t table_flags) {
+    if (table_flags & TABLE_FLAG_VAR_KEYS)
+        return INTERNAL_VAR;
+
+    if (table_flags & TABLE_FLAG_PACKED_KEYS)
+        return INTERNAL_PACKED;
+
+    return INTERNAL_PLAIN;
+}
+
+// Check whether the internal page can take one more pair with the key
+bool internal_has_room(const page_t *page, const tree_key_t *key, int format) {
+    int num_keys = page->num_of_keys;
+
+    switch (format) {
+    case INTERNAL_PLAIN:
+        return num_keys < INTERNAL_ORDER - 1;
+    case INTERNAL_VAR:
+        return var_used_space(page) + VAR_ENTRY_SIZE + key->size <= DATA_SIZE;
+    default:
+        break;
+    }
+
+    if (num_keys == 0)
+        return true;
+
+    db_key_t min_key = (db_key_t)page->base_key;
+    db_key_t max_key = (db_key_t)((uint64_t)page->base_key +
+                                  packed_get_delta(page, num_keys - 1));
+
+    if (key->prefix < min_key)
+        min_key = key->prefix;
+    if (key->prefix > max_key)
+        max_key = key->prefix;
+
+    return num_keys + 1 <= PACKED_CAPACITY(packed_width(min_key, max_key));
+}
+
+// Check whether the internal page holds too few keys after a deletion
+bool internal_is_underfull(const page_t *page, int format) {
+    if (format == INTERNAL_VAR)
+        return var_used_space(page) < DATA_SIZE / 2;
+
+    return page->num_of_keys < (INTERNAL_ORDER + 1) / 2 - 1;
+}
+
+/* Check whether the pairs of left, k_prime and the pairs
+ * of right fit a page.
+ */
+bool internal_can_merge(const page_t *left, const tree_key_t *k_prime,
+                        const page_t *right, int format) {
+    int num_left = left->num_of_keys;
+    int num_right = right->num_of_keys;
+    tree_key_t min_key, max_key;
+
+    switch (format) {
+    case INTERNAL_PLAIN:
+        return num_left + num_right + 1 <= INTERNAL_ORDER - 1;
+    case INTERNAL_VAR:
+        return var_used_space(left) + var_used_space(right) +
+               VAR_ENTRY_SIZE + k_prime->size <= DATA_SIZE;
+    default:
+        break;
+    }
+
+    if (num_left > 0)
+        internal_get_key(left, 0, format, &min_key);
+    else
+        min_key = *k_prime;
+
+    if (num_right > 0)
+        internal_get_key(right, num_right - 1, format, &max_key);
+    else
+        max_key = *k_prime;
+
+    return num_left + num_right + 1 <=
+           PACKED_CAPACITY(packed_width(min_key.prefix, max_key.prefix));
+}
+
+// Check whether num_entries sorted entries fit a page
+bool internal_fits(const internal_entry *entries, int num_entries, int format) {
+    switch (format) {
+    case INTERNAL_PLAIN:
+        return num_entries <= INTERNAL_ORDER - 1;
+    case INTERNAL_VAR: {
+        int used = 0;
+
+        for (int i = 0; i < num_entries; i++)
+            used += VAR_ENTRY_SIZE + entries[i].key.size;
+
+        return used <= DATA_SIZE;
+    }
+    default:
+        break;
+    }
+
+    if (num_entries == 0)
+        return true;
+
+    return num_entries <= PACKED_CAPACITY(
+        packed_width(entries[0].key.prefix, entries[num_entries - 1].key.prefix));
+}
+
+// Get the key of the index-th pair
+void internal_get_key(const page_t *page, int index, int format,
+                      tree_key_t *key) {
+    switch (format) {
+    case INTERNAL_PLAIN:
+        key_set_int(key, page->pairs[index].key);
+        break;
+    case INTERNAL_PACKED:
+        key_set_int(key, (db_key_t)((uint64_t)page->base_key +
+                                    packed_get_delta(page, index)));
+        break;
+    default: {
+        var_entry entry;
+
+        var_get_entry(page, index, &entry);
+        key->prefix = entry.prefix;
+        key->size = entry.size;
+        memcpy(key->data, page->packed + entry.offset, entry.size);
+        break;
+    }
+    }
+}
+
+// Get the page num of the index-th pair (-1 for the most left page num)
+pagenum_t internal_get_child(const page_t *page, int index, int format) {
+    pagenum_t page_num;
+
+    if (index < 0)
+        return page->most_left_page_num;
+
+    switch (format) {
+    case INTERNAL_PLAIN:
+        return page->pairs[index].page_num;
+    case INTERNAL_PACKED:
+        memcpy(&page_num, packed_children(page) + index * sizeof(pagenum_t),
+               sizeof(pagenum_t));
+        return page_num;
+    default:
+        memcpy(&page_num, page->packed + index * VAR_ENTRY_SIZE + 8,
+               sizeof(pagenum_t));
+        return page_num;
+    }
+}
+
+// Copy all key-page num pairs of the page into entries
+void internal_unpack(const page_t *page, internal_entry *entries, int format) {
+    for (int i = 0; i < page->num_of_keys; i++) {
+        internal_get_key(page, i, format, &entries[i].key);
+        entries[i].page_num = internal_get_child(page, i, format);
+    }
+}
+
+/* Store the sorted entries into the page and set its number of keys.
+ * Returns 1 without touching the page if the entries do not fit.
+ */
+int internal_pack(page_t *page, const internal_entry *entries,
+                  int num_entries, int format) {
+    if (!internal_fits(entries, num_entries, format))
+        return 1;
+
+    switch (format) {
+    case INTERNAL_PLAIN:
+        for (int i = 0; i < num_entries; i++) {
+            page->pairs[i].key = entries[i].key.prefix;
+            page->pairs[i].page_num = entries[i].page_num;
+        }
+        break;
+    case INTERNAL_PACKED: {
+        db_key_t base_key = num_entries > 0 ? entries[0].key.prefix : 0;
+        db_key_t max_key =
+            num_entries > 0 ? entries[num_entries - 1].key.prefix : 0;
+
+        page->base_key = base_key;
+        page->key_width = packed_width(base_key, max_key);
+
+        byte *children = packed_children(page);
+
+        for (int i = 0; i < num_entries; i++) {
+            packed_set_delta(page, i,
+                             (uint64_t)entries[i].key.prefix - (uint64_t)base_key);
+            memcpy(children + i * sizeof(pagenum_t), &entries[i].page_num,
+                   sizeof(pagenum_t));
+        }
+        break;
+    }
+    default: {
+        uint16_t offset = DATA_SIZE;
+        var_entry entry;
+
+        for (int i = 0; i < num_entries; i++) {
+            offset -= entries[i].key.size;
+
+            entry.prefix = entries[i].key.prefix;
+            entry.page_num = entries[i].page_num;
+            entry.size = entries[i].key.size;
+            entry.offset = offset;
+
+            var_set_entry(page, i, &entry);
+            memcpy(page->packed + offset, entries[i].key.data, entry.size);
+        }
+        break;
+    }
+    }
+
+    page->num_of_keys = num_entries;
+    return 0;
+}
+
+// Get the index of the last key <= key, or -1 (the most left page)
+int internal_search(const page_t *page, const tree_key_t *key, int format) {
+    int num_keys = page->num_of_keys;
+
+    switch (format) {
+    case INTERNAL_PLAIN: {
+        int p_index = -1;
+
+        while (p_index < num_keys - 1 &&
+               page->pairs[p_index + 1].key <= key->prefix)
+            p_index++;
+
+        return p_index;
+    }
+    case INTERNAL_VAR:
+        return var_count(page, key, true) - 1;
+    default:
+        break;
+    }
+
+    if (num_keys == 0 || key->prefix < page->base_key)
+        return -1;
+
+    uint64_t target = (uint64_t)key->prefix - (uint64_t)page->base_key;
+
+    if (target >= packed_max_delta(page->key_width))
+        return num_keys - 1;
+
+    return packed_count_le(page, num_keys, target) - 1;
+}
+
+// Get the number of keys < key
+int internal_lower_bound(const page_t *page, const tree_key_t *key,
+                         int format) {
+    int num_keys = page->num_of_keys;
+
+    switch (format) {
+    case INTERNAL_PLAIN: {
+        int index = 0;
+
+        while (index < num_keys && page->pairs[index].key < key->prefix)
+            index++;
+
+        return index;
+    }
+    case INTERNAL_VAR:
+        return var_count(page, key, false);
+    default:
+        break;
+    }
+
+    if (num_keys == 0 || key->prefix <= page->base_key)
+        return 0;
+
+    uint64_t target = (uint64_t)key->prefix - (uint64_t)page->base_key - 1;
+
+    if (target >= packed_max_delta(page->key_width))
+        return num_keys;
+
+    return packed_count_le(page, num_keys, target);
+}
@@ -0,0 +1,516 @@
+#include "io.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// For stats
+int64_t stat_io_requests;
+int64_t stat_io_submits;
+
+#define add_stat(stat, n) __atomic_fetch_add(&(stat), (n), __ATOMIC_RELAXED)
+
+/* What is to be registered with the rings. Each ring registers it again
+ * when it sees the version changed.
+ */
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int registered_fds[IO_MAX_FILES];
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static void *registered_base = NULL;
+static size_t registered_size = 0;
+static uint64_t registry_version = 1;
+static uint64_t buffers_version = 1;  // Of the buffers only
+
+static int io_sync_submit(io_request *reqs, int n);
+static int io_uring_submit(io_request *reqs, int n);
+
+static const io_backend_t sync_backend = { "sync", io_sync_submit };
+static const io_backend_t uring_backend = { "io_uring", io_uring_submit };
+
+// Picked with IO_BACKEND_AUTO on the first use, unless opened before
+static const io_backend_t *backend = NULL;
+
+static void init_registry() {
+    for (int i = 0; i < IO_MAX_FILES; i++)
+        registered_fds[i] = -1;
+}
+
+/* Sync backend */
+
+// Get the buffer of a request at a byte offset, and the bytes up to its end
+static char *io_get_buffer(const io_request *req, int64_t at, size_t *size) {
+    if (req->iov == NULL) {
+        *size = req->size - at;
+        return (char*)req->buf + at;
+    }
+
+    for (int i = 0; i < req->iovcnt; i++) {
+        if (at < (int64_t)req->iov[i].iov_len) {
+            *size = req->iov[i].iov_len - at;
+            return (char*)req->iov[i].iov_base + at;
+        }
+
+        at -= req->iov[i].iov_len;
+    }
+
+    *size = 0;
+    return NULL;
+}
+
+// Finish the rest of a request with pread()/pwrite()
+static void io_sync_finish(io_request *req) {
+    if (req->result < 0)
+        req->result = 0;
+
+    while (req->result < req->size) {
+        size_t size;
+        char *buf = io_get_buffer(req, req->result, &size);
+        off_t offset = req->offset + req->result;
+        ssize_t ret;
+
+        // The whole of a vectored request at once
+        if (req->iov != NULL && req->result == 0)
+            ret = req->write ? pwritev(req->fd, req->iov, req->iovcnt, offset) :
+                               preadv(req->fd, req->iov, req->iovcnt, offset);
+        else
+            ret = req->write ? pwrite(req->fd, buf, size, offset) :
+                               pread(req->fd, buf, size, offset);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+
+        if (ret < 0) {
+            req->result = -errno;
+            return;
+        }
+
+        // Reading past the end of the file
+        if (ret == 0)
+            return;
+
+        req->result += ret;
+    }
+}
+
+static int io_sync_submit(io_request *reqs, int n) {
+    int failed = 0;
+
+    for (int i = 0; i < n; i++) {
+        reqs[i].result = 0;
+        io_sync_finish(&reqs[i]);
+        failed += reqs[i].result != reqs[i].size;
+    }
+
+    add_stat(stat_io_submits, n);
+
+    return failed;
+}
+
+/* io_uring backend
+ *
+ * There is no liburing here, so the rings are set up with the system calls
+ * and shared with the kernel as described in io_uring(7).
+ */
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg,
+                                 unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+typedef struct uring_t {
+    int fd = -1;
+    unsigned entries;
+
+    void *sq_ptr;
+    size_t sq_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    void *cq_ptr;  // The same as sq_ptr with IORING_FEAT_SINGLE_MMAP
+    size_t cq_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    uint64_t version = 0;     // Of the registry, when registered
+    bool files_registered = false;
+    uint64_t buffers_version = 0;
+    void *buffers_base = NULL;  // Registered buffer, NULL if none
+    size_t buffers_size = 0;
+
+    ~uring_t();
+} uring_t;
+
+static thread_local uring_t ring;
+
+static void uring_close(uring_t *r) {
+    if (r->fd < 0)
+        return;
+
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    munmap(r->sq_ptr, r->sq_size);
+    close(r->fd);
+
+    r->fd = -1;
+    r->version = 0;
+    r->files_registered = false;
+    r->buffers_version = 0;
+    r->buffers_base = NULL;
+    r->buffers_size = 0;
+}
+
+uring_t::~uring_t() {
+    uring_close(this);
+}
+
+// Set up the ring of the thread. Returns 0 on success.
+static int uring_setup(uring_t *r) {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_io_uring_setup(IO_QUEUE_DEPTH, &p);
+    if (r->fd < 0)
+        return 1;
+
+    r->entries = p.sq_entries;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_size > r->sq_size)
+            r->sq_size = r->cq_size;
+        r->cq_size = r->sq_size;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail_sq;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            goto fail_cq;
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL, r->sqes_size,
+                                         PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, r->fd,
+                                         IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail_sqes;
+
+    r->sq_head = (unsigned*)((char*)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned*)((char*)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned*)((char*)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)((char*)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned*)((char*)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned*)((char*)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned*)((char*)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)((char*)r->cq_ptr + p.cq_off.cqes);
+
+    return 0;
+
+fail_sqes:
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+fail_cq:
+    munmap(r->sq_ptr, r->sq_size);
+fail_sq:
+    close(r->fd);
+    r->fd = -1;
+    return 1;
+}
+
+/* Bring the files and buffers registered with the ring up to date.
+ * A registration the kernel refuses (e.g. over RLIMIT_MEMLOCK) is done
+ * without, with plain reads and writes.
+ */
+static void uring_update_registry(uring_t *r) {
+    int fds[IO_MAX_FILES];
+    void *base;
+    size_t size;
+    uint64_t version;
+
+    if (r->version == __atomic_load_n(&registry_version, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_once(&registry_once, init_registry);
+    pthread_mutex_lock(&registry_mutex);
+
+    if (r->version == registry_version) {
+        pthread_mutex_unlock(&registry_mutex);
+        return;
+    }
+
+    r->version = registry_version;
+    memcpy(fds, registered_fds, sizeof(fds));
+    base = registered_base;
+    size = registered_size;
+    version = buffers_version;
+
+    pthread_mutex_unlock(&registry_mutex);
+
+    if (r->files_registered)
+        sys_io_uring_register(r->fd, IORING_UNREGISTER_FILES, NULL, 0);
+    r->files_registered =
+        sys_io_uring_register(r->fd, IORING_REGISTER_FILES, fds,
+                              IO_MAX_FILES) == 0;
+
+    /* Memory set again is registered again, even at the same address: it
+     * may be mapped anew, and the registration pins the pages of the old.
+     */
+    if (version == r->buffers_version)
+        return;
+    r->buffers_version = version;
+
+    if (r->buffers_base != NULL)
+        sys_io_uring_register(r->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    r->buffers_base = NULL;
+    r->buffers_size = 0;
+
+    if (base != NULL) {
+        struct iovec iov = { base, size };
+
+        if (sys_io_uring_register(r->fd, IORING_REGISTER_BUFFERS,
+                                  &iov, 1) == 0) {
+            r->buffers_base = base;
+            r->buffers_size = size;
+        }
+    }
+}
+
+static void uring_prep(uring_t *r, const io_request *req, uint64_t index) {
+    unsigned tail = *r->sq_tail;
+    unsigned i = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[i];
+    char *buf = (char*)req->buf;
+    char *base = (char*)r->buffers_base;
+    bool fixed_buf = base != NULL && buf >= base &&
+                     buf + req->size <= base + r->buffers_size;
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    if (req->iov != NULL)
+        sqe->opcode = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    else if (fixed_buf)
+        sqe->opcode = req->write ? IORING_OP_WRITE_FIXED :
+                                   IORING_OP_READ_FIXED;
+    else
+        sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+
+    if (r->files_registered && req->slot >= 0 && req->slot < IO_MAX_FILES) {
+        sqe->fd = req->slot;
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = req->fd;
+    }
+
+    if (req->iov != NULL) {
+        sqe->addr = (uint64_t)(uintptr_t)req->iov;
+        sqe->len = req->iovcnt;
+    } else {
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = req->size;
+    }
+    sqe->off = req->offset;
+    sqe->buf_index = 0;
+    sqe->user_data = index;
+
+    r->sq_array[i] = i;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int io_uring_submit(io_request *reqs, int n) {
+    uring_t *r = &ring;
+    int failed = 0;
+
+    if (r->fd < 0 && uring_setup(r) != 0)
+        return io_sync_submit(reqs, n);
+
+    uring_update_registry(r);
+
+    for (int done = 0; done < n;) {
+        unsigned count = n - done < (int)r->entries ? n - done : r->entries;
+        unsigned completed = 0;
+
+        for (unsigned i = 0; i < count; i++)
+            uring_prep(r, &reqs[done + i], done + i);
+
+        // Submit the batch and sleep until all of it is complete.
+        unsigned to_submit = count;
+        while (completed < count) {
+            int ret = sys_io_uring_enter(r->fd, to_submit, count - completed,
+                                         IORING_ENTER_GETEVENTS);
+
+            if (ret < 0 && errno != EINTR && errno != EAGAIN &&
+                errno != EBUSY) {
+                // The ring is broken; do what is left synchronously.
+                uring_close(r);
+                for (unsigned i = 0; i < count; i++)
+                    reqs[done + i].result = -1;
+                break;
+            }
+
+            if (to_submit != 0)
+                add_stat(stat_io_submits, 1);
+            if (ret > 0)
+                to_submit -= (unsigned)ret < to_submit ? ret : to_submit;
+
+            unsigned head = *r->cq_head;
+            unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+            for (; head != tail; head++) {
+                struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+
+                reqs[cqe->user_data].result = cqe->res;
+                completed++;
+            }
+
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        // Finish failed or short transfers the plain way.
+        for (unsigned i = 0; i < count; i++) {
+            io_request *req = &reqs[done + i];
+
+            if (req->result != req->size && req->result != 0)
+                io_sync_finish(req);
+            failed += req->result != req->size;
+        }
+
+        done += count;
+
+        if (r->fd < 0)
+            return failed + io_sync_submit(reqs + done, n - done);
+    }
+
+    return failed;
+}
+
+/* Backend selection */
+
+static bool is_uring_available() {
+    struct io_uring_params p;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    fd = sys_io_uring_setup(1, &p);
+    if (fd < 0)
+        return false;
+
+    close(fd);
+    return true;
+}
+
+/* Use the backend for the following I/O.
+ * Returns 1 (keeping the current one) if it is not available.
+ */
+int io_open(int new_backend) {
+    switch (new_backend) {
+    case IO_BACKEND_AUTO:
+        backend = is_uring_available() ? &uring_backend : &sync_backend;
+        return 0;
+    case IO_BACKEND_SYNC:
+        backend = &sync_backend;
+        return 0;
+    case IO_BACKEND_URING:
+        if (!is_uring_available())
+            return 1;
+        backend = &uring_backend;
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+// Get the name of the backend in use
+const char *io_get_backend_name() {
+    if (backend == NULL)
+        io_open(IO_BACKEND_AUTO);
+
+    return backend->name;
+}
+
+// Register the file in the slot, or clear the slot with fd -1
+void io_set_file(int slot, int fd) {
+    if (slot < 0 || slot >= IO_MAX_FILES)
+        return;
+
+    pthread_once(&registry_once, init_registry);
+    pthread_mutex_lock(&registry_mutex);
+
+    registered_fds[slot] = fd;
+    __atomic_fetch_add(&registry_version, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+// Register the memory of the buffer frames, or forget it with NULL
+void io_set_buffers(void *base, size_t size) {
+    pthread_once(&registry_once, init_registry);
+    pthread_mutex_lock(&registry_mutex);
+
+    registered_base = base;
+    registered_size = base != NULL ? size : 0;
+    buffers_version++;
+    __atomic_fetch_add(&registry_version, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+/* Do the requests, in any order, and set their results.
+ * Returns the number of requests not done in full.
+ */
+int io_submit(io_request *reqs, int n) {
+    if (n <= 0)
+        return 0;
+
+    if (backend == NULL)
+        io_open(IO_BACKEND_AUTO);
+
+    add_stat(stat_io_requests, n);
+
+    return backend->submit(reqs, n);
+}
+
+// Read or write size bytes at offset, returning the bytes done or -errno
+int64_t io_read(int fd, int slot, void *buf, uint32_t size, uint64_t offset) {
+    io_request req = { fd, slot, buf, size, offset, false, 0, NULL, 0 };
+
+    io_submit(&req, 1);
+    return req.result;
+}
+
+int64_t io_write(int fd, int slot, const void *buf, uint32_t size,
+                 uint64_t offset) {
+    io_request req = { fd, slot, (void*)buf, size, offset, true, 0, NULL, 0 };
+
+    io_submit(&req, 1);
+    return req.result;
+}
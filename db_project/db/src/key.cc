@@ -0,0 +1,49 @@
+#include "key.h"
+
+// Start an empty composite key
+void key_builder_init(key_builder_t *builder) {
+    builder->size = 0;
+    builder->overflow = false;
+}
+
+// Append an int64 component (8 bytes)
+void key_append_int64(key_builder_t *builder, int64_t value) {
+    uint64_t biased = (uint64_t)value ^ ((uint64_t)1 << 63);
+
+    if (builder->size + 8 > MAX_KEY_SIZE) {
+        builder->overflow = true;
+        return;
+    }
+
+    // Big-endian, so memcmp() sees the most significant byte first.
+    for (int i = 7; i >= 0; i--)
+        builder->data[builder->size++] = (byte)(biased >> (8 * i));
+}
+
+/* Append a byte-string component.
+ * 0x00 bytes are escaped as 0x00 0xff and the component ends with 0x00 0x00,
+ * so a shorter string orders before the strings it prefixes.
+ */
+void key_append_bytes(key_builder_t *builder, const char *data, uint16_t size) {
+    uint16_t encoded_size = size + 2;
+
+    for (uint16_t i = 0; i < size; i++) {
+        if (data[i] == 0)
+            encoded_size++;
+    }
+
+    if (builder->size + encoded_size > MAX_KEY_SIZE) {
+        builder->overflow = true;
+        return;
+    }
+
+    for (uint16_t i = 0; i < size; i++) {
+        builder->data[builder->size++] = data[i];
+
+        if (data[i] == 0)
+            builder->data[builder->size++] = (byte)0xff;
+    }
+
+    builder->data[builder->size++] = 0;
+    builder->data[builder->size++] = 0;
+}
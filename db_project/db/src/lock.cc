@@ -0,0 +1,313 @@
+#include "lock.h"
+
+#include <algorithm>
+#include <pthread.h>
+#include <time.h>
+#include <unordered_map>
+
+// For stats
+int64_t stat_lock_requests;
+int64_t stat_lock_waits;
+int64_t stat_lock_wait_ns;
+int64_t stat_deadlocks;
+
+// How long a waiting request sleeps before looking for a deadlock again
+#define LOCK_CHECK_INTERVAL_NS (10 * 1000 * 1000)  // 10 ms
+
+#define add_stat(stat, n) __atomic_fetch_add(&(stat), (n), __ATOMIC_RELAXED)
+
+typedef struct lock_id {
+    int64_t table_id;
+    bool end;        // The end of the table, after the last key
+    tree_key_t key;
+} lock_id;
+
+typedef struct lock_request {
+    txn_t *txn;
+    int granted_mode;  // 0 if not granted yet
+    int wait_mode;     // 0 if not waiting
+} lock_request;
+
+typedef struct lock_t {
+    lock_id id;
+    int partition;
+    std::vector<lock_request> queue;  // In the order of the requests
+} lock_t;
+
+struct hash_lock_id {
+    size_t operator()(const lock_id &id) const {
+        // FNV-1a
+        uint64_t h = 14695981039346656037ULL;
+        const byte *data = id.key.data;
+
+        h = (h ^ (uint64_t)id.table_id) * 1099511628211ULL;
+        h = (h ^ (uint64_t)id.key.prefix) * 1099511628211ULL;
+        h = (h ^ (uint64_t)id.end) * 1099511628211ULL;
+
+        for (uint16_t i = 0; i < id.key.size; i++)
+            h = (h ^ (uint8_t)data[i]) * 1099511628211ULL;
+
+        return h;
+    }
+};
+
+struct equal_lock_id {
+    bool operator()(const lock_id &a, const lock_id &b) const {
+        return a.table_id == b.table_id && a.end == b.end &&
+               (a.end || key_compare(&a.key, &b.key) == 0);
+    }
+};
+
+typedef struct lock_partition {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;  // Signaled when a lock is released
+    std::unordered_map<lock_id, lock_t*, hash_lock_id, equal_lock_id> locks;
+} lock_partition;
+
+static lock_partition partitions[LOCK_PARTITIONS];
+static pthread_once_t partitions_once = PTHREAD_ONCE_INIT;
+
+// The wait-for graph: a waiting transaction -> the ones it waits for
+static pthread_mutex_t graph_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::unordered_map<uint64_t, std::vector<uint64_t>> waits_for;
+
+static void init_partitions() {
+    for (int i = 0; i < LOCK_PARTITIONS; i++) {
+        pthread_mutex_init(&partitions[i].mutex, NULL);
+        pthread_cond_init(&partitions[i].cond, NULL);
+    }
+}
+
+static inline bool is_conflicting(int a, int b) {
+    return a == LOCK_EXCLUSIVE || b == LOCK_EXCLUSIVE;
+}
+
+static inline int64_t get_time_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Get the transactions a request of the mode at index waits for:
+ * the others granted a conflicting mode and, for a new request, the ones
+ * before it waiting for a conflicting mode.
+ */
+static void get_blockers(const lock_t *lock, size_t index, int mode,
+                         std::vector<uint64_t> *blockers) {
+    const lock_request *req = &lock->queue[index];
+
+    for (size_t i = 0; i < lock->queue.size(); i++) {
+        const lock_request *other = &lock->queue[i];
+
+        if (i == index)
+            continue;
+
+        if ((other->granted_mode && is_conflicting(mode, other->granted_mode)) ||
+            (!req->granted_mode && i < index && other->wait_mode &&
+             is_conflicting(mode, other->wait_mode)))
+            blockers->push_back(other->txn->txn_id);
+    }
+}
+
+// Whether a transaction is reachable from the ones given in the graph
+static bool is_reachable(std::vector<uint64_t> from, uint64_t txn_id) {
+    std::vector<uint64_t> visited;
+
+    while (!from.empty()) {
+        uint64_t id = from.back();
+        from.pop_back();
+
+        if (id == txn_id)
+            return true;
+
+        if (std::find(visited.begin(), visited.end(), id) != visited.end())
+            continue;
+        visited.push_back(id);
+
+        auto it = waits_for.find(id);
+        if (it != waits_for.end())
+            from.insert(from.end(), it->second.begin(), it->second.end());
+    }
+
+    return false;
+}
+
+// Remove the request at index, and the lock with its last request
+static void remove_request(lock_partition *part, lock_t *lock, size_t index) {
+    lock->queue.erase(lock->queue.begin() + index);
+
+    if (lock->queue.empty()) {
+        part->locks.erase(lock->id);
+        delete lock;
+    }
+}
+
+/* Lock the record with the key (the end of the table if NULL) for txn.
+ * With wait, waits until the lock is granted or a deadlock is found.
+ * An instant request is forgotten once granted, unless txn held the lock.
+ */
+int lock_acquire(txn_t *txn, int64_t table_id, const tree_key_t *key,
+                 int mode, bool instant, bool wait) {
+    lock_id id;
+    std::vector<uint64_t> blockers;
+
+    pthread_once(&partitions_once, init_partitions);
+
+    id.table_id = table_id;
+    id.end = key == NULL;
+    if (key != NULL)
+        id.key = *key;
+    else
+        key_set_int(&id.key, 0);
+
+    int partition = hash_lock_id()(id) % LOCK_PARTITIONS;
+    lock_partition *part = &partitions[partition];
+
+    add_stat(stat_lock_requests, 1);
+    pthread_mutex_lock(&part->mutex);
+
+    lock_t *lock;
+    auto it = part->locks.find(id);
+
+    if (it != part->locks.end()) {
+        lock = it->second;
+    } else {
+        lock = new lock_t;
+        lock->id = id;
+        lock->partition = partition;
+        part->locks[id] = lock;
+    }
+
+    // Find the request of txn, or make one.
+    size_t index;
+    for (index = 0; index < lock->queue.size(); index++) {
+        if (lock->queue[index].txn == txn)
+            break;
+    }
+
+    bool is_new = index == lock->queue.size();
+
+    if (is_new) {
+        lock_request req = { txn, 0, 0 };
+        lock->queue.push_back(req);
+    } else if (lock->queue[index].granted_mode == LOCK_EXCLUSIVE ||
+               lock->queue[index].granted_mode == mode) {
+        // Held already.
+        pthread_mutex_unlock(&part->mutex);
+        return LOCK_GRANTED;
+    }
+
+    get_blockers(lock, index, mode, &blockers);
+
+    if (!blockers.empty() && !wait) {
+        if (is_new)
+            remove_request(part, lock, index);
+
+        pthread_mutex_unlock(&part->mutex);
+        return LOCK_BUSY;
+    }
+
+    int64_t wait_start = 0;
+
+    if (!blockers.empty()) {
+        wait_start = get_time_ns();
+        add_stat(stat_lock_waits, 1);
+        lock->queue[index].wait_mode = mode;
+    }
+
+    while (!blockers.empty()) {
+        // Give up if the transactions waited for wait for this one.
+        pthread_mutex_lock(&graph_mutex);
+        bool deadlock = is_reachable(blockers, txn->txn_id);
+        if (deadlock)
+            waits_for.erase(txn->txn_id);
+        else
+            waits_for[txn->txn_id] = blockers;
+        pthread_mutex_unlock(&graph_mutex);
+
+        if (deadlock) {
+            lock->queue[index].wait_mode = 0;
+            if (is_new)
+                remove_request(part, lock, index);
+
+            // The requests behind this one may go on now.
+            pthread_cond_broadcast(&part->cond);
+            pthread_mutex_unlock(&part->mutex);
+
+            add_stat(stat_deadlocks, 1);
+            add_stat(stat_lock_wait_ns, get_time_ns() - wait_start);
+            return LOCK_DEADLOCK;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOCK_CHECK_INTERVAL_NS;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_cond_timedwait(&part->cond, &part->mutex, &deadline);
+
+        // The queue may have changed meanwhile.
+        for (index = 0; lock->queue[index].txn != txn; index++)
+            ;
+
+        blockers.clear();
+        get_blockers(lock, index, mode, &blockers);
+    }
+
+    if (wait_start != 0) {
+        pthread_mutex_lock(&graph_mutex);
+        waits_for.erase(txn->txn_id);
+        pthread_mutex_unlock(&graph_mutex);
+
+        lock->queue[index].wait_mode = 0;
+        add_stat(stat_lock_wait_ns, get_time_ns() - wait_start);
+    }
+
+    if (is_new && instant) {
+        remove_request(part, lock, index);
+        pthread_cond_broadcast(&part->cond);
+    } else {
+        lock->queue[index].granted_mode =
+            std::max(lock->queue[index].granted_mode, mode);
+        if (is_new)
+            txn->locks.push_back(lock);
+    }
+
+    pthread_mutex_unlock(&part->mutex);
+
+    return LOCK_GRANTED;
+}
+
+// Release every lock of txn, waking up the waiting requests
+void lock_release_all(txn_t *txn) {
+    for (size_t i = 0; i < txn->locks.size(); i++) {
+        lock_t *lock = txn->locks[i];
+        lock_partition *part = &partitions[lock->partition];
+
+        pthread_mutex_lock(&part->mutex);
+
+        for (size_t j = 0; j < lock->queue.size(); j++) {
+            if (lock->queue[j].txn == txn) {
+                remove_request(part, lock, j);
+                break;
+            }
+        }
+
+        pthread_cond_broadcast(&part->cond);
+        pthread_mutex_unlock(&part->mutex);
+    }
+
+    txn->locks.clear();
+}
+
+// Reset the stats
+void init_lock_stat() {
+    stat_lock_requests = 0;
+    stat_lock_waits = 0;
+    stat_lock_wait_ns = 0;
+    stat_deadlocks = 0;
+}
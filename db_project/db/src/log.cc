@@ -0,0 +1,501 @@
+#include "log.h"
+#include "crc32c.h"
+#include "key.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// For stats
+int64_t stat_log_records;
+int64_t stat_log_commits;
+int64_t stat_log_syncs;
+
+typedef struct log_manager_t {
+    int fd;
+    pthread_mutex_t mutex;
+    pthread_cond_t flushed_cond;
+    byte *buffer;        // Records appended since the last write
+    byte *write_buffer;  // Records being written by the flushing committer
+    uint32_t used;       // Bytes used in buffer
+    lsn_t base_lsn;      // LSN of the first record in the file
+    lsn_t buffer_lsn;    // LSN of the first byte of buffer
+    lsn_t next_lsn;      // LSN of the next record
+    lsn_t flushed_lsn;   // Every record before it is on disk
+    bool flushing;       // A committer is writing write_buffer
+    bool failed;         // A write or sync failed; nothing is durable since
+
+    // The current operation (under the latch of the database)
+    bool op_active;
+    uint64_t op_id;      // 0 until the operation logs its first change
+    uint64_t next_op_id;
+    lsn_t op_last_lsn;
+} log_manager_t;
+
+static log_manager_t log_manager = {
+    -1, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    NULL, NULL, 0,
+    0, 0, 0, 0,
+    false, false,
+    false, 0, 0, 0
+};
+
+// macro for getting the file offset of an LSN
+#define lsn_to_offset(lsn) \
+    (LOG_FILE_HEADER_SIZE + ((lsn) - log_manager.base_lsn))
+
+// Write all bytes, retrying short writes
+static int write_fully(int fd, const byte *src, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, src, size, offset);
+
+        if (written <= 0)
+            return 1;
+
+        src += written;
+        size -= written;
+        offset += written;
+    }
+
+    return 0;
+}
+
+/* Read the record at offset into dest (of capacity bytes).
+ * Returns the size of the record, or 0 if there is no valid record with
+ * the expected LSN there (the end of the log).
+ */
+static uint32_t read_record(int fd, off_t offset, lsn_t lsn, byte *dest,
+                            uint32_t capacity) {
+    log_record_t header;
+
+    if (pread(fd, &header, sizeof(header), offset) != sizeof(header))
+        return 0;
+
+    if (header.size < sizeof(header) || header.size > capacity ||
+        header.lsn != lsn)
+        return 0;
+
+    if (pread(fd, dest, header.size, offset) != header.size)
+        return 0;
+
+    uint32_t checksum = header.checksum;
+    ((log_record_t*)dest)->checksum = 0;
+
+    if (crc32c(0, dest, header.size) != checksum)
+        return 0;
+
+    ((log_record_t*)dest)->checksum = checksum;
+    return header.size;
+}
+
+/* Write and sync the buffered records until the record at lsn is on disk.
+ * Called with the mutex held. A committer that finds another one writing
+ * waits for it, and takes over if its record is still not on disk.
+ * Returns 1 if a write or sync failed, now or before: flushed_lsn stays
+ * where it was, and the log takes no more writes.
+ */
+static int flush_locked(lsn_t lsn) {
+    while (log_manager.flushed_lsn <= lsn) {
+        if (log_manager.failed)
+            return 1;
+
+        if (log_manager.flushing) {
+            pthread_cond_wait(&log_manager.flushed_cond, &log_manager.mutex);
+            continue;
+        }
+
+        // Take the buffered records, and let others append meanwhile.
+        byte *records = log_manager.buffer;
+        uint32_t size = log_manager.used;
+        off_t offset = lsn_to_offset(log_manager.buffer_lsn);
+        lsn_t end_lsn = log_manager.next_lsn;
+
+        log_manager.buffer = log_manager.write_buffer;
+        log_manager.write_buffer = records;
+        log_manager.used = 0;
+        log_manager.buffer_lsn = end_lsn;
+        log_manager.flushing = true;
+
+        pthread_mutex_unlock(&log_manager.mutex);
+
+        bool failed = write_fully(log_manager.fd, records, size, offset) ||
+                      fdatasync(log_manager.fd) != 0;
+
+        pthread_mutex_lock(&log_manager.mutex);
+
+        stat_log_syncs++;
+        if (failed)
+            log_manager.failed = true;
+        else
+            log_manager.flushed_lsn = end_lsn;
+        log_manager.flushing = false;
+        pthread_cond_broadcast(&log_manager.flushed_cond);
+    }
+
+    return 0;
+}
+
+/* Append a record with its payload in two parts (either may be empty).
+ * Returns the LSN of the record.
+ */
+static lsn_t append_record(uint32_t type, uint64_t op_id, lsn_t prev_lsn,
+                           const void *payload1, uint32_t size1,
+                           const void *payload2, uint32_t size2) {
+    log_record_t header;
+    uint32_t size = (sizeof(header) + size1 + size2 + 7) & ~7U;
+
+    pthread_mutex_lock(&log_manager.mutex);
+
+    // Make room, writing out the buffered records. After a failure they
+    // can never be written, so they are dropped.
+    while (log_manager.used + size > LOG_BUFFER_SIZE) {
+        if (flush_locked(log_manager.next_lsn - 1)) {
+            log_manager.used = 0;
+            log_manager.buffer_lsn = log_manager.next_lsn;
+        }
+    }
+
+    header.size = size;
+    header.checksum = 0;
+    header.lsn = log_manager.next_lsn;
+    header.prev_lsn = prev_lsn;
+    header.op_id = op_id;
+    header.type = type;
+    header.reserved = 0;
+
+    byte *dest = log_manager.buffer + log_manager.used;
+    memcpy(dest, &header, sizeof(header));
+    memcpy(dest + sizeof(header), payload1, size1);
+    memcpy(dest + sizeof(header) + size1, payload2, size2);
+    memset(dest + sizeof(header) + size1 + size2, 0,
+           size - sizeof(header) - size1 - size2);
+
+    header.checksum = crc32c(0, dest, size);
+    memcpy(dest + offsetof(log_record_t, checksum), &header.checksum,
+           sizeof(header.checksum));
+
+    log_manager.used += size;
+    log_manager.next_lsn += size;
+    stat_log_records++;
+
+    pthread_mutex_unlock(&log_manager.mutex);
+
+    return header.lsn;
+}
+
+// Open the log file, creating it if not exist
+int log_open(const char *pathname) {
+    log_file_header file_header;
+
+    if (log_manager.fd >= 0)
+        return 1;
+
+    int fd = open(pathname, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return 1;
+
+    // A new log starts from LSN 1.
+    if (pread(fd, &file_header, sizeof(file_header), 0) != sizeof(file_header)) {
+        memset(&file_header, 0, sizeof(file_header));
+        file_header.magic = LOG_FILE_MAGIC;
+        file_header.base_lsn = 1;
+
+        if (write_fully(fd, (byte*)&file_header, sizeof(file_header), 0) ||
+            fdatasync(fd)) {
+            close(fd);
+            return 1;
+        }
+    }
+
+    if (file_header.magic != LOG_FILE_MAGIC) {
+        close(fd);
+        return 1;
+    }
+
+    log_manager.fd = fd;
+    log_manager.base_lsn = file_header.base_lsn;
+    log_manager.buffer = (byte*)malloc(LOG_BUFFER_SIZE);
+    log_manager.write_buffer = (byte*)malloc(LOG_BUFFER_SIZE);
+    log_manager.used = 0;
+    log_manager.flushing = false;
+    log_manager.failed = false;
+    log_manager.op_active = false;
+    log_manager.op_id = 0;
+    log_manager.next_op_id = 0;
+    log_manager.op_last_lsn = 0;
+    pthread_mutex_init(&log_manager.mutex, NULL);
+    pthread_cond_init(&log_manager.flushed_cond, NULL);
+
+    // Find the end of the log, dropping a torn record at the tail.
+    lsn_t lsn = log_manager.base_lsn;
+    uint32_t size;
+
+    while ((size = read_record(fd, lsn_to_offset(lsn), lsn,
+                               log_manager.write_buffer, LOG_BUFFER_SIZE)) > 0) {
+        log_record_t *record = (log_record_t*)log_manager.write_buffer;
+
+        if (record->op_id > log_manager.next_op_id)
+            log_manager.next_op_id = record->op_id;
+
+        lsn += size;
+    }
+
+    ftruncate(fd, lsn_to_offset(lsn));
+
+    log_manager.buffer_lsn = lsn;
+    log_manager.next_lsn = lsn;
+    log_manager.flushed_lsn = lsn;
+
+    return 0;
+}
+
+// Flush and close the log file
+int log_close() {
+    if (log_manager.fd < 0)
+        return 1;
+
+    int ret = log_flush(log_manager.next_lsn - 1);
+
+    close(log_manager.fd);
+    free(log_manager.buffer);
+    free(log_manager.write_buffer);
+    pthread_mutex_destroy(&log_manager.mutex);
+    pthread_cond_destroy(&log_manager.flushed_cond);
+    log_manager.fd = -1;
+
+    return ret;
+}
+
+// Check whether the log is open
+bool log_is_enabled() {
+    return log_manager.fd >= 0;
+}
+
+// Start an operation; its LOG_BEGIN is appended with its first change
+void log_begin_op() {
+    log_manager.op_active = true;
+    log_manager.op_id = 0;
+    log_manager.op_last_lsn = 0;
+}
+
+/* Finish the operation.
+ * Returns the LSN of its LOG_COMMIT to wait for, or 0 if it changed nothing.
+ */
+lsn_t log_end_op() {
+    lsn_t lsn = 0;
+
+    if (log_manager.op_active && log_manager.op_id != 0) {
+        lsn = append_record(LOG_COMMIT, log_manager.op_id,
+                            log_manager.op_last_lsn, NULL, 0, NULL, 0);
+        stat_log_commits++;
+    }
+
+    log_manager.op_active = false;
+    log_manager.op_id = 0;
+
+    return lsn;
+}
+
+/* Append a record of the current operation, beginning it with the first one.
+ * Returns the LSN of the record.
+ */
+static lsn_t append_op_record(uint32_t type, const void *payload1,
+                              uint32_t size1, const void *payload2,
+                              uint32_t size2) {
+    if (log_manager.op_active && log_manager.op_id == 0) {
+        log_manager.op_id = ++log_manager.next_op_id;
+        log_manager.op_last_lsn =
+            append_record(LOG_BEGIN, log_manager.op_id, 0, NULL, 0, NULL, 0);
+    }
+
+    lsn_t lsn = append_record(type, log_manager.op_id, log_manager.op_last_lsn,
+                              payload1, size1, payload2, size2);
+
+    if (log_manager.op_active)
+        log_manager.op_last_lsn = lsn;
+
+    return lsn;
+}
+
+/* Log a change of length bytes at offset of a page.
+ * Returns the LSN of the record.
+ */
+lsn_t log_page_update(int64_t table_id, pagenum_t page_num, uint16_t offset,
+                      uint16_t length, const byte *before, const byte *after) {
+    log_update_t update;
+    byte images[2 * PAGE_SIZE];
+
+    update.table_id = table_id;
+    update.page_num = page_num;
+    update.offset = offset;
+    update.length = length;
+    update.reserved = 0;
+
+    memcpy(images, before, length);
+    memcpy(images + length, after, length);
+
+    return append_op_record(LOG_UPDATE, &update, sizeof(update), images,
+                            2 * length);
+}
+
+/* Log the whole page before its first change after a checkpoint.
+ * Returns the LSN of the record.
+ */
+lsn_t log_page_image(int64_t table_id, pagenum_t page_num, const byte *page) {
+    log_update_t update;
+
+    update.table_id = table_id;
+    update.page_num = page_num;
+    update.offset = 0;
+    update.length = PAGE_SIZE;
+    update.reserved = 0;
+
+    return append_op_record(LOG_PAGE_IMAGE, &update, sizeof(update), page,
+                            PAGE_SIZE);
+}
+
+// Log how to undo a change of a transaction
+lsn_t log_undo(const log_undo_t *undo, const byte *key, const byte *value) {
+    byte payload[sizeof(log_undo_t) + MAX_KEY_SIZE];
+
+    memcpy(payload, undo, sizeof(*undo));
+    memcpy(payload + sizeof(*undo), key, undo->key_size);
+
+    return append_op_record(LOG_UNDO, payload, sizeof(*undo) + undo->key_size,
+                            value, undo->val_size);
+}
+
+/* Log the end of a transaction (LOG_TXN_COMMIT or LOG_TXN_ABORT).
+ * Returns the LSN of the record.
+ */
+lsn_t log_txn_end(uint32_t type, uint64_t txn_id) {
+    log_txn_t txn;
+
+    txn.txn_id = txn_id;
+    return append_op_record(type, &txn, sizeof(txn), NULL, 0);
+}
+
+// Log the file of a table id
+void log_table(int64_t table_id, uint64_t flags, const char *pathname) {
+    log_table_t table;
+
+    memset(&table, 0, sizeof(table));
+    table.table_id = table_id;
+    table.flags = flags;
+    strncpy(table.pathname, pathname, sizeof(table.pathname) - 1);
+
+    append_record(LOG_TABLE, 0, 0, &table, sizeof(table), NULL, 0);
+}
+
+/* Wait until the record at lsn is on disk.
+ * Returns 1 if it cannot be, as a write or sync of the log failed.
+ */
+int log_flush(lsn_t lsn) {
+    pthread_mutex_lock(&log_manager.mutex);
+
+    // Nothing beyond the appended records can be waited for.
+    if (lsn >= log_manager.next_lsn)
+        lsn = log_manager.next_lsn - 1;
+
+    int ret = flush_locked(lsn);
+
+    pthread_mutex_unlock(&log_manager.mutex);
+
+    return ret;
+}
+
+// Get the LSN every record before which is on disk
+lsn_t log_get_flushed_lsn() {
+    pthread_mutex_lock(&log_manager.mutex);
+    lsn_t lsn = log_manager.flushed_lsn;
+    pthread_mutex_unlock(&log_manager.mutex);
+
+    return lsn;
+}
+
+// Get the LSN of the first record
+lsn_t log_get_base_lsn() {
+    pthread_mutex_lock(&log_manager.mutex);
+    lsn_t lsn = log_manager.base_lsn;
+    pthread_mutex_unlock(&log_manager.mutex);
+
+    return lsn;
+}
+
+// Get the LSN of the next record
+lsn_t log_get_end_lsn() {
+    pthread_mutex_lock(&log_manager.mutex);
+    lsn_t lsn = log_manager.next_lsn;
+    pthread_mutex_unlock(&log_manager.mutex);
+
+    return lsn;
+}
+
+/* Read size bytes of the records from lsn.
+ * Returns 1 if they are not all on disk.
+ */
+int log_read(lsn_t lsn, byte *dest, uint64_t size) {
+    pthread_mutex_lock(&log_manager.mutex);
+    bool on_disk = lsn >= log_manager.base_lsn &&
+                   lsn + size <= log_manager.flushed_lsn;
+    off_t offset = lsn_to_offset(lsn);
+    pthread_mutex_unlock(&log_manager.mutex);
+
+    if (!on_disk)
+        return 1;
+
+    while (size > 0) {
+        ssize_t n = pread(log_manager.fd, dest, size, offset);
+
+        if (n <= 0)
+            return 1;
+
+        dest += n;
+        size -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+/* Drop all records, once every page they changed is on disk.
+ * LSNs go on from the end of the dropped records.
+ */
+int log_truncate() {
+    log_file_header file_header;
+
+    if (log_manager.fd < 0)
+        return 1;
+
+    pthread_mutex_lock(&log_manager.mutex);
+
+    if (flush_locked(log_manager.next_lsn - 1)) {
+        pthread_mutex_unlock(&log_manager.mutex);
+        return 1;
+    }
+
+    memset(&file_header, 0, sizeof(file_header));
+    file_header.magic = LOG_FILE_MAGIC;
+    file_header.base_lsn = log_manager.next_lsn;
+
+    int ret = write_fully(log_manager.fd, (byte*)&file_header,
+                          sizeof(file_header), 0);
+    ret |= ftruncate(log_manager.fd, LOG_FILE_HEADER_SIZE);
+    ret |= fdatasync(log_manager.fd);
+
+    log_manager.base_lsn = file_header.base_lsn;
+
+    pthread_mutex_unlock(&log_manager.mutex);
+
+    return ret != 0;
+}
+
+// For stat
+void init_log_stat() {
+    stat_log_records = 0;
+    stat_log_commits = 0;
+    stat_log_syncs = 0;
+}
@@ -0,0 +1,299 @@
+#include "mvcc.h"
+#include "overflow.h"
+
+#include <deque>
+#include <map>
+#include <set>
+
+// For stats
+int64_t stat_versions_created;
+int64_t stat_versions_read;
+int64_t stat_versions_purged;
+
+typedef struct version_t {
+    uint64_t txn_id;     // The writer, 0 if none
+    uint64_t commit_ts;  // 0 while the writer is active
+    bool exists;         // Whether the record existed before the writer
+    uint16_t val_size;
+    byte value[MAX_UNDO_VALUE_SIZE];
+} version_t;
+
+typedef struct record_id {
+    int64_t table_id;
+    tree_key_t key;
+} record_id;
+
+// A committed version waiting for the snapshots before it
+typedef struct purge_item {
+    uint64_t commit_ts;
+    record_id rid;
+} purge_item;
+
+struct compare_record_ids {
+    bool operator()(const record_id &a, const record_id &b) const {
+        if (a.table_id != b.table_id)
+            return a.table_id < b.table_id;
+
+        return key_compare(&a.key, &b.key) < 0;
+    }
+};
+
+/* The versions of each record, the latest last.
+ * Everything here is protected by the db latch.
+ */
+typedef std::map<record_id, std::vector<version_t>, compare_record_ids>
+    version_map;
+
+static version_map versions;
+static std::deque<purge_item> purge_queue;  // In commit order
+static std::multiset<uint64_t> open_snapshots;
+static uint64_t commit_clock = 0;  // Timestamp of the last commit
+
+// Whether the snapshot sees the writer of a version
+static bool is_visible(const snapshot_t *snapshot, const version_t *version) {
+    if (version->txn_id != 0 && version->txn_id == snapshot->txn_id)
+        return true;
+
+    return version->commit_ts != 0 && version->commit_ts <= snapshot->ts;
+}
+
+static record_id make_record_id(int64_t table_id, const tree_key_t *key) {
+    record_id rid;
+
+    rid.table_id = table_id;
+    rid.key = *key;
+    return rid;
+}
+
+/* Get the snapshot of the calling thread: the one of its transaction, or the
+ * latest one at TXN_SERIALIZABLE or without a transaction.
+ */
+void mvcc_get_snapshot(const txn_t *txn, snapshot_t *snapshot) {
+    if (txn != NULL) {
+        snapshot->ts = txn->isolation == TXN_SNAPSHOT ? txn->snapshot_ts :
+                                                        commit_clock;
+        snapshot->txn_id = txn->txn_id;
+        return;
+    }
+
+    snapshot->ts = commit_clock;
+    snapshot->txn_id = 0;
+}
+
+// Take a snapshot to keep over several operations
+void mvcc_open_snapshot(snapshot_t *snapshot) {
+    snapshot->ts = commit_clock;
+    snapshot->txn_id = 0;
+    open_snapshots.insert(snapshot->ts);
+}
+
+// Release a snapshot taken by mvcc_open_snapshot()
+void mvcc_close_snapshot(const snapshot_t *snapshot) {
+    open_snapshots.erase(open_snapshots.find(snapshot->ts));
+}
+
+// Take the snapshot of a new transaction
+void mvcc_begin_txn(txn_t *txn) {
+    txn->snapshot_ts = commit_clock;
+    open_snapshots.insert(txn->snapshot_ts);
+}
+
+// Make the versions of a transaction visible to the later snapshots
+void mvcc_commit_txn(txn_t *txn) {
+    uint64_t commit_ts = ++commit_clock;
+
+    for (size_t i = 0; i < txn->undo.size(); i++) {
+        purge_item item;
+
+        item.commit_ts = commit_ts;
+        item.rid = make_record_id(txn->undo[i].table_id, &txn->undo[i].key);
+
+        version_map::iterator it = versions.find(item.rid);
+        if (it == versions.end())
+            continue;
+
+        for (size_t j = 0; j < it->second.size(); j++) {
+            if (it->second[j].txn_id == txn->txn_id)
+                it->second[j].commit_ts = commit_ts;
+        }
+
+        purge_queue.push_back(item);
+    }
+
+    open_snapshots.erase(open_snapshots.find(txn->snapshot_ts));
+}
+
+// Drop the versions of a transaction rolled back
+void mvcc_abort_txn(txn_t *txn) {
+    for (size_t i = 0; i < txn->undo.size(); i++) {
+        record_id rid = make_record_id(txn->undo[i].table_id,
+                                       &txn->undo[i].key);
+        version_map::iterator it = versions.find(rid);
+
+        if (it == versions.end())
+            continue;
+
+        std::vector<version_t> *chain = &it->second;
+
+        for (size_t j = chain->size(); j-- > 0;) {
+            if ((*chain)[j].txn_id == txn->txn_id)
+                chain->erase(chain->begin() + j);
+        }
+
+        if (chain->empty())
+            versions.erase(it);
+    }
+
+    open_snapshots.erase(open_snapshots.find(txn->snapshot_ts));
+}
+
+/* Keep the value before a change of the record with the key.
+ * txn is the writer, NULL for an operation committing by itself.
+ * Returns true if the version is kept; the overflow pages of the value are
+ * then freed when it is purged.
+ */
+bool mvcc_add_version(int64_t table_id, const tree_key_t *key, const txn_t *txn,
+                      bool exists, const byte *value, uint16_t val_size) {
+    version_t version;
+    record_id rid = make_record_id(table_id, key);
+
+    // Nobody can see the record as it was.
+    if (txn == NULL && open_snapshots.empty())
+        return false;
+
+    version.txn_id = txn != NULL ? txn->txn_id : 0;
+    version.commit_ts = 0;
+    version.exists = exists;
+    version.val_size = exists ? val_size : 0;
+    if (exists)
+        memcpy(version.value, value, val_size);
+
+    // An operation by itself commits now.
+    if (txn == NULL) {
+        purge_item item;
+
+        version.commit_ts = ++commit_clock;
+        item.commit_ts = version.commit_ts;
+        item.rid = rid;
+        purge_queue.push_back(item);
+    }
+
+    versions[rid].push_back(version);
+    stat_versions_created++;
+
+    return true;
+}
+
+/* Get the version of a record seen by the snapshot.
+ * exists, value and val_size hold the latest version on the call, and the
+ * one seen on return (value must have MAX_UNDO_VALUE_SIZE bytes).
+ */
+void mvcc_read(const snapshot_t *snapshot, int64_t table_id,
+               const tree_key_t *key, bool *exists, byte *value,
+               uint16_t *val_size) {
+    if (versions.empty())
+        return;
+
+    version_map::iterator it = versions.find(make_record_id(table_id, key));
+
+    if (it == versions.end())
+        return;
+
+    // Step back through the writers the snapshot does not see.
+    for (size_t i = it->second.size(); i-- > 0;) {
+        const version_t *version = &it->second[i];
+
+        if (is_visible(snapshot, version))
+            break;
+
+        *exists = version->exists;
+        *val_size = version->val_size;
+        memcpy(value, version->value, version->val_size);
+        stat_versions_read++;
+    }
+}
+
+// Whether others committed a change of the record after the snapshot
+bool mvcc_is_changed_since(const snapshot_t *snapshot, int64_t table_id,
+                           const tree_key_t *key) {
+    if (versions.empty())
+        return false;
+
+    version_map::iterator it = versions.find(make_record_id(table_id, key));
+
+    if (it == versions.end())
+        return false;
+
+    return !is_visible(snapshot, &it->second.back());
+}
+
+/* Get the keys with versions in the range, in order:
+ * begin_key < key <= end_key, or begin_key <= key <= end_key with
+ * include_begin.
+ */
+void mvcc_get_keys(int64_t table_id, const tree_key_t *begin_key,
+                   bool include_begin, const tree_key_t *end_key,
+                   std::vector<tree_key_t> *keys) {
+    record_id begin = make_record_id(table_id, begin_key);
+    record_id end = make_record_id(table_id, end_key);
+
+    if (versions.empty() || key_compare(begin_key, end_key) > 0)
+        return;
+
+    version_map::iterator it = include_begin ? versions.lower_bound(begin) :
+                                               versions.upper_bound(begin);
+    version_map::iterator last = versions.upper_bound(end);
+
+    for (; it != last; ++it)
+        keys->push_back(it->first.key);
+}
+
+// Purge the versions every snapshot sees
+void mvcc_purge() {
+    while (!purge_queue.empty()) {
+        const purge_item *item = &purge_queue.front();
+
+        // An open snapshot does not see it yet.
+        if (!open_snapshots.empty() &&
+            item->commit_ts > *open_snapshots.begin())
+            break;
+
+        version_map::iterator it = versions.find(item->rid);
+
+        if (it != versions.end()) {
+            std::vector<version_t> *chain = &it->second;
+
+            for (size_t i = chain->size(); i-- > 0;) {
+                const version_t *version = &(*chain)[i];
+                overflow_ref ref;
+
+                if (version->commit_ts != item->commit_ts)
+                    continue;
+
+                // Nothing refers to the overflow pages of the value now.
+                if (version->exists && version->val_size == OVERFLOW_REF_SIZE) {
+                    memcpy(&ref, version->value, OVERFLOW_REF_SIZE);
+                    overflow_free(item->rid.table_id, &ref);
+                }
+
+                chain->erase(chain->begin() + i);
+                stat_versions_purged++;
+            }
+
+            if (chain->empty())
+                versions.erase(it);
+        }
+
+        purge_queue.pop_front();
+    }
+}
+
+// Drop every version and reset the stats (no snapshot must be open)
+void mvcc_clear() {
+    versions.clear();
+    purge_queue.clear();
+    open_snapshots.clear();
+    stat_versions_created = 0;
+    stat_versions_read = 0;
+    stat_versions_purged = 0;
+}
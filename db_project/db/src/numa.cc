@@ -0,0 +1,113 @@
+#include "numa.h"
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int num_nodes = 1;
+static pthread_once_t nodes_once = PTHREAD_ONCE_INIT;
+
+/* Read a list of ranges ("0-3,8,10-11") from a sysfs file, and call visit
+ * with each number in it. Returns 1 if the file cannot be read.
+ */
+static int read_list(const char *path, void (*visit)(int number, void *arg),
+                     void *arg) {
+    FILE *file = fopen(path, "r");
+    int first, last;
+    char sep;
+
+    if (file == NULL)
+        return 1;
+
+    while (fscanf(file, "%d", &first) == 1) {
+        last = first;
+        sep = fgetc(file);
+
+        if (sep == '-') {
+            if (fscanf(file, "%d", &last) != 1)
+                break;
+            sep = fgetc(file);
+        }
+
+        for (int i = first; i <= last; i++)
+            visit(i, arg);
+
+        if (sep != ',')
+            break;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static void count_node(int node, void *arg) {
+    if (node + 1 > *(int*)arg)
+        *(int*)arg = node + 1;
+}
+
+static void init_nodes() {
+    int count = 0;
+
+    if (read_list("/sys/devices/system/node/online", count_node, &count) ||
+        count < 1)
+        count = 1;
+
+    num_nodes = count < MAX_NUMA_NODES ? count : MAX_NUMA_NODES;
+}
+
+// Get the number of NUMA nodes
+int numa_count_nodes() {
+    pthread_once(&nodes_once, init_nodes);
+    return num_nodes;
+}
+
+// Get the node of the CPU the calling thread runs on
+int numa_current_node() {
+    unsigned cpu, node;
+
+    if (numa_count_nodes() == 1 ||
+        syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        return 0;
+
+    return (int)node < num_nodes ? (int)node : num_nodes - 1;
+}
+
+/* Place the pages of the memory on the node, before they are first touched.
+ * Returns 0 on success.
+ */
+int numa_place_memory(void *addr, size_t size, int node) {
+    unsigned long mask = 1UL << node;
+
+    // The kernel reads maxnode - 1 bits of the mask.
+    return syscall(SYS_mbind, addr, size, MPOL_PREFERRED, &mask,
+                   sizeof(mask) * 8 + 1, 0) != 0;
+}
+
+static void add_cpu(int cpu, void *arg) {
+    if (cpu < CPU_SETSIZE)
+        CPU_SET(cpu, (cpu_set_t*)arg);
+}
+
+/* Run the calling thread on the CPUs of the node only.
+ * Returns 0 on success.
+ */
+int numa_pin_thread(int node) {
+    char path[64];
+    cpu_set_t cpus;
+
+    if (node < 0 || node >= numa_count_nodes())
+        return 1;
+
+    CPU_ZERO(&cpus);
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+
+    if (read_list(path, add_cpu, &cpus) || CPU_COUNT(&cpus) == 0)
+        return 1;
+
+    return sched_setaffinity(0, sizeof(cpus), &cpus) != 0;
+}
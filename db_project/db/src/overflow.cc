@@ -0,0 +1,123 @@
+#include "overflow.h"
+
+#include <cstring>
+
+/* Write a value into a new chain of overflow pages.
+ * Returns 0 and sets the reference of the chain on success, or 1 (freeing
+ * the pages written) if no page can be allocated.
+ */
+int overflow_write(int64_t table_id, const char *value, uint32_t val_size,
+                   overflow_ref *ref) {
+    buf_descriptor_t *buf = NULL;
+    buf_descriptor_t *next_buf;
+    page_t *page;
+    uint32_t written = 0;
+
+    if (val_size == 0 || val_size > MAX_LARGE_VALUE_SIZE)
+        return 1;
+
+    ref->value_size = val_size;
+    ref->reserved = 0;
+
+    while (written < val_size) {
+        uint32_t size = val_size - written;
+
+        if (size > DATA_SIZE)
+            size = DATA_SIZE;
+
+        next_buf = get_buffer_of_new_page(table_id);
+
+        if (next_buf == NULL) {
+            if (buf != NULL) {
+                mark_buffer_dirty(buf);
+                unpin_buffer(buf);
+                overflow_free(table_id, ref);
+            }
+            return 1;
+        }
+
+        // Link the new page to the previous one.
+        if (buf == NULL) {
+            ref->first_page_num = next_buf->page_num;
+        } else {
+            buf->buf_page->next_overflow_page_num = next_buf->page_num;
+            mark_buffer_dirty(buf);
+            unpin_buffer(buf);
+        }
+
+        buf = next_buf;
+        page = buf->buf_page;
+
+        page->next_overflow_page_num = -1;
+        page->overflow_tag = OVERFLOW_PAGE_TAG;
+        page->overflow_size = size;
+        memcpy(page->overflow_data, value + written, size);
+
+        written += size;
+    }
+
+    mark_buffer_dirty(buf);
+    unpin_buffer(buf);
+
+    return 0;
+}
+
+/* Read size bytes of the value from offset, following the chain.
+ * Returns the number of bytes read, short if a page cannot be read in.
+ */
+uint32_t overflow_read(int64_t table_id, const overflow_ref *ref,
+                       uint32_t offset, char *buf, uint32_t size) {
+    pagenum_t page_num = ref->first_page_num;
+    uint32_t read_size = 0;
+
+    if (offset >= ref->value_size)
+        return 0;
+
+    if (size > ref->value_size - offset)
+        size = ref->value_size - offset;
+
+    // Every page but the last one is full, so skip the pages before offset.
+    while (read_size < size && page_num != (pagenum_t)-1) {
+        buf_descriptor_t *page_buf = get_buffer(table_id, page_num);
+        if (page_buf == NULL)
+            break;
+
+        page_t *page = page_buf->buf_page;
+
+        if (offset >= page->overflow_size) {
+            offset -= page->overflow_size;
+        } else {
+            uint32_t chunk = page->overflow_size - offset;
+
+            if (chunk > size - read_size)
+                chunk = size - read_size;
+
+            memcpy(buf + read_size, page->overflow_data + offset, chunk);
+            read_size += chunk;
+            offset = 0;
+        }
+
+        page_num = page->next_overflow_page_num;
+        unpin_buffer(page_buf);
+    }
+
+    return read_size;
+}
+
+/* Free all pages of the chain.
+ * The rest of the chain is left allocated from a page that cannot be read in.
+ */
+void overflow_free(int64_t table_id, const overflow_ref *ref) {
+    pagenum_t page_num = ref->first_page_num;
+
+    while (page_num != (pagenum_t)-1) {
+        buf_descriptor_t *page_buf = get_buffer(table_id, page_num);
+        if (page_buf == NULL)
+            return;
+
+        page_num = page_buf->buf_page->next_overflow_page_num;
+        if (free_page(table_id, page_buf))
+            page_num = -1;
+        unpin_buffer(page_buf);
+    }
+}
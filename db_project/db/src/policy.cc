@@ -0,0 +1,457 @@
+#include "policy.h"
+
+#include <algorithm>
+#include <list>
+#include <set>
+#include <unordered_map>
+
+// The lists of the descriptors (policy_list), 0 for none
+#define LIST_NONE 0
+#define LIST_COLD 1  // Clock
+#define LIST_A1IN 1  // 2Q
+#define LIST_AM 2
+#define LIST_T1 1    // ARC
+#define LIST_T2 2
+
+typedef struct buf_list_t {
+    buf_descriptor_t *head;  // The most recent
+    buf_descriptor_t *tail;
+    uint32_t size;
+} buf_list_t;
+
+static void list_push_front(buf_list_t *list, uint32_t id,
+                            buf_descriptor_t *buf_desc) {
+    buf_desc->policy_prev = NULL;
+    buf_desc->policy_next = list->head;
+    if (list->head != NULL)
+        list->head->policy_prev = buf_desc;
+    else
+        list->tail = buf_desc;
+
+    list->head = buf_desc;
+    list->size++;
+    buf_desc->policy_list = id;
+}
+
+static void list_unlink(buf_list_t *list, buf_descriptor_t *buf_desc) {
+    if (buf_desc->policy_prev != NULL)
+        buf_desc->policy_prev->policy_next = buf_desc->policy_next;
+    else
+        list->head = buf_desc->policy_next;
+
+    if (buf_desc->policy_next != NULL)
+        buf_desc->policy_next->policy_prev = buf_desc->policy_prev;
+    else
+        list->tail = buf_desc->policy_prev;
+
+    buf_desc->policy_prev = NULL;
+    buf_desc->policy_next = NULL;
+    buf_desc->policy_list = LIST_NONE;
+    list->size--;
+}
+
+static void list_push_back(buf_list_t *list, uint32_t id,
+                           buf_descriptor_t *buf_desc) {
+    buf_desc->policy_next = NULL;
+    buf_desc->policy_prev = list->tail;
+    if (list->tail != NULL)
+        list->tail->policy_next = buf_desc;
+    else
+        list->head = buf_desc;
+
+    list->tail = buf_desc;
+    list->size++;
+    buf_desc->policy_list = id;
+}
+
+// The least recent buffer of the list that may be taken, NULL if none
+static buf_descriptor_t *list_get_victim(buf_list_t *list,
+                                         const victim_filter_t *filter) {
+    for (buf_descriptor_t *buf_desc = list->tail; buf_desc != NULL;
+         buf_desc = buf_desc->policy_prev) {
+        if (buffer_is_replaceable(buf_desc, filter))
+            return buf_desc;
+    }
+
+    return NULL;
+}
+
+/* The pages evicted lately, the most recent first, with a value each.
+ * Ghost lists keep page ids only, not the pages.
+ */
+typedef std::pair<int64_t, pagenum_t> page_key_t;
+
+struct hash_page_key {
+    size_t operator()(const page_key_t &key) const {
+        return std::hash<uint64_t>()((uint64_t)key.first * 100000 + key.second);
+    }
+};
+
+typedef struct ghost_list_t {
+    std::list<page_key_t> order;
+    std::unordered_map<page_key_t,
+                       std::pair<std::list<page_key_t>::iterator, uint64_t>,
+                       hash_page_key> index;
+} ghost_list_t;
+
+#define page_key(buf_desc) \
+    (page_key_t((buf_desc)->table_id, (buf_desc)->page_num))
+
+static void ghost_push(ghost_list_t *ghost, const page_key_t &key,
+                       uint64_t value) {
+    ghost->order.push_front(key);
+    ghost->index[key] = std::make_pair(ghost->order.begin(), value);
+}
+
+static bool ghost_contains(const ghost_list_t *ghost, const page_key_t &key) {
+    return ghost->index.find(key) != ghost->index.end();
+}
+
+// Take the page out of the list. Returns false if it is not there.
+static bool ghost_take(ghost_list_t *ghost, const page_key_t &key,
+                       uint64_t *value) {
+    auto it = ghost->index.find(key);
+
+    if (it == ghost->index.end())
+        return false;
+
+    if (value != NULL)
+        *value = it->second.second;
+
+    ghost->order.erase(it->second.first);
+    ghost->index.erase(it);
+    return true;
+}
+
+// Forget the oldest pages until size are left
+static void ghost_trim(ghost_list_t *ghost, size_t size) {
+    while (ghost->order.size() > size) {
+        ghost->index.erase(ghost->order.back());
+        ghost->order.pop_back();
+    }
+}
+
+/*
+ * Clock sweep. The usage counts are kept by the buffer manager. The cold
+ * pages are also queued, and go first, the oldest first, so a scan cycles
+ * through a few frames instead of sweeping the hand over the others.
+ */
+typedef struct clock_data_t {
+    buf_list_t cold;
+} clock_data_t;
+
+static int clock_init(buffer_pool_t *pool) {
+    pool->clock_hand = 0;
+    pool->policy_data = new clock_data_t();
+    return 0;
+}
+
+static void clock_destroy(buffer_pool_t *pool) {
+    delete (clock_data_t*)pool->policy_data;
+    pool->policy_data = NULL;
+}
+
+static void clock_insert(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                         bool cold) {
+    if (cold)
+        list_push_front(&((clock_data_t*)pool->policy_data)->cold, LIST_COLD,
+                        buf_desc);
+}
+
+// A cold page used again, or evicted, leaves the queue.
+static void clock_update(buffer_pool_t *pool, buf_descriptor_t *buf_desc) {
+    if (buf_desc->policy_list == LIST_COLD)
+        list_unlink(&((clock_data_t*)pool->policy_data)->cold, buf_desc);
+}
+
+static void clock_remove(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                         bool) {
+    clock_update(pool, buf_desc);
+}
+
+static buf_descriptor_t *clock_get_victim(buffer_pool_t *pool,
+                                          const victim_filter_t *filter) {
+    buf_descriptor_t *buf_desc =
+        list_get_victim(&((clock_data_t*)pool->policy_data)->cold, filter);
+
+    if (buf_desc != NULL)
+        return buf_desc;
+
+    // Every unpinned buffer is reached within MAX_USAGE_COUNT + 1 rounds.
+    for (uint64_t i = 0; i < (uint64_t)pool->num_buf * (MAX_USAGE_COUNT + 1); i++) {
+        buf_desc = pool->frames[pool->clock_hand];
+        pool->clock_hand = (pool->clock_hand + 1) % pool->num_buf;
+
+        if (!buffer_is_replaceable(buf_desc, filter))
+            continue;
+
+        if (buf_desc->usage_count == 0)
+            return buf_desc;
+
+        buf_desc->usage_count--;
+    }
+
+    return NULL;
+}
+
+/*
+ * LRU-2. The buffers are ordered by their backward 2-distance: those used
+ * once by their last use, then the others by their second last use.
+ */
+typedef std::pair<std::pair<int, uint64_t>, buf_descriptor_t*> lru_k_entry;
+
+typedef struct lru_k_t {
+    uint64_t clock;                 // Counts the uses
+    std::set<lru_k_entry> order;    // The victim first
+    ghost_list_t history;           // The last use of the pages evicted
+} lru_k_t;
+
+#define lru_k_entry_of(buf_desc) \
+    (lru_k_entry((buf_desc)->policy_history[1] == 0 ? \
+                 std::make_pair(0, (buf_desc)->policy_history[0]) : \
+                 std::make_pair(1, (buf_desc)->policy_history[1]), \
+                 (buf_desc)))
+
+static int lru_k_init(buffer_pool_t *pool) {
+    pool->policy_data = new lru_k_t();
+    ((lru_k_t*)pool->policy_data)->clock = 0;
+    return 0;
+}
+
+static void lru_k_destroy(buffer_pool_t *pool) {
+    delete (lru_k_t*)pool->policy_data;
+    pool->policy_data = NULL;
+}
+
+static void lru_k_insert(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                         bool cold) {
+    lru_k_t *lru_k = (lru_k_t*)pool->policy_data;
+    uint64_t last_use;
+
+    // A cold page is used once, before every other page.
+    if (cold) {
+        buf_desc->policy_history[1] = 0;
+        buf_desc->policy_history[0] = 0;
+    } else {
+        buf_desc->policy_history[1] =
+            ghost_take(&lru_k->history, page_key(buf_desc), &last_use) ?
+                last_use : 0;
+        buf_desc->policy_history[0] = ++lru_k->clock;
+    }
+
+    lru_k->order.insert(lru_k_entry_of(buf_desc));
+}
+
+static void lru_k_access(buffer_pool_t *pool, buf_descriptor_t *buf_desc) {
+    lru_k_t *lru_k = (lru_k_t*)pool->policy_data;
+
+    lru_k->order.erase(lru_k_entry_of(buf_desc));
+    buf_desc->policy_history[1] = buf_desc->policy_history[0];
+    buf_desc->policy_history[0] = ++lru_k->clock;
+    lru_k->order.insert(lru_k_entry_of(buf_desc));
+}
+
+static void lru_k_remove(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                         bool evicted) {
+    lru_k_t *lru_k = (lru_k_t*)pool->policy_data;
+
+    lru_k->order.erase(lru_k_entry_of(buf_desc));
+
+    if (evicted) {
+        ghost_push(&lru_k->history, page_key(buf_desc),
+                   buf_desc->policy_history[0]);
+        ghost_trim(&lru_k->history, pool->num_buf);
+    }
+}
+
+static buf_descriptor_t *lru_k_get_victim(buffer_pool_t *pool,
+                                          const victim_filter_t *filter) {
+    lru_k_t *lru_k = (lru_k_t*)pool->policy_data;
+
+    for (const lru_k_entry &entry : lru_k->order) {
+        if (buffer_is_replaceable(entry.second, filter))
+            return entry.second;
+    }
+
+    return NULL;
+}
+
+/*
+ * 2Q (the full version, with Kin a quarter and Kout half of the frames)
+ */
+typedef struct two_q_t {
+    buf_list_t lists[3];  // A1in and Am
+    ghost_list_t a1out;
+} two_q_t;
+
+#define two_q_kin(pool) ((pool)->num_buf / 4 > 0 ? (pool)->num_buf / 4 : 1)
+#define two_q_kout(pool) ((pool)->num_buf / 2 > 0 ? (pool)->num_buf / 2 : 1)
+
+static int two_q_init(buffer_pool_t *pool) {
+    pool->policy_data = new two_q_t();
+    return 0;
+}
+
+static void two_q_destroy(buffer_pool_t *pool) {
+    delete (two_q_t*)pool->policy_data;
+    pool->policy_data = NULL;
+}
+
+static void two_q_insert(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                         bool cold) {
+    two_q_t *two_q = (two_q_t*)pool->policy_data;
+
+    if (cold)
+        list_push_back(&two_q->lists[LIST_A1IN], LIST_A1IN, buf_desc);
+    else if (ghost_take(&two_q->a1out, page_key(buf_desc), NULL))
+        list_push_front(&two_q->lists[LIST_AM], LIST_AM, buf_desc);
+    else
+        list_push_front(&two_q->lists[LIST_A1IN], LIST_A1IN, buf_desc);
+}
+
+static void two_q_access(buffer_pool_t *pool, buf_descriptor_t *buf_desc) {
+    two_q_t *two_q = (two_q_t*)pool->policy_data;
+
+    // A page in A1in is left in its place, whatever its uses there.
+    if (buf_desc->policy_list == LIST_AM) {
+        list_unlink(&two_q->lists[LIST_AM], buf_desc);
+        list_push_front(&two_q->lists[LIST_AM], LIST_AM, buf_desc);
+    }
+}
+
+static void two_q_remove(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                         bool evicted) {
+    two_q_t *two_q = (two_q_t*)pool->policy_data;
+    uint32_t list = buf_desc->policy_list;
+
+    list_unlink(&two_q->lists[list], buf_desc);
+
+    if (evicted && list == LIST_A1IN) {
+        ghost_push(&two_q->a1out, page_key(buf_desc), 0);
+        ghost_trim(&two_q->a1out, two_q_kout(pool));
+    }
+}
+
+static buf_descriptor_t *two_q_get_victim(buffer_pool_t *pool,
+                                          const victim_filter_t *filter) {
+    two_q_t *two_q = (two_q_t*)pool->policy_data;
+    uint32_t first = two_q->lists[LIST_A1IN].size > two_q_kin(pool) ?
+        LIST_A1IN : LIST_AM;
+    buf_descriptor_t *victim = list_get_victim(&two_q->lists[first], filter);
+
+    if (victim == NULL)
+        victim = list_get_victim(
+            &two_q->lists[first == LIST_A1IN ? LIST_AM : LIST_A1IN], filter);
+
+    return victim;
+}
+
+/*
+ * ARC
+ */
+typedef struct arc_t {
+    buf_list_t lists[3];  // T1 and T2
+    ghost_list_t b1;
+    ghost_list_t b2;
+    uint32_t target;      // The target size of T1 (p)
+} arc_t;
+
+static int arc_init(buffer_pool_t *pool) {
+    pool->policy_data = new arc_t();
+    return 0;
+}
+
+static void arc_destroy(buffer_pool_t *pool) {
+    delete (arc_t*)pool->policy_data;
+    pool->policy_data = NULL;
+}
+
+// Keep |T1| + |B1| within the frames, and all four lists within twice them
+static void arc_trim(buffer_pool_t *pool, arc_t *arc) {
+    size_t t1 = arc->lists[LIST_T1].size;
+    size_t t2 = arc->lists[LIST_T2].size;
+
+    ghost_trim(&arc->b1, pool->num_buf > t1 ? pool->num_buf - t1 : 0);
+    ghost_trim(&arc->b2, 2 * (size_t)pool->num_buf > t1 + t2 + arc->b1.order.size() ?
+                         2 * (size_t)pool->num_buf - t1 - t2 - arc->b1.order.size() : 0);
+}
+
+static void arc_insert(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                       bool cold) {
+    arc_t *arc = (arc_t*)pool->policy_data;
+    size_t b1 = arc->b1.order.size();
+    size_t b2 = arc->b2.order.size();
+
+    if (cold) {
+        list_push_back(&arc->lists[LIST_T1], LIST_T1, buf_desc);
+    } else if (ghost_take(&arc->b1, page_key(buf_desc), NULL)) {
+        uint32_t delta = b2 > b1 ? b2 / b1 : 1;
+
+        arc->target = std::min(pool->num_buf, arc->target + delta);
+        list_push_front(&arc->lists[LIST_T2], LIST_T2, buf_desc);
+    } else if (ghost_take(&arc->b2, page_key(buf_desc), NULL)) {
+        uint32_t delta = b1 > b2 ? b1 / b2 : 1;
+
+        arc->target = arc->target > delta ? arc->target - delta : 0;
+        list_push_front(&arc->lists[LIST_T2], LIST_T2, buf_desc);
+    } else {
+        list_push_front(&arc->lists[LIST_T1], LIST_T1, buf_desc);
+    }
+
+    arc_trim(pool, arc);
+}
+
+static void arc_access(buffer_pool_t *pool, buf_descriptor_t *buf_desc) {
+    arc_t *arc = (arc_t*)pool->policy_data;
+
+    list_unlink(&arc->lists[buf_desc->policy_list], buf_desc);
+    list_push_front(&arc->lists[LIST_T2], LIST_T2, buf_desc);
+}
+
+static void arc_remove(buffer_pool_t *pool, buf_descriptor_t *buf_desc,
+                       bool evicted) {
+    arc_t *arc = (arc_t*)pool->policy_data;
+    uint32_t list = buf_desc->policy_list;
+
+    list_unlink(&arc->lists[list], buf_desc);
+    if (evicted)
+        ghost_push(list == LIST_T1 ? &arc->b1 : &arc->b2, page_key(buf_desc),
+                   0);
+    arc_trim(pool, arc);
+}
+
+static buf_descriptor_t *arc_get_victim(buffer_pool_t *pool,
+                                        const victim_filter_t *filter) {
+    arc_t *arc = (arc_t*)pool->policy_data;
+    uint32_t t1 = arc->lists[LIST_T1].size;
+    bool in_b2 = ghost_contains(&arc->b2,
+                                page_key_t(filter->table_id, filter->page_num));
+    uint32_t first = t1 > 0 && (t1 > arc->target || (in_b2 && t1 == arc->target)) ?
+        LIST_T1 : LIST_T2;
+    buf_descriptor_t *victim = list_get_victim(&arc->lists[first], filter);
+
+    if (victim == NULL)
+        victim = list_get_victim(
+            &arc->lists[first == LIST_T1 ? LIST_T2 : LIST_T1], filter);
+
+    return victim;
+}
+
+static const replacement_policy_t policies[] = {
+    { "clock", clock_init, clock_destroy, clock_insert, clock_update,
+      clock_remove, clock_get_victim },
+    { "lru-2", lru_k_init, lru_k_destroy, lru_k_insert, lru_k_access,
+      lru_k_remove, lru_k_get_victim },
+    { "2q", two_q_init, two_q_destroy, two_q_insert, two_q_access,
+      two_q_remove, two_q_get_victim },
+    { "arc", arc_init, arc_destroy, arc_insert, arc_access, arc_remove,
+      arc_get_victim },
+};
+
+// Get the replacement policy, NULL if there is no such one
+const replacement_policy_t *get_replacement_policy(int policy) {
+    if (policy < 0 || policy >= (int)(sizeof(policies) / sizeof(policies[0])))
+        return NULL;
+
+    return &policies[policy];
+}
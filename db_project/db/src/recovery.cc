@@ -0,0 +1,261 @@
+#include "recovery.h"
+#include "file.h"
+
+#include <algorithm>
+#include <pthread.h>
+#include <vector>
+
+// For stats
+int64_t stat_redo_records;
+int64_t stat_undo_records;
+
+// A LOG_UPDATE to replay
+typedef struct recovery_item {
+    int64_t table_id;  // Table id of this session
+    pagenum_t page_num;
+    const log_record_t *record;
+    bool committed;
+} recovery_item;
+
+typedef struct recovery_worker {
+    pthread_t thread;
+    std::vector<recovery_item> items;
+    int64_t num_redo;
+    int64_t num_undo;
+} recovery_worker;
+
+// Get the payload of an update record
+#define get_update(record) ((const log_update_t*)((record) + 1))
+
+// Copy the bytes before (or after) of an update record into the page
+static void apply_update(page_t *page, const log_record_t *record, bool after) {
+    const log_update_t *update = get_update(record);
+    const byte *image = (const byte*)(update + 1);
+
+    if (after)
+        image += update->length;
+
+    memcpy((byte*)page + update->offset, image, update->length);
+}
+
+// Recover the pages of a worker, one page at a time
+static void *recover_pages(void *arg) {
+    recovery_worker *worker = (recovery_worker*)arg;
+    page_t *page = file_new_page_buffer();
+    size_t begin = 0;
+
+    while (begin < worker->items.size()) {
+        const recovery_item *items = &worker->items[begin];
+        size_t n = 1;
+
+        // The items of a page are adjacent, in LSN order.
+        while (begin + n < worker->items.size() &&
+               items[n].table_id == items[0].table_id &&
+               items[n].page_num == items[0].page_num)
+            n++;
+
+        bool changed = false;
+
+        // Start from the page as of the checkpoint, or the page on disk.
+        if (items[0].record->type == LOG_PAGE_IMAGE) {
+            memcpy(page, get_update(items[0].record) + 1, PAGE_SIZE);
+            changed = true;
+        } else {
+            file_read_page(items[0].table_id, items[0].page_num, page);
+        }
+
+        // Redo the changes the page missed.
+        lsn_t page_lsn = page->page_lsn;
+
+        for (size_t i = 0; i < n; i++) {
+            if (items[i].record->type != LOG_UPDATE ||
+                items[i].record->lsn <= page_lsn)
+                continue;
+
+            apply_update(page, items[i].record, true);
+            page->page_lsn = items[i].record->lsn;
+            worker->num_redo++;
+            changed = true;
+        }
+
+        // Undo the incomplete operations, keeping the page LSN.
+        page_lsn = page->page_lsn;
+
+        for (size_t i = n; i-- > 0;) {
+            if (items[i].committed || items[i].record->type != LOG_UPDATE)
+                continue;
+
+            apply_update(page, items[i].record, false);
+            worker->num_undo++;
+            changed = true;
+        }
+
+        page->page_lsn = page_lsn;
+
+        if (changed) {
+            file_set_page_checksum(items[0].table_id, items[0].page_num, page);
+            file_write_page(items[0].table_id, items[0].page_num, page);
+        }
+
+        begin += n;
+    }
+
+    free(page);
+    return NULL;
+}
+
+// Get the table id of this session of a logged table id, -1 if gone
+static int64_t map_table_id(
+        const std::vector<std::pair<int64_t, int64_t>> &tables,
+        int64_t table_id) {
+    int64_t ret = -1;
+
+    // The last table logged with the id is the one of the record.
+    for (size_t i = 0; i < tables.size(); i++) {
+        if (tables[i].first == table_id)
+            ret = tables[i].second;
+    }
+
+    return ret;
+}
+
+// Compare items by page, keeping the LSN order of a page
+static bool compare_items(const recovery_item &a, const recovery_item &b) {
+    if (a.table_id != b.table_id)
+        return a.table_id < b.table_id;
+
+    return a.page_num < b.page_num;
+}
+
+/* Recover the tables from the log, and get the undo entries of the loser
+ * transactions in log order.
+ * Called after the log and the buffer pool are initialized, before any
+ * page is buffered. Returns 0 on success.
+ */
+int recover_tables(std::vector<undo_entry> *losers) {
+    lsn_t base_lsn = log_get_base_lsn();
+    uint64_t size = log_get_end_lsn() - base_lsn;
+    std::vector<std::pair<int64_t, int64_t>> tables;  // Logged id, session id
+    std::vector<uint64_t> committed;
+    std::vector<uint64_t> ended_txns;
+    recovery_worker workers[RECOVERY_THREADS];
+    const log_record_t *record;
+
+    stat_redo_records = 0;
+    stat_undo_records = 0;
+
+    if (size == 0)
+        return 0;
+
+    byte *records = (byte*)malloc(size);
+
+    if (records == NULL || log_read(base_lsn, records, size)) {
+        free(records);
+        return 1;
+    }
+
+    // Open the tables and find the complete operations.
+    for (uint64_t offset = 0; offset < size; offset += record->size) {
+        record = (const log_record_t*)(records + offset);
+
+        if (record->type == LOG_COMMIT)
+            committed.push_back(record->op_id);
+
+        if (record->type == LOG_TABLE) {
+            const log_table_t *table = (const log_table_t*)(record + 1);
+
+            tables.push_back(std::make_pair(table->table_id,
+                buffer_open_table(table->pathname, table->flags)));
+        }
+    }
+
+    std::sort(committed.begin(), committed.end());
+
+    // Split the changes among the workers by page.
+    for (uint64_t offset = 0; offset < size; offset += record->size) {
+        record = (const log_record_t*)(records + offset);
+
+        if (record->type != LOG_UPDATE && record->type != LOG_PAGE_IMAGE)
+            continue;
+
+        recovery_item item;
+        const log_update_t *update = get_update(record);
+
+        item.table_id = map_table_id(tables, update->table_id);
+
+        // The table file is gone.
+        if (item.table_id < 0)
+            continue;
+
+        item.page_num = update->page_num;
+        item.record = record;
+        item.committed = record->op_id == 0 ||
+            std::binary_search(committed.begin(), committed.end(),
+                               record->op_id);
+
+        uint64_t h = ((uint64_t)item.table_id * 100000 + item.page_num);
+        workers[h % RECOVERY_THREADS].items.push_back(item);
+    }
+
+    for (int i = 0; i < RECOVERY_THREADS; i++) {
+        std::stable_sort(workers[i].items.begin(), workers[i].items.end(),
+                         compare_items);
+        workers[i].num_redo = 0;
+        workers[i].num_undo = 0;
+        pthread_create(&workers[i].thread, NULL, recover_pages, &workers[i]);
+    }
+
+    for (int i = 0; i < RECOVERY_THREADS; i++) {
+        pthread_join(workers[i].thread, NULL);
+        stat_redo_records += workers[i].num_redo;
+        stat_undo_records += workers[i].num_undo;
+    }
+
+    // Find the transactions that ended. Records of incomplete operations
+    // were undone above.
+    for (uint64_t offset = 0; offset < size; offset += record->size) {
+        record = (const log_record_t*)(records + offset);
+
+        if ((record->type == LOG_TXN_COMMIT || record->type == LOG_TXN_ABORT) &&
+            std::binary_search(committed.begin(), committed.end(),
+                               record->op_id))
+            ended_txns.push_back(((const log_txn_t*)(record + 1))->txn_id);
+    }
+
+    std::sort(ended_txns.begin(), ended_txns.end());
+
+    // Collect the undo entries of the other transactions.
+    for (uint64_t offset = 0; offset < size; offset += record->size) {
+        record = (const log_record_t*)(records + offset);
+
+        if (record->type != LOG_UNDO ||
+            !std::binary_search(committed.begin(), committed.end(),
+                                record->op_id))
+            continue;
+
+        const log_undo_t *undo = (const log_undo_t*)(record + 1);
+        const byte *key_data = (const byte*)(undo + 1);
+        undo_entry entry;
+
+        if (std::binary_search(ended_txns.begin(), ended_txns.end(),
+                               undo->txn_id))
+            continue;
+
+        entry.table_id = map_table_id(tables, undo->table_id);
+        if (entry.table_id < 0)
+            continue;
+
+        entry.txn_id = undo->txn_id;
+        entry.type = undo->type;
+        entry.key.prefix = undo->key;
+        entry.key.size = undo->key_size;
+        memcpy(entry.key.data, key_data, undo->key_size);
+        entry.val_size = undo->val_size;
+        memcpy(entry.value, key_data + undo->key_size, undo->val_size);
+        losers->push_back(entry);
+    }
+
+    free(records);
+
+    return 0;
+}
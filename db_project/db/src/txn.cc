@@ -0,0 +1,73 @@
+#include "txn.h"
+#include "log.h"
+
+#include <atomic>
+
+// The transaction of each thread
+thread_local txn_t *current_txn = NULL;
+
+std::atomic<uint64_t> next_txn_id(1);
+std::atomic<int> num_active_txns(0);
+
+// Get the transaction of the calling thread, NULL if none
+txn_t *txn_get_current() {
+    return current_txn;
+}
+
+// Get a new transaction id
+uint64_t txn_new_id() {
+    return next_txn_id++;
+}
+
+// Start a transaction on the calling thread
+txn_t *txn_start(int isolation) {
+    current_txn = new txn_t;
+    current_txn->txn_id = txn_new_id();
+    current_txn->isolation = isolation;
+    num_active_txns++;
+
+    return current_txn;
+}
+
+// Forget the transaction of the calling thread
+void txn_finish() {
+    delete current_txn;
+    current_txn = NULL;
+    num_active_txns--;
+}
+
+// Get the number of transactions not finished
+int txn_num_active() {
+    return num_active_txns;
+}
+
+/* Remember how to undo a change of the current transaction, and log it.
+ * Called in the operation of the change.
+ */
+void txn_add_undo(txn_t *txn, int type, int64_t table_id,
+                  const tree_key_t *key, const byte *value, uint16_t val_size) {
+    undo_entry entry;
+
+    entry.txn_id = txn->txn_id;
+    entry.table_id = table_id;
+    entry.type = type;
+    entry.key = *key;
+    entry.val_size = val_size;
+    if (val_size > 0)
+        memcpy(entry.value, value, val_size);
+    txn->undo.push_back(entry);
+
+    if (!log_is_enabled())
+        return;
+
+    log_undo_t undo;
+
+    undo.txn_id = txn->txn_id;
+    undo.table_id = table_id;
+    undo.key = key->prefix;
+    undo.type = type;
+    undo.key_size = key->size;
+    undo.val_size = val_size;
+
+    log_undo(&undo, key->data, value);
+}
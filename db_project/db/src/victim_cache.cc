@@ -0,0 +1,174 @@
+#include "victim_cache.h"
+#include "compress.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+
+// For stat
+int64_t stat_victim_cache_hits;
+
+typedef struct victim_entry_t {
+    int64_t table_id;
+    pagenum_t page_num;
+    uint32_t size;                  // Of the compressed page after it
+    struct victim_entry_t *prev;    // More recent
+    struct victim_entry_t *next;    // Less recent
+} victim_entry_t;
+
+typedef struct victim_key_t {
+    int64_t table_id;
+    pagenum_t page_num;
+
+    bool operator==(const victim_key_t &other) const {
+        return table_id == other.table_id && page_num == other.page_num;
+    }
+} victim_key_t;
+
+struct victim_key_hash {
+    size_t operator()(const victim_key_t &key) const {
+        return std::hash<uint64_t>()(key.page_num * 0x9e3779b97f4a7c15ULL ^
+                                     (uint64_t)key.table_id);
+    }
+};
+
+static std::unordered_map<victim_key_t, victim_entry_t*, victim_key_hash>
+    entries;
+static victim_entry_t *head = NULL;  // The most recent
+static victim_entry_t *tail = NULL;
+static size_t budget = 0;
+static size_t size = 0;
+
+// Bytes an entry takes, with its slot in the map
+static inline size_t entry_size(const victim_entry_t *entry) {
+    return sizeof(victim_entry_t) + entry->size + 4 * sizeof(void*);
+}
+
+static void unlink_entry(victim_entry_t *entry) {
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        head = entry->next;
+
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        tail = entry->prev;
+}
+
+static void remove_entry(victim_entry_t *entry) {
+    unlink_entry(entry);
+    entries.erase({ entry->table_id, entry->page_num });
+    size -= entry_size(entry);
+    free(entry);
+}
+
+// Drop the least recent pages until the cache takes no more than limit
+static void shrink_to(size_t limit) {
+    while (tail != NULL && size > limit)
+        remove_entry(tail);
+}
+
+/* Set the budget of the cache in bytes (0 to turn it off), dropping the
+ * pages over it.
+ */
+void victim_cache_set_budget(size_t new_budget) {
+    budget = new_budget;
+    shrink_to(budget);
+}
+
+// Whether the cache is on
+bool victim_cache_is_enabled() {
+    return budget != 0;
+}
+
+// Keep a clean page evicted from its frame
+void victim_cache_put(int64_t table_id, pagenum_t page_num,
+                      const page_t *page) {
+    static byte compressed[VICTIM_CACHE_MAX_SIZE];
+    victim_entry_t *entry;
+
+    if (budget == 0)
+        return;
+
+    uint32_t compressed_size = compress_bytes((const byte*)page, PAGE_SIZE,
+                                              compressed,
+                                              VICTIM_CACHE_MAX_SIZE);
+    if (compressed_size == 0)
+        return;
+
+    entry = (victim_entry_t*)malloc(sizeof(victim_entry_t) +
+                                    compressed_size);
+    if (entry == NULL)
+        return;
+
+    entry->table_id = table_id;
+    entry->page_num = page_num;
+    entry->size = compressed_size;
+    memcpy(entry + 1, compressed, compressed_size);
+
+    auto it = entries.find({ table_id, page_num });
+    if (it != entries.end())
+        remove_entry(it->second);
+
+    shrink_to(budget - std::min(budget, entry_size(entry)));
+    if (entry_size(entry) > budget) {
+        free(entry);
+        return;
+    }
+
+    entry->prev = NULL;
+    entry->next = head;
+    if (head != NULL)
+        head->prev = entry;
+    else
+        tail = entry;
+    head = entry;
+
+    entries[{ table_id, page_num }] = entry;
+    size += entry_size(entry);
+}
+
+/* Take a page out of the cache into dest.
+ * Returns 1 if it is not there.
+ */
+int victim_cache_take(int64_t table_id, pagenum_t page_num, page_t *dest) {
+    if (entries.empty())
+        return 1;
+
+    auto it = entries.find({ table_id, page_num });
+    if (it == entries.end())
+        return 1;
+
+    victim_entry_t *entry = it->second;
+    uint32_t page_size = decompress_bytes((const byte*)(entry + 1),
+                                          entry->size, (byte*)dest,
+                                          PAGE_SIZE);
+    remove_entry(entry);
+
+    if (page_size != PAGE_SIZE)
+        return 1;
+
+    stat_victim_cache_hits++;
+    return 0;
+}
+
+// Whether the page is in the cache
+bool victim_cache_contains(int64_t table_id, pagenum_t page_num) {
+    return !entries.empty() &&
+           entries.find({ table_id, page_num }) != entries.end();
+}
+
+// Drop every page (the table ids are given out again)
+void victim_cache_clear() {
+    shrink_to(0);
+}
+
+// Get the bytes the cache takes, and the number of pages in it
+size_t victim_cache_get_size(uint64_t *num_pages) {
+    if (num_pages != NULL)
+        *num_pages = entries.size();
+
+    return size;
+}
@@ -2,8 +2,13 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <string>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 /*******************************************************************************
  * The test structures stated here were written to give you and idea of what a
  * test should contain and look like. Feel free to change the code and add new
@@ -333,3 +338,409 @@ TEST_F(BptTest, OverallOpsTest) {
 
     remove(pathname.c_str());
 }
+
+/*
+ * Tests operations on a table with packed internal pages
+ * - Insert sparse keys so that internal pages split with various key widths,
+ *   delete most of them so that internal pages coalesce and redistribute,
+ *   and check the remaining records with find and scan
+ */
+TEST(PackedKeysTest, OverallOpsTest) {
+    std::string pathname = "packed_keys_test.db";
+    int32_t num_keys = 40000;
+    int32_t num_deletion = 30000;
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+    int x, y;
+    db_key_t tmp;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(num_keys, 512), 0);
+
+    int64_t table_id = open_table(pathname.c_str(), TABLE_FLAG_PACKED_KEYS);
+    ASSERT_TRUE(table_id >= 0);
+
+    // Keys are dense in some ranges and far apart in the others.
+    db_key_t *keys = (db_key_t*)malloc(num_keys * sizeof(db_key_t));
+    for (int i = 0; i < num_keys; i++)
+        keys[i] = (i % 3 == 0) ? (int64_t)i * 1000000007 - (1LL << 40) : i;
+
+    srand(time(NULL));
+    for (int i = 0; i < num_keys * 3 / 2; i++) {
+        x = rand() % num_keys;
+        y = rand() % num_keys;
+
+        tmp = keys[x];
+        keys[x] = keys[y];
+        keys[y] = tmp;
+    }
+
+    memset(buf, 'a', MAX_VALUE_SIZE);
+    for (int i = 0; i < num_keys; i++) {
+        sprintf(buf, "%-20ld", keys[i]);
+        buf[20] = 'a';
+        ASSERT_EQ(db_insert(table_id, keys[i], buf, MIN_VALUE_SIZE), 0);
+    }
+
+    for (int i = 0; i < num_keys; i++) {
+        ASSERT_EQ(db_find(table_id, keys[i], buf, &val_size), 0);
+        ASSERT_EQ(val_size, MIN_VALUE_SIZE);
+        ASSERT_EQ(strtoll(buf, NULL, 10), keys[i]);
+    }
+
+    for (int i = 0; i < num_deletion; i++)
+        ASSERT_EQ(db_delete(table_id, keys[i]), 0);
+
+    for (int i = 0; i < num_keys; i++)
+        ASSERT_EQ(db_find(table_id, keys[i], NULL, NULL), i < num_deletion ? 2 : 0);
+
+    std::vector<int64_t> s_keys;
+    std::vector<char*> s_values;
+    std::vector<uint16_t> s_val_sizes;
+
+    ASSERT_EQ(db_scan(table_id, INT64_MIN, INT64_MAX, &s_keys, &s_values,
+                      &s_val_sizes), 0);
+    ASSERT_EQ(s_keys.size(), num_keys - num_deletion);
+
+    for (size_t i = 0; i < s_keys.size(); i++) {
+        if (i > 0) {
+            ASSERT_LT(s_keys[i - 1], s_keys[i]);
+        }
+        free(s_values[i]);
+    }
+
+    free(keys);
+    shutdown_db();
+    remove(pathname.c_str());
+}
+
+TEST(VarKeysTest, OverallOpsTest) {
+    std::string pathname = "var_keys_test.db";
+    int32_t num_keys = 30000;
+    int32_t num_deletion = 20000;
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+    int x, y;
+    key_builder_t builder;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(num_keys, 512), 0);
+
+    int64_t table_id = open_table(pathname.c_str(), TABLE_FLAG_VAR_KEYS);
+    ASSERT_TRUE(table_id >= 0);
+
+    // Composite keys (tenant, id) with few tenants, so that many keys share
+    // their first 8 bytes, and ids of different lengths.
+    std::vector<std::string> keys;
+    for (int i = 0; i < num_keys; i++) {
+        std::string id = "user-" + std::to_string(i) + std::string(i % 29, 'x');
+
+        key_builder_init(&builder);
+        key_append_int64(&builder, i % 7 - 3);
+        key_append_bytes(&builder, id.c_str(), id.size());
+        ASSERT_FALSE(builder.overflow);
+
+        keys.push_back(std::string(builder.data, builder.size));
+    }
+
+    srand(time(NULL));
+    for (int i = 0; i < num_keys * 3 / 2; i++) {
+        x = rand() % num_keys;
+        y = rand() % num_keys;
+        std::swap(keys[x], keys[y]);
+    }
+
+    memset(buf, 'a', MAX_VALUE_SIZE);
+    for (int i = 0; i < num_keys; i++) {
+        sprintf(buf, "%-20d", i);
+        buf[20] = 'a';
+        ASSERT_EQ(db_insert(table_id, keys[i].data(), keys[i].size(), buf,
+                            MIN_VALUE_SIZE), 0);
+    }
+
+    // Duplicates and int64 keys are refused.
+    ASSERT_EQ(db_insert(table_id, keys[0].data(), keys[0].size(), buf,
+                        MIN_VALUE_SIZE), 1);
+    ASSERT_EQ(db_insert(table_id, 1, buf, MIN_VALUE_SIZE), 1);
+
+    for (int i = 0; i < num_keys; i++) {
+        ASSERT_EQ(db_find(table_id, keys[i].data(), keys[i].size(), buf,
+                          &val_size), 0);
+        ASSERT_EQ(val_size, MIN_VALUE_SIZE);
+        ASSERT_EQ(strtol(buf, NULL, 10), i);
+    }
+
+    for (int i = 0; i < num_deletion; i++)
+        ASSERT_EQ(db_delete(table_id, keys[i].data(), keys[i].size()), 0);
+
+    for (int i = 0; i < num_keys; i++)
+        ASSERT_EQ(db_find(table_id, keys[i].data(), keys[i].size(), NULL, NULL),
+                  i < num_deletion ? 2 : 0);
+
+    std::vector<std::string> expected(keys.begin() + num_deletion, keys.end());
+    std::sort(expected.begin(), expected.end());
+
+    std::vector<std::string> s_keys;
+    std::vector<char*> s_values;
+    std::vector<uint16_t> s_val_sizes;
+    std::string begin(1, '\0');
+    std::string end(MAX_KEY_SIZE, '\xff');
+
+    ASSERT_EQ(db_scan(table_id, begin.data(), begin.size(), end.data(),
+                      end.size(), &s_keys, &s_values, &s_val_sizes), 0);
+    ASSERT_EQ(s_keys, expected);
+
+    for (size_t i = 0; i < s_keys.size(); i++)
+        free(s_values[i]);
+
+    // The keys of a tenant form a range.
+    key_builder_init(&builder);
+    key_append_int64(&builder, 0);
+    begin = std::string(builder.data, builder.size);
+    end = begin + std::string(MAX_KEY_SIZE - begin.size(), '\xff');
+
+    s_keys.clear();
+    s_values.clear();
+    s_val_sizes.clear();
+    ASSERT_EQ(db_scan(table_id, begin.data(), begin.size(), end.data(),
+                      end.size(), &s_keys, &s_values, &s_val_sizes), 0);
+
+    size_t tenant_keys = 0;
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (expected[i].compare(0, begin.size(), begin) == 0)
+            tenant_keys++;
+    }
+    ASSERT_EQ(s_keys.size(), tenant_keys);
+
+    for (size_t i = 0; i < s_keys.size(); i++) {
+        ASSERT_EQ(s_keys[i].compare(0, begin.size(), begin), 0);
+        free(s_values[i]);
+    }
+
+    shutdown_db();
+    remove(pathname.c_str());
+}
+
+TEST(OverflowTest, LargeValuesTest) {
+    std::string pathname = "overflow_test.db";
+    int32_t num_keys = 200;
+    uint32_t max_size = 5 * PAGE_SIZE + 123;
+    char *value = (char*)malloc(max_size);
+    char *buf = (char*)malloc(max_size);
+    uint32_t val_size, read_size;
+    uint16_t small_size;
+    struct stat st;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(num_keys, 512), 0);
+
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    for (uint32_t i = 0; i < max_size; i++)
+        value[i] = 'a' + i % 26;
+
+    // Every third value fits in the leaf.
+    auto sized = [&](int key) -> uint32_t {
+        return key % 3 == 0 ? MAX_VALUE_SIZE :
+            MAX_VALUE_SIZE + 1 + key * 131 % (max_size - MAX_VALUE_SIZE);
+    };
+
+    for (int i = 0; i < num_keys; i++) {
+        value[0] = (char)i;
+        ASSERT_EQ(db_insert_large(table_id, i, value, sized(i)), 0);
+    }
+    ASSERT_EQ(db_insert_large(table_id, 0, value, max_size), 1);
+    ASSERT_EQ(db_insert_large(table_id, num_keys, value, MIN_VALUE_SIZE - 1), 1);
+
+    for (int i = 0; i < num_keys; i++) {
+        ASSERT_EQ(db_get_value_size(table_id, i, &val_size), 0);
+        ASSERT_EQ(val_size, sized(i));
+
+        // Stream the value in pieces.
+        uint32_t offset = 0;
+        uint32_t piece = 1000 + i;
+        while (offset < val_size) {
+            ASSERT_EQ(db_read_value(table_id, i, offset, buf + offset, piece,
+                                    &read_size), 0);
+            ASSERT_EQ(read_size, std::min(piece, val_size - offset));
+            offset += read_size;
+        }
+        ASSERT_EQ(buf[0], (char)i);
+        ASSERT_EQ(memcmp(buf + 1, value + 1, val_size - 1), 0);
+
+        ASSERT_EQ(db_find(table_id, i, buf, &small_size),
+                  val_size <= MAX_VALUE_SIZE ? 0 : 3);
+    }
+
+    std::vector<int64_t> s_keys;
+    std::vector<char*> s_values;
+    std::vector<uint16_t> s_val_sizes;
+
+    ASSERT_EQ(db_scan(table_id, 0, num_keys, &s_keys, &s_values, &s_val_sizes), 0);
+    ASSERT_EQ(s_keys.size(), num_keys);
+    for (int i = 0; i < num_keys; i++) {
+        ASSERT_EQ(s_values[i] == NULL, sized(i) > MAX_VALUE_SIZE);
+        free(s_values[i]);
+    }
+
+    // The overflow pages of deleted values are reused.
+    ASSERT_EQ(stat(pathname.c_str(), &st), 0);
+    off_t file_size = st.st_size;
+
+    for (int i = 0; i < num_keys; i++)
+        ASSERT_EQ(db_delete(table_id, i), 0);
+    for (int i = 0; i < num_keys; i++)
+        ASSERT_EQ(db_insert_large(table_id, i, value, sized(i)), 0);
+
+    ASSERT_EQ(stat(pathname.c_str(), &st), 0);
+    ASSERT_EQ(st.st_size, file_size);
+
+    free(value);
+    free(buf);
+    shutdown_db();
+    remove(pathname.c_str());
+}
+
+/*
+ * Tests a table opened with TABLE_OPEN_MMAP:
+ * 1. Build a table the usual way
+ * 2. Open it mapped, and find and scan the records without reading pages
+ * 3. Check that it refuses changes
+ */
+TEST(MmapTest, ReadsInPlace) {
+    std::string pathname = "mmap_test.db";
+    int num_keys = 3000;
+    char value[MAX_VALUE_SIZE];
+    char ret_val[MAX_VALUE_SIZE];
+    uint16_t val_size;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(num_keys, 512), 0);
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    for (int i = 0; i < num_keys; i++) {
+        memset(value, 'a' + i % 26, MIN_VALUE_SIZE);
+        ASSERT_EQ(db_insert(table_id, i, value, MIN_VALUE_SIZE), 0);
+    }
+    ASSERT_EQ(shutdown_db(), 0);
+
+    // A mapped table is never created.
+    ASSERT_EQ(init_db(num_keys, 16), 0);
+    EXPECT_LT(open_table("mmap_missing.db", TABLE_OPEN_MMAP), 0);
+    table_id = open_table(pathname.c_str(), TABLE_OPEN_MMAP);
+    ASSERT_TRUE(table_id >= 0);
+
+    init_buffer_stat();
+
+    for (int i = 0; i < num_keys; i++) {
+        ASSERT_EQ(db_find(table_id, i, ret_val, &val_size), 0);
+        ASSERT_EQ(val_size, MIN_VALUE_SIZE);
+        ASSERT_EQ(ret_val[0], 'a' + i % 26);
+    }
+
+    std::vector<int64_t> s_keys;
+    std::vector<char*> s_values;
+    std::vector<uint16_t> s_val_sizes;
+
+    ASSERT_EQ(db_scan(table_id, 0, num_keys, &s_keys, &s_values, &s_val_sizes), 0);
+    ASSERT_EQ(s_keys.size(), num_keys);
+    for (size_t i = 0; i < s_values.size(); i++)
+        free(s_values[i]);
+
+    // The pages are read in place, not into the buffer pool.
+    EXPECT_EQ(get_buffer_hit_ratio(), 100);
+
+    memset(value, 'z', MIN_VALUE_SIZE);
+    EXPECT_NE(db_insert(table_id, num_keys, value, MIN_VALUE_SIZE), 0);
+    EXPECT_NE(db_update(table_id, 0, value, MIN_VALUE_SIZE), 0);
+    EXPECT_NE(db_delete(table_id, 0), 0);
+    ASSERT_EQ(db_find(table_id, 0, ret_val, &val_size), 0);
+    EXPECT_EQ(ret_val[0], 'a');
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(pathname.c_str());
+}
+
+// Flip a byte in the data of a page on disk.
+static void corrupt_page(const std::string &pathname, pagenum_t page_num) {
+    int fd = open(pathname.c_str(), O_RDWR);
+    char c;
+
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(pread(fd, &c, 1, page_num * PAGE_SIZE + HEADER_SIZE), 1);
+    c ^= 0x5a;
+    ASSERT_EQ(pwrite(fd, &c, 1, page_num * PAGE_SIZE + HEADER_SIZE), 1);
+    close(fd);
+}
+
+/*
+ * Tests that the operations fail on a page torn on disk, without crashing:
+ * 1. Build a tree of two levels
+ * 2. Tear its second leaf and check the finds and the scan through it
+ * 3. Tear the root and check every operation
+ */
+TEST(TornPageTest, FailsOperations) {
+    std::string pathname = "torn_page_test.db";
+    int num_keys = 3000;
+    char value[MAX_VALUE_SIZE];
+    char ret_val[MAX_VALUE_SIZE];
+    uint16_t val_size;
+    page_t header, root;
+    std::vector<int64_t> s_keys;
+    std::vector<char*> s_values;
+    std::vector<uint16_t> s_val_sizes;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(num_keys, 512), 0);
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    memset(value, 'a', MIN_VALUE_SIZE);
+    for (int i = 0; i < num_keys; i++)
+        ASSERT_EQ(db_insert(table_id, i, value, MIN_VALUE_SIZE), 0);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    int fd = open(pathname.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(pread(fd, &header, PAGE_SIZE, 0), PAGE_SIZE);
+    ASSERT_EQ(pread(fd, &root, PAGE_SIZE, header.root_page_num * PAGE_SIZE),
+              PAGE_SIZE);
+    close(fd);
+    ASSERT_FALSE(root.is_leaf);
+
+    // The keys of the second leaf start at the first key of the root.
+    pagenum_t leaf_num = root.pairs[0].page_num;
+    int64_t leaf_key = root.pairs[0].key;
+    corrupt_page(pathname, leaf_num);
+
+    ASSERT_EQ(init_db(num_keys, 512), 0);
+    table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    EXPECT_EQ(db_find(table_id, 0, ret_val, &val_size), 0);
+    EXPECT_EQ(db_find(table_id, leaf_key, ret_val, &val_size), DB_BAD_PAGE);
+    EXPECT_EQ(db_scan(table_id, 0, num_keys, &s_keys, &s_values, &s_val_sizes),
+              DB_BAD_PAGE);
+    for (size_t i = 0; i < s_values.size(); i++)
+        free(s_values[i]);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    corrupt_page(pathname, header.root_page_num);
+
+    ASSERT_EQ(init_db(num_keys, 512), 0);
+    table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    EXPECT_EQ(db_find(table_id, 0, ret_val, &val_size), DB_BAD_PAGE);
+    EXPECT_EQ(db_insert(table_id, num_keys, value, MIN_VALUE_SIZE),
+              DB_BAD_PAGE);
+    EXPECT_EQ(db_update(table_id, 0, value, MIN_VALUE_SIZE), DB_BAD_PAGE);
+    EXPECT_EQ(db_delete(table_id, 0), DB_BAD_PAGE);
+    EXPECT_EQ(db_scan(table_id, 0, num_keys, &s_keys, &s_values, &s_val_sizes),
+              DB_BAD_PAGE);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(pathname.c_str());
+}
@@ -0,0 +1,882 @@
+#include "db.h"
+#include "buffer.h"
+#include "file.h"
+#include "victim_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <pthread.h>
+#include <random>
+#include <string>
+#include <vector>
+
+class StatCout : public std::stringstream
+{
+public:
+    ~StatCout()
+    {
+        std::cout << "\u001b[32m[   STAT   ] \u001b[33m" << str() << "\u001b[0m" << std::flush;
+    }
+};
+
+#define STAT_COUT StatCout()
+
+static const int policies[] = {
+    BUFFER_POLICY_CLOCK, BUFFER_POLICY_LRU_K, BUFFER_POLICY_2Q, BUFFER_POLICY_ARC
+};
+static const char *policy_names[] = { "clock", "lru-2", "2q", "arc" };
+
+// Make a value of size bytes starting with the number
+static void make_value(char *buf, int number, uint16_t size) {
+    snprintf(buf, MAX_VALUE_SIZE + 1, "%-*d", size, number);
+}
+
+// Insert the keys in [begin, end) with values of size bytes
+static void insert_keys(int64_t table_id, int begin, int end, uint16_t size) {
+    char buf[MAX_VALUE_SIZE + 1];
+
+    for (int key = begin; key < end; key++) {
+        make_value(buf, key, size);
+        ASSERT_EQ(db_insert(table_id, key, buf, size), 0);
+    }
+}
+
+// Find the keys in [begin, end)
+static void find_keys(int64_t table_id, int begin, int end) {
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+
+    for (int key = begin; key < end; key++)
+        ASSERT_EQ(db_find(table_id, key, buf, &val_size), 0) << key;
+}
+
+/*
+ * Tests tables bound to their own buffer pools:
+ * 1. Create a pool, and open a table with it and another with the default
+ * 2. Fill the default pool many times over, and find the keys of the table
+ *    of the other pool without reading a page
+ * 3. Move the table to the default pool
+ */
+TEST(PoolTest, KeepsTablesApart) {
+    std::string hot_path = "pool_hot.db";
+    std::string cold_path = "pool_cold.db";
+    int num_hot_keys = 200;
+
+    remove(hot_path.c_str());
+    remove(cold_path.c_str());
+    ASSERT_EQ(init_db(100, 32), 0);
+
+    ASSERT_EQ(create_buffer_pool("hot", 100, 32), 0);
+    EXPECT_NE(create_buffer_pool("hot", 100, 32), 0);
+    EXPECT_NE(create_buffer_pool(DEFAULT_BUFFER_POOL, 100, 32), 0);
+    EXPECT_NE(create_buffer_pool("tiny", 100, 3), 0);
+    EXPECT_NE(create_buffer_pool("hot pool", 100, 32), 0);
+    EXPECT_NE(create_buffer_pool("", 100, 32), 0);
+    EXPECT_EQ(open_table(hot_path.c_str(), 0, "none"), -1);
+
+    int64_t hot = open_table(hot_path.c_str(), 0, "hot");
+    int64_t cold = open_table(cold_path.c_str());
+    ASSERT_GE(hot, 0);
+    ASSERT_GE(cold, 0);
+
+    insert_keys(hot, 0, num_hot_keys, MIN_VALUE_SIZE);
+    find_keys(hot, 0, num_hot_keys);
+    uint32_t hot_num_buf = buffer_get_table_num_buf(hot);
+    EXPECT_GT(hot_num_buf, 0u);
+
+    insert_keys(cold, 0, 5000, MAX_VALUE_SIZE);
+    EXPECT_LE(buffer_get_table_num_buf(cold), 32u);
+    EXPECT_EQ(buffer_get_table_num_buf(hot), hot_num_buf);
+
+    int64_t num_reads = stat_read_page;
+    find_keys(hot, 0, num_hot_keys);
+    EXPECT_EQ(stat_read_page, num_reads);
+
+    // Opened again without a pool, the table stays where it is
+    EXPECT_EQ(open_table(hot_path.c_str()), hot);
+    EXPECT_EQ(buffer_get_table_num_buf(hot), hot_num_buf);
+
+    // And it moves with one
+    EXPECT_EQ(open_table(hot_path.c_str(), 0, DEFAULT_BUFFER_POOL), hot);
+    EXPECT_EQ(buffer_get_table_num_buf(hot), 0u);
+    find_keys(hot, 0, num_hot_keys);
+    EXPECT_GT(buffer_get_table_num_buf(hot), 0u);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(hot_path.c_str());
+    remove(cold_path.c_str());
+}
+
+/*
+ * Tests the quotas of the tables of a pool:
+ * 1. Check the quotas refused
+ * 2. Keep a minimum for a table, and a maximum for another inserting many
+ *    keys, and check the frames each holds
+ */
+TEST(PoolTest, KeepsQuotas) {
+    std::string hot_path = "quota_hot.db";
+    std::string scan_path = "quota_scan.db";
+    int num_buf = 40;
+
+    // Enough keys for 20 full leaves, whatever the page size
+    int num_hot_keys = 20 * (DATA_SIZE / (SLOT_SIZE + MAX_VALUE_SIZE));
+
+    remove(hot_path.c_str());
+    remove(scan_path.c_str());
+    ASSERT_EQ(init_db(100, num_buf), 0);
+
+    int64_t hot = open_table(hot_path.c_str());
+    int64_t scan = open_table(scan_path.c_str());
+    ASSERT_GE(hot, 0);
+    ASSERT_GE(scan, 0);
+
+    EXPECT_NE(set_table_quota(hot, 0, 2), 0);
+    EXPECT_NE(set_table_quota(hot, 8, 4), 0);
+    EXPECT_NE(set_table_quota(hot, num_buf - 3, 0), 0);
+    EXPECT_NE(set_table_quota(-1, 0, 0), 0);
+
+    insert_keys(hot, 0, num_hot_keys, MAX_VALUE_SIZE);
+    find_keys(hot, 0, num_hot_keys);
+    ASSERT_GE(buffer_get_table_num_buf(hot), 12u);
+
+    ASSERT_EQ(set_table_quota(hot, 12, 0), 0);
+    ASSERT_EQ(set_table_quota(scan, 0, 10), 0);
+    EXPECT_NE(set_table_quota(scan, num_buf - 12 - 3, 0), 0);
+
+    for (int round = 0; round < 10; round++) {
+        insert_keys(scan, round * 500, (round + 1) * 500, MAX_VALUE_SIZE);
+        EXPECT_LE(buffer_get_table_num_buf(scan), 10u);
+        EXPECT_GE(buffer_get_table_num_buf(hot), 12u);
+    }
+    find_keys(scan, 0, 5000);
+    EXPECT_LE(buffer_get_table_num_buf(scan), 10u);
+
+    // The hot table takes back the frames beyond its minimum
+    find_keys(hot, 0, num_hot_keys);
+    EXPECT_GE(buffer_get_table_num_buf(hot), 12u);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(hot_path.c_str());
+    remove(scan_path.c_str());
+}
+
+/*
+ * Tests the B+ tree on a small pool with each replacement policy:
+ * insert, find and delete keys, with the pages evicted over and over
+ */
+TEST(PolicyTest, RunsTreesWithEachPolicy) {
+    std::string pathname = "policy_test.db";
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+    int num_keys = 3000;
+
+    EXPECT_NE(init_buffer_pool(100, 16, -1), 0);
+    EXPECT_NE(init_buffer_pool(100, 16, 4), 0);
+
+    for (int policy : policies) {
+        remove(pathname.c_str());
+        ASSERT_EQ(init_db(100, 16, NULL, policy), 0) << policy_names[policy];
+        EXPECT_EQ(create_buffer_pool("pool", 100, 16, policy), 0);
+
+        int64_t table_id = open_table(pathname.c_str());
+        ASSERT_GE(table_id, 0);
+
+        insert_keys(table_id, 0, num_keys, MAX_VALUE_SIZE);
+        find_keys(table_id, 0, num_keys);
+
+        for (int key = 0; key < num_keys; key += 2)
+            ASSERT_EQ(db_delete(table_id, key), 0);
+
+        for (int key = 0; key < num_keys; key++) {
+            EXPECT_EQ(db_find(table_id, key, buf, &val_size) == 0, key % 2 == 1)
+                << policy_names[policy] << " " << key;
+        }
+
+        ASSERT_EQ(shutdown_db(), 0);
+    }
+
+    remove(pathname.c_str());
+}
+
+// Get the pages of the table resident in the default pool
+static std::vector<pagenum_t> get_resident_pages(int64_t table_id) {
+    buffer_pool_t *pool = find_pool(DEFAULT_BUFFER_POOL);
+    std::vector<pagenum_t> pages;
+
+    for (uint32_t i = 0; i < pool->num_buf; i++) {
+        if (pool->frames[i]->table_id == table_id)
+            pages.push_back(pool->frames[i]->page_num);
+    }
+
+    return pages;
+}
+
+/*
+ * Tests that the pages dropped without an eviction are not remembered by
+ * the policies: read again after their table moved away and back, or their
+ * frames were dropped by a shrink, they are placed as pages never read
+ */
+TEST(PolicyTest, ForgetsPagesDroppedWithoutEviction) {
+    std::string pathname = "policy_drop_test.db";
+    pagenum_t fresh_page_num = 40;
+
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        remove(pathname.c_str());
+        ASSERT_EQ(init_buffer_pool(100, 16), 0);
+        ASSERT_EQ(buffer_create_pool("pool", 100, 16, policies[i]), 0);
+        int64_t table_id = buffer_open_table(pathname.c_str(), 0, "pool");
+        ASSERT_GE(table_id, 0);
+
+        for (pagenum_t page_num = 1; page_num <= 12; page_num++)
+            unpin_buffer(get_buffer(table_id, page_num));
+
+        ASSERT_EQ(buffer_open_table(pathname.c_str()), table_id);
+        ASSERT_EQ(buffer_open_table(pathname.c_str(), 0, "pool"), table_id);
+        for (pagenum_t page_num = 1; page_num <= 6; page_num++)
+            unpin_buffer(get_buffer(table_id, page_num));
+
+        ASSERT_EQ(buffer_resize_pool("pool", 4), 0);
+        ASSERT_EQ(buffer_resize_pool("pool", 16), 0);
+
+        buf_descriptor_t *fresh = get_buffer(table_id, fresh_page_num);
+        ASSERT_NE(fresh, nullptr);
+
+        for (pagenum_t page_num = 1; page_num <= 12; page_num++) {
+            buf_descriptor_t *buf = buffer_lookup(table_id, page_num);
+
+            // The pages kept through the shrink are left out.
+            if (buf != NULL) {
+                unpin_buffer(buf);
+                continue;
+            }
+
+            buf = get_buffer(table_id, page_num);
+            ASSERT_NE(buf, nullptr);
+            EXPECT_EQ(buf->policy_list, fresh->policy_list)
+                << policy_names[i] << " " << page_num;
+            EXPECT_EQ(buf->policy_history[1], 0u)
+                << policy_names[i] << " " << page_num;
+            unpin_buffer(buf);
+        }
+
+        unpin_buffer(fresh);
+        close_buffer_pool();
+    }
+
+    remove(pathname.c_str());
+}
+
+/*
+ * Tests scans over a table many times the pool with each replacement
+ * policy: the pages resident before, found by lookups, mostly stay
+ */
+TEST(PolicyTest, KeepsLookedUpPagesThroughScans) {
+    std::string pathname = "scan_test.db";
+    std::vector<int64_t> keys;
+    std::vector<char*> values;
+    std::vector<uint16_t> val_sizes;
+    int num_keys = 10000;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(100, 64), 0);
+    int64_t table_id = open_table(pathname.c_str());
+    insert_keys(table_id, 0, num_keys, MAX_VALUE_SIZE);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    for (int policy : policies) {
+        ASSERT_EQ(init_db(100, 64, NULL, policy), 0);
+        table_id = open_table(pathname.c_str());
+
+        for (int round = 0; round < 3; round++)
+            find_keys(table_id, 0, 500);
+
+        std::vector<pagenum_t> hot_pages = get_resident_pages(table_id);
+
+        keys.clear();
+        values.clear();
+        val_sizes.clear();
+        ASSERT_EQ(db_scan(table_id, INT64_MIN, INT64_MAX, &keys, &values,
+                          &val_sizes), 0);
+        ASSERT_EQ(keys.size(), (size_t)num_keys);
+        for (char *value : values)
+            free(value);
+
+        std::vector<pagenum_t> pages = get_resident_pages(table_id);
+        int num_kept = 0;
+        for (pagenum_t page_num : hot_pages) {
+            num_kept += std::find(pages.begin(), pages.end(), page_num) !=
+                        pages.end();
+        }
+
+        EXPECT_GE(num_kept * 2, (int)hot_pages.size())
+            << policy_names[policy] << " " << num_kept << "/"
+            << hot_pages.size();
+        ASSERT_EQ(shutdown_db(), 0);
+    }
+
+    remove(pathname.c_str());
+}
+
+// Pages drawn from a Zipfian distribution over num_pages pages
+class ZipfianPages {
+public:
+    ZipfianPages(int num_pages, double skew, uint32_t seed) :
+        random(seed), pages(num_pages) {
+        double sum = 0;
+
+        for (int i = 0; i < num_pages; i++) {
+            sum += 1.0 / pow(i + 1, skew);
+            cdf.push_back(sum);
+            pages[i] = i + 1;
+        }
+
+        // The hot pages are spread over the file
+        std::shuffle(pages.begin(), pages.end(), random);
+    }
+
+    pagenum_t next() {
+        double u = std::uniform_real_distribution<double>(0, cdf.back())(random);
+
+        return pages[std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()];
+    }
+
+private:
+    std::mt19937 random;
+    std::vector<double> cdf;
+    std::vector<pagenum_t> pages;
+};
+
+// Run the trace of pages on the pool with the policy, and get the hit ratio
+static int64_t run_trace(int policy, const std::vector<pagenum_t> &trace) {
+    std::string pathname = "policy_trace.db";
+
+    remove(pathname.c_str());
+    EXPECT_EQ(init_buffer_pool(1000, 256, policy), 0);
+    int64_t table_id = buffer_open_table(pathname.c_str());
+    EXPECT_GE(table_id, 0);
+
+    init_buffer_stat();
+    for (pagenum_t page_num : trace) {
+        buf_descriptor_t *buf = get_buffer(table_id, page_num);
+
+        EXPECT_NE(buf, nullptr);
+        if (buf == NULL)
+            break;
+        unpin_buffer(buf);
+    }
+
+    int64_t hit_ratio = get_buffer_hit_ratio();
+    close_buffer_pool();
+    remove(pathname.c_str());
+
+    return hit_ratio;
+}
+
+/*
+ * Compares the hit ratios of the policies, on page traces over a table of
+ * 2000 pages with 256 frames:
+ * - Zipfian: skewed lookups
+ * - Scan-mixed: the same lookups, with a scan of 1000 pages every 5000
+ * The policies keeping pages used once apart do better than clock with the
+ * scans.
+ */
+TEST(PolicyTest, ComparesHitRatios) {
+    std::vector<pagenum_t> zipfian;
+    std::vector<pagenum_t> scan_mixed;
+    ZipfianPages zipf(2000, 0.9, 1);
+    int64_t hit_ratios[2][4];
+
+    for (int i = 0; i < 50000; i++) {
+        pagenum_t page_num = zipf.next();
+
+        zipfian.push_back(page_num);
+        scan_mixed.push_back(page_num);
+
+        if (i % 5000 == 4999) {
+            for (pagenum_t scan = 1000; scan < 2000; scan++)
+                scan_mixed.push_back(scan);
+        }
+    }
+
+    for (int policy : policies) {
+        hit_ratios[0][policy] = run_trace(policy, zipfian);
+        hit_ratios[1][policy] = run_trace(policy, scan_mixed);
+
+        STAT_COUT << policy_names[policy] << ": zipfian " << hit_ratios[0][policy]
+                  << "%, scan-mixed " << hit_ratios[1][policy] << "%" << std::endl;
+    }
+
+    for (int policy : policies) {
+        EXPECT_GT(hit_ratios[0][policy], 0);
+        if (policy != BUFFER_POLICY_CLOCK) {
+            EXPECT_GE(hit_ratios[1][policy], hit_ratios[1][BUFFER_POLICY_CLOCK])
+                << policy_names[policy];
+        }
+    }
+}
+
+struct find_args {
+    int64_t table_id;
+    int num_keys;
+    int num_rounds;
+    int num_failed;
+};
+
+// Find every key over and over
+static void *find_all_keys(void *arg) {
+    find_args *args = (find_args*)arg;
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+
+    for (int round = 0; round < args->num_rounds; round++) {
+        for (int key = 0; key < args->num_keys; key++) {
+            if (db_find(args->table_id, key, buf, &val_size) != 0)
+                args->num_failed++;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Tests resizing the default pool while another thread finds keys:
+ * 1. Grow and shrink the pool back and forth under the finds and inserts
+ * 2. Grow it to hold the whole table, and find every key without a read
+ */
+TEST(PoolTest, ResizesOnline) {
+    std::string pathname = "resize_test.db";
+    std::string log_path = "resize_test.log";
+    uint32_t sizes[] = { 64, 8, 256, 32, 4, 128, 16 };
+    int num_keys = 2000;
+    pthread_t thread;
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+    ASSERT_EQ(init_db(100, 16, log_path.c_str()), 0);
+
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+    insert_keys(table_id, 0, num_keys, MAX_VALUE_SIZE);
+
+    EXPECT_NE(resize_buffer_pool("none", 32), 0);
+    EXPECT_NE(resize_buffer_pool(DEFAULT_BUFFER_POOL, 3), 0);
+    ASSERT_EQ(set_table_quota(table_id, 8, 0), 0);
+    EXPECT_NE(resize_buffer_pool(DEFAULT_BUFFER_POOL, 11), 0);
+    ASSERT_EQ(set_table_quota(table_id, 0, 0), 0);
+
+    find_args args = { table_id, num_keys, 5, 0 };
+    ASSERT_EQ(pthread_create(&thread, NULL, find_all_keys, &args), 0);
+
+    for (int round = 0; round < 5; round++) {
+        for (uint32_t size : sizes) {
+            ASSERT_EQ(resize_buffer_pool(DEFAULT_BUFFER_POOL, size), 0);
+            EXPECT_EQ(buffer_get_pool_num_buf(DEFAULT_BUFFER_POOL), size);
+            insert_keys(table_id, num_keys + round * 100 + size,
+                        num_keys + round * 100 + size + 1, MIN_VALUE_SIZE);
+        }
+    }
+
+    pthread_join(thread, NULL);
+    EXPECT_EQ(args.num_failed, 0);
+
+    ASSERT_EQ(resize_buffer_pool(DEFAULT_BUFFER_POOL, 1024), 0);
+    find_keys(table_id, 0, num_keys);
+    int64_t num_reads = stat_read_page;
+    find_keys(table_id, 0, num_keys);
+    EXPECT_EQ(stat_read_page, num_reads);
+
+    ASSERT_EQ(shutdown_db(), 0);
+
+    // The changes are all in the table
+    ASSERT_EQ(init_db(100, 16, log_path.c_str()), 0);
+    table_id = open_table(pathname.c_str());
+    find_keys(table_id, 0, num_keys);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+}
+
+/*
+ * Tests shrinking a pool with a frame at the tail pinned:
+ * the pool shrinks down to the frame, and the rest of the way once it is
+ * unpinned; growing again takes back the frames dropped first
+ */
+TEST(PoolTest, ShrinksDownToPinnedFrames) {
+    std::string pathname = "shrink_test.db";
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_buffer_pool(100, 8), 0);
+    int64_t table_id = buffer_open_table(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+
+    // The frames added are used first
+    ASSERT_EQ(buffer_resize_pool(DEFAULT_BUFFER_POOL, 16), 0);
+    buf_descriptor_t *buf = get_buffer(table_id, 1);
+    ASSERT_NE(buf, nullptr);
+    memset(buf->buf_page->space + HEADER_SIZE, 'a', DATA_SIZE);
+    mark_buffer_dirty(buf);
+
+    EXPECT_NE(buffer_resize_pool(DEFAULT_BUFFER_POOL, 4), 0);
+    EXPECT_EQ(buffer_get_pool_num_buf(DEFAULT_BUFFER_POOL), 9u);
+    EXPECT_EQ(buffer_lookup(table_id, 1), buf);
+    unpin_buffer(buf);
+    unpin_buffer(buf);
+
+    EXPECT_EQ(buffer_resize_pool(DEFAULT_BUFFER_POOL, 4), 0);
+    EXPECT_EQ(buffer_get_pool_num_buf(DEFAULT_BUFFER_POOL), 4u);
+    EXPECT_EQ(buffer_lookup(table_id, 1), nullptr);
+
+    // The page was written back as it was evicted
+    buf = get_buffer(table_id, 1);
+    ASSERT_NE(buf, nullptr);
+    EXPECT_EQ(buf->buf_page->space[HEADER_SIZE], 'a');
+    unpin_buffer(buf);
+
+    // The frames dropped from the first chunk are taken back first
+    buffer_pool_t *pool = find_pool(DEFAULT_BUFFER_POOL);
+    ASSERT_EQ(pool->num_chunks, 1);
+    ASSERT_EQ(buffer_resize_pool(DEFAULT_BUFFER_POOL, 12), 0);
+    EXPECT_EQ(pool->num_chunks, 2);
+    EXPECT_EQ(pool->chunks[1].first, 8u);
+    std::vector<buf_descriptor_t*> bufs;
+    for (pagenum_t page_num = 1; page_num <= 12; page_num++) {
+        bufs.push_back(get_buffer(table_id, page_num));
+        ASSERT_NE(bufs.back(), nullptr);
+    }
+    for (buf_descriptor_t *page_buf : bufs)
+        unpin_buffer(page_buf);
+
+    close_buffer_pool();
+    remove(pathname.c_str());
+}
+
+// Pin the thread to its node, and check it stays there
+static void *pin_to_node(void *arg) {
+    int node = numa_current_node();
+
+    *(int*)arg = numa_pin_thread(node) == 0 && numa_current_node() == node;
+    return NULL;
+}
+
+/*
+ * Tests frames in huge pages split among the NUMA nodes:
+ * 1. The frames are mapped in whole huge pages, in a chunk for each node
+ *    (falling back to transparent huge pages without reserved ones)
+ * 2. The B+ tree runs on them, with the pool grown and shrunk
+ * 3. A thread pinned to its node stays there
+ */
+TEST(FrameTest, AllocatesHugeAndNumaFrames) {
+    std::string pathname = "frame_test.db";
+    int num_keys = 3000;
+    int pinned = 0;
+    pthread_t thread;
+
+    EXPECT_GE(numa_count_nodes(), 1);
+    EXPECT_LT(numa_current_node(), numa_count_nodes());
+    EXPECT_NE(numa_pin_thread(numa_count_nodes()), 0);
+
+    remove(pathname.c_str());
+    buffer_set_frame_flags(FRAME_HUGE_PAGES | FRAME_NUMA);
+    ASSERT_EQ(init_db(100, 1024), 0);
+
+    buffer_pool_t *pool = find_pool(DEFAULT_BUFFER_POOL);
+    ASSERT_NE(pool, nullptr);
+    EXPECT_EQ(pool->num_nodes, numa_count_nodes());
+    EXPECT_EQ(pool->num_chunks, numa_count_nodes());
+    for (int i = 0; i < pool->num_chunks; i++) {
+        EXPECT_EQ(pool->chunks[i].map_size % HUGE_PAGE_SIZE, 0u);
+        EXPECT_GE(pool->chunks[i].map_size,
+                  (size_t)pool->chunks[i].num_buf * PAGE_SIZE);
+        EXPECT_EQ((uintptr_t)pool->chunks[i].buf_pages % PAGE_ALIGNMENT, 0u);
+    }
+
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+    insert_keys(table_id, 0, num_keys, MAX_VALUE_SIZE);
+
+    ASSERT_EQ(resize_buffer_pool(DEFAULT_BUFFER_POOL, 2048), 0);
+    EXPECT_EQ(pool->num_chunks, 2 * numa_count_nodes());
+    find_keys(table_id, 0, num_keys);
+    ASSERT_EQ(resize_buffer_pool(DEFAULT_BUFFER_POOL, 16), 0);
+    find_keys(table_id, 0, num_keys);
+
+    ASSERT_EQ(pthread_create(&thread, NULL, pin_to_node, &pinned), 0);
+    pthread_join(thread, NULL);
+    EXPECT_TRUE(pinned);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    buffer_set_frame_flags(0);
+    remove(pathname.c_str());
+}
+
+/*
+ * Tests warming up the buffer pool after a restart:
+ * 1. Shut down with a dump of the pages resident, the last ones found
+ * 2. Start again and warm up: finding the same keys reads no page
+ * 3. Warm up into a smaller pool, which is filled and no more
+ * 4. Warm up a table with a quota, which takes its max_buf frames only
+ */
+TEST(PoolTest, WarmsUpAfterRestart) {
+    std::string pathname = "warm_up_test.db";
+    std::string dump_path = "warm_up_test.dump";
+    int num_keys = 20000;
+    int num_hot_keys = 1000;
+
+    remove(pathname.c_str());
+    remove(dump_path.c_str());
+    ASSERT_EQ(init_db(100, 128), 0);
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+    insert_keys(table_id, 0, num_keys, MAX_VALUE_SIZE);
+    find_keys(table_id, 0, num_hot_keys);
+    ASSERT_EQ(shutdown_db(dump_path.c_str()), 0);
+
+    ASSERT_EQ(init_db(100, 128), 0);
+    EXPECT_NE(warm_up_db("none.dump"), 0);
+    ASSERT_EQ(warm_up_db(dump_path.c_str()), 0);
+    wait_warm_up_db();
+    EXPECT_GT(stat_read_page, 0);
+
+    table_id = open_table(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+    int64_t num_reads = stat_read_page;
+    find_keys(table_id, 0, num_hot_keys);
+    EXPECT_EQ(stat_read_page, num_reads);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    ASSERT_EQ(init_db(100, 32), 0);
+    ASSERT_EQ(warm_up_db(dump_path.c_str()), 0);
+    wait_warm_up_db();
+    table_id = open_table(pathname.c_str());
+    EXPECT_EQ(buffer_get_table_num_buf(table_id), 32u);
+    EXPECT_EQ(stat_read_page, 32);
+    find_keys(table_id, 0, num_keys);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    ASSERT_EQ(init_db(100, 128), 0);
+    table_id = open_table(pathname.c_str());
+    ASSERT_EQ(set_table_quota(table_id, 0, 16), 0);
+    std::vector<warm_page_t> pages;
+    ASSERT_EQ(buffer_load_dump(dump_path.c_str(), &pages), 0);
+    ASSERT_GT(pages.size(), 16u);
+    init_buffer_stat();
+    for (size_t done = 0; done < pages.size();) {
+        int n = buffer_warm_up(&pages[done], pages.size() - done);
+
+        ASSERT_GT(n, 0);
+        done += n;
+    }
+    EXPECT_EQ(buffer_get_table_num_buf(table_id), 16u);
+    EXPECT_EQ(stat_read_page, 16);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    remove(pathname.c_str());
+    remove(dump_path.c_str());
+}
+
+// Find the keys of a table in a scattered order
+static void find_scattered_keys(int64_t table_id, int num_keys) {
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+
+    for (int i = 0; i < num_keys; i++) {
+        int key = (int)((int64_t)i * 7919 % num_keys);
+        ASSERT_EQ(db_find(table_id, key, buf, &val_size), 0) << key;
+    }
+}
+
+/* Find the keys of a table on a small pool, after once to read them in,
+ * and count the pages read
+ */
+static int64_t count_reads(const char *pathname, int num_keys) {
+    EXPECT_EQ(init_db(100, 16), 0);
+    int64_t table_id = open_table(pathname);
+    find_scattered_keys(table_id, num_keys);
+    int64_t num_reads = stat_read_page;
+    find_scattered_keys(table_id, num_keys);
+    num_reads = stat_read_page - num_reads;
+    EXPECT_EQ(shutdown_db(), 0);
+
+    return num_reads;
+}
+
+/*
+ * Tests the compressed victim cache behind a small pool:
+ * 1. With a budget the table fits in, the pages evicted come back without
+ *    a read
+ * 2. With a small budget, the cache stays within it
+ */
+TEST(PoolTest, KeepsVictimsCompressed) {
+    std::string pathname = "victim_test.db";
+    // Keys for 50 full leaves, and budgets in pages, whatever the page size
+    int num_keys = 50 * (DATA_SIZE / (SLOT_SIZE + MAX_VALUE_SIZE));
+    size_t small_budget = 4 * PAGE_SIZE;
+    uint64_t num_pages;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(100, 16), 0);
+    int64_t table_id = open_table(pathname.c_str());
+    insert_keys(table_id, 0, num_keys, MAX_VALUE_SIZE);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    int64_t num_reads = count_reads(pathname.c_str(), num_keys);
+
+    set_victim_cache_budget(256 * PAGE_SIZE);
+    int64_t num_cached_reads = count_reads(pathname.c_str(), num_keys);
+    EXPECT_LT(num_cached_reads * 4, num_reads);
+
+    ASSERT_EQ(init_db(100, 16), 0);
+    table_id = open_table(pathname.c_str());
+    find_scattered_keys(table_id, num_keys);
+    EXPECT_GT(victim_cache_get_size(&num_pages), 0u);
+    EXPECT_GT(num_pages, 16u);
+    EXPECT_LT(victim_cache_get_size(), num_pages * PAGE_SIZE / 2);
+    int64_t num_hits = stat_victim_cache_hits;
+    find_scattered_keys(table_id, num_keys);
+    EXPECT_GT(stat_victim_cache_hits, num_hits);
+
+    set_victim_cache_budget(small_budget);
+    EXPECT_LE(victim_cache_get_size(), small_budget);
+    find_scattered_keys(table_id, num_keys);
+    EXPECT_LE(victim_cache_get_size(), small_budget);
+    ASSERT_EQ(shutdown_db(), 0);
+    EXPECT_EQ(victim_cache_get_size(), 0u);
+
+    set_victim_cache_budget(0);
+    remove(pathname.c_str());
+}
+
+/*
+ * Tests the per-thread descriptor cache:
+ * 1. The B+ tree runs with it, with the pool resized under it, and a table
+ *    moved to another pool, and the descents hit it
+ * 2. Another thread gets the pages it caches on its own
+ * 3. A page evicted and read again into another frame is not taken from
+ *    the frame it left
+ */
+TEST(PoolTest, CachesDescriptorsPerThread) {
+    std::string pathname = "desc_cache_test.db";
+    int num_keys = 3000;
+    char value[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+    pthread_t thread;
+
+    remove(pathname.c_str());
+    enable_desc_cache(true);
+    ASSERT_EQ(init_db(100, 64), 0);
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+
+    insert_keys(table_id, 0, num_keys, MIN_VALUE_SIZE);
+    int64_t num_hits = stat_desc_cache_hits;
+    find_keys(table_id, 0, num_keys);
+    EXPECT_GT(stat_desc_cache_hits - num_hits, num_keys);
+
+    ASSERT_EQ(resize_buffer_pool(DEFAULT_BUFFER_POOL, 8), 0);
+    find_keys(table_id, 0, num_keys);
+    ASSERT_EQ(resize_buffer_pool(DEFAULT_BUFFER_POOL, 128), 0);
+    for (int key = 0; key < num_keys; key += 2)
+        ASSERT_EQ(db_delete(table_id, key), 0);
+    find_keys(table_id, 1, 2);
+    EXPECT_NE(db_find(table_id, 0, value, &val_size), 0);
+
+    ASSERT_EQ(create_buffer_pool("other", 100, 16), 0);
+    ASSERT_EQ(open_table(pathname.c_str(), 0, "other"), table_id);
+    insert_keys(table_id, num_keys, num_keys + 500, MIN_VALUE_SIZE);
+    for (int key = 1; key < num_keys + 500; key += 2)
+        ASSERT_EQ(db_find(table_id, key, value, &val_size), 0) << key;
+
+    // Half the keys are deleted, in each of the two rounds
+    find_args args = { table_id, num_keys, 2, 0 };
+    ASSERT_EQ(pthread_create(&thread, NULL, find_all_keys, &args), 0);
+    pthread_join(thread, NULL);
+    EXPECT_EQ(args.num_failed, num_keys);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    ASSERT_EQ(init_buffer_pool(100, 4), 0);
+    table_id = buffer_open_table(pathname.c_str());
+    buf_descriptor_t *buf = get_buffer(table_id, 1);
+    ASSERT_NE(buf, nullptr);
+    memset(buf->buf_page->space + HEADER_SIZE, 'a', DATA_SIZE);
+    mark_buffer_dirty(buf);
+    unpin_buffer(buf);
+    for (pagenum_t page_num = 2; page_num < 10; page_num++)
+        unpin_buffer(get_buffer(table_id, page_num));
+    EXPECT_EQ(buffer_lookup(table_id, 1), nullptr);
+    for (pagenum_t page_num = 2; page_num < 5; page_num++)
+        unpin_buffer(get_buffer(table_id, page_num));
+
+    buf = get_buffer(table_id, 1);
+    ASSERT_NE(buf, nullptr);
+    EXPECT_EQ(buffer_lookup(table_id, 1), buf);
+    EXPECT_EQ(buf->buf_page->space[HEADER_SIZE], 'a');
+    unpin_buffer(buf);
+    close_buffer_pool();
+
+    enable_desc_cache(false);
+    remove(pathname.c_str());
+}
+
+/*
+ * Tests pointer swizzling:
+ * 1. The B+ tree runs with it on a small pool and a resized one, and once
+ *    it fits the pool, a lookup goes through the hashtable for the header
+ *    and the root only
+ * 2. The pages written and logged hold no pointers: the table reads back
+ *    the same without it
+ */
+TEST(PoolTest, SwizzlesChildReferences) {
+    std::string pathname = "swizzle_test.db";
+    std::string log_path = "swizzle_test.log";
+    int num_keys = 5000;
+    char value[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+    enable_swizzling(true);
+    ASSERT_EQ(init_db(100, 8, log_path.c_str()), 0);
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+
+    insert_keys(table_id, 0, num_keys, MIN_VALUE_SIZE);
+    for (int key = 0; key < num_keys; key += 3)
+        ASSERT_EQ(db_delete(table_id, key), 0);
+    for (int key = 0; key < num_keys; key++) {
+        EXPECT_EQ(db_find(table_id, key, value, &val_size) == 0,
+                  key % 3 != 0) << key;
+    }
+
+    ASSERT_EQ(resize_buffer_pool(DEFAULT_BUFFER_POOL, 1024), 0);
+    find_keys(table_id, 1, 2);
+    insert_keys(table_id, num_keys, num_keys + 1000, MIN_VALUE_SIZE);
+
+    // The inserts changed the internal pages, whose pointers are dropped.
+    find_keys(table_id, num_keys, num_keys + 1000);
+    int64_t num_hits = stat_swizzled_hits;
+    int64_t num_gets = stat_get_buffer;
+    find_keys(table_id, num_keys, num_keys + 1000);
+    EXPECT_GE(stat_swizzled_hits - num_hits, 1000);  // The leaves at least
+    EXPECT_EQ(stat_get_buffer - num_gets - (stat_swizzled_hits - num_hits),
+              2 * 1000);
+
+    ASSERT_EQ(resize_buffer_pool(DEFAULT_BUFFER_POOL, 8), 0);
+    find_keys(table_id, num_keys, num_keys + 1000);
+    ASSERT_EQ(shutdown_db(), 0);
+    enable_swizzling(false);
+
+    ASSERT_EQ(init_db(100, 64, log_path.c_str()), 0);
+    table_id = open_table(pathname.c_str());
+    for (int key = 0; key < num_keys; key++) {
+        EXPECT_EQ(db_find(table_id, key, value, &val_size) == 0,
+                  key % 3 != 0) << key;
+    }
+    find_keys(table_id, num_keys, num_keys + 1000);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+}
@@ -0,0 +1,123 @@
+#include "compress.h"
+#include "db.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+/*
+ * Tests the codec with compressible and incompressible bytes
+ */
+TEST(CompressTest, HandlesRoundTrip) {
+    byte src[PAGE_SIZE];
+    byte compressed[PAGE_SIZE];
+    byte dest[PAGE_SIZE];
+    uint32_t size;
+
+    // Repetitive strings compress well.
+    for (int i = 0; i < PAGE_SIZE; i++)
+        src[i] = "value-of-some-record-"[i % 21];
+
+    size = compress_bytes(src, PAGE_SIZE, compressed, PAGE_SIZE);
+    ASSERT_GT(size, 0);
+    EXPECT_LT(size, PAGE_SIZE / 4);
+    ASSERT_EQ(decompress_bytes(compressed, size, dest, PAGE_SIZE), PAGE_SIZE);
+    EXPECT_EQ(memcmp(src, dest, PAGE_SIZE), 0);
+
+    // Random bytes do not fit in the same size.
+    srand(time(NULL));
+    for (int i = 0; i < PAGE_SIZE; i++)
+        src[i] = rand();
+
+    EXPECT_EQ(compress_bytes(src, PAGE_SIZE, compressed, PAGE_SIZE), 0);
+
+    // Truncated streams are rejected.
+    size = compress_bytes(src, PAGE_SIZE / 2, compressed, PAGE_SIZE);
+    ASSERT_GT(size, 0);
+    EXPECT_EQ(decompress_bytes(compressed, size - 1, dest, PAGE_SIZE), 0);
+}
+
+/*
+ * Tests leaf page compression
+ * - Only the live part of the leaf page is restored, the free space is zeroed
+ */
+TEST(CompressTest, HandlesLeafPage) {
+    page_t *page = (page_t*)malloc(PAGE_SIZE);
+    page_t *dest = (page_t*)malloc(PAGE_SIZE);
+    byte compressed[PAGE_SIZE];
+    uint16_t offset = PAGE_SIZE;
+
+    memset(page, 0x5a, PAGE_SIZE);
+    page->parent_page_num = 3;
+    page->is_leaf = 1;
+    page->num_of_keys = 20;
+    page->right_sibling_page_num = -1;
+
+    for (int i = 0; i < page->num_of_keys; i++) {
+        slot_t *slot = (slot_t*)(page->data + i * SLOT_SIZE);
+
+        offset -= 100;
+        slot->key = i;
+        slot->size = 100;
+        slot->offset = offset;
+        snprintf(page->space + offset, 100, "%08d-value-%0*d", i, 80, 0);
+    }
+
+    uint32_t size = compress_leaf_page(page, compressed, PAGE_SIZE);
+    ASSERT_GT(size, 0);
+    EXPECT_LT(size, PAGE_SIZE / 2);
+    ASSERT_TRUE(is_compressed_page(compressed));
+    ASSERT_EQ(decompress_leaf_page(compressed, dest), 0);
+
+    uint32_t slots_end = HEADER_SIZE + page->num_of_keys * SLOT_SIZE;
+    EXPECT_EQ(memcmp(page, dest, slots_end), 0);
+    EXPECT_EQ(memcmp(page->space + offset, dest->space + offset,
+                     PAGE_SIZE - offset), 0);
+    for (uint32_t i = slots_end; i < offset; i++)
+        ASSERT_EQ(dest->space[i], 0);
+
+    // Internal pages are left alone.
+    page->is_leaf = 0;
+    EXPECT_EQ(compress_leaf_page(page, compressed, PAGE_SIZE), 0);
+
+    free(page);
+    free(dest);
+}
+
+/*
+ * Tests record operations on a table with compressed leaf pages
+ */
+TEST(CompressTest, HandlesCompressedTable) {
+    std::string pathname = "compress_test.db";
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+    int num_keys = 3000;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(100, 64), 0);
+
+    int64_t table_id = open_table(pathname.c_str(), TABLE_FLAG_COMPRESSED_LEAF);
+    ASSERT_TRUE(table_id >= 0);
+
+    for (int i = 0; i < num_keys; i++) {
+        snprintf(buf, sizeof(buf), "%08d-%0*d", i, MAX_VALUE_SIZE - 10, i % 7);
+        ASSERT_EQ(db_insert(table_id, i, buf, MAX_VALUE_SIZE), 0);
+    }
+
+    for (int i = 0; i < num_keys; i += 2)
+        ASSERT_EQ(db_delete(table_id, i), 0);
+
+    for (int i = 0; i < num_keys; i++) {
+        if (i % 2 == 0) {
+            EXPECT_NE(db_find(table_id, i, buf, &val_size), 0);
+            continue;
+        }
+
+        ASSERT_EQ(db_find(table_id, i, buf, &val_size), 0);
+        ASSERT_EQ(val_size, MAX_VALUE_SIZE);
+        ASSERT_EQ(atoi(buf), i);
+    }
+
+    shutdown_db();
+    remove(pathname.c_str());
+}
@@ -1,8 +1,12 @@
 #include "file.h"
+#include "buffer.h"
+#include "crc32c.h"
+#include "io.h"
 
 #include <gtest/gtest.h>
 
 #include <string>
+#include <vector>
 
 /*******************************************************************************
  * The test structures stated here were written to give you and idea of what a
@@ -207,3 +211,401 @@ TEST_F(FileTest, CheckReadWriteOperation) {
 
     ASSERT_FALSE(is_diff);
 }
+
+/*
+ * Tests the page size recorded in the header page
+ * - A file written with another page size is refused at open time, every
+ *   time, and leaves no table registered
+ */
+TEST(FileInitTest, CheckPageSize) {
+    int64_t table_id;
+    std::string pathname = "page_size_test.db";
+
+    remove(pathname.c_str());
+    table_id = file_open_table_file(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    page_t *header_page = (page_t*)malloc(PAGE_SIZE);
+    file_read_page(table_id, 0, header_page);
+    EXPECT_EQ(header_page->page_size, PAGE_SIZE);
+
+    // Pretend the file was written with twice the page size
+    header_page->page_size = 2 * PAGE_SIZE;
+    file_write_page(table_id, 0, header_page);
+    file_close_table_files();
+
+    init_tables();
+    EXPECT_LT(file_open_table_file(pathname.c_str()), 0);
+    EXPECT_LT(file_open_table_file(pathname.c_str()), 0);
+    EXPECT_EQ(file_get_num_tables(), 0);
+
+    file_close_table_files();
+    free(header_page);
+
+    ASSERT_EQ(remove(pathname.c_str()), 0);
+}
+
+/*
+ * Tests the table registry with many tables:
+ * 1. Open more tables than a chunk of table nodes holds
+ * 2. Check the ids are distinct, and found by the ids and the pathnames
+ * 3. Read the header page of each through its id
+ */
+TEST(FileInitTest, OpensManyTables) {
+    const int num_tables = 600;
+    std::vector<int64_t> table_ids;
+    page_t *page = file_new_page_buffer();
+
+    ASSERT_NE(page, nullptr);
+    file_close_table_files();
+
+    // A header page alone makes a table, and spares writing 10 MiB each.
+    page->magic_number = MAGIC_NUMBER;
+    page->page_size = PAGE_SIZE;
+    page->num_of_pages = 1;
+    page->free_page_num = -1;
+    page->root_page_num = -1;
+
+    for (int i = 0; i < num_tables; i++) {
+        std::string pathname = "many_test_" + std::to_string(i) + ".db";
+        int fd = open(pathname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        ASSERT_GE(fd, 0);
+        page->num_of_pages = i + 1;
+        ASSERT_EQ(pwrite(fd, page, PAGE_SIZE, 0), PAGE_SIZE);
+        close(fd);
+
+        int64_t table_id = file_open_table_file(pathname.c_str());
+        ASSERT_GE(table_id, 0) << pathname;
+        table_ids.push_back(table_id);
+    }
+
+    EXPECT_EQ(file_get_num_tables(), num_tables);
+
+    for (int i = 0; i < num_tables; i++) {
+        std::string pathname = "many_test_" + std::to_string(i) + ".db";
+        table_node *table = file_get_table(i);
+
+        ASSERT_NE(table, nullptr);
+        EXPECT_EQ(table->table_id, table_ids[i]);
+        EXPECT_STREQ(table->pathname, pathname.c_str());
+        if (i > 0) {
+            EXPECT_NE(table_ids[i], table_ids[i - 1]);
+        }
+
+        // Opened again, the table keeps its id
+        EXPECT_EQ(file_open_table_file(pathname.c_str()), table_ids[i]);
+
+        memset(page, 0, PAGE_SIZE);
+        file_read_page(table_ids[i], 0, page);
+        EXPECT_EQ(page->num_of_pages, (pagenum_t)i + 1);
+    }
+
+    EXPECT_EQ(file_get_num_tables(), num_tables);
+    EXPECT_EQ(file_get_table(num_tables), nullptr);
+    EXPECT_EQ(file_sync_tables(), 0);
+
+    file_close_table_files();
+    EXPECT_EQ(file_get_num_tables(), 0);
+    EXPECT_EQ(file_get_table(0), nullptr);
+
+    for (int i = 0; i < num_tables; i++)
+        remove(("many_test_" + std::to_string(i) + ".db").c_str());
+
+    free(page);
+}
+
+/*
+ * Tests the CRC32C of known bytes, at once and in parts
+ */
+TEST(ChecksumTest, ComputesCrc32c) {
+    const char *digits = "123456789";
+
+    EXPECT_EQ(crc32c(0, digits, 9), 0xe3069283);
+    EXPECT_EQ(crc32c(crc32c(0, digits, 4), digits + 4, 5), 0xe3069283);
+    EXPECT_EQ(crc32c(0, digits, 0), 0);
+}
+
+/*
+ * Tests that a page changed on disk after its checksum is refused
+ */
+TEST(ChecksumTest, DetectsTornPage) {
+    std::string pathname = "checksum_test.db";
+    pagenum_t page_num;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_buffer_pool(100, 16), 0);
+    int64_t table_id = file_open_table_file(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    // Write a page through the buffer pool.
+    buf_descriptor_t *buf = get_buffer_of_new_page(table_id);
+    page_num = buf->page_num;
+    memset(buf->buf_page->space + HEADER_SIZE, 'a', DATA_SIZE);
+    mark_buffer_dirty(buf);
+    unpin_buffer(buf);
+    ASSERT_EQ(close_buffer_pool(), 0);
+
+    // Tear the second half of it.
+    int fd = open(pathname.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    char garbage[PAGE_SIZE / 2];
+    memset(garbage, 'b', sizeof(garbage));
+    ASSERT_EQ(pwrite(fd, garbage, sizeof(garbage),
+                     PAGE_SIZE * page_num + PAGE_SIZE / 2), sizeof(garbage));
+    close(fd);
+
+    ASSERT_EQ(init_buffer_pool(100, 16), 0);
+    table_id = file_open_table_file(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    EXPECT_EQ(get_buffer(table_id, page_num), nullptr);
+    EXPECT_EQ(stat_checksum_failures, 1);
+
+    ASSERT_EQ(close_buffer_pool(), 0);
+    ASSERT_EQ(remove(pathname.c_str()), 0);
+}
+
+/*
+ * Tests batched page I/O with each backend:
+ * 1. Write pages in a batch and read them back in another
+ * 2. Check that adjacent pages are merged, and io_uring submits at once
+ * 3. Check that pages read ahead into the buffer pool are hits
+ */
+TEST(IoTest, ReadsAndWritesInBatches) {
+    const int num_pages = 32;
+    const int backends[] = { IO_BACKEND_SYNC, IO_BACKEND_URING };
+    std::string pathname = "io_test.db";
+
+    for (int backend : backends) {
+        if (io_open(backend) != 0) {
+            // Not in this kernel; the sync backend stays.
+            EXPECT_EQ(backend, IO_BACKEND_URING);
+            EXPECT_STREQ(io_get_backend_name(), "sync");
+            continue;
+        }
+
+        remove(pathname.c_str());
+        ASSERT_EQ(init_buffer_pool(100, 2 * num_pages), 0);
+        int64_t table_id = file_open_table_file(pathname.c_str());
+        ASSERT_TRUE(table_id >= 0);
+
+        page_t *pages = (page_t*)calloc(num_pages, PAGE_SIZE);
+        page_io ios[num_pages];
+        pagenum_t page_nums[num_pages];
+
+        for (int i = 0; i < num_pages; i++) {
+            page_nums[i] = i + 1;
+            memset(pages[i].space + HEADER_SIZE, 'a' + i % 26, DATA_SIZE);
+            file_set_page_checksum(table_id, page_nums[i], &pages[i]);
+            ios[i] = { table_id, page_nums[i], &pages[i], -1 };
+        }
+
+        // The pages follow each other, so they go in one vectored request.
+        stat_io_submits = 0;
+        stat_io_requests = 0;
+        EXPECT_EQ(file_write_pages(ios, num_pages), 0);
+        EXPECT_EQ(stat_io_requests, (num_pages + IO_MAX_VECTOR - 1) / IO_MAX_VECTOR);
+        if (backend == IO_BACKEND_URING) {
+            EXPECT_LT(stat_io_submits, num_pages);
+        }
+
+        page_t *read_pages = (page_t*)calloc(num_pages, PAGE_SIZE);
+
+        for (int i = 0; i < num_pages; i++)
+            ios[i] = { table_id, page_nums[i], &read_pages[i], -1 };
+
+        EXPECT_EQ(file_read_pages(ios, num_pages), 0);
+        EXPECT_EQ(memcmp(pages, read_pages, num_pages * PAGE_SIZE), 0);
+
+        // Read ahead into the buffer pool, then get the pages from it.
+        init_buffer_stat();
+        EXPECT_EQ(buffer_prefetch(table_id, page_nums, num_pages), num_pages);
+        EXPECT_EQ(buffer_prefetch(table_id, page_nums, num_pages), 0);
+
+        for (int i = 0; i < num_pages; i++) {
+            buf_descriptor_t *buf = get_buffer(table_id, page_nums[i]);
+            ASSERT_NE(buf, nullptr);
+            EXPECT_EQ(memcmp(buf->buf_page, &pages[i], PAGE_SIZE), 0);
+            unpin_buffer(buf);
+        }
+
+        EXPECT_EQ(stat_read_page, num_pages);
+
+        free(pages);
+        free(read_pages);
+        ASSERT_EQ(close_buffer_pool(), 0);
+        ASSERT_EQ(remove(pathname.c_str()), 0);
+    }
+
+    io_open(IO_BACKEND_AUTO);
+}
+
+/*
+ * Tests tables opened with O_DIRECT:
+ * 1. Check the open mode, and that it is not recorded in the header page
+ * 2. Write pages from the aligned frames and from an unaligned buffer
+ * 3. Read them back after opening the table the usual way
+ */
+TEST(FileInitTest, OpensWithDirectIo) {
+    std::string pathname = "direct_test.db";
+    table_node *table = NULL;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_buffer_pool(100, 16), 0);
+    int64_t table_id = file_open_table_file(pathname.c_str(), TABLE_OPEN_DIRECT);
+    ASSERT_TRUE(table_id >= 0);
+
+    for (int i = 0; i < file_get_num_tables() && table == NULL; i++) {
+        table = file_get_table(i);
+        if (table != NULL && table->table_id != table_id)
+            table = NULL;
+    }
+    ASSERT_NE(table, nullptr);
+    EXPECT_TRUE(table->flags & TABLE_OPEN_DIRECT);
+    EXPECT_TRUE(fcntl(table->fd, F_GETFL) & O_DIRECT);
+
+    // Through a frame of the buffer pool
+    buf_descriptor_t *buf = get_buffer_of_new_page(table_id);
+    pagenum_t frame_page_num = buf->page_num;
+    EXPECT_EQ((uintptr_t)buf->buf_page % PAGE_ALIGNMENT, 0);
+    memset(buf->buf_page->space + HEADER_SIZE, 'a', DATA_SIZE);
+    mark_buffer_dirty(buf);
+    unpin_buffer(buf);
+
+    // Through a buffer off the alignment
+    char *unaligned = (char*)malloc(PAGE_SIZE + 1) + 1;
+    page_t *page = (page_t*)unaligned;
+    memset(unaligned, 0, PAGE_SIZE);
+    memset(page->space + HEADER_SIZE, 'b', DATA_SIZE);
+    file_write_page(table_id, frame_page_num + 1, page);
+
+    ASSERT_EQ(close_buffer_pool(), 0);
+
+    ASSERT_EQ(init_buffer_pool(100, 16), 0);
+    table_id = file_open_table_file(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+    EXPECT_EQ(file_get_table_flags(table_id), 0);
+
+    buf = get_buffer(table_id, frame_page_num);
+    ASSERT_NE(buf, nullptr);
+    EXPECT_EQ(buf->buf_page->space[HEADER_SIZE], 'a');
+    unpin_buffer(buf);
+
+    memset(unaligned, 0, PAGE_SIZE);
+    EXPECT_EQ(file_read_page(table_id, frame_page_num + 1, page), 0);
+    EXPECT_EQ(page->space[HEADER_SIZE + DATA_SIZE - 1], 'b');
+    ASSERT_EQ(close_buffer_pool(), 0);
+
+    // A read past the end leaves the buffer off the alignment as it was
+    ASSERT_EQ(init_buffer_pool(100, 16), 0);
+    table_id = file_open_table_file(pathname.c_str(), TABLE_OPEN_DIRECT);
+    ASSERT_TRUE(table_id >= 0);
+    memset(unaligned, 'x', PAGE_SIZE);
+    file_read_page(table_id, 1 << 20, page);
+    EXPECT_EQ(unaligned[0], 'x');
+    EXPECT_EQ(unaligned[PAGE_SIZE - 1], 'x');
+
+    free(unaligned - 1);
+    ASSERT_EQ(close_buffer_pool(), 0);
+    ASSERT_EQ(remove(pathname.c_str()), 0);
+}
+
+/*
+ * Tests that a dirty victim is written with its dirty neighbors on disk
+ */
+TEST(IoTest, WritesDirtyNeighborsTogether) {
+    const int num_buf = 16;
+    std::string pathname = "neighbors_test.db";
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_buffer_pool(100, num_buf), 0);
+    int64_t table_id = file_open_table_file(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    // Dirty a run of pages, then make them the oldest.
+    for (pagenum_t page_num = 1; page_num <= EVICT_NEIGHBORS + 1; page_num++) {
+        buf_descriptor_t *buf = get_buffer(table_id, page_num);
+        ASSERT_NE(buf, nullptr);
+        buf->buf_page->space[HEADER_SIZE] = 'a';
+        mark_buffer_dirty(buf);
+        unpin_buffer(buf);
+    }
+
+    init_buffer_stat();
+    stat_io_requests = 0;
+
+    for (pagenum_t page_num = 100; page_num < 100 + 2 * num_buf; page_num++) {
+        buf_descriptor_t *buf = get_buffer(table_id, page_num);
+        ASSERT_NE(buf, nullptr);
+        unpin_buffer(buf);
+    }
+
+    // Every run page is written, in one request with the first victim.
+    EXPECT_EQ(stat_write_page, EVICT_NEIGHBORS + 1);
+    EXPECT_EQ(stat_io_requests, stat_read_page + 1);
+
+    ASSERT_EQ(close_buffer_pool(), 0);
+    ASSERT_EQ(remove(pathname.c_str()), 0);
+}
+
+/*
+ * Tests that the pages a write or read fails on are not taken as done:
+ * 1. Fail the writes of the table file, and check the page stays dirty
+ * 2. Write it once the file works again, and read it back
+ * 3. Check that a read past the end fails over a page left in the buffer
+ */
+TEST(IoTest, KeepsFailedPagesDirty) {
+    std::string pathname = "failed_io_test.db";
+
+    // io_uring writes through the file registered, not the descriptor.
+    ASSERT_EQ(io_open(IO_BACKEND_SYNC), 0);
+    remove(pathname.c_str());
+    ASSERT_EQ(init_buffer_pool(100, 16), 0);
+    int64_t table_id = file_open_table_file(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    buf_descriptor_t *buf = get_buffer_of_new_page(table_id);
+    ASSERT_NE(buf, nullptr);
+    pagenum_t page_num = buf->page_num;
+    memset(buf->buf_page->space + HEADER_SIZE, 'a', DATA_SIZE);
+    mark_buffer_dirty(buf);
+    unpin_buffer(buf);
+
+    // Writes to /dev/full fail with ENOSPC.
+    table_node *table = file_get_table(file_get_table_index(table_id));
+    ASSERT_NE(table, nullptr);
+    int table_fd = table->fd;
+    int full_fd = open("/dev/full", O_WRONLY);
+    ASSERT_GE(full_fd, 0);
+    int saved_fd = dup(table_fd);
+    ASSERT_GE(dup2(full_fd, table_fd), 0);
+    close(full_fd);
+
+    EXPECT_NE(buffer_checkpoint(), 0);
+    EXPECT_TRUE(buf->is_dirty);
+
+    ASSERT_GE(dup2(saved_fd, table_fd), 0);
+    close(saved_fd);
+    ASSERT_EQ(close_buffer_pool(), 0);
+
+    ASSERT_EQ(init_buffer_pool(100, 16), 0);
+    table_id = file_open_table_file(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    buf = get_buffer(table_id, page_num);
+    ASSERT_NE(buf, nullptr);
+    EXPECT_EQ(buf->buf_page->space[HEADER_SIZE], 'a');
+
+    // The page left in the buffer matches its checksum.
+    page_t *page = file_new_page_buffer();
+    memcpy(page, buf->buf_page, PAGE_SIZE);
+    unpin_buffer(buf);
+    file_set_page_checksum(table_id, page_num, page);
+    EXPECT_EQ(file_read_page(table_id, 1 << 20, page), 1);
+
+    free(page);
+    ASSERT_EQ(close_buffer_pool(), 0);
+    ASSERT_EQ(remove(pathname.c_str()), 0);
+    io_open(IO_BACKEND_AUTO);
+}
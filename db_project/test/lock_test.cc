@@ -0,0 +1,243 @@
+#include "db.h"
+#include "lock.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <pthread.h>
+#include <string>
+#include <unistd.h>
+
+int64_t lock_test_table_id;
+pthread_barrier_t lock_test_barrier;
+std::atomic<bool> lock_test_done;
+
+// Make a transaction to lock with, without a thread
+static void make_txn(txn_t *txn, uint64_t txn_id) {
+    txn->txn_id = txn_id;
+    txn->isolation = TXN_SERIALIZABLE;
+}
+
+/*
+ * Tests the modes and the instant requests
+ */
+TEST(LockTest, GrantsCompatibleModes) {
+    txn_t a, b;
+    tree_key_t key;
+
+    make_txn(&a, 1001);
+    make_txn(&b, 1002);
+    key_set_int(&key, 7);
+
+    EXPECT_EQ(lock_acquire(&a, 1, &key, LOCK_SHARED, false, false), LOCK_GRANTED);
+    EXPECT_EQ(lock_acquire(&b, 1, &key, LOCK_SHARED, false, false), LOCK_GRANTED);
+    EXPECT_EQ(lock_acquire(&b, 1, &key, LOCK_EXCLUSIVE, false, false), LOCK_BUSY);
+    EXPECT_EQ(lock_acquire(&b, 1, NULL, LOCK_EXCLUSIVE, false, false), LOCK_GRANTED);
+    EXPECT_EQ(lock_acquire(&a, 1, NULL, LOCK_SHARED, false, false), LOCK_BUSY);
+
+    // Another table, another record
+    EXPECT_EQ(lock_acquire(&a, 2, NULL, LOCK_EXCLUSIVE, false, false), LOCK_GRANTED);
+
+    lock_release_all(&b);
+    EXPECT_EQ(lock_acquire(&a, 1, &key, LOCK_EXCLUSIVE, false, false), LOCK_GRANTED);
+
+    // An instant request leaves nothing behind.
+    EXPECT_EQ(lock_acquire(&b, 1, NULL, LOCK_EXCLUSIVE, true, false), LOCK_GRANTED);
+    EXPECT_EQ(lock_acquire(&a, 1, NULL, LOCK_EXCLUSIVE, false, false), LOCK_GRANTED);
+    EXPECT_EQ(a.locks.size(), 3);
+    EXPECT_EQ(b.locks.size(), 0);
+
+    lock_release_all(&a);
+}
+
+// Update key 1 at TXN_SERIALIZABLE after the main thread
+void *update_after(void *arg) {
+    char buf[MAX_VALUE_SIZE];
+    int64_t *ret = (int64_t*)malloc(sizeof(int64_t));
+
+    memset(buf, 'b', sizeof(buf));
+    db_begin((int)(int64_t)arg);
+    pthread_barrier_wait(&lock_test_barrier);
+
+    *ret = db_update(lock_test_table_id, 1, buf, MIN_VALUE_SIZE);
+    if (*ret == 0)
+        db_commit();
+
+    return ret;
+}
+
+/*
+ * Tests that writers of a record wait for each other
+ */
+TEST(LockTest, SerializesWriters) {
+    std::string pathname = "lock_test.db";
+    char buf[MAX_VALUE_SIZE];
+    uint16_t val_size;
+    pthread_t thread;
+    void *ret;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(100, 64), 0);
+    lock_test_table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(lock_test_table_id >= 0);
+
+    memset(buf, 'x', sizeof(buf));
+    for (int key = 0; key < 10; key++)
+        ASSERT_EQ(db_insert(lock_test_table_id, key, buf, MIN_VALUE_SIZE), 0);
+
+    for (int isolation = TXN_SNAPSHOT; isolation <= TXN_SERIALIZABLE;
+         isolation++) {
+        pthread_barrier_init(&lock_test_barrier, NULL, 2);
+        pthread_create(&thread, NULL, update_after, (void*)(int64_t)isolation);
+
+        ASSERT_EQ(db_begin(), 0);
+        memset(buf, 'a', sizeof(buf));
+        ASSERT_EQ(db_update(lock_test_table_id, 1, buf, MIN_VALUE_SIZE), 0);
+        pthread_barrier_wait(&lock_test_barrier);
+
+        // Let the other thread wait for a while.
+        usleep(50 * 1000);
+        ASSERT_EQ(db_commit(), 0);
+
+        pthread_join(thread, &ret);
+        ASSERT_EQ(db_find(lock_test_table_id, 1, buf, &val_size), 0);
+
+        // A snapshot does not see the commit it waited for.
+        if (isolation == TXN_SNAPSHOT) {
+            EXPECT_EQ(*(int64_t*)ret, TXN_ROLLED_BACK);
+            EXPECT_EQ(buf[0], 'a');
+        } else {
+            EXPECT_EQ(*(int64_t*)ret, 0);
+            EXPECT_EQ(buf[0], 'b');
+        }
+
+        free(ret);
+        pthread_barrier_destroy(&lock_test_barrier);
+    }
+
+    EXPECT_EQ(stat_lock_waits, 2);
+    EXPECT_GE(stat_lock_wait_ns, 2 * 40 * 1000 * 1000);
+    EXPECT_EQ(stat_deadlocks, 0);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(pathname.c_str());
+}
+
+// Update the key, then the other one
+void *update_two(void *arg) {
+    int64_t first = (int64_t)arg;
+    char buf[MAX_VALUE_SIZE];
+    int64_t *ret = (int64_t*)malloc(sizeof(int64_t));
+
+    memset(buf, 'c', sizeof(buf));
+    db_begin();
+    db_update(lock_test_table_id, first, buf, MIN_VALUE_SIZE);
+    pthread_barrier_wait(&lock_test_barrier);
+
+    *ret = db_update(lock_test_table_id, 1 - first, buf, MIN_VALUE_SIZE);
+    if (*ret == 0)
+        db_commit();
+
+    return ret;
+}
+
+/*
+ * Tests that one of two transactions waiting for each other is rolled back
+ */
+TEST(LockTest, DetectsDeadlock) {
+    std::string pathname = "lock_test_deadlock.db";
+    char buf[MAX_VALUE_SIZE];
+    pthread_t threads[2];
+    void *ret[2];
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(100, 64), 0);
+    lock_test_table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(lock_test_table_id >= 0);
+
+    memset(buf, 'x', sizeof(buf));
+    for (int key = 0; key < 2; key++)
+        ASSERT_EQ(db_insert(lock_test_table_id, key, buf, MIN_VALUE_SIZE), 0);
+
+    pthread_barrier_init(&lock_test_barrier, NULL, 2);
+    for (int64_t i = 0; i < 2; i++)
+        pthread_create(&threads[i], NULL, update_two, (void*)i);
+    for (int i = 0; i < 2; i++)
+        pthread_join(threads[i], &ret[i]);
+    pthread_barrier_destroy(&lock_test_barrier);
+
+    // One is rolled back and the other commits.
+    EXPECT_EQ(*(int64_t*)ret[0] + *(int64_t*)ret[1], TXN_ROLLED_BACK);
+    EXPECT_EQ(stat_deadlocks, 1);
+    free(ret[0]);
+    free(ret[1]);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(pathname.c_str());
+}
+
+// Insert a key into the range scanned by the main thread
+void *insert_into_range(void *arg) {
+    char buf[MAX_VALUE_SIZE];
+
+    memset(buf, 'p', sizeof(buf));
+    pthread_barrier_wait(&lock_test_barrier);
+    db_insert(lock_test_table_id, (int64_t)arg, buf, MIN_VALUE_SIZE);
+    lock_test_done = true;
+
+    return NULL;
+}
+
+/*
+ * Tests that a serializable scan keeps insertions out of its range
+ */
+TEST(LockTest, PreventsPhantoms) {
+    std::string pathname = "lock_test_phantom.db";
+    char buf[MAX_VALUE_SIZE];
+    std::vector<int64_t> keys;
+    std::vector<char*> values;
+    std::vector<uint16_t> val_sizes;
+    int64_t inserted[2] = { 25, 45 };  // In the range, after the range
+    pthread_t thread;
+
+    remove(pathname.c_str());
+    ASSERT_EQ(init_db(100, 64), 0);
+    lock_test_table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(lock_test_table_id >= 0);
+
+    memset(buf, 'x', sizeof(buf));
+    for (int key = 0; key < 100; key += 10)
+        ASSERT_EQ(db_insert(lock_test_table_id, key, buf, MIN_VALUE_SIZE), 0);
+
+    for (int i = 0; i < 2; i++) {
+        lock_test_done = false;
+        pthread_barrier_init(&lock_test_barrier, NULL, 2);
+        pthread_create(&thread, NULL, insert_into_range, (void*)inserted[i]);
+
+        ASSERT_EQ(db_begin(TXN_SERIALIZABLE), 0);
+        keys.clear();
+        ASSERT_EQ(db_scan(lock_test_table_id, 10, 30, &keys, &values,
+                          &val_sizes), 0);
+        size_t num_keys = keys.size();
+        pthread_barrier_wait(&lock_test_barrier);
+        usleep(50 * 1000);
+
+        // Up to the key after the range, insertions wait.
+        keys.clear();
+        ASSERT_EQ(db_scan(lock_test_table_id, 10, 30, &keys, &values,
+                          &val_sizes), 0);
+        EXPECT_EQ(keys.size(), num_keys);
+        EXPECT_EQ(lock_test_done, i == 1);
+        ASSERT_EQ(db_commit(), 0);
+
+        pthread_join(thread, NULL);
+        pthread_barrier_destroy(&lock_test_barrier);
+        EXPECT_TRUE(lock_test_done);
+    }
+
+    for (size_t i = 0; i < values.size(); i++)
+        free(values[i]);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(pathname.c_str());
+}
@@ -0,0 +1,409 @@
+#include "log.h"
+#include "db.h"
+#include "recovery.h"
+#include "file.h"
+
+#include <gtest/gtest.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define NUM_THREADS 8
+#define KEYS_PER_THREAD 200
+
+int64_t log_test_table_id;
+
+void *insert_keys(void *arg) {
+    int64_t first = (int64_t)arg;
+    char buf[MAX_VALUE_SIZE];
+    int64_t *failed = (int64_t*)calloc(1, sizeof(int64_t));
+
+    for (int64_t key = first; key < first + KEYS_PER_THREAD; key++) {
+        snprintf(buf, sizeof(buf), "%-*ld", MIN_VALUE_SIZE, key);
+        if (db_insert(log_test_table_id, key, buf, MIN_VALUE_SIZE) != 0)
+            (*failed)++;
+    }
+
+    return failed;
+}
+
+/*
+ * Tests that concurrent operations share log writes and survive a restart
+ */
+TEST(LogTest, HandlesGroupCommit) {
+    std::string pathname = "log_test.db";
+    std::string log_path = "log_test.log";
+    pthread_t threads[NUM_THREADS];
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+    struct stat st;
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+    ASSERT_EQ(init_db(100, 64, log_path.c_str()), 0);
+
+    log_test_table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(log_test_table_id >= 0);
+
+    for (int64_t i = 0; i < NUM_THREADS; i++)
+        pthread_create(&threads[i], NULL, insert_keys,
+                       (void*)(i * KEYS_PER_THREAD));
+
+    for (int i = 0; i < NUM_THREADS; i++) {
+        void *failed;
+
+        pthread_join(threads[i], &failed);
+        EXPECT_EQ(*(int64_t*)failed, 0);
+        free(failed);
+    }
+
+    // Every insertion committed, in fewer syncs than commits.
+    EXPECT_EQ(stat_log_commits, NUM_THREADS * KEYS_PER_THREAD);
+    EXPECT_LT(stat_log_syncs, stat_log_commits);
+    EXPECT_GE(log_get_flushed_lsn(), 1);
+
+    // A failed operation logs nothing.
+    int64_t num_records = stat_log_records;
+    snprintf(buf, sizeof(buf), "%-*d", MIN_VALUE_SIZE, 0);
+    EXPECT_NE(db_insert(log_test_table_id, 0, buf, MIN_VALUE_SIZE), 0);
+    EXPECT_EQ(stat_log_records, num_records);
+
+    // A clean shutdown leaves an empty log.
+    ASSERT_EQ(shutdown_db(), 0);
+    ASSERT_EQ(stat(log_path.c_str(), &st), 0);
+    EXPECT_EQ(st.st_size, LOG_FILE_HEADER_SIZE);
+
+    ASSERT_EQ(init_db(100, 64, log_path.c_str()), 0);
+    log_test_table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(log_test_table_id >= 0);
+
+    for (int64_t key = 0; key < NUM_THREADS * KEYS_PER_THREAD; key++) {
+        ASSERT_EQ(db_find(log_test_table_id, key, buf, &val_size), 0);
+        ASSERT_EQ(atol(buf), key);
+    }
+
+    shutdown_db();
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+}
+
+/*
+ * Tests that a torn record at the end of the log is dropped on open
+ */
+TEST(LogTest, HandlesTornTail) {
+    std::string log_path = "log_test_torn.log";
+    byte before[16] = { 0 };
+    byte after[16] = { 1 };
+    byte garbage[100];
+
+    remove(log_path.c_str());
+    init_log_stat();
+    ASSERT_EQ(log_open(log_path.c_str()), 0);
+
+    log_begin_op();
+    log_page_update(1, 1, 128, sizeof(after), before, after);
+    lsn_t commit_lsn = log_end_op();
+    ASSERT_NE(commit_lsn, 0);
+    log_flush(commit_lsn);
+
+    lsn_t end_lsn = log_get_flushed_lsn();
+    EXPECT_GT(end_lsn, commit_lsn);
+    EXPECT_EQ(stat_log_records, 3);
+    ASSERT_EQ(log_close(), 0);
+
+    // Append half a record.
+    memset(garbage, 0x5a, sizeof(garbage));
+    FILE *fp = fopen(log_path.c_str(), "ab");
+    ASSERT_NE(fp, nullptr);
+    fwrite(garbage, 1, sizeof(garbage), fp);
+    fclose(fp);
+
+    ASSERT_EQ(log_open(log_path.c_str()), 0);
+    EXPECT_EQ(log_get_flushed_lsn(), end_lsn);
+    ASSERT_EQ(log_close(), 0);
+
+    remove(log_path.c_str());
+}
+
+/*
+ * Tests that committed operations survive a crash, with pages half written
+ */
+TEST(LogTest, HandlesCrashRecovery) {
+    std::string pathname = "log_test_crash.db";
+    std::string log_path = "log_test_crash.log";
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+    int num_keys = 5000;
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+
+    // Crash without writing back the buffer pool.
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+
+    if (pid == 0) {
+        if (init_db(100, 16, log_path.c_str()) != 0)
+            _exit(1);
+
+        int64_t table_id = open_table(pathname.c_str());
+
+        for (int i = 0; i < num_keys; i++) {
+            snprintf(buf, sizeof(buf), "%-*d", MIN_VALUE_SIZE + i % 50, i);
+            if (db_insert(table_id, i, buf, MIN_VALUE_SIZE + i % 50) != 0)
+                _exit(1);
+        }
+
+        for (int i = 0; i < num_keys; i += 3) {
+            if (db_delete(table_id, i) != 0)
+                _exit(1);
+        }
+
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    ASSERT_EQ(init_db(100, 64, log_path.c_str()), 0);
+    EXPECT_GT(stat_redo_records, 0);
+
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    for (int i = 0; i < num_keys; i++) {
+        if (i % 3 == 0) {
+            EXPECT_NE(db_find(table_id, i, buf, &val_size), 0);
+            continue;
+        }
+
+        ASSERT_EQ(db_find(table_id, i, buf, &val_size), 0);
+        ASSERT_EQ(val_size, MIN_VALUE_SIZE + i % 50);
+        ASSERT_EQ(atoi(buf), i);
+    }
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+}
+
+/*
+ * Tests that pages torn by a crash are restored from the page images
+ */
+TEST(LogTest, RepairsTornPages) {
+    std::string pathname = "log_test_torn.db";
+    std::string log_path = "log_test_torn_pages.log";
+    char buf[MAX_VALUE_SIZE + 1];
+    char garbage[PAGE_SIZE / 2];
+    uint16_t val_size;
+    int num_keys = 3000;
+    int num_torn = 20;
+    pagenum_t num_pages = INITIAL_DB_FILE_SIZE / PAGE_SIZE;
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+
+    if (pid == 0) {
+        if (init_db(100, 16, log_path.c_str()) != 0)
+            _exit(1);
+
+        int64_t table_id = open_table(pathname.c_str());
+
+        for (int i = 0; i < num_keys; i++) {
+            snprintf(buf, sizeof(buf), "%-*d", MIN_VALUE_SIZE, i);
+            if (db_insert(table_id, i, buf, MIN_VALUE_SIZE) != 0)
+                _exit(1);
+        }
+
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    // Tear the pages allocated first (the free list starts at the end).
+    int fd = open(pathname.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    memset(garbage, 0x5a, sizeof(garbage));
+
+    for (pagenum_t page_num = num_pages - num_torn; page_num < num_pages;
+         page_num++)
+        ASSERT_EQ(pwrite(fd, garbage, sizeof(garbage),
+                         PAGE_SIZE * page_num + PAGE_SIZE / 2),
+                  sizeof(garbage));
+    close(fd);
+
+    ASSERT_EQ(init_db(100, 64, log_path.c_str()), 0);
+
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    for (int i = 0; i < num_keys; i++) {
+        ASSERT_EQ(db_find(table_id, i, buf, &val_size), 0);
+        ASSERT_EQ(atoi(buf), i);
+    }
+
+    EXPECT_EQ(stat_checksum_failures, 0);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+}
+
+/*
+ * Tests that the changes of an operation without a commit are undone
+ */
+TEST(LogTest, UndoesIncompleteOperation) {
+    std::string pathname = "log_test_undo.db";
+    std::string log_path = "log_test_undo.log";
+    page_t page;
+    byte zeros[16] = { 0 };
+    byte committed[16];
+    byte incomplete[16];
+    int64_t logged_table_id = 7;
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+
+    // Page 1 is a zero-filled free page of a new table.
+    ASSERT_EQ(init_db(100, 16), 0);
+    ASSERT_TRUE(open_table(pathname.c_str()) >= 0);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    memset(committed, 'c', sizeof(committed));
+    memset(incomplete, 'i', sizeof(incomplete));
+
+    ASSERT_EQ(log_open(log_path.c_str()), 0);
+    log_table(logged_table_id, 0, pathname.c_str());
+
+    log_begin_op();
+    log_page_update(logged_table_id, 1, 200, sizeof(committed), zeros, committed);
+    log_end_op();
+
+    log_begin_op();
+    log_page_update(logged_table_id, 1, 200, sizeof(incomplete), committed,
+                    incomplete);
+    log_page_update(logged_table_id, 1, 400, sizeof(incomplete), zeros,
+                    incomplete);
+    log_flush(log_get_end_lsn());
+    ASSERT_EQ(log_close(), 0);
+
+    // Recover, then look at the page on disk.
+    ASSERT_EQ(init_db(100, 16, log_path.c_str()), 0);
+    EXPECT_EQ(stat_redo_records, 3);
+    EXPECT_EQ(stat_undo_records, 2);
+    ASSERT_EQ(shutdown_db(), 0);
+
+    int fd = open(pathname.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(pread(fd, &page, PAGE_SIZE, PAGE_SIZE), PAGE_SIZE);
+    close(fd);
+
+    EXPECT_EQ(memcmp((byte*)&page + 200, committed, sizeof(committed)), 0);
+    EXPECT_EQ(memcmp((byte*)&page + 400, zeros, sizeof(zeros)), 0);
+    EXPECT_GT(page.page_lsn, 0);
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+}
+
+// Make the writes of the open file of the path fail, as on a full disk
+static bool fail_writes(const char *pathname) {
+    char real_path[PATH_MAX], link_path[PATH_MAX], fd_path[PATH_MAX];
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    bool found = false;
+
+    if (dir == NULL || realpath(pathname, real_path) == NULL)
+        return false;
+
+    int full_fd = open("/dev/full", O_WRONLY);
+
+    while (!found && full_fd >= 0 && (entry = readdir(dir)) != NULL) {
+        snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%s", entry->d_name);
+        ssize_t size = readlink(fd_path, link_path, sizeof(link_path) - 1);
+        if (size <= 0)
+            continue;
+
+        link_path[size] = '\0';
+        if (strcmp(link_path, real_path) == 0)
+            found = dup2(full_fd, atoi(entry->d_name)) >= 0;
+    }
+
+    closedir(dir);
+    close(full_fd);
+    return found;
+}
+
+/*
+ * Tests a failed write of the log: the commits after it fail, and no page
+ * changed by them is written or evicted, so a restart finds the commits
+ * before it only
+ */
+TEST(LogTest, StopsAfterFailedWrite) {
+    std::string pathname = "log_test_failed.db";
+    std::string log_path = "log_test_failed.log";
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+    int num_keys = 100;
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+
+    ASSERT_EQ(init_db(100, 16, log_path.c_str()), 0);
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+
+    snprintf(buf, sizeof(buf), "%-*d", MIN_VALUE_SIZE, 0);
+    for (int i = 0; i < num_keys; i++)
+        ASSERT_EQ(db_insert(table_id, i, buf, MIN_VALUE_SIZE), 0);
+
+    lsn_t flushed_lsn = log_get_flushed_lsn();
+    ASSERT_TRUE(fail_writes(log_path.c_str()));
+
+    EXPECT_NE(db_insert(table_id, num_keys, buf, MIN_VALUE_SIZE), 0);
+    EXPECT_NE(db_insert(table_id, num_keys + 1, buf, MIN_VALUE_SIZE), 0);
+    ASSERT_EQ(db_begin(), 0);
+    ASSERT_EQ(db_insert(table_id, num_keys + 2, buf, MIN_VALUE_SIZE), 0);
+    EXPECT_NE(db_commit(), 0);
+    EXPECT_EQ(log_get_flushed_lsn(), flushed_lsn);
+
+    // The frames of the pages changed cannot be taken for others now.
+    int num_failed = 0;
+    for (pagenum_t page_num = 100; page_num < 164; page_num++) {
+        buf_descriptor_t *page_buf = get_buffer(table_id, page_num);
+
+        if (page_buf == NULL)
+            num_failed++;
+        else
+            unpin_buffer(page_buf);
+    }
+    EXPECT_GT(num_failed, 0);
+
+    EXPECT_NE(checkpoint_db(), 0);
+    EXPECT_NE(shutdown_db(), 0);
+
+    ASSERT_EQ(init_db(100, 16, log_path.c_str()), 0);
+    table_id = open_table(pathname.c_str());
+    for (int i = 0; i < num_keys; i++)
+        ASSERT_EQ(db_find(table_id, i, buf, &val_size), 0) << i;
+    for (int i = num_keys; i < num_keys + 3; i++)
+        EXPECT_NE(db_find(table_id, i, buf, &val_size), 0) << i;
+    ASSERT_EQ(shutdown_db(), 0);
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+}
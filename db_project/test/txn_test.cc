@@ -0,0 +1,341 @@
+#include "db.h"
+#include "log.h"
+#include "mvcc.h"
+#include "recovery.h"
+
+#include <gtest/gtest.h>
+
+#include <pthread.h>
+#include <string>
+#include <sys/wait.h>
+
+// Make a value of size bytes starting with the number
+static void make_value(char *buf, int number, uint16_t size) {
+    snprintf(buf, MAX_VALUE_SIZE + 1, "%-*d", size, number);
+}
+
+// Check that a record has the value made of the number
+static void expect_value(int64_t table_id, int64_t key, int number) {
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+
+    ASSERT_EQ(db_find(table_id, key, buf, &val_size), 0);
+    buf[val_size] = '\0';
+    EXPECT_EQ(atoi(buf), number);
+}
+
+/*
+ * Tests that a transaction over two tables commits as a whole or not at all
+ */
+TEST(TxnTest, CommitsAndAborts) {
+    std::string pathnames[2] = { "txn_test_a.db", "txn_test_b.db" };
+    std::string log_path = "txn_test.log";
+    char buf[MAX_VALUE_SIZE + 1];
+    char *large = (char*)malloc(PAGE_SIZE * 3);
+    uint32_t large_size = PAGE_SIZE * 3;
+    uint16_t val_size;
+    int64_t table_ids[2];
+    int num_keys = 500;
+
+    for (int i = 0; i < 2; i++)
+        remove(pathnames[i].c_str());
+    remove(log_path.c_str());
+    memset(large, 'L', large_size);
+
+    ASSERT_EQ(init_db(100, 64, log_path.c_str()), 0);
+
+    for (int i = 0; i < 2; i++) {
+        table_ids[i] = open_table(pathnames[i].c_str());
+        ASSERT_TRUE(table_ids[i] >= 0);
+    }
+
+    for (int key = 0; key < num_keys; key++) {
+        make_value(buf, key, MIN_VALUE_SIZE);
+        ASSERT_EQ(db_insert(table_ids[0], key, buf, MIN_VALUE_SIZE), 0);
+    }
+    ASSERT_EQ(db_insert_large(table_ids[1], 0, large, large_size), 0);
+
+    // Move every key to the other table, then change your mind.
+    ASSERT_EQ(db_begin(), 0);
+    EXPECT_NE(db_begin(), 0);
+
+    for (int key = 0; key < num_keys; key++) {
+        make_value(buf, key, MIN_VALUE_SIZE);
+        ASSERT_EQ(db_insert(table_ids[1], key + 1, buf, MIN_VALUE_SIZE), 0);
+        ASSERT_EQ(db_delete(table_ids[0], key), 0);
+    }
+    ASSERT_EQ(db_delete(table_ids[1], 0), 0);
+    make_value(buf, -1, MAX_VALUE_SIZE);
+    ASSERT_EQ(db_update(table_ids[1], 1, buf, MAX_VALUE_SIZE), 0);
+    EXPECT_NE(db_update(table_ids[1], num_keys + 1, buf, MAX_VALUE_SIZE), 0);
+
+    // The changes are seen by the transaction.
+    EXPECT_NE(db_find(table_ids[0], 0, buf, &val_size), 0);
+    expect_value(table_ids[1], 1, -1);
+
+    ASSERT_EQ(db_abort(), 0);
+    EXPECT_NE(db_abort(), 0);
+
+    for (int key = 0; key < num_keys; key++) {
+        expect_value(table_ids[0], key, key);
+        EXPECT_NE(db_find(table_ids[1], key + 1, buf, &val_size), 0);
+    }
+
+    // The large value is back, with its overflow pages.
+    char *read_buf = (char*)malloc(large_size);
+    uint32_t read_size;
+    ASSERT_EQ(db_read_value(table_ids[1], 0, 0, read_buf, large_size,
+                            &read_size), 0);
+    ASSERT_EQ(read_size, large_size);
+    EXPECT_EQ(memcmp(read_buf, large, large_size), 0);
+
+    // Now commit. The operations do not wait for the log, only full log
+    // buffers are written before the commit (the page images they log
+    // grow with the page size).
+    int64_t num_commits = stat_log_commits;
+    int64_t num_syncs = stat_log_syncs;
+    lsn_t begin_lsn = log_get_end_lsn();
+    ASSERT_EQ(db_begin(), 0);
+
+    for (int key = 0; key < num_keys; key++) {
+        make_value(buf, key * 2, MIN_VALUE_SIZE + key % 50);
+        ASSERT_EQ(db_update(table_ids[0], key, buf, MIN_VALUE_SIZE + key % 50),
+                  0);
+    }
+    ASSERT_EQ(db_delete(table_ids[1], 0), 0);
+
+    ASSERT_EQ(db_commit(), 0);
+    EXPECT_EQ(stat_log_commits - num_commits, num_keys + 2);
+    int64_t num_full_buffers = (log_get_end_lsn() - begin_lsn) / LOG_BUFFER_SIZE;
+    EXPECT_LE(stat_log_syncs - num_syncs, num_full_buffers + 2);
+    EXPECT_LT(stat_log_syncs - num_syncs, num_keys / 10);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    ASSERT_EQ(init_db(100, 64, log_path.c_str()), 0);
+
+    for (int i = 0; i < 2; i++)
+        ASSERT_EQ(open_table(pathnames[i].c_str()), table_ids[i]);
+
+    for (int key = 0; key < num_keys; key++)
+        expect_value(table_ids[0], key, key * 2);
+    EXPECT_NE(db_find(table_ids[1], 0, buf, &val_size), 0);
+
+    ASSERT_EQ(shutdown_db(), 0);
+    free(large);
+    free(read_buf);
+    for (int i = 0; i < 2; i++)
+        remove(pathnames[i].c_str());
+    remove(log_path.c_str());
+}
+
+/*
+ * Tests that a transaction interrupted by a crash is rolled back on restart
+ */
+TEST(TxnTest, RollsBackAfterCrash) {
+    std::string pathname = "txn_test_crash.db";
+    std::string log_path = "txn_test_crash.log";
+    char buf[MAX_VALUE_SIZE + 1];
+    uint16_t val_size;
+    int num_keys = 2000;
+
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+
+    if (pid == 0) {
+        if (init_db(100, 16, log_path.c_str()) != 0)
+            _exit(1);
+
+        int64_t table_id = open_table(pathname.c_str());
+
+        // Even keys commit.
+        db_begin();
+        for (int key = 0; key < num_keys; key += 2) {
+            make_value(buf, key, MIN_VALUE_SIZE);
+            if (db_insert(table_id, key, buf, MIN_VALUE_SIZE) != 0)
+                _exit(1);
+        }
+        if (db_commit() != 0)
+            _exit(1);
+
+        // Odd keys, updates and deletions do not.
+        db_begin();
+        for (int key = 1; key < num_keys; key += 2) {
+            make_value(buf, key, MIN_VALUE_SIZE);
+            if (db_insert(table_id, key, buf, MIN_VALUE_SIZE) != 0)
+                _exit(1);
+        }
+        for (int key = 0; key < num_keys; key += 4) {
+            make_value(buf, -key, MAX_VALUE_SIZE);
+            if (db_update(table_id, key, buf, MAX_VALUE_SIZE) != 0 ||
+                db_delete(table_id, key + 2) != 0)
+                _exit(1);
+        }
+
+        // Make the changes durable, then crash.
+        log_flush(log_get_end_lsn());
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    ASSERT_EQ(init_db(100, 64, log_path.c_str()), 0);
+
+    int64_t table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(table_id >= 0);
+
+    for (int key = 0; key < num_keys; key++) {
+        if (key % 2 == 1) {
+            EXPECT_NE(db_find(table_id, key, buf, &val_size), 0);
+            continue;
+        }
+
+        ASSERT_EQ(db_find(table_id, key, buf, &val_size), 0);
+        EXPECT_EQ(val_size, MIN_VALUE_SIZE);
+        expect_value(table_id, key, key);
+    }
+
+    ASSERT_EQ(shutdown_db(), 0);
+    remove(pathname.c_str());
+    remove(log_path.c_str());
+}
+
+int64_t mvcc_test_table_id;
+pthread_barrier_t mvcc_test_barrier;
+
+// Read the table from a transaction while the main thread changes it
+void *read_snapshot(void *) {
+    char buf[MAX_VALUE_SIZE + 1];
+    char *large = (char*)malloc(PAGE_SIZE * 2);
+    uint16_t val_size;
+    uint32_t read_size;
+    std::vector<int64_t> keys;
+    std::vector<char*> values;
+    std::vector<uint16_t> val_sizes;
+    int64_t *failed = (int64_t*)calloc(1, sizeof(int64_t));
+
+    db_begin();
+    pthread_barrier_wait(&mvcc_test_barrier);
+    pthread_barrier_wait(&mvcc_test_barrier);
+
+    // The changes after db_begin() are not seen.
+    if (db_find(mvcc_test_table_id, 1, buf, &val_size) != 0 || atoi(buf) != 1)
+        (*failed)++;
+    if (db_find(mvcc_test_table_id, 2, buf, &val_size) != 0)
+        (*failed)++;
+    if (db_find(mvcc_test_table_id, 200, buf, &val_size) == 0)
+        (*failed)++;
+    if (db_read_value(mvcc_test_table_id, 300, 0, large, PAGE_SIZE * 2,
+                      &read_size) != 0 || read_size != PAGE_SIZE * 2 ||
+        large[PAGE_SIZE] != 'L')
+        (*failed)++;
+
+    if (db_scan(mvcc_test_table_id, 0, 1000, &keys, &values, &val_sizes) != 0 ||
+        keys.size() != 101 || keys[2] != 2 || atoi(values[1]) != 1)
+        (*failed)++;
+
+    for (size_t i = 0; i < values.size(); i++)
+        free(values[i]);
+
+    db_commit();
+    free(large);
+
+    return failed;
+}
+
+// Change the table from a transaction while the main thread reads it
+void *write_uncommitted(void *) {
+    char buf[MAX_VALUE_SIZE + 1];
+
+    db_begin();
+    make_value(buf, -5, MIN_VALUE_SIZE);
+    db_update(mvcc_test_table_id, 5, buf, MIN_VALUE_SIZE);
+    db_delete(mvcc_test_table_id, 6);
+
+    pthread_barrier_wait(&mvcc_test_barrier);
+    pthread_barrier_wait(&mvcc_test_barrier);
+
+    db_commit();
+    return NULL;
+}
+
+/*
+ * Tests that readers see a consistent snapshot while others write
+ */
+TEST(MvccTest, ReadsFromSnapshots) {
+    std::string pathname = "mvcc_test.db";
+    char buf[MAX_VALUE_SIZE + 1];
+    char *large = (char*)malloc(PAGE_SIZE * 2);
+    uint16_t val_size;
+    std::vector<int64_t> keys;
+    std::vector<char*> values;
+    std::vector<uint16_t> val_sizes;
+    pthread_t thread;
+    void *failed;
+
+    remove(pathname.c_str());
+    memset(large, 'L', PAGE_SIZE * 2);
+    ASSERT_EQ(init_db(100, 64), 0);
+
+    mvcc_test_table_id = open_table(pathname.c_str());
+    ASSERT_TRUE(mvcc_test_table_id >= 0);
+
+    for (int key = 0; key < 100; key++) {
+        make_value(buf, key, MIN_VALUE_SIZE);
+        ASSERT_EQ(db_insert(mvcc_test_table_id, key, buf, MIN_VALUE_SIZE), 0);
+    }
+    ASSERT_EQ(db_insert_large(mvcc_test_table_id, 300, large, PAGE_SIZE * 2), 0);
+
+    // A reader transaction does not see the changes made after it began.
+    pthread_barrier_init(&mvcc_test_barrier, NULL, 2);
+    pthread_create(&thread, NULL, read_snapshot, NULL);
+    pthread_barrier_wait(&mvcc_test_barrier);
+
+    make_value(buf, -1, MAX_VALUE_SIZE);
+    ASSERT_EQ(db_update(mvcc_test_table_id, 1, buf, MAX_VALUE_SIZE), 0);
+    ASSERT_EQ(db_delete(mvcc_test_table_id, 2), 0);
+    make_value(buf, 200, MIN_VALUE_SIZE);
+    ASSERT_EQ(db_insert(mvcc_test_table_id, 200, buf, MIN_VALUE_SIZE), 0);
+    ASSERT_EQ(db_delete(mvcc_test_table_id, 300), 0);
+    EXPECT_EQ(stat_versions_created, 4);
+
+    pthread_barrier_wait(&mvcc_test_barrier);
+    pthread_join(thread, &failed);
+    EXPECT_EQ(*(int64_t*)failed, 0);
+    free(failed);
+
+    expect_value(mvcc_test_table_id, 1, -1);
+    EXPECT_NE(db_find(mvcc_test_table_id, 2, buf, &val_size), 0);
+    EXPECT_GT(stat_versions_read, 0);
+
+    // The versions are gone with the reader.
+    EXPECT_EQ(stat_versions_purged, stat_versions_created);
+
+    // Others do not see the changes of a transaction until it commits.
+    pthread_create(&thread, NULL, write_uncommitted, NULL);
+    pthread_barrier_wait(&mvcc_test_barrier);
+
+    expect_value(mvcc_test_table_id, 5, 5);
+    expect_value(mvcc_test_table_id, 6, 6);
+    ASSERT_EQ(db_scan(mvcc_test_table_id, 5, 6, &keys, &values, &val_sizes), 0);
+    EXPECT_EQ(keys.size(), 2);
+    for (size_t i = 0; i < values.size(); i++)
+        free(values[i]);
+
+    pthread_barrier_wait(&mvcc_test_barrier);
+    pthread_join(thread, NULL);
+
+    expect_value(mvcc_test_table_id, 5, -5);
+    EXPECT_NE(db_find(mvcc_test_table_id, 6, buf, &val_size), 0);
+    EXPECT_EQ(stat_versions_purged, stat_versions_created);
+
+    pthread_barrier_destroy(&mvcc_test_barrier);
+    ASSERT_EQ(shutdown_db(), 0);
+    free(large);
+    remove(pathname.c_str());
+}